@@ -0,0 +1,1124 @@
+//
+//	PerfReplay
+//
+//	Performance regression suite for the SpoutCapture frame pipeline.
+//
+//	Each trace in the "traces" folder describes a workload : the capture
+//	settings (the same as a headless configuration file) and a timeline
+//	of screen activity such as an idle desktop, video playback, scrolling,
+//	a window resize storm or switching between Desktop, Region and Window.
+//	The screen is drawn in memory and captured at the trace frame rate
+//	by CapturePipeline, the capture loop of the application, with the
+//	screen in place of desktop duplication, the senders and GDI capture.
+//	The pipeline decides what is due, keeps the tile maps and streams to
+//	a receiver and records to the snapshot ring as the application does.
+//	No window, GPU or Spout sender is needed. The "preview" setting of a
+//	trace is passed to the pipeline, which reads back the desktop for it.
+//
+//	Each loop is one frame of the trace on the clock of the pipeline, so
+//	that the frames sent are the same on any machine, and the snapshot
+//	ring writer takes each frame before the next so that the frame memory
+//	is the same each run. Every frame received is checked against the
+//	screen that was sent, and a trace with any frame that differs fails.
+//
+//	For each trace :
+//		fps      capture frames per second the pipeline could sustain
+//		         (1000 / average msec of capture work per frame)
+//		p99      capture to reconstructed frame at the receiver, msec,
+//		         after the first half second
+//		allocs   heap allocations per frame, all threads
+//		memory   peak frame memory, MB
+//
+//	Each trace is replayed 5 times. Other work on the machine only makes
+//	the timing worse, so the best fps and p99 of the runs are used, with
+//	the fastest calibration, and the median of the others.
+//	The results are compared with "baselines.txt". A metric worse than
+//	its baseline by more than the tolerance fails and the exit code is 1.
+//	fps and p99 are scaled by a calibration of the machine against that
+//	of the baselines. "--update" writes the results as the new baselines,
+//	scaled to the calibration of the baselines if they have one.
+//
+//	Usage :
+//		PerfReplay [--update] [--repeat n] [--baselines file] [trace ...]
+//		Traces default to those in the baselines file
+//
+//	Build (Linux) :
+//		g++ -O2 -std=c++17 -I../src PerfReplay.cpp ../src/AdaptiveRate.cpp ../src/CaptureConfig.cpp
+//			../src/CapturePipeline.cpp ../src/CaptureStats.cpp ../src/FrameArena.cpp
+//			../src/FramePacer.cpp ../src/FrameQueue.cpp ../src/FrameStream.cpp
+//			../src/ScrollDetect.cpp ../src/SnapshotRing.cpp ../src/ThreadSchedule.cpp
+//			../src/TileCodec.cpp ../src/TileMap.cpp -lpthread -o PerfReplay
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CapturePipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+//
+// Heap allocations by all threads
+//
+
+static std::atomic<unsigned long long> g_Allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	g_Allocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size > 0 ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+// GCC warns of free with a pointer from operator new, which is malloc here
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+//
+// Screen drawn in memory
+//
+// A desktop background with a document window. The window has a toolbar,
+// a status bar, a scroll bar and text drawn from an endless document.
+//
+
+struct Rect {
+	int left, top, right, bottom;
+	int Width() const { return right - left; }
+	int Height() const { return bottom - top; }
+	bool IsEmpty() const { return left >= right || top >= bottom; }
+};
+
+static Rect Intersect(const Rect& a, const Rect& b)
+{
+	return { std::max(a.left, b.left), std::max(a.top, b.top),
+		std::min(a.right, b.right), std::min(a.bottom, b.bottom) };
+}
+
+static uint32_t HashInt(uint32_t x)
+{
+	x ^= x >> 16; x *= 0x7FEB352D;
+	x ^= x >> 15; x *= 0x846CA68B;
+	return x ^ (x >> 16);
+}
+
+#define TOOLBAR_HEIGHT 40
+#define STATUS_HEIGHT  20
+#define SCROLLBAR_WIDTH 16
+#define LINE_HEIGHT    18
+
+class Screen {
+
+public:
+
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<uint32_t> pixels;
+	Rect window{};
+
+	// Changes since the last frame, as duplication reports them
+	std::vector<TileMove> moves;
+	std::vector<Rect> dirty;
+
+	void Resize(unsigned int w, unsigned int h)
+	{
+		width = w;
+		height = h;
+		pixels.assign((size_t)w*h, 0);
+		Draw({ 0, 0, (int)w, (int)h });
+		Frame();
+		dirty.push_back({ 0, 0, (int)w, (int)h });
+	}
+
+	void SetWindow(const Rect& rect)
+	{
+		Rect old = window;
+		window = Intersect(rect, { 0, 0, (int)width, (int)height });
+		Draw(old);
+		Draw(window);
+		dirty.push_back(old);
+		dirty.push_back(window);
+	}
+
+	// Clear the changes for the next frame
+	void Frame()
+	{
+		moves.clear();
+		dirty.clear();
+	}
+
+	// A blinking caret and a clock
+	void Idle(unsigned int frame)
+	{
+		if (frame % 30 == 0) {
+			Rect content = Content();
+			Rect caret = Intersect({ content.left + 200, content.top + 38, content.left + 202, content.top + 54 }, content);
+			for (int y = caret.top; y < caret.bottom; y++)
+				for (int x = caret.left; x < caret.right; x++)
+					pixels[(size_t)y*width + x] ^= 0x00FFFFFF;
+			if (!caret.IsEmpty())
+				dirty.push_back(caret);
+		}
+		if (frame % 60 == 0) {
+			Rect clock = { (int)width - 90, (int)height - 24, (int)width - 10, (int)height - 4 };
+			m_Clock++;
+			for (int y = clock.top; y < clock.bottom; y++)
+				for (int x = clock.left; x < clock.right; x++)
+					pixels[(size_t)y*width + x] = (HashInt(m_Clock*977 + (x - clock.left)/6) >> ((y - clock.top) % 16)) & 1
+						? 0xFFFFFFFF : 0xFF203040;
+			dirty.push_back(clock);
+		}
+	}
+
+	// Blocks of colour in a rectangle, changed at fps of the screen rate
+	void Video(const Rect& rect, double fps, double rate, unsigned int frame)
+	{
+		unsigned int interval = std::max(1u, (unsigned int)(rate/std::max(fps, 1.0) + 0.5));
+		if (frame % interval != 0)
+			return;
+		Rect r = Intersect(rect, { 0, 0, (int)width, (int)height });
+		m_Video++;
+		for (int y = r.top; y < r.bottom; y++) {
+			uint32_t* line = pixels.data() + (size_t)y*width;
+			for (int x = r.left; x < r.right; x++) {
+				uint32_t block = HashInt(m_Video*7919 + (uint32_t)(y/8)*1031 + (uint32_t)(x/8));
+				line[x] = 0xFF000000 | (block & 0x00FFFFFF);
+			}
+		}
+		if (!r.IsEmpty())
+			dirty.push_back(r);
+	}
+
+	// Move the document content by (dx, dy), e.g. dy = -20 reading on
+	void Scroll(int dx, int dy)
+	{
+		// The document starts at 0, 0
+		dx = std::min(dx, m_DocX);
+		dy = std::min(dy, m_DocY);
+		if (dx == 0 && dy == 0)
+			return;
+		m_DocX -= dx;
+		m_DocY -= dy;
+
+		Rect content = Content();
+		Rect dest = Intersect(content, { content.left + dx, content.top + dy, content.right + dx, content.bottom + dy });
+		if (!dest.IsEmpty()) {
+			size_t bytes = (size_t)dest.Width()*4;
+			for (int i = 0; i < dest.Height(); i++) {
+				int y = dy > 0 ? dest.bottom - 1 - i : dest.top + i;
+				memmove(pixels.data() + (size_t)y*width + dest.left,
+					pixels.data() + (size_t)(y - dy)*width + (dest.left - dx), bytes);
+			}
+			moves.push_back({ dest.left, dest.top, dest.right, dest.bottom, dx, dy });
+		}
+
+		// The uncovered strips and the scroll bar
+		Rect strips[4] = {
+			{ content.left, content.top, content.right, dest.top },
+			{ content.left, dest.bottom, content.right, content.bottom },
+			{ content.left, dest.top, dest.left, dest.bottom },
+			{ dest.right, dest.top, content.right, dest.bottom } };
+		if (dest.IsEmpty()) {
+			strips[0] = content;
+			strips[1] = strips[2] = strips[3] = {};
+		}
+		for (const Rect& strip : strips) {
+			if (!strip.IsEmpty()) {
+				Draw(strip);
+				dirty.push_back(strip);
+			}
+		}
+		Rect bar = { content.right, content.top, window.right, content.bottom };
+		Draw(bar);
+		dirty.push_back(bar);
+	}
+
+private:
+
+	int m_DocX = 0;
+	int m_DocY = 0;
+	uint32_t m_Clock = 0;
+	uint32_t m_Video = 0;
+
+	Rect Content() const
+	{
+		return { window.left, window.top + TOOLBAR_HEIGHT,
+			std::max(window.left, window.right - SCROLLBAR_WIDTH), std::max(window.top, window.bottom - STATUS_HEIGHT) };
+	}
+
+	// Draw the background and window in a rectangle
+	void Draw(const Rect& rect)
+	{
+		Rect r = Intersect(rect, { 0, 0, (int)width, (int)height });
+		Rect content = Content();
+		int thumb = content.top + (m_DocY/40) % std::max(1, content.Height() - 60);
+		for (int y = r.top; y < r.bottom; y++) {
+			uint32_t* line = pixels.data() + (size_t)y*width;
+			for (int x = r.left; x < r.right; x++) {
+				uint32_t c;
+				if (x < window.left || x >= window.right || y < window.top || y >= window.bottom)
+					c = 0xFF103050 + (uint32_t)((x + y)/64 % 16)*0x000101; // Background
+				else if (y < content.top)
+					c = ((x - window.left)/32 % 2) ? 0xFFD8D8D8 : 0xFFC8C8D0; // Toolbar
+				else if (y >= content.bottom)
+					c = 0xFFE0E0E0; // Status bar
+				else if (x >= content.right)
+					c = (y >= thumb && y < thumb + 60) ? 0xFF909090 : 0xFFF0F0F0; // Scroll bar
+				else
+					c = Text(x - content.left + m_DocX, y - content.top + m_DocY);
+				line[x] = c;
+			}
+		}
+	}
+
+	// Lines of 8 pixel glyphs of random length
+	static uint32_t Text(int x, int y)
+	{
+		uint32_t row = (uint32_t)(y/LINE_HEIGHT);
+		int gy = y % LINE_HEIGHT - 3;
+		uint32_t length = 80 + HashInt(row) % 1600;
+		if (gy < 0 || gy >= 12 || x < 8 || (uint32_t)x >= length || HashInt(row*31) % 9 == 0)
+			return 0xFFFFFFFF;
+		uint32_t glyph = HashInt(row*4099 + (uint32_t)(x/8));
+		if (glyph % 11 == 0) // Space
+			return 0xFFFFFFFF;
+		int gx = x % 8;
+		return (gx < 6 && ((glyph >> (gy*2 + gx/3)) & 1)) ? 0xFF202020 : 0xFFFFFFFF;
+	}
+
+};
+
+//
+// Trace
+//
+
+struct Activity {
+	std::string name;
+	std::vector<double> args;
+};
+
+struct Segment {
+	unsigned int frames = 0;
+	std::string mode; // Switch of source, no frames
+	std::vector<Activity> activities;
+};
+
+struct Trace {
+	std::string name;
+	CaptureConfig config;
+	unsigned int screenWidth = 1920;
+	unsigned int screenHeight = 1080;
+	Rect window = { 320, 180, 1600, 900 };
+	double receiverDelay = 0.0; // msec after each frame received
+	bool bPreview = false;      // The desktop texture is read back for the preview
+	std::vector<Segment> segments;
+	std::string error;
+};
+
+static std::string Trim(const std::string& str)
+{
+	size_t start = str.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos)
+		return std::string();
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(start, end - start + 1);
+}
+
+// Numbers separated by spaces, commas or "x"
+static std::vector<double> ParseNumbers(const std::string& text)
+{
+	std::vector<double> numbers;
+	const char* p = text.c_str();
+	while (*p) {
+		char* end = nullptr;
+		double value = strtod(p, &end);
+		if (end == p) {
+			p++;
+			continue;
+		}
+		numbers.push_back(value);
+		p = end;
+	}
+	return numbers;
+}
+
+//	Trace file, # for comments :
+//		key = value        capture setting, or screen = WxH, window-rect = left, top, width, height,
+//		                   receiver-delay = msec for a slow receiver, preview = off | thumbnail | full
+//		mode desktop       switch the source, or region or window
+//		frames activity    idle | video left,top,width,height fps | scroll dx dy
+//		                   | resize width height width2 height2, several separated by ;
+static bool LoadTrace(const std::string& path, Trace& trace)
+{
+	std::ifstream file(path);
+	if (!file) {
+		trace.error = "could not open " + path;
+		return false;
+	}
+	std::string line;
+	unsigned int number = 0;
+	while (std::getline(file, line)) {
+		number++;
+		size_t hash = line.find('#');
+		if (hash != std::string::npos)
+			line = line.substr(0, hash);
+		line = Trim(line);
+		if (line.empty())
+			continue;
+
+		char tmp[64];
+		snprintf(tmp, 64, " (line %u)", number);
+		size_t equals = line.find('=');
+		if (equals != std::string::npos) {
+			std::string key = Trim(line.substr(0, equals));
+			std::string value = Trim(line.substr(equals + 1));
+			std::vector<double> values = ParseNumbers(value);
+			if (key == "screen" && values.size() == 2 && values[0] >= 64 && values[1] >= 64) {
+				trace.screenWidth = (unsigned int)values[0];
+				trace.screenHeight = (unsigned int)values[1];
+			}
+			else if (key == "window-rect" && values.size() == 4 && values[2] >= 64 && values[3] >= 64) {
+				trace.window = { (int)values[0], (int)values[1], (int)(values[0] + values[2]), (int)(values[1] + values[3]) };
+			}
+			else if (key == "receiver-delay" && values.size() == 1 && values[0] >= 0.0) {
+				trace.receiverDelay = values[0];
+			}
+			else if (key == "preview" && (value == "off" || value == "thumbnail" || value == "full")) {
+				trace.bPreview = value != "off";
+			}
+			else if (!trace.config.Set(key, value)) {
+				trace.error = trace.config.error + tmp;
+				return false;
+			}
+			continue;
+		}
+
+		Segment segment;
+		if (line.compare(0, 5, "mode ") == 0) {
+			segment.mode = Trim(line.substr(5));
+			if (segment.mode != "desktop" && segment.mode != "region" && segment.mode != "window") {
+				trace.error = "unknown mode " + segment.mode + tmp;
+				return false;
+			}
+			trace.segments.push_back(segment);
+			continue;
+		}
+
+		char* end = nullptr;
+		long frames = strtol(line.c_str(), &end, 10);
+		if (end == line.c_str() || frames <= 0) {
+			trace.error = std::string("expected a setting, mode or frame count") + tmp;
+			return false;
+		}
+		segment.frames = (unsigned int)frames;
+		std::stringstream activities(end);
+		std::string item;
+		while (std::getline(activities, item, ';')) {
+			item = Trim(item);
+			Activity activity;
+			size_t space = item.find(' ');
+			activity.name = item.substr(0, space);
+			if (space != std::string::npos)
+				activity.args = ParseNumbers(item.substr(space));
+			size_t args = activity.name == "idle" ? 0 : activity.name == "video" ? 5
+				: activity.name == "scroll" ? 2 : activity.name == "resize" ? 4 : (size_t)-1;
+			if (args == (size_t)-1 || activity.args.size() != args) {
+				trace.error = "unknown activity or arguments \"" + item + "\"" + tmp;
+				return false;
+			}
+			segment.activities.push_back(activity);
+		}
+		trace.segments.push_back(segment);
+	}
+
+	if (!trace.config.Validate()) {
+		trace.error = trace.config.error;
+		return false;
+	}
+	return true;
+}
+
+//
+// Replay
+//
+
+struct Result {
+	unsigned int frames = 0;
+	double fps = 0.0;
+	double p99 = 0.0;
+	double allocs = 0.0;
+	double memory = 0.0;
+	unsigned int received = 0;
+	unsigned int moves = 0;
+	unsigned int coalesced = 0;
+	unsigned int mismatches = 0; // Frames received that differ from the screen
+};
+
+// Hash of the pixels of a frame and its size, never 0. Four lanes
+// so that the receiver keeps up with a full frame at each message.
+static uint64_t HashPixels(const uint32_t* pixels, unsigned int pitch, unsigned int width, unsigned int height)
+{
+	const uint64_t prime = 0x9E3779B97F4A7C15ull;
+	uint64_t h[4] = { ((uint64_t)width << 32 | height)*prime, 1, 2, 3 };
+	for (unsigned int y = 0; y < height; y++) {
+		const uint32_t* line = pixels + (size_t)y*pitch;
+		unsigned int x = 0;
+		for (; x + 8 <= width; x += 8) {
+			uint64_t w[4];
+			memcpy(w, line + x, 32);
+			for (int i = 0; i < 4; i++)
+				h[i] = (h[i] ^ w[i])*prime;
+		}
+		for (; x < width; x++)
+			h[0] = (h[0] ^ line[x])*prime;
+	}
+	return ((h[0] ^ h[1]*3) ^ (h[2]*5 ^ h[3]*7)) | 1;
+}
+
+//
+// Screen as the capture platform of the pipeline
+//
+// Desktop duplication reports the changes of the screen since the last
+// frame acquired, or nothing if it has not changed. The staging texture,
+// the OpenGL texture read back for the region or the preview and the
+// window capture are copies of the screen in memory. Every frame sent is
+// numbered in turn and the hash of the screen it shows is kept for the
+// receiver to check.
+//
+
+struct ReplayScreen {
+
+	Screen& screen;
+	FrameArena& arena;
+	std::vector<std::atomic<uint64_t>>& screens;
+	Rect region{};
+
+	std::vector<uint32_t> staging;  // Staging texture
+	std::vector<uint32_t> readback; // OpenGL texture, read back for the region or preview
+	uint32_t sent = 0;              // Frames sent by both senders
+	bool bWork = false;             // A frame was acquired, captured or pushed this update
+	double checkTime = 0.0;         // Hashing and Settle, not counted as capture work
+	std::function<void()> Settle;   // Wait for the stream and ring to take the frames pushed
+
+	ReplayScreen(Screen& s, FrameArena& a, std::vector<std::atomic<uint64_t>>& hashes)
+		: screen(s), arena(a), screens(hashes) {}
+
+	// Hash of the screen for a frame sent, by frame number.
+	// Atomic as the receiver learns of a frame through the socket.
+	void RecordScreen(uint32_t number, const uint32_t* pixels, unsigned int pitch,
+		unsigned int width, unsigned int height)
+	{
+		double start = CaptureStats::Now();
+		if (number < screens.size())
+			screens[number].store(HashPixels(pixels, pitch, width, height), std::memory_order_release);
+		checkTime += CaptureStats::Now() - start;
+	}
+
+	CapturePlatform GetPlatform()
+	{
+		CapturePlatform platform;
+		platform.AcquireDesktop = [this](unsigned int, DesktopFrame& frame) {
+			// Duplication would wait for a change, the replay loop has done so
+			if (screen.dirty.empty() && screen.moves.empty())
+				return false;
+			frame.width = screen.width;
+			frame.height = screen.height;
+			frame.moves = screen.moves;
+			for (const Rect& r : screen.dirty)
+				frame.rects.push_back({ r.left, r.top, r.right, r.bottom });
+			screen.Frame();
+			bWork = true;
+			return true;
+		};
+		platform.SendDesktop = [this](bool bReadback) {
+			if (bReadback) {
+				readback.resize(screen.pixels.size());
+				memcpy(readback.data(), screen.pixels.data(), readback.size()*4);
+			}
+			sent++;
+			RecordScreen(sent, screen.pixels.data(), screen.width, screen.width, screen.height);
+			return sent;
+		};
+		platform.StageDesktop = [this]() {
+			staging.resize(screen.pixels.size());
+			memcpy(staging.data(), screen.pixels.data(), staging.size()*4);
+			return true;
+		};
+		platform.ReadStaged = [this](int left, int top, unsigned int width, unsigned int height) -> FramePtr {
+			bWork = true;
+			Rect part = Intersect({ left, top, left + (int)width, top + (int)height },
+				{ 0, 0, (int)screen.width, (int)screen.height });
+			if (part.IsEmpty() || staging.empty())
+				return nullptr;
+			FramePtr frame = arena.Allocate((unsigned int)part.Width(), (unsigned int)part.Height());
+			if (frame) {
+				for (unsigned int y = 0; y < frame->height; y++)
+					memcpy(frame->pixels + (size_t)y*frame->pitch,
+						staging.data() + (size_t)(part.top + y)*screen.width + part.left, frame->pitch);
+				arena.AddCopy(frame->size);
+			}
+			return frame;
+		};
+		platform.ReadRegion = [this](int left, int top, unsigned int width, unsigned int height) {
+			Rect part = Intersect({ left, top, left + (int)width, top + (int)height },
+				{ 0, 0, (int)screen.width, (int)screen.height });
+			readback.resize(screen.pixels.size());
+			for (int y = part.top; y < part.bottom; y++)
+				memcpy(readback.data() + (size_t)y*screen.width + part.left,
+					screen.pixels.data() + (size_t)y*screen.width + part.left, (size_t)part.Width()*4);
+		};
+		platform.SendRegion = [this]() {
+			// Cropped from the texture read back
+			bWork = true;
+			sent++;
+			if (readback.size() == screen.pixels.size())
+				RecordScreen(sent, readback.data() + (size_t)region.top*screen.width + region.left,
+					screen.width, (unsigned int)region.Width(), (unsigned int)region.Height());
+			return sent;
+		};
+		platform.CaptureWindow = [this]() -> FramePtr {
+			// GDI capture of the document window, after a region frame
+			// pushed by the same update has been taken
+			bWork = true;
+			double start = CaptureStats::Now();
+			Settle();
+			checkTime += CaptureStats::Now() - start;
+			Rect source = screen.window;
+			FramePtr frame = arena.Allocate((unsigned int)source.Width(), (unsigned int)source.Height());
+			if (!frame)
+				return nullptr;
+			for (unsigned int y = 0; y < frame->height; y++)
+				memcpy(frame->pixels + (size_t)y*frame->pitch,
+					screen.pixels.data() + (size_t)(source.top + y)*screen.width + source.left, frame->pitch);
+			frame->number = sent + 1;
+			frame->timestamp = CaptureStats::Now();
+			RecordScreen(frame->number, (const uint32_t*)frame->pixels, frame->width, frame->width, frame->height);
+			return frame;
+		};
+		platform.SendWindow = [this](const FrameRef&) {
+			sent++;
+			return true;
+		};
+		return platform;
+	}
+};
+
+static bool Replay(const Trace& trace, Result& result, std::string& error)
+{
+	unsigned int totalFrames = 0;
+	for (const Segment& segment : trace.segments)
+		totalFrames += segment.frames;
+	if (totalFrames == 0) {
+		error = "no frames";
+		return false;
+	}
+
+	Screen screen;
+	screen.Resize(trace.screenWidth, trace.screenHeight);
+	screen.SetWindow(trace.window);
+
+	// The pipeline as the headless application sets it up, streaming
+	// to a receiver and recording to a ring of its own
+	CaptureConfig config = trace.config;
+	char address[256];
+	snprintf(address, 256, "unix:perf-replay-%d.sock", (int)getpid());
+	char ringPath[256];
+	snprintf(ringPath, 256, "perf-replay-%d.ring", (int)getpid());
+	config.streamAddress = address;
+	config.snapshotFile = ringPath;
+	config.folder.clear();
+
+	// Each loop is a tick of the trace on the clock of the pipeline,
+	// so that what is due each tick does not depend on the machine
+	double now = 0.0;
+	CapturePipeline pipeline;
+	pipeline.SetClock([&now]() { return now; });
+
+	// At most a desktop and a window frame each tick
+	std::vector<std::atomic<uint64_t>> screens(totalFrames*2 + 2);
+	ReplayScreen platform(screen, pipeline.GetArena(), screens);
+	pipeline.SetPlatform(platform.GetPlatform());
+	bool bOpened = pipeline.Configure(config);
+	if (!bOpened) {
+		error = pipeline.error;
+		pipeline.CloseSnapshot();
+		remove(ringPath);
+		return false;
+	}
+	Rect region = { config.regionLeft, config.regionTop,
+		config.regionLeft + (int)config.regionWidth, config.regionTop + (int)config.regionHeight };
+	if (config.regionWidth == 0)
+		region = trace.window;
+	platform.region = Intersect(region, { 0, 0, (int)screen.width, (int)screen.height });
+	pipeline.SetRegion(platform.region.left, platform.region.top,
+		(unsigned int)platform.region.Width(), (unsigned int)platform.region.Height());
+	pipeline.SetPreview(trace.bPreview);
+
+	// Receiver, recording the latency of every frame sent after the
+	// first half second, which includes the key frame sent on connection.
+	// Every frame received must be the screen that was captured.
+	std::atomic<uint32_t> warmup{ UINT32_MAX };
+	CaptureStats latency(totalFrames*2 + 16);
+	std::atomic<unsigned int> received{ 0 };
+	std::atomic<unsigned int> moves{ 0 };
+	std::atomic<unsigned int> mismatches{ 0 };
+	std::atomic<uint32_t> firstMismatch{ 0 };
+	std::atomic<bool> bConnected{ false };
+	std::thread receiver([&]() {
+		FrameStreamReceiver client;
+		for (int i = 0; i < 100 && !client.Connect(address); i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		bConnected = client.IsConnected();
+		while (client.Receive()) {
+			const TileDecoder& decoder = client.GetDecoder();
+			uint32_t number = decoder.GetFrame();
+			if (number > warmup)
+				latency.AddSample(client.GetLatency().GetLast());
+			moves += decoder.GetMoves();
+			received++;
+			uint64_t expected = number < screens.size() ? screens[number].load(std::memory_order_acquire) : 0;
+			if (expected != HashPixels((const uint32_t*)decoder.GetPixels(), decoder.GetWidth(),
+				decoder.GetWidth(), decoder.GetHeight())) {
+				if (mismatches++ == 0)
+					firstMismatch = number;
+			}
+			if (trace.receiverDelay > 0.0)
+				std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(trace.receiverDelay));
+		}
+	});
+	FrameStream& stream = pipeline.GetStream();
+	for (int i = 0; i < 200 && !stream.IsConnected(); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	if (!stream.IsConnected()) {
+		pipeline.CloseStream();
+		receiver.join();
+		pipeline.CloseSnapshot();
+		remove(ringPath);
+		error = "the receiver did not connect";
+		return false;
+	}
+
+	// The loop runs at the desktop rate, or the window rate if higher
+	// for the region or a window. Duplication reports a desktop frame
+	// only if the screen has changed.
+	auto source = [](const std::string& mode) {
+		return mode == "region" ? SOURCE_REGION : mode == "window" ? SOURCE_WINDOW : SOURCE_DESKTOP;
+	};
+	auto loopRate = [&](CaptureSource mode) {
+		return mode == SOURCE_DESKTOP ? config.desktopFps : std::max(config.desktopFps, config.windowFps);
+	};
+	double rate = loopRate(config.source);
+
+	// The ring writer, and the stream unless the receiver is slow, take
+	// each frame before the next is captured, so that the frame memory
+	// does not depend on how the threads were run
+	const SnapshotRing& ring = pipeline.GetRing();
+	FrameQueue& queue = stream.GetQueue();
+	platform.Settle = [&]() {
+		for (int i = 0; i < 100; i++) {
+			bool bRing = ring.IsOpen() && (ring.GetQueue().GetSize() > 0
+				|| ring.GetRecorded() + ring.GetDropped() < ring.GetQueue().GetPushed());
+			bool bStream = trace.receiverDelay <= 0.0 && (queue.GetSize() > 0
+				|| stream.GetSent() + stream.GetDropped() < queue.GetPushed());
+			if (!bRing && !bStream)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	};
+
+	FramePacer pacer(rate);
+	CaptureStats work(totalFrames);
+	unsigned long long allocations = g_Allocations.load();
+	unsigned int frame = 0;
+	bool bResizeSmall = false;
+
+	for (const Segment& segment : trace.segments) {
+		if (!segment.mode.empty()) {
+			pipeline.SetSource(source(segment.mode));
+			rate = loopRate(source(segment.mode));
+			pacer.SetFps(rate);
+			continue;
+		}
+
+		for (unsigned int i = 0; i < segment.frames; i++, frame++) {
+
+			// Screen activity
+			for (const Activity& activity : segment.activities) {
+				const std::vector<double>& a = activity.args;
+				if (activity.name == "idle") {
+					screen.Idle(frame);
+				}
+				else if (activity.name == "video") {
+					screen.Video({ (int)a[0], (int)a[1], (int)(a[0] + a[2]), (int)(a[1] + a[3]) }, a[4], rate, frame);
+				}
+				else if (activity.name == "scroll") {
+					screen.Scroll((int)a[0], (int)a[1]);
+				}
+				else if (activity.name == "resize") {
+					bResizeSmall = !bResizeSmall;
+					int w = (int)(bResizeSmall ? a[2] : a[0]);
+					int h = (int)(bResizeSmall ? a[3] : a[1]);
+					screen.SetWindow({ screen.window.left, screen.window.top, screen.window.left + w, screen.window.top + h });
+				}
+			}
+
+			platform.Settle();
+			if (now >= 500.0 && warmup == UINT32_MAX)
+				warmup = platform.sent;
+
+			// Wait for the tick
+			double wait = pacer.GetWait();
+			if (wait > 0.0)
+				std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
+			pacer.Frame();
+
+			double start = CaptureStats::Now();
+			platform.bWork = false;
+			platform.checkTime = 0.0;
+			pipeline.Update();
+			if (platform.bWork)
+				work.AddSample(CaptureStats::Now() - start - platform.checkTime);
+			now += 1000.0/rate;
+		}
+	}
+	platform.Settle();
+	pipeline.Flush();
+
+	// Let the stream send the last frame
+	unsigned int sent = 0;
+	for (int i = 0; i < 100; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (stream.GetSent() == sent && stream.GetQueue().GetSize() == 0)
+			break;
+		sent = stream.GetSent();
+	}
+	result.allocs = (double)(g_Allocations.load() - allocations)/std::max(1u, frame);
+	result.coalesced = stream.GetQueue().GetCoalesced();
+
+	pipeline.CloseStream();
+	receiver.join();
+	pipeline.CloseSnapshot();
+	remove(ringPath);
+
+	result.frames = frame;
+	result.fps = work.GetAverage() > 0.0 ? 1000.0/work.GetAverage() : 0.0;
+	result.p99 = latency.GetPercentile(99.0);
+	result.memory = (double)pipeline.GetArena().GetPeakBytes()/1048576.0;
+	result.received = received;
+	result.moves = moves;
+	result.mismatches = mismatches;
+	if (!bConnected || received == 0) {
+		error = "no frames were received";
+		return false;
+	}
+	if (mismatches > 0) {
+		char tmp[128];
+		snprintf(tmp, 128, "%u frames received differ from the screen, the first frame %u",
+			(unsigned int)mismatches, (unsigned int)firstMismatch);
+		error = tmp;
+		return false;
+	}
+	return true;
+}
+
+//
+// Calibration
+//
+// Capture work of a fixed 1920x1080 frame on one thread, msec : a copy,
+// a tile compare with a tenth changed and a hash, the median of a few
+// runs. The timing baselines are scaled by this against the calibration
+// they were written with, so that they hold on a faster or slower machine.
+//
+
+static double Calibrate()
+{
+	const unsigned int width = 1920;
+	const unsigned int height = 1080;
+	std::vector<uint32_t> previous((size_t)width*height);
+	std::vector<uint32_t> current(previous.size());
+	for (size_t i = 0; i < previous.size(); i++)
+		previous[i] = HashInt((uint32_t)i);
+	TileMap map;
+	map.Resize(width, height);
+	uint64_t hash = 0;
+	std::vector<double> times;
+	for (unsigned int run = 0; run < 30; run++) {
+		double start = CaptureStats::Now();
+		memcpy(current.data(), previous.data(), current.size()*4);
+		for (unsigned int y = (run % 10)*108; y < (run % 10)*108 + 108; y++)
+			current[(size_t)y*width + run] ^= 0x00FFFFFF;
+		map.Clear();
+		map.Compare((const unsigned char*)previous.data(), (const unsigned char*)current.data(), width*4);
+		hash ^= HashPixels(current.data(), width, width, height);
+		times.push_back(CaptureStats::Now() - start);
+	}
+	std::sort(times.begin(), times.end());
+	return hash != 0 ? times[times.size()/2] : 0.0;
+}
+
+//
+// Baselines
+//
+//	# comment
+//	tolerance metric = percent [absolute]
+//	calibration = msec
+//	trace fps p99 allocs memory
+//
+
+#define METRICS 4
+static const char* metricNames[METRICS] = { "fps", "p99", "allocs", "memory" };
+static const char* metricUnits[METRICS] = { "", " msec", "", " MB" };
+
+struct Tolerance {
+	double percent = 20.0;
+	double absolute = 0.0;
+};
+
+struct Baselines {
+	std::vector<std::string> header; // Comment, tolerance and calibration lines, kept by --update
+	Tolerance tolerance[METRICS];
+	double calibration = 0.0;
+	std::vector<std::pair<std::string, std::vector<double>>> traces;
+};
+
+static bool LoadBaselines(const std::string& path, Baselines& baselines)
+{
+	std::ifstream file(path);
+	if (!file)
+		return false;
+	std::string line;
+	while (std::getline(file, line)) {
+		std::string text = Trim(line.substr(0, line.find('#')));
+		if (text.empty() || text.compare(0, 10, "tolerance ") == 0 || text.compare(0, 12, "calibration ") == 0)
+			baselines.header.push_back(line);
+		if (text.empty())
+			continue;
+		std::stringstream words(text);
+		std::string name;
+		words >> name;
+		if (name == "tolerance") {
+			std::string metric, equals;
+			words >> metric >> equals;
+			std::vector<double> values = ParseNumbers(text.substr(text.find('=') + 1));
+			for (int i = 0; i < METRICS; i++) {
+				if (metric == metricNames[i] && !values.empty()) {
+					baselines.tolerance[i].percent = values[0];
+					baselines.tolerance[i].absolute = values.size() > 1 ? values[1] : 0.0;
+				}
+			}
+			continue;
+		}
+		if (name == "calibration") {
+			std::vector<double> values = ParseNumbers(text.substr(text.find('=') + 1));
+			if (!values.empty())
+				baselines.calibration = values[0];
+			continue;
+		}
+		std::vector<double> values;
+		double value;
+		while (words >> value)
+			values.push_back(value);
+		if (values.size() == METRICS)
+			baselines.traces.push_back({ name, values });
+	}
+	return true;
+}
+
+static bool SaveBaselines(const std::string& path, const Baselines& baselines)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+	bool bCalibration = false;
+	for (const std::string& line : baselines.header) {
+		if (line.compare(0, 12, "calibration ") == 0) {
+			fprintf(file, "calibration = %.3f\n", baselines.calibration);
+			bCalibration = true;
+		}
+		else {
+			fprintf(file, "%s\n", line.c_str());
+		}
+	}
+	if (!bCalibration)
+		fprintf(file, "calibration = %.3f\n", baselines.calibration);
+	for (const auto& trace : baselines.traces) {
+		fprintf(file, "%-12s %10.1f %8.2f %8.1f %8.1f\n", trace.first.c_str(),
+			trace.second[0], trace.second[1], trace.second[2], trace.second[3]);
+	}
+	fclose(file);
+	return true;
+}
+
+// Higher is better for fps, lower for the others
+static bool IsRegression(int metric, double value, double baseline, const Tolerance& tolerance, double& limit)
+{
+	if (metric == 0) {
+		limit = baseline*(1.0 - tolerance.percent/100.0) - tolerance.absolute;
+		return value < limit;
+	}
+	limit = baseline*(1.0 + tolerance.percent/100.0) + tolerance.absolute;
+	return value > limit;
+}
+
+int main(int argc, char* argv[])
+{
+	bool bUpdate = false;
+	int repeat = 5;
+	std::string baselinePath = "baselines.txt";
+	std::vector<std::string> names;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--update")
+			bUpdate = true;
+		else if (arg == "--repeat" && i + 1 < argc)
+			repeat = std::max(1, atoi(argv[++i]));
+		else if (arg == "--baselines" && i + 1 < argc)
+			baselinePath = argv[++i];
+		else
+			names.push_back(arg);
+	}
+
+	// Traces are in "traces" beside the baselines
+	std::string folder = baselinePath.substr(0, baselinePath.find_last_of("/\\") + 1);
+	Baselines baselines;
+	bool bBaselines = LoadBaselines(baselinePath, baselines);
+	if (!bBaselines && !bUpdate) {
+		printf("Could not read %s\n", baselinePath.c_str());
+		return 2;
+	}
+	if (names.empty()) {
+		for (const auto& trace : baselines.traces)
+			names.push_back(trace.first);
+	}
+	if (names.empty()) {
+		printf("No traces\n");
+		return 2;
+	}
+
+	// Timing is compared as if on the machine of the baselines
+	if (baselines.calibration <= 0.0)
+		baselines.calibration = Calibrate();
+
+	int failures = 0;
+	int errors = 0;
+	for (const std::string& name : names) {
+		Trace trace;
+		trace.name = name;
+		Result result;
+		std::string error;
+		if (!LoadTrace(folder + "traces/" + name + ".trace", trace)) {
+			printf("%-12s ERROR %s\n", name.c_str(), trace.error.c_str());
+			errors++;
+			continue;
+		}
+		fflush(stdout);
+
+		// Each metric, and a calibration before each run
+		// so that the scale follows the load on the machine
+		std::vector<double> runs[METRICS];
+		std::vector<double> calibrations;
+		for (int i = 0; i < repeat && error.empty(); i++) {
+			calibrations.push_back(Calibrate());
+			if (Replay(trace, result, error)) {
+				double run[METRICS] = { result.fps, result.p99, result.allocs, result.memory };
+				for (int j = 0; j < METRICS; j++)
+					runs[j].push_back(run[j]);
+			}
+		}
+		if (!error.empty()) {
+			printf("%-12s ERROR %s\n", name.c_str(), error.c_str());
+			errors++;
+			continue;
+		}
+		// The highest fps, the lowest p99 and the median of the others
+		double values[METRICS];
+		for (int i = 0; i < METRICS; i++) {
+			std::sort(runs[i].begin(), runs[i].end());
+			values[i] = i == 0 ? runs[i].back() : i == 1 ? runs[i].front() : runs[i][runs[i].size()/2];
+		}
+		double calibration = *std::min_element(calibrations.begin(), calibrations.end());
+		double scale = calibration/baselines.calibration;
+		printf("%-12s %u frames (%u received, %u coalesced, %u moves) : %.0f fps, p99 %.2f msec, %.1f allocs/frame, %.1f MB\n",
+			name.c_str(), result.frames, result.received, result.coalesced, result.moves,
+			values[0], values[1], values[2], values[3]);
+		printf("%-12s calibration %.3f msec, timing scaled by %.2f\n", "", calibration, scale);
+
+		auto baseline = std::find_if(baselines.traces.begin(), baselines.traces.end(),
+			[&](const std::pair<std::string, std::vector<double>>& t) { return t.first == name; });
+		if (bUpdate) {
+			// Timing as on the machine of the calibration kept
+			std::vector<double> updated(values, values + METRICS);
+			updated[0] *= scale;
+			updated[1] /= scale;
+			if (baseline != baselines.traces.end())
+				baseline->second = updated;
+			else
+				baselines.traces.push_back({ name, updated });
+			continue;
+		}
+		if (baseline == baselines.traces.end()) {
+			printf("%-12s no baseline, run with --update\n", "");
+			continue;
+		}
+		for (int i = 0; i < METRICS; i++) {
+			// A slower machine has a lower fps and a higher p99
+			double expected = baseline->second[i];
+			if (i == 0)
+				expected /= scale;
+			else if (i == 1)
+				expected *= scale;
+			double limit = 0.0;
+			if (IsRegression(i, values[i], expected, baselines.tolerance[i], limit)) {
+				printf("%-12s REGRESSION %s %.2f%s, %s %.2f (baseline %.2f)\n", "", metricNames[i],
+					values[i], metricUnits[i], i == 0 ? "minimum" : "maximum", limit, expected);
+				failures++;
+			}
+		}
+	}
+
+	if (bUpdate) {
+		if (errors > 0 || !SaveBaselines(baselinePath, baselines)) {
+			printf("Baselines not written\n");
+			return 2;
+		}
+		printf("Baselines written to %s\n", baselinePath.c_str());
+		return 0;
+	}
+	if (errors > 0)
+		return 2;
+	if (failures > 0) {
+		printf("FAILED : %d regression%s\n", failures, failures > 1 ? "s" : "");
+		return 1;
+	}
+	printf("PASSED\n");
+	return 0;
+}
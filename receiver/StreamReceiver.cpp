@@ -0,0 +1,150 @@
+//
+//	StreamReceiver
+//
+//	Reference receiver for the SpoutCapture frame stream.
+//
+//	Connects to SpoutCapture, reconstructs each frame from the tile deltas
+//	and reports the frame rate, data rate and capture to frame latency.
+//	Optionally writes the last frame received as a BMP file.
+//
+//	A snapshot clip (SnapshotRing) has the same format and is played
+//	with the address "file:clip.stc".
+//
+//	Usage :
+//		StreamReceiver [address] [frame.bmp]
+//		address defaults to "tcp:7590"
+//
+//	Build (Linux) :
+//		g++ -O2 -std=c++17 -I../src StreamReceiver.cpp ../src/FrameStream.cpp ../src/FrameQueue.cpp
+//			../src/ThreadSchedule.cpp ../src/TileCodec.cpp ../src/TileMap.cpp ../src/CaptureStats.cpp -lpthread
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "FrameStream.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+// Write 4 byte per pixel BGRA as a top-down 32 bit BMP
+static bool WriteBmp(const char* path, const unsigned char* pixels, unsigned int width, unsigned int height)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	uint32_t imagesize = width*height*4;
+	unsigned char header[54]{};
+	uint32_t filesize = 54 + imagesize;
+	int32_t h = -(int32_t)height; // Top-down
+	header[0] = 'B'; header[1] = 'M';
+	memcpy(header + 2, &filesize, 4);
+	header[10] = 54;
+	header[14] = 40;
+	memcpy(header + 18, &width, 4);
+	memcpy(header + 22, &h, 4);
+	header[26] = 1;
+	header[28] = 32;
+	memcpy(header + 34, &imagesize, 4);
+	fwrite(header, 1, 54, file);
+	fwrite(pixels, 1, imagesize, file);
+	fclose(file);
+	return true;
+}
+
+// Decode every frame of a clip and report its length
+static int PlayClip(const char* path, const char* bmp)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		printf("Could not open %s\n", path);
+		return 1;
+	}
+
+	TileDecoder decoder;
+	std::vector<unsigned char> message;
+	unsigned int frames = 0;
+	double first = 0.0;
+	double bytes = 0.0;
+	double start = CaptureStats::Now();
+	unsigned char prefix[4];
+	while (fread(prefix, 1, 4, file) == 4) {
+		uint32_t size = (uint32_t)prefix[0] | ((uint32_t)prefix[1] << 8)
+			| ((uint32_t)prefix[2] << 16) | ((uint32_t)prefix[3] << 24);
+		if (size > decoder.GetMaximumMessage()) {
+			printf("Invalid frame size after %u frames\n", frames);
+			break;
+		}
+		message.resize(size);
+		if (fread(message.data(), 1, size, file) != size || !decoder.Decode(message.data(), size)) {
+			printf("Invalid frame after %u frames\n", frames);
+			break;
+		}
+		if (frames == 0)
+			first = decoder.GetTimestamp();
+		frames++;
+		bytes += (double)size + 4.0;
+	}
+	fclose(file);
+
+	double length = frames > 0 ? decoder.GetTimestamp() - first : 0.0;
+	printf("%ux%u : %u frames, %.2f seconds (%.1f fps), %.2f MB, decoded in %.0f msec\n",
+		decoder.GetWidth(), decoder.GetHeight(), frames, length/1000.0,
+		length > 0.0 ? (frames - 1)*1000.0/length : 0.0, bytes/1048576.0, CaptureStats::Now() - start);
+	if (bmp && frames > 0)
+		WriteBmp(bmp, decoder.GetPixels(), decoder.GetWidth(), decoder.GetHeight());
+	return frames > 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string address = (argc > 1) ? argv[1] : "tcp:7590";
+	const char* bmp = (argc > 2) ? argv[2] : nullptr;
+
+	if (address.compare(0, 5, "file:") == 0)
+		return PlayClip(address.substr(5).c_str(), bmp);
+
+	FrameStreamReceiver receiver;
+	printf("Connecting to %s\n", address.c_str());
+	while (!receiver.Connect(address))
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	printf("Connected\n");
+
+	unsigned int frames = 0;
+	unsigned int tiles = 0;
+	unsigned int moves = 0;
+	double start = CaptureStats::Now();
+	double bytes = 0.0;
+
+	while (receiver.Receive()) {
+
+		const TileDecoder& decoder = receiver.GetDecoder();
+		frames++;
+		tiles += decoder.GetTiles();
+		moves += decoder.GetMoves();
+
+		double now = CaptureStats::Now();
+		if (now - start >= 1000.0) {
+			double seconds = (now - start)/1000.0;
+			CaptureStats& latency = receiver.GetLatency();
+			printf("%ux%u frame %u : %.1f fps, %.0f tiles/frame, %u moves, %.2f MB/s, latency %.2f msec (p99 %.2f)\n",
+				decoder.GetWidth(), decoder.GetHeight(), decoder.GetFrame(),
+				frames/seconds, frames > 0 ? (double)tiles/frames : 0.0, moves,
+				(receiver.GetBytesReceived() - bytes)/seconds/1048576.0,
+				latency.GetAverage(), latency.GetPercentile(99.0));
+			if (bmp)
+				WriteBmp(bmp, decoder.GetPixels(), decoder.GetWidth(), decoder.GetHeight());
+			frames = 0;
+			tiles = 0;
+			moves = 0;
+			bytes = receiver.GetBytesReceived();
+			start = now;
+		}
+	}
+
+	printf("Disconnected, %u messages skipped\n", receiver.GetErrors());
+	return 0;
+}
@@ -0,0 +1,222 @@
+//
+//	AdaptiveRate
+//
+//	Window capture rate that follows how much of the window changes.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "AdaptiveRate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+// Tile size of Measure, as TileMap
+#define ADAPTIVE_TILE 64
+// Lines of each tile hashed
+#define ADAPTIVE_STEP 4
+
+static const uint64_t hashPrime = 0x9E3779B97F4A7C15ull;
+
+static uint64_t HashSpan(uint64_t h, const unsigned char* span, unsigned int bytes)
+{
+	for (unsigned int i = 0; i + 8 <= bytes; i += 8) {
+		uint64_t w;
+		memcpy(&w, span + i, 8);
+		h = (h ^ w)*hashPrime;
+	}
+	if (bytes & 4) {
+		uint32_t w;
+		memcpy(&w, span + bytes - 4, 4);
+		h = (h ^ w)*hashPrime;
+	}
+	return h;
+}
+
+AdaptiveRate::AdaptiveRate()
+{
+	m_Clock = CaptureStats::Now;
+	Reset();
+}
+
+void AdaptiveRate::SetRange(double minFps, double maxFps)
+{
+	m_Max = std::max(maxFps, 1.0);
+	m_Min = std::min(std::max(minFps, 1.0), m_Max);
+}
+
+double AdaptiveRate::GetMinimum() const
+{
+	return m_Min;
+}
+
+double AdaptiveRate::GetMaximum() const
+{
+	return m_Max;
+}
+
+void AdaptiveRate::SetHold(double msec)
+{
+	m_Hold = std::max(msec, 1.0);
+}
+
+double AdaptiveRate::GetHold() const
+{
+	return m_Hold;
+}
+
+void AdaptiveRate::SetThreshold(double fraction)
+{
+	m_Threshold = std::min(std::max(fraction, 0.0), 1.0);
+}
+
+double AdaptiveRate::GetThreshold() const
+{
+	return m_Threshold;
+}
+
+void AdaptiveRate::SetClock(FramePacer::Clock clock)
+{
+	m_Clock = clock;
+	Reset();
+}
+
+void AdaptiveRate::Reset()
+{
+	m_LastActive = m_Clock();
+	m_Density = 0.0;
+	m_Hashes.clear();
+	m_Before.clear();
+	m_Width = 0;
+	m_Height = 0;
+}
+
+void AdaptiveRate::Update(double changed)
+{
+	m_Polls++;
+	// Smoothed over about a second at the minimum rate
+	double weight = std::max(0.05, std::min(1.0, m_Min/GetFps()));
+	m_Density += (changed - m_Density)*weight;
+	if (changed > m_Threshold) {
+		m_LastActive = m_Clock();
+		m_Active++;
+	}
+}
+
+double AdaptiveRate::Measure(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int pitch)
+{
+	unsigned int columns = (width + ADAPTIVE_TILE - 1)/ADAPTIVE_TILE;
+	unsigned int rows = (height + ADAPTIVE_TILE - 1)/ADAPTIVE_TILE;
+	if (!pixels || columns == 0 || rows == 0) {
+		Update(0.0);
+		return 0.0;
+	}
+
+	// Each line updates the hash of every tile across it,
+	// so that memory is read in order
+	m_Current.assign((size_t)columns*rows, 1);
+	for (unsigned int y = 0; y < height; y += ADAPTIVE_STEP) {
+		const unsigned char* line = pixels + (size_t)y*pitch;
+		uint64_t* hashes = m_Current.data() + (size_t)(y/ADAPTIVE_TILE)*columns;
+		for (unsigned int c = 0; c < columns; c++) {
+			unsigned int bytes = (std::min(width, (c + 1)*ADAPTIVE_TILE) - c*ADAPTIVE_TILE)*4;
+			hashes[c] = HashSpan(hashes[c], line + (size_t)c*ADAPTIVE_TILE*4, bytes);
+		}
+	}
+
+	double changed = 1.0;
+	if (width == m_Width && height == m_Height && m_Hashes.size() == m_Current.size()) {
+		unsigned int count = 0;
+		for (size_t i = 0; i < m_Current.size(); i++)
+			count += Count(i, m_Current[i]) ? 1 : 0;
+		changed = (double)count/(double)m_Current.size();
+	}
+	else {
+		m_Before = m_Current;
+		std::swap(m_Hashes, m_Current);
+	}
+	m_Width = width;
+	m_Height = height;
+
+	Update(changed);
+	return changed;
+}
+
+double AdaptiveRate::Measure(const TileMap& map, const unsigned char* pixels, unsigned int pitch)
+{
+	// The tiles not marked are only known to be as last measured
+	// if the last frame was measured at the same size
+	unsigned int width = map.GetWidth();
+	unsigned int height = map.GetHeight();
+	if (!pixels || map.GetTileSize() != ADAPTIVE_TILE || width != m_Width || height != m_Height
+		|| m_Hashes.size() != (size_t)map.GetCols()*map.GetRows())
+		return Measure(pixels, width, height, pitch);
+
+	unsigned int count = 0;
+	const std::vector<TileMove>& moves = map.GetMoves();
+	for (unsigned int row = 0; row < map.GetRows(); row++) {
+		for (unsigned int col = 0; col < map.GetCols(); col++) {
+			bool bChanged = map.IsChanged(col, row);
+			for (size_t m = 0; m < moves.size() && !bChanged; m++) {
+				bChanged = (int)(col*ADAPTIVE_TILE) < moves[m].right && moves[m].left < (int)((col + 1)*ADAPTIVE_TILE)
+					&& (int)(row*ADAPTIVE_TILE) < moves[m].bottom && moves[m].top < (int)((row + 1)*ADAPTIVE_TILE);
+			}
+			if (bChanged && Count((size_t)row*map.GetCols() + col, HashTile(pixels, pitch, col, row)))
+				count++;
+		}
+	}
+	double changed = (double)count/(double)m_Hashes.size();
+	Update(changed);
+	return changed;
+}
+
+// Hash of every fourth line of a tile, as Measure
+uint64_t AdaptiveRate::HashTile(const unsigned char* pixels, unsigned int pitch, unsigned int col, unsigned int row) const
+{
+	unsigned int bytes = (std::min(m_Width, (col + 1)*ADAPTIVE_TILE) - col*ADAPTIVE_TILE)*4;
+	unsigned int bottom = std::min(m_Height, (row + 1)*ADAPTIVE_TILE);
+	uint64_t h = 1;
+	for (unsigned int y = row*ADAPTIVE_TILE; y < bottom; y += ADAPTIVE_STEP)
+		h = HashSpan(h, pixels + (size_t)y*pitch + (size_t)col*ADAPTIVE_TILE*4, bytes);
+	return h;
+}
+
+// Record the hash of a tile. True if it changed and
+// is not back as it was before its last change (blinks).
+bool AdaptiveRate::Count(size_t tile, uint64_t hash)
+{
+	if (hash == m_Hashes[tile])
+		return false;
+	bool bChanged = hash != m_Before[tile];
+	m_Before[tile] = m_Hashes[tile];
+	m_Hashes[tile] = hash;
+	return bChanged;
+}
+
+double AdaptiveRate::GetFps() const
+{
+	double idle = m_Clock() - m_LastActive;
+	if (idle < m_Hold)
+		return m_Max;
+	// Halve for each hold time after the first
+	double halvings = std::floor(idle/m_Hold);
+	if (halvings >= 30.0)
+		return m_Min;
+	return std::max(m_Min, m_Max/std::pow(2.0, halvings));
+}
+
+double AdaptiveRate::GetDensity() const
+{
+	return m_Density;
+}
+
+unsigned int AdaptiveRate::GetPolls() const
+{
+	return m_Polls;
+}
+
+unsigned int AdaptiveRate::GetActive() const
+{
+	return m_Active;
+}
@@ -0,0 +1,87 @@
+//
+//	AdaptiveRate
+//
+//	Window capture rate that follows how much of the window changes.
+//
+//	Each frame polled reports the fraction of the frame that changed
+//	since the last, measured by a sampled hash of each tile or given by
+//	the caller. A change of more than the threshold returns to the maximum
+//	rate at once. After the hold time without one the rate halves each
+//	further hold time, down to the minimum. A static dialog is then
+//	polled a few times a second and a playing video at the full rate.
+//	Smaller changes are still captured at the rate of the time but do
+//	not keep the rate up. Measure also leaves out tiles that change back
+//	to what they were before their last change, such as a blinking caret.
+//	Given the tile map compared for the frame, Measure hashes only the
+//	tiles it marks or moves, as the others have not changed.
+//
+//	The clock is replaceable as for FramePacer.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "FramePacer.h"
+#include "TileMap.h"
+
+class AdaptiveRate {
+
+public:
+
+	AdaptiveRate();
+
+	void SetRange(double minFps, double maxFps);
+	double GetMinimum() const;
+	double GetMaximum() const;
+	void SetHold(double msec); // Default 1000
+	double GetHold() const;
+	void SetThreshold(double fraction); // Default 0, any change
+	double GetThreshold() const;
+	void SetClock(FramePacer::Clock clock);
+
+	// Start again at the maximum rate, e.g. for a new window
+	void Reset();
+
+	// Fraction of the frame changed since the last poll, 0 to 1
+	void Update(double changed);
+
+	// Compare a 4 byte per pixel frame with the last measured by a hash
+	// of every fourth line of each tile. Updates with and returns the
+	// fraction of tiles changed, less those that blink. A new size is
+	// a full change.
+	double Measure(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int pitch);
+	// As Measure, with a map of the tiles that changed since the last frame
+	// measured. A tile under a move is a change. The frame has the map size.
+	double Measure(const TileMap& map, const unsigned char* pixels, unsigned int pitch);
+
+	double GetFps() const;         // Rate for the next poll
+	double GetDensity() const;     // Recent fraction changed, smoothed
+	unsigned int GetPolls() const; // Updates
+	unsigned int GetActive() const; // Updates above the threshold
+
+private:
+
+	FramePacer::Clock m_Clock;
+	double m_Min = 5.0;
+	double m_Max = 60.0;
+	double m_Hold = 1000.0;
+	double m_Threshold = 0.0;
+	double m_LastActive = 0.0; // Time of the last change above the threshold
+	double m_Density = 0.0;
+	unsigned int m_Polls = 0;
+	unsigned int m_Active = 0;
+
+	// Tile hashes of the last frame measured and before each tile last changed
+	std::vector<uint64_t> m_Hashes;
+	std::vector<uint64_t> m_Before;
+	std::vector<uint64_t> m_Current;
+	unsigned int m_Width = 0;
+	unsigned int m_Height = 0;
+
+	uint64_t HashTile(const unsigned char* pixels, unsigned int pitch, unsigned int col, unsigned int row) const;
+	bool Count(size_t tile, uint64_t hash);
+
+};
@@ -0,0 +1,449 @@
+//
+//	CaptureConfig
+//
+//	Capture settings from a configuration file or the command line.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureConfig.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static std::string Trim(const std::string& str)
+{
+	size_t start = str.find_first_not_of(" \t\r\n");
+	if (start == std::string::npos)
+		return std::string();
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(start, end - start + 1);
+}
+
+static std::string Lower(std::string str)
+{
+	std::transform(str.begin(), str.end(), str.begin(),
+		[](unsigned char c) { return (char)tolower(c); });
+	return str;
+}
+
+static bool ParseBool(const std::string& value, bool& result)
+{
+	std::string str = Lower(value);
+	if (str == "true" || str == "yes" || str == "on" || str == "1") {
+		result = true;
+		return true;
+	}
+	if (str == "false" || str == "no" || str == "off" || str == "0") {
+		result = false;
+		return true;
+	}
+	return false;
+}
+
+static bool ParseNumber(const std::string& value, double& result)
+{
+	if (value.empty())
+		return false;
+	char* end = nullptr;
+	result = strtod(value.c_str(), &end);
+	return *end == 0;
+}
+
+static bool ParseInteger(const std::string& value, long& result)
+{
+	if (value.empty())
+		return false;
+	char* end = nullptr;
+	result = strtol(value.c_str(), &end, 10);
+	return *end == 0;
+}
+
+bool CaptureConfig::Load(const std::string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	// A name without a path is looked for in the folder
+	if (!file && !folder.empty() && path.find_first_of("/\\:") == std::string::npos)
+		file = fopen((folder + "/" + path).c_str(), "rb");
+	if (!file) {
+		error = "Could not open " + path;
+		return false;
+	}
+
+	std::string text;
+	char buffer[4096];
+	size_t n = 0;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		text.append(buffer, n);
+	fclose(file);
+
+	return Parse(text, path);
+}
+
+bool CaptureConfig::Parse(const std::string& text, const std::string& name)
+{
+	size_t pos = 0;
+	unsigned int line = 0;
+	while (pos < text.size()) {
+		size_t end = text.find('\n', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		std::string str = text.substr(pos, end - pos);
+		pos = end + 1;
+		line++;
+
+		size_t comment = str.find('#');
+		if (comment != std::string::npos)
+			str.erase(comment);
+		str = Trim(str);
+		if (str.empty())
+			continue;
+
+		size_t equals = str.find('=');
+		if (equals == std::string::npos) {
+			error = name + " line " + std::to_string(line) + " : expected key = value";
+			return false;
+		}
+		if (!Set(Trim(str.substr(0, equals)), Trim(str.substr(equals + 1)))) {
+			error = name + " line " + std::to_string(line) + " : " + error;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CaptureConfig::ParseCommandLine(const std::string& line)
+{
+	return ParseArgs(SplitCommandLine(line));
+}
+
+bool CaptureConfig::ParseArgs(const std::vector<std::string>& args)
+{
+	for (size_t i = 0; i < args.size(); i++) {
+
+		const std::string& arg = args[i];
+
+		// A window title
+		if (arg.compare(0, 2, "--") != 0) {
+			windowTitle = arg;
+			source = SOURCE_WINDOW;
+			continue;
+		}
+
+		std::string key = arg.substr(2);
+		std::string value;
+		size_t equals = key.find('=');
+		if (equals != std::string::npos) {
+			value = key.substr(equals + 1);
+			key.erase(equals);
+		}
+		else if (i + 1 < args.size() && args[i + 1].compare(0, 2, "--") != 0) {
+			value = args[++i];
+		}
+		else {
+			value = "true"; // A flag, e.g. --headless
+		}
+
+		if (Lower(key) == "config") {
+			if (!Load(value))
+				return false;
+		}
+		else if (!Set(key, value)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CaptureConfig::Set(const std::string& key, const std::string& value)
+{
+	std::string name = Lower(key);
+	std::string str = Lower(value);
+	bool bValid = true;
+	double number = 0.0;
+	long integer = 0;
+
+	if (name == "headless") {
+		bValid = ParseBool(value, bHeadless);
+	}
+	else if (name == "source") {
+		if (str == "desktop") source = SOURCE_DESKTOP;
+		else if (str == "region") source = SOURCE_REGION;
+		else if (str == "window") source = SOURCE_WINDOW;
+		else bValid = false;
+	}
+	else if (name == "region") {
+		// left, top, width, height
+		long values[4]{};
+		size_t pos = 0;
+		for (int i = 0; i < 4 && bValid; i++) {
+			size_t end = value.find(',', pos);
+			if ((end == std::string::npos) != (i == 3))
+				bValid = false;
+			else
+				bValid = ParseInteger(Trim(value.substr(pos, end == std::string::npos ? end : end - pos)), values[i]);
+			pos = end + 1;
+		}
+		if (bValid && values[2] >= 0 && values[3] >= 0) {
+			regionLeft = (int)values[0];
+			regionTop = (int)values[1];
+			regionWidth = (unsigned int)values[2];
+			regionHeight = (unsigned int)values[3];
+		}
+		else {
+			bValid = false;
+		}
+	}
+	else if (name == "window") {
+		windowTitle = value;
+	}
+	else if (name == "desktop-sender") {
+		desktopName = value;
+	}
+	else if (name == "window-sender") {
+		windowName = value;
+	}
+	else if (name == "desktop-fps") {
+		bValid = ParseNumber(value, number);
+		if (bValid) desktopFps = number;
+	}
+	else if (name == "window-fps") {
+		bValid = ParseNumber(value, number);
+		if (bValid) windowFps = number;
+	}
+	else if (name == "present-aligned") {
+		bValid = ParseBool(value, bPresentAligned);
+	}
+	else if (name == "adaptive") {
+		bValid = ParseBool(value, bAdaptive);
+	}
+	else if (name == "adaptive-min-fps") {
+		bValid = ParseNumber(value, number);
+		if (bValid) adaptiveMinFps = number;
+	}
+	else if (name == "adaptive-hold") {
+		bValid = ParseNumber(value, number) && number >= 10.0 && number <= 60000.0;
+		if (bValid) adaptiveHold = number;
+	}
+	else if (name == "adaptive-threshold") {
+		bValid = ParseNumber(value, number) && number >= 0.0 && number < 100.0;
+		if (bValid) adaptiveThreshold = number;
+	}
+	else if (name == "tile-map") {
+		bValid = ParseBool(value, bTileMap);
+	}
+	else if (name == "scroll") {
+		bValid = ParseBool(value, bScroll);
+	}
+	else if (name == "stream") {
+		if (str == "off" || str == "false" || str.empty())
+			streamAddress.clear();
+		else if (str.compare(0, 4, "tcp:") == 0 || str.compare(0, 5, "unix:") == 0)
+			streamAddress = value;
+		else
+			bValid = false;
+	}
+	else if (name == "queue") {
+		if (str == "coalesce") queuePolicy = QUEUE_COALESCE;
+		else if (str == "drop-oldest") queuePolicy = QUEUE_DROP_OLDEST;
+		else if (str == "drop-newest") queuePolicy = QUEUE_DROP_NEWEST;
+		else if (str == "block") queuePolicy = QUEUE_BLOCK;
+		else bValid = false;
+	}
+	else if (name == "stream-remote") {
+		bValid = ParseBool(value, bStreamRemote);
+	}
+	else if (name == "queue-depth") {
+		bValid = ParseInteger(value, integer) && integer >= 1;
+		if (bValid) queueDepth = (unsigned int)integer;
+	}
+	else if (name == "frame-memory") {
+		bValid = ParseInteger(value, integer) && integer >= 1;
+		if (bValid) frameMemory = (unsigned int)integer;
+	}
+	else if (name == "capture-priority") {
+		bValid = ParsePriority(str, captureSchedule.priority);
+	}
+	else if (name == "capture-cores") {
+		captureSchedule.affinity = 0;
+		bValid = str.empty() || ParseCores(str, captureSchedule.affinity);
+	}
+	else if (name == "mmcss") {
+		bValid = ParseBool(value, captureSchedule.bMmcss);
+	}
+	else if (name == "worker-priority") {
+		bValid = ParsePriority(str, workerSchedule.priority);
+	}
+	else if (name == "worker-cores") {
+		workerSchedule.affinity = 0;
+		bValid = str.empty() || ParseCores(str, workerSchedule.affinity);
+	}
+	else if (name == "jitter") {
+		bValid = ParseNumber(value, number) && number >= 0.0 && number <= 600.0;
+		if (bValid) jitterTime = number;
+	}
+	else if (name == "snapshot") {
+		bValid = ParseNumber(value, number) && number >= 0.0 && number <= 3600.0;
+		if (bValid) snapshotTime = number;
+	}
+	else if (name == "snapshot-memory") {
+		bValid = ParseInteger(value, integer) && integer >= 1;
+		if (bValid) snapshotMemory = (unsigned int)integer;
+	}
+	else if (name == "snapshot-fps") {
+		bValid = ParseNumber(value, number);
+		if (bValid) snapshotFps = number;
+	}
+	else if (name == "snapshot-file") {
+		bValid = !value.empty();
+		if (bValid) snapshotFile = value;
+	}
+	else if (name == "snapshot-folder") {
+		snapshotFolder = value;
+	}
+	else if (name == "snapshot-key") {
+		if (str == "off" || str.empty())
+			snapshotKey = 0;
+		else if (value.size() == 1 && isalnum((unsigned char)value[0]))
+			snapshotKey = (char)toupper((unsigned char)value[0]);
+		else
+			bValid = false;
+	}
+	else if (name == "log") {
+		logFile = value;
+	}
+	else {
+		error = "unknown setting \"" + key + "\"";
+		return false;
+	}
+
+	if (!bValid)
+		error = "invalid value \"" + value + "\" for " + key;
+	return bValid;
+}
+
+bool CaptureConfig::Validate()
+{
+	if (desktopFps <= 0.0 || desktopFps > 1000.0 || windowFps <= 0.0 || windowFps > 1000.0) {
+		error = "frame rates must be more than 0 and no more than 1000 fps";
+		return false;
+	}
+	if (adaptiveMinFps < 1.0 || adaptiveMinFps > 1000.0) {
+		error = "the adaptive minimum must be at least 1 fps and no more than 1000 fps";
+		return false;
+	}
+	if (source == SOURCE_WINDOW && windowTitle.empty()) {
+		error = "window capture needs a window title";
+		return false;
+	}
+	if ((regionWidth == 0) != (regionHeight == 0)) {
+		error = "region width and height must both be set";
+		return false;
+	}
+	if (desktopName.empty() || windowName.empty() || desktopName.size() >= 256 || windowName.size() >= 256) {
+		error = "sender names must be 1 to 255 characters";
+		return false;
+	}
+	if (desktopName == windowName) {
+		error = "the desktop and window senders need different names";
+		return false;
+	}
+	if (queueDepth > 1024) {
+		error = "queue depth must be no more than 1024";
+		return false;
+	}
+	if (frameMemory < 16) {
+		error = "frame memory must be at least 16 MB";
+		return false;
+	}
+	if (snapshotTime > 0.0 && (snapshotMemory < 16 || snapshotMemory > 65536)) {
+		error = "snapshot memory must be 16 to 65536 MB";
+		return false;
+	}
+	if (snapshotFps <= 0.0 || snapshotFps > 1000.0) {
+		error = "the snapshot frame rate must be more than 0 and no more than 1000 fps";
+		return false;
+	}
+	return true;
+}
+
+std::string CaptureConfig::Describe() const
+{
+	const char* policies[] = { "drop oldest", "drop newest", "block", "coalesce" };
+	char tmp[256];
+	std::string str = bHeadless ? "headless, " : "";
+	if (source == SOURCE_DESKTOP) {
+		str += "desktop";
+	}
+	else if (source == SOURCE_REGION) {
+		if (regionWidth > 0)
+			snprintf(tmp, 256, "region %d,%d %ux%u", regionLeft, regionTop, regionWidth, regionHeight);
+		else
+			snprintf(tmp, 256, "region");
+		str += tmp;
+	}
+	else {
+		str += "window \"" + windowTitle + "\"";
+	}
+	snprintf(tmp, 256, ", \"%s\" %.0f fps%s, \"%s\" %.0f fps", desktopName.c_str(), desktopFps,
+		bPresentAligned ? " present aligned" : "", windowName.c_str(), windowFps);
+	str += tmp;
+	if (bAdaptive) {
+		snprintf(tmp, 256, " adaptive from %.0f fps", adaptiveMinFps);
+		str += tmp;
+	}
+	if (bTileMap)
+		str += ", tile map";
+	if (!bScroll)
+		str += ", no scroll moves";
+	if (!streamAddress.empty()) {
+		snprintf(tmp, 256, ", stream %s%s (%s %u)", streamAddress.c_str(), bStreamRemote ? " remote" : "",
+			policies[queuePolicy], queueDepth);
+		str += tmp;
+	}
+	if (snapshotTime > 0.0) {
+		snprintf(tmp, 256, ", snapshot %.0f s %u MB %.0f fps", snapshotTime, snapshotMemory, snapshotFps);
+		str += tmp;
+	}
+	if (!captureSchedule.IsDefault()) {
+		snprintf(tmp, 256, ", capture %s cores 0x%llx%s", GetPriorityName(captureSchedule.priority),
+			(unsigned long long)captureSchedule.affinity, captureSchedule.bMmcss ? " MMCSS" : "");
+		str += tmp;
+	}
+	if (!workerSchedule.IsDefault()) {
+		snprintf(tmp, 256, ", workers %s cores 0x%llx", GetPriorityName(workerSchedule.priority),
+			(unsigned long long)workerSchedule.affinity);
+		str += tmp;
+	}
+	return str;
+}
+
+std::vector<std::string> SplitCommandLine(const std::string& line)
+{
+	std::vector<std::string> args;
+	std::string arg;
+	bool bArg = false;
+	bool bQuoted = false;
+	for (size_t i = 0; i < line.size(); i++) {
+		char c = line[i];
+		if (c == '"') {
+			bQuoted = !bQuoted;
+			bArg = true;
+		}
+		else if ((c == ' ' || c == '\t') && !bQuoted) {
+			if (bArg)
+				args.push_back(arg);
+			arg.clear();
+			bArg = false;
+		}
+		else {
+			arg += c;
+			bArg = true;
+		}
+	}
+	if (bArg)
+		args.push_back(arg);
+	return args;
+}
@@ -0,0 +1,133 @@
+//
+//	CaptureConfig
+//
+//	Capture settings from a configuration file or the command line,
+//	so that SpoutCapture can run unattended without the menu.
+//
+//	File format, one setting per line, # for comments :
+//
+//		headless = true
+//		source = desktop | region | window
+//		region = left, top, width, height
+//		window = Part of the window title
+//		desktop-sender = DesktopSender
+//		window-sender = WindowSender
+//		desktop-fps = 60
+//		window-fps = 60
+//		present-aligned = false
+//		adaptive = false (window rate from how much of the window changes)
+//		adaptive-min-fps = 5 (no more than window-fps)
+//		adaptive-hold = 1000 (msec at each rate before halving)
+//		adaptive-threshold = 0 (percent of tiles changed to return to full rate)
+//		tile-map = false
+//		scroll = true (scrolls sent as moves)
+//		stream = off | tcp:port | tcp:host:port | unix:path
+//		stream-remote = false (tcp:host:port on an interface other than loopback)
+//		queue = coalesce | drop-oldest | drop-newest | block
+//		queue-depth = 4
+//		frame-memory = 512 (MB)
+//		capture-priority = normal | high | highest | realtime
+//		capture-cores = 0,2-3 (any if not set)
+//		mmcss = false (Windows "Capture" task)
+//		worker-priority = normal
+//		worker-cores =
+//		jitter = 0 (seconds to measure scheduling jitter at startup)
+//		snapshot = 10 (seconds in a snapshot clip, 0 for no snapshot ring)
+//		snapshot-memory = 64 (MB)
+//		snapshot-fps = 30
+//		snapshot-file = snapshot.ring
+//		snapshot-folder = (clips, the data folder if not set)
+//		snapshot-key = S (Ctrl+Alt+S saves a clip, off for none)
+//		log = file name in AppData\Roaming\Spout
+//
+//	Command line :
+//
+//		SpoutCapture [--config file] [--headless] [--key value | --key=value] ["Window title"]
+//
+//	Arguments are applied in order, so that those after "--config"
+//	replace settings from the file. A single argument without a key
+//	selects the window to capture by title.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include "FrameQueue.h"
+#include "ThreadSchedule.h"
+
+enum CaptureSource {
+	SOURCE_DESKTOP,
+	SOURCE_REGION,
+	SOURCE_WINDOW
+};
+
+struct CaptureConfig {
+
+	bool bHeadless = false;
+	CaptureSource source = SOURCE_DESKTOP;
+
+	// Region of the desktop, zero size for the window size
+	int regionLeft = 0;
+	int regionTop = 0;
+	unsigned int regionWidth = 0;
+	unsigned int regionHeight = 0;
+
+	std::string windowTitle; // Window to capture, part of the title
+	std::string desktopName = "DesktopSender";
+	std::string windowName = "WindowSender";
+
+	double desktopFps = 60.0;
+	double windowFps = 60.0;
+	bool bPresentAligned = false;
+
+	// Window rate from window-fps down to adaptiveMinFps while it is not changing
+	bool bAdaptive = false;
+	double adaptiveMinFps = 5.0;
+	double adaptiveHold = 1000.0; // msec
+	double adaptiveThreshold = 0.0; // Percent
+
+	bool bTileMap = false;
+	bool bScroll = true;
+	std::string streamAddress; // Empty for no stream
+	bool bStreamRemote = false; // No authentication
+	QueuePolicy queuePolicy = QUEUE_COALESCE;
+	unsigned int queueDepth = 4;
+	unsigned int frameMemory = 512; // MB
+
+	// Capture (update) thread, and stream and recovery threads
+	ThreadSchedule captureSchedule;
+	ThreadSchedule workerSchedule;
+	double jitterTime = 0.0; // Seconds
+
+	// Ring of recent frames saved as a clip on demand
+	double snapshotTime = 10.0; // Seconds, 0 for none
+	unsigned int snapshotMemory = 64; // MB, fewer seconds are kept if full
+	double snapshotFps = 30.0;
+	std::string snapshotFile = "snapshot.ring";
+	std::string snapshotFolder;
+	char snapshotKey = 'S'; // With Ctrl+Alt, 0 for none
+
+	std::string logFile;
+
+	// Folder for a configuration file without a path
+	std::string folder;
+
+	// Each returns false with a description in error
+	bool Load(const std::string& path);
+	bool Parse(const std::string& text, const std::string& name = "");
+	bool ParseCommandLine(const std::string& line);
+	bool ParseArgs(const std::vector<std::string>& args);
+	bool Set(const std::string& key, const std::string& value);
+	bool Validate();
+	std::string error;
+
+	// Summary for the log
+	std::string Describe() const;
+
+};
+
+// Split a command line into arguments, with double quotes for spaces
+std::vector<std::string> SplitCommandLine(const std::string& line);
@@ -0,0 +1,578 @@
+//
+//	CapturePipeline
+//
+//	The capture loop without the platform.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CapturePipeline.h"
+
+#include <algorithm>
+
+// Longest wait for a desktop frame, msec
+#define DESKTOP_TIMEOUT 500.0
+
+// Add desktop changes to a map of the part at left, top. A move is kept
+// as a move from the last frame sent only if nothing has changed since.
+static void AddToMap(TileMap& map, int left, int top, const DesktopFrame& frame, bool bScroll)
+{
+	bool bMoves = bScroll && map.GetMoves().empty() && map.GetChangedCount() == 0;
+	for (const TileMove& m : frame.moves) {
+		if (bMoves)
+			map.AddMove({ m.left - left, m.top - top, m.right - left, m.bottom - top, m.dx, m.dy });
+		else
+			map.MarkRect(m.left - left, m.top - top, m.right - left, m.bottom - top);
+	}
+	for (const CaptureRect& r : frame.rects)
+		map.MarkRect(r.left - left, r.top - top, r.right - left, r.bottom - top);
+}
+
+CapturePipeline::CapturePipeline()
+{
+}
+
+CapturePipeline::~CapturePipeline()
+{
+	// The stream and ring threads hold frames of the arena
+	m_WindowFrame.reset();
+	m_Stream.Close();
+	m_Ring.Close();
+}
+
+void CapturePipeline::SetPlatform(const CapturePlatform& platform)
+{
+	m_Platform = platform;
+}
+
+void CapturePipeline::SetClock(FramePacer::Clock clock)
+{
+	m_DesktopPacer.SetClock(clock);
+	m_WindowPacer.SetClock(clock);
+	m_SnapshotPacer.SetClock(clock);
+	m_AdaptiveRate.SetClock(clock);
+}
+
+bool CapturePipeline::Configure(const CaptureConfig& config)
+{
+	m_Config = config;
+	error.clear();
+
+	// Rates
+	m_DesktopPacer.SetFps(config.desktopFps);
+	m_DesktopPacer.SetMode(config.bPresentAligned ? FramePacer::PACE_PRESENT : FramePacer::PACE_FIXED);
+	m_WindowPacer.SetFps(config.windowFps);
+	m_WindowFps = config.windowFps;
+	m_bAdaptive = config.bAdaptive;
+	m_AdaptiveRate.SetRange(config.adaptiveMinFps, config.windowFps);
+	m_AdaptiveRate.SetHold(config.adaptiveHold);
+	m_AdaptiveRate.SetThreshold(config.adaptiveThreshold / 100.0);
+	m_SnapshotPacer.SetFps(config.snapshotFps);
+
+	// Source. Without a size the region is set by the application.
+	SetSource(config.source);
+	if (config.regionWidth > 0)
+		SetRegion(config.regionLeft, config.regionTop, config.regionWidth, config.regionHeight);
+
+	// Outputs
+	m_Arena.SetBudget((size_t)config.frameMemory * 1024 * 1024);
+	m_bTileMap = config.bTileMap;
+	m_bScroll = config.bScroll;
+	if (!m_Stream.IsOpen()) {
+		m_Stream.SetQueue(config.queueDepth, config.queuePolicy);
+		m_Stream.SetRemote(config.bStreamRemote);
+		m_Stream.SetSchedule(config.workerSchedule);
+	}
+	m_Ring.SetSchedule(config.workerSchedule);
+	bool bResult = true;
+	if (!config.streamAddress.empty() && !OpenStream(config.streamAddress)) {
+		error = "stream could not listen on " + config.streamAddress;
+		bResult = false;
+	}
+	if (config.snapshotTime > 0.0 && !OpenSnapshot()) {
+		if (!error.empty()) error += ", ";
+		error += "snapshot ring could not be created as " + GetPath(config.snapshotFile);
+		bResult = false;
+	}
+	return bResult;
+}
+
+void CapturePipeline::SetSource(CaptureSource source)
+{
+	if (source == m_Source)
+		return;
+	m_Source = source;
+	// Everything has changed for the new source
+	m_WindowTiles.SetAll();
+	m_WindowFrame.reset();
+	m_ScrollDetector.Reset();
+	m_bWindowOpen = false;
+}
+
+CaptureSource CapturePipeline::GetSource() const
+{
+	return m_Source;
+}
+
+void CapturePipeline::SetRegion(int left, int top, unsigned int width, unsigned int height)
+{
+	if (left == m_RegionLeft && top == m_RegionTop && width == m_RegionWidth && height == m_RegionHeight)
+		return;
+	m_RegionLeft = left;
+	m_RegionTop = top;
+	m_RegionWidth = width;
+	m_RegionHeight = height;
+	if (m_Source == SOURCE_REGION) {
+		m_WindowTiles.Resize(width, height);
+		m_WindowTiles.SetAll();
+	}
+}
+
+void CapturePipeline::SetPreview(bool bPreview)
+{
+	m_bPreview = bPreview;
+}
+
+void CapturePipeline::SetDesktopFps(double fps)
+{
+	m_DesktopPacer.SetFps(fps);
+}
+
+void CapturePipeline::SetWindowFps(double fps)
+{
+	m_WindowPacer.SetFps(fps);
+	m_WindowFps = fps;
+	m_AdaptiveRate.SetRange(m_Config.adaptiveMinFps, fps);
+}
+
+void CapturePipeline::SetPresentAligned(bool bAligned)
+{
+	m_DesktopPacer.SetMode(bAligned ? FramePacer::PACE_PRESENT : FramePacer::PACE_FIXED);
+}
+
+void CapturePipeline::SetAdaptive(bool bAdaptive)
+{
+	m_bAdaptive = bAdaptive;
+	m_AdaptiveRate.Reset();
+}
+
+void CapturePipeline::SetTileMap(bool bTileMap)
+{
+	m_bTileMap = bTileMap;
+	// Start again with all tiles changed
+	m_DesktopTiles.SetAll();
+	m_WindowTiles.SetAll();
+}
+
+void CapturePipeline::SetScroll(bool bScroll)
+{
+	m_bScroll = bScroll;
+}
+
+bool CapturePipeline::OpenStream(const std::string& address)
+{
+	m_Stream.Close();
+	if (!m_Stream.Open(address))
+		return false;
+	m_DesktopTiles.SetAll();
+	m_WindowTiles.SetAll();
+	return true;
+}
+
+void CapturePipeline::CloseStream()
+{
+	m_Stream.Close();
+}
+
+bool CapturePipeline::OpenSnapshot()
+{
+	m_Ring.Close();
+	std::string folder = m_Config.snapshotFolder.empty() ? m_Config.folder : m_Config.snapshotFolder;
+	double seconds = m_Config.snapshotTime > 0.0 ? m_Config.snapshotTime : 10.0;
+	m_Ring.SetClips(folder, seconds * 1000.0);
+	m_SnapshotPacer.SetFps(m_Config.snapshotFps);
+	if (!m_Ring.Open(GetPath(m_Config.snapshotFile), (size_t)m_Config.snapshotMemory * 1024 * 1024))
+		return false;
+	m_DesktopTiles.SetAll();
+	m_WindowTiles.SetAll();
+	return true;
+}
+
+void CapturePipeline::CloseSnapshot()
+{
+	m_Ring.Close();
+}
+
+void CapturePipeline::ResetWindow()
+{
+	// Release the current frame, the next is the new size
+	m_WindowFrame.reset();
+	// Free the buffers of the last window for the new size
+	m_Arena.Trim();
+	m_WindowTiles.SetAll();
+	m_ScrollDetector.Reset();
+	// A new window starts at the full rate
+	m_AdaptiveRate.Reset();
+	m_bWindowOpen = false;
+}
+
+void CapturePipeline::Update()
+{
+	PushStaged();
+
+	// The window rate follows how much of the window changes
+	m_WindowPacer.ChangeFps((m_bAdaptive && m_Source == SOURCE_WINDOW) ? m_AdaptiveRate.GetFps() : m_WindowFps);
+
+	// The desktop is always captured, by desktop duplication. The region is
+	// cropped from the desktop read back, so the desktop is acquired for a
+	// region frame as well.
+	bool bDesktopDue = m_DesktopPacer.IsDue();
+	bool bRegionDue = m_Source == SOURCE_REGION && m_WindowPacer.IsDue();
+	if (bDesktopDue || bRegionDue)
+		CaptureDesktop(bDesktopDue, bRegionDue);
+
+	// A region frame when due, with or without a new desktop frame
+	if (bRegionDue)
+		SendRegion();
+	else if (m_Source == SOURCE_WINDOW && m_WindowPacer.IsDue())
+		CaptureWindow();
+}
+
+void CapturePipeline::Flush()
+{
+	PushStaged();
+}
+
+unsigned int CapturePipeline::GetDesktopTimeout() const
+{
+	// A wait for a region frame is limited by the next desktop frame
+	double wait = DESKTOP_TIMEOUT;
+	if (!m_DesktopPacer.IsDue())
+		wait = std::min(wait, m_DesktopPacer.GetWait());
+	if (m_Source == SOURCE_REGION || (m_Source == SOURCE_WINDOW && m_bWindowOpen))
+		wait = std::min(wait, m_WindowPacer.GetWait());
+	return (unsigned int)wait;
+}
+
+unsigned int CapturePipeline::GetDesktopFrames() const
+{
+	return m_DesktopFrames;
+}
+
+unsigned int CapturePipeline::GetAcquired() const
+{
+	return m_Acquired;
+}
+
+FrameArena& CapturePipeline::GetArena()
+{
+	return m_Arena;
+}
+
+FrameStream& CapturePipeline::GetStream()
+{
+	return m_Stream;
+}
+
+SnapshotRing& CapturePipeline::GetRing()
+{
+	return m_Ring;
+}
+
+FramePacer& CapturePipeline::GetDesktopPacer()
+{
+	return m_DesktopPacer;
+}
+
+FramePacer& CapturePipeline::GetWindowPacer()
+{
+	return m_WindowPacer;
+}
+
+AdaptiveRate& CapturePipeline::GetAdaptiveRate()
+{
+	return m_AdaptiveRate;
+}
+
+const ScrollDetector& CapturePipeline::GetScrollDetector() const
+{
+	return m_ScrollDetector;
+}
+
+const TileMap& CapturePipeline::GetDesktopTiles() const
+{
+	return m_DesktopTiles;
+}
+
+const TileMap& CapturePipeline::GetWindowTiles() const
+{
+	return m_WindowTiles;
+}
+
+FrameRef CapturePipeline::GetWindowFrame() const
+{
+	return m_WindowFrame;
+}
+
+//
+// Acquire a desktop frame and send it if a desktop frame is due.
+// A frame acquired only for the region is read back but not sent.
+//
+bool CapturePipeline::CaptureDesktop(bool bDesktopDue, bool bRegionDue)
+{
+	if (!m_Platform.AcquireDesktop)
+		return false;
+	m_Desktop.moves.clear();
+	m_Desktop.rects.clear();
+	m_Desktop.bImage = true;
+	m_Desktop.bAll = false;
+	if (!m_Platform.AcquireDesktop(GetDesktopTimeout(), m_Desktop))
+		return false;
+	m_Acquired++;
+
+	AddChanges(m_Desktop);
+
+	bool bRegion = m_Source == SOURCE_REGION;
+	bool bReadback = bRegion || (m_Source == SOURCE_DESKTOP && m_bPreview);
+	uint32_t number = 0;
+	if (bDesktopDue) {
+		// The OpenGL texture is read back at the same time only if it is
+		// used, for the region or the desktop preview
+		number = m_Platform.SendDesktop ? m_Platform.SendDesktop(bReadback) : 0;
+		if (m_bTileMap && m_Platform.PublishTiles)
+			m_Platform.PublishTiles(OUTPUT_DESKTOP, m_DesktopTiles);
+		m_DesktopPacer.Frame(m_Desktop.presentTime);
+		m_DesktopFrames++;
+	}
+	else if (bRegionDue && m_Platform.ReadRegion) {
+		m_Platform.ReadRegion(m_RegionLeft, m_RegionTop, m_RegionWidth, m_RegionHeight);
+	}
+
+	// Copy the frame for the stream and ring. A region frame is cropped
+	// from the last copy, so it is made of every frame while streaming.
+	bool bStage = false;
+	if (m_Source == SOURCE_DESKTOP)
+		bStage = bDesktopDue && (IsStreaming() || IsRecordingDue());
+	else if (bRegion)
+		bStage = IsStreaming() || (bRegionDue && IsRecordingDue());
+	m_bStaged = bStage && m_Platform.StageDesktop && m_Platform.StageDesktop();
+
+	if (bDesktopDue) {
+		if (m_Source == SOURCE_DESKTOP)
+			StageFrame(0, 0, m_Desktop.width, m_Desktop.height, m_DesktopTiles, number);
+		m_DesktopTiles.Clear();
+	}
+
+	if (m_Platform.ReleaseDesktop)
+		m_Platform.ReleaseDesktop();
+
+	return true;
+}
+
+//
+// Changed tiles from desktop duplication metadata
+//
+// Move rectangles are applied first and then dirty rectangles.
+// Together they cover everything that has changed since the last frame.
+// Moves are added to the maps so that a scroll is sent as a move,
+// or marked as changed if the scroll option is off.
+//
+void CapturePipeline::AddChanges(const DesktopFrame& frame)
+{
+	if (m_DesktopTiles.GetWidth() != frame.width || m_DesktopTiles.GetHeight() != frame.height) {
+		m_DesktopTiles.Resize(frame.width, frame.height);
+		m_DesktopTiles.SetAll();
+	}
+	bool bRegion = m_Source == SOURCE_REGION;
+	if (bRegion && (m_WindowTiles.GetWidth() != m_RegionWidth || m_WindowTiles.GetHeight() != m_RegionHeight)) {
+		m_WindowTiles.Resize(m_RegionWidth, m_RegionHeight);
+		m_WindowTiles.SetAll();
+	}
+
+	// No image update, only the mouse
+	if (!frame.bImage)
+		return;
+
+	// An image update without metadata is not expected
+	if (frame.bAll) {
+		m_DesktopTiles.SetAll();
+		if (bRegion) m_WindowTiles.SetAll();
+		return;
+	}
+
+	AddToMap(m_DesktopTiles, 0, 0, frame, m_bScroll);
+	if (bRegion)
+		AddToMap(m_WindowTiles, m_RegionLeft, m_RegionTop, frame, m_bScroll);
+}
+
+//
+// Send the region from the desktop read back. Stream and record it
+// from the last desktop copy if it holds the last frame acquired.
+//
+void CapturePipeline::SendRegion()
+{
+	if (m_WindowTiles.GetWidth() != m_RegionWidth || m_WindowTiles.GetHeight() != m_RegionHeight) {
+		m_WindowTiles.Resize(m_RegionWidth, m_RegionHeight);
+		m_WindowTiles.SetAll();
+	}
+
+	uint32_t number = m_Platform.SendRegion ? m_Platform.SendRegion() : 0;
+	// Tiles changed since the last region frame
+	if (m_bTileMap && m_Platform.PublishTiles)
+		m_Platform.PublishTiles(OUTPUT_WINDOW, m_WindowTiles);
+	StageFrame(m_RegionLeft, m_RegionTop, m_RegionWidth, m_RegionHeight, m_WindowTiles, number);
+	m_WindowTiles.Clear();
+	m_WindowPacer.Frame();
+}
+
+//
+// Capture the window, compare it with the last frame, and send,
+// stream and record it
+//
+void CapturePipeline::CaptureWindow()
+{
+	FramePtr frame = m_Platform.CaptureWindow ? m_Platform.CaptureWindow() : nullptr;
+	m_bWindowOpen = frame != nullptr;
+	if (!frame)
+		return;
+
+	CompareWindow(frame);
+	m_WindowFrame = frame;
+	if (m_Platform.SendWindow && !m_Platform.SendWindow(m_WindowFrame))
+		return;
+
+	if (m_bTileMap && m_Platform.PublishTiles)
+		m_Platform.PublishTiles(OUTPUT_WINDOW, m_WindowTiles);
+	if (IsStreaming())
+		m_Stream.Push(m_WindowFrame, m_WindowTiles); // The stream keeps a reference
+	if (m_Ring.IsOpen()) {
+		if (m_SnapshotPacer.IsDue()) {
+			m_Ring.Push(m_WindowFrame, m_WindowTiles); // So does the ring
+			m_SnapshotPacer.Frame();
+		}
+		else {
+			m_Ring.Skip(m_WindowTiles);
+		}
+	}
+	m_WindowPacer.Frame();
+}
+
+//
+// Changed tiles since the previous window frame, after a scroll.
+// The detector keeps the hashes of this frame for the next.
+//
+void CapturePipeline::CompareWindow(const FramePtr& frame)
+{
+	bool bDetect = false;
+	bool bCompared = m_bTileMap || m_Stream.IsOpen() || m_Ring.IsOpen();
+	if (bCompared) {
+		if (m_WindowFrame && m_WindowFrame->width == frame->width && m_WindowFrame->height == frame->height) {
+			m_WindowTiles.Clear();
+			TileMove move;
+			bDetect = m_bScroll;
+			if (bDetect && m_ScrollDetector.Detect(m_WindowFrame->pixels, frame->pixels,
+				frame->width, frame->height, frame->pitch, move))
+				m_WindowTiles.AddMove(move);
+			m_WindowTiles.Compare(m_WindowFrame->pixels, frame->pixels, frame->pitch);
+		}
+		else {
+			m_WindowTiles.Resize(frame->width, frame->height);
+			m_WindowTiles.SetAll();
+		}
+	}
+	if (!bDetect)
+		m_ScrollDetector.Reset();
+
+	// Change density for the adaptive rate. The tiles compared
+	// above are used if there are, so the frame is not read again.
+	if (m_bAdaptive) {
+		if (bCompared)
+			m_AdaptiveRate.Measure(m_WindowTiles, frame->pixels, frame->pitch);
+		else
+			m_AdaptiveRate.Measure(frame->pixels, frame->width, frame->height, frame->pitch);
+	}
+}
+
+//
+// Stage part of the desktop copy to be streamed and recorded by the next
+// Update. The map covers the same width and height. A frame that is not
+// streamed or recorded passes its changed tiles to the next, e.g. a region
+// frame while the copy does not hold the last desktop frame.
+//
+void CapturePipeline::StageFrame(int left, int top, unsigned int width, unsigned int height,
+	const TileMap& map, uint32_t number)
+{
+	bool bRecord = m_bStaged && IsRecordingDue();
+	if (m_Ring.IsOpen() && !bRecord)
+		m_Ring.Skip(map);
+
+	bool bSend = IsStreaming();
+	if (!m_bStaged) {
+		if (bSend)
+			m_Stream.Skip(map);
+		return;
+	}
+	if (!bSend && !bRecord)
+		return;
+
+	m_StagedLeft = left;
+	m_StagedTop = top;
+	m_StagedWidth = width;
+	m_StagedHeight = height;
+	m_StagedNumber = number;
+	m_StagedTime = CaptureStats::Now();
+	m_StagedTiles = map;
+	m_bStagedRecord = bRecord;
+	m_bStagedPending = true;
+	if (bRecord)
+		m_SnapshotPacer.Frame();
+}
+
+//
+// Stream and record the part staged by the last Update. Frames are
+// pushed in the order staged, before the tiles of any frame skipped
+// by this Update, so that those are merged into the frame after.
+//
+void CapturePipeline::PushStaged()
+{
+	if (!m_bStagedPending)
+		return;
+	m_bStagedPending = false;
+
+	bool bSend = IsStreaming();
+	bool bRecord = m_bStagedRecord && m_Ring.IsOpen();
+	FramePtr frame = m_Platform.ReadStaged
+		? m_Platform.ReadStaged(m_StagedLeft, m_StagedTop, m_StagedWidth, m_StagedHeight) : nullptr;
+	if (frame) {
+		frame->number = m_StagedNumber;
+		frame->timestamp = m_StagedTime;
+		if (bSend)
+			m_Stream.Push(frame, m_StagedTiles);
+		if (bRecord)
+			m_Ring.Push(frame, m_StagedTiles);
+	}
+	else {
+		if (bSend)
+			m_Stream.Skip(m_StagedTiles);
+		if (bRecord)
+			m_Ring.Skip(m_StagedTiles);
+	}
+}
+
+bool CapturePipeline::IsStreaming() const
+{
+	return m_Stream.IsOpen() && m_Stream.IsConnected();
+}
+
+bool CapturePipeline::IsRecordingDue() const
+{
+	return m_Ring.IsOpen() && m_SnapshotPacer.IsDue();
+}
+
+// A file without a path is in the settings folder
+std::string CapturePipeline::GetPath(const std::string& file) const
+{
+	if (m_Config.folder.empty() || file.find_first_of("/\\:") != std::string::npos)
+		return file;
+	return m_Config.folder + "/" + file;
+}
@@ -0,0 +1,227 @@
+//
+//	CapturePipeline
+//
+//	The capture loop of SpoutCapture without the platform, so that the
+//	application, the tests and the performance suite run the same code.
+//
+//	Each Update decides what is due : a desktop frame at the desktop rate,
+//	a region or window frame at the window rate. It keeps the tile maps,
+//	from the duplication rectangles for the desktop and region or by
+//	comparison of window frames, and pushes the frames sent to the stream
+//	and the snapshot ring.
+//
+//	The desktop is acquired when a desktop or region frame is due. The wait
+//	for a new desktop frame is limited by the next frame due of every other
+//	output, so that an idle desktop does not hold back the region or window.
+//	The region is cropped from the desktop read back, so in region mode the
+//	desktop is acquired at the higher of the two rates, but it is only sent
+//	and streamed when a desktop frame is due. The desktop map keeps the
+//	changes of the frames acquired in between until then.
+//
+//	Desktop and region frames for the stream and ring are copied for the
+//	CPU when they are sent and read by the next Update, by which time the
+//	copy on the GPU has completed. A frame that is not streamed or recorded
+//	passes its changed tiles to the next.
+//
+//	The platform is a set of functions (CapturePlatform) :
+//		AcquireDesktop  wait for a desktop frame and describe its changes
+//		SendDesktop     send it, read back for the region or the preview
+//		ReadRegion      read back the region only, the desktop is not sent
+//		StageDesktop    copy it for the CPU
+//		ReleaseDesktop  done with the desktop frame
+//		ReadStaged      part of the copy in a frame from the arena
+//		SendRegion      send the region cropped from the desktop read back
+//		CaptureWindow   the selected window in a frame from the arena
+//		SendWindow      send the window frame
+//		PublishTiles    the tile map of the frame just sent
+//	Functions that are not set do nothing.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "AdaptiveRate.h"
+#include "CaptureConfig.h"
+#include "FrameArena.h"
+#include "FramePacer.h"
+#include "FrameStream.h"
+#include "ScrollDetect.h"
+#include "SnapshotRing.h"
+#include "TileMap.h"
+
+enum CaptureOutput {
+	OUTPUT_DESKTOP, // Desktop sender
+	OUTPUT_WINDOW   // Window sender, the region or a window
+};
+
+// Changed area of a desktop frame (right and bottom exclusive)
+struct CaptureRect {
+	int32_t left;
+	int32_t top;
+	int32_t right;
+	int32_t bottom;
+};
+
+// A desktop frame acquired, as duplication describes it
+struct DesktopFrame {
+	unsigned int width = 0;
+	unsigned int height = 0;
+	double presentTime = 0.0; // msec, for a present aligned desktop rate
+	bool bImage = true;       // False if only the mouse has moved
+	bool bAll = false;        // The changes are not known
+	std::vector<TileMove> moves;
+	std::vector<CaptureRect> rects;
+};
+
+struct CapturePlatform {
+	// Wait up to timeout msec for a new desktop frame.
+	// The frame is held until ReleaseDesktop.
+	std::function<bool(unsigned int timeout, DesktopFrame& frame)> AcquireDesktop;
+	// Returns the sender frame number
+	std::function<uint32_t(bool bReadback)> SendDesktop;
+	std::function<void(int left, int top, unsigned int width, unsigned int height)> ReadRegion;
+	std::function<bool()> StageDesktop;
+	std::function<void()> ReleaseDesktop;
+	// A copy of the part in a new frame, since the staging texture is
+	// copied to again by the next StageDesktop.
+	// Returns nullptr if the part could not be read
+	std::function<FramePtr(int left, int top, unsigned int width, unsigned int height)> ReadStaged;
+	// Returns the sender frame number
+	std::function<uint32_t()> SendRegion;
+	// Returns nullptr if no window is captured
+	std::function<FramePtr()> CaptureWindow;
+	// Returns false if the frame was not sent
+	std::function<bool(const FrameRef& frame)> SendWindow;
+	std::function<void(CaptureOutput output, const TileMap& map)> PublishTiles;
+};
+
+class CapturePipeline {
+
+public:
+
+	CapturePipeline();
+	~CapturePipeline();
+
+	void SetPlatform(const CapturePlatform& platform);
+	// Clock of the pacers and adaptive rate
+	void SetClock(FramePacer::Clock clock);
+
+	// Rates, source and outputs from the settings, and the stream and
+	// snapshot ring opened if they are set. Returns false with a
+	// description in error if either could not be opened.
+	bool Configure(const CaptureConfig& config);
+	std::string error;
+
+	void SetSource(CaptureSource source);
+	CaptureSource GetSource() const;
+	// Part of the desktop sent in region mode. A new position or size
+	// starts the region map again with everything changed.
+	void SetRegion(int left, int top, unsigned int width, unsigned int height);
+	// The desktop preview needs the desktop read back
+	void SetPreview(bool bPreview);
+	void SetDesktopFps(double fps);
+	void SetWindowFps(double fps); // The adaptive maximum
+	void SetPresentAligned(bool bAligned);
+	void SetAdaptive(bool bAdaptive);
+	void SetTileMap(bool bTileMap);
+	void SetScroll(bool bScroll);
+
+	// Stream to a receiver and snapshot ring.
+	// Opening either starts the tile maps again.
+	bool OpenStream(const std::string& address);
+	void CloseStream();
+	bool OpenSnapshot(); // With the snapshot settings
+	void CloseSnapshot();
+
+	// A new window is selected, or none
+	void ResetWindow();
+
+	// One pass of the capture loop
+	void Update();
+	// Push the frame staged by the last Update, e.g. before closing
+	void Flush();
+
+	// Wait for a desktop frame, msec, no longer than this
+	unsigned int GetDesktopTimeout() const;
+	unsigned int GetDesktopFrames() const; // Sent
+	unsigned int GetAcquired() const;      // Desktop frames acquired
+
+	FrameArena& GetArena();
+	FrameStream& GetStream();
+	SnapshotRing& GetRing();
+	FramePacer& GetDesktopPacer();
+	FramePacer& GetWindowPacer();
+	AdaptiveRate& GetAdaptiveRate();
+	const ScrollDetector& GetScrollDetector() const;
+	const TileMap& GetDesktopTiles() const;
+	const TileMap& GetWindowTiles() const;
+	FrameRef GetWindowFrame() const;
+
+private:
+
+	CapturePlatform m_Platform;
+	CaptureConfig m_Config;
+
+	FrameArena m_Arena;
+	FrameStream m_Stream;
+	SnapshotRing m_Ring;
+	FramePacer m_DesktopPacer;
+	FramePacer m_WindowPacer;
+	FramePacer m_SnapshotPacer;
+	AdaptiveRate m_AdaptiveRate;
+
+	CaptureSource m_Source = SOURCE_DESKTOP;
+	int m_RegionLeft = 0;
+	int m_RegionTop = 0;
+	unsigned int m_RegionWidth = 0;
+	unsigned int m_RegionHeight = 0;
+	double m_WindowFps = 60.0;
+	bool m_bPreview = false;
+	bool m_bAdaptive = false;
+	bool m_bTileMap = false;
+	bool m_bScroll = true;
+
+	// Desktop changes since the last desktop frame sent, and the
+	// region or window changes since the last frame of the window sender
+	TileMap m_DesktopTiles;
+	TileMap m_WindowTiles;
+	DesktopFrame m_Desktop;
+	unsigned int m_DesktopFrames = 0;
+	unsigned int m_Acquired = 0;
+
+	// Previous window frame, compared after a scroll
+	FrameRef m_WindowFrame;
+	ScrollDetector m_ScrollDetector;
+	bool m_bWindowOpen = false; // The last window capture had a frame
+
+	// The copy holds the last desktop frame acquired
+	bool m_bStaged = false;
+	// Part of the copy to push by the next Update
+	bool m_bStagedPending = false;
+	bool m_bStagedRecord = false;
+	int m_StagedLeft = 0;
+	int m_StagedTop = 0;
+	unsigned int m_StagedWidth = 0;
+	unsigned int m_StagedHeight = 0;
+	uint32_t m_StagedNumber = 0;
+	double m_StagedTime = 0.0;
+	TileMap m_StagedTiles;
+
+	bool CaptureDesktop(bool bDesktopDue, bool bRegionDue);
+	void AddChanges(const DesktopFrame& frame);
+	void SendRegion();
+	void CaptureWindow();
+	void CompareWindow(const FramePtr& frame);
+	void StageFrame(int left, int top, unsigned int width, unsigned int height,
+		const TileMap& map, uint32_t number);
+	void PushStaged();
+	bool IsStreaming() const;
+	bool IsRecordingDue() const;
+	std::string GetPath(const std::string& file) const;
+
+};
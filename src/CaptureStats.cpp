@@ -0,0 +1,166 @@
+//
+//	CaptureStats
+//
+//	Rolling timing statistics for the capture, send and preview stages.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+
+CaptureStats::CaptureStats(unsigned int samples)
+{
+	m_Samples.resize(samples > 0 ? samples : 1);
+}
+
+void CaptureStats::Start()
+{
+	m_StartTime = Now();
+}
+
+double CaptureStats::Stop()
+{
+	double elapsed = Now() - m_StartTime;
+	AddSample(elapsed);
+	return elapsed;
+}
+
+void CaptureStats::AddSample(double msec)
+{
+	m_Samples[m_Next] = msec;
+	m_Next = (m_Next + 1) % (unsigned int)m_Samples.size();
+	m_Count++;
+	m_Last = msec;
+}
+
+void CaptureStats::Reset()
+{
+	m_Next = 0;
+	m_Count = 0;
+	m_Last = 0.0;
+}
+
+unsigned int CaptureStats::GetCount() const
+{
+	return m_Count;
+}
+
+double CaptureStats::GetAverage() const
+{
+	unsigned int n = std::min(m_Count, (unsigned int)m_Samples.size());
+	if (n == 0) return 0.0;
+	double total = 0.0;
+	for (unsigned int i = 0; i < n; i++)
+		total += m_Samples[i];
+	return total / (double)n;
+}
+
+double CaptureStats::GetMinimum() const
+{
+	unsigned int n = std::min(m_Count, (unsigned int)m_Samples.size());
+	if (n == 0) return 0.0;
+	return *std::min_element(m_Samples.begin(), m_Samples.begin() + n);
+}
+
+double CaptureStats::GetMaximum() const
+{
+	unsigned int n = std::min(m_Count, (unsigned int)m_Samples.size());
+	if (n == 0) return 0.0;
+	return *std::max_element(m_Samples.begin(), m_Samples.begin() + n);
+}
+
+double CaptureStats::GetDeviation() const
+{
+	unsigned int n = std::min(m_Count, (unsigned int)m_Samples.size());
+	if (n < 2) return 0.0;
+	double average = GetAverage();
+	double total = 0.0;
+	for (unsigned int i = 0; i < n; i++)
+		total += (m_Samples[i] - average)*(m_Samples[i] - average);
+	return sqrt(total / (double)(n - 1));
+}
+
+double CaptureStats::GetPercentile(double percent) const
+{
+	unsigned int n = std::min(m_Count, (unsigned int)m_Samples.size());
+	if (n == 0) return 0.0;
+	std::vector<double> sorted(m_Samples.begin(), m_Samples.begin() + n);
+	std::sort(sorted.begin(), sorted.end());
+	double rank = (percent / 100.0)*(double)(n - 1);
+	if (rank <= 0.0) return sorted.front();
+	if (rank >= (double)(n - 1)) return sorted.back();
+	return sorted[(unsigned int)ceil(rank)];
+}
+
+double CaptureStats::GetLast() const
+{
+	return m_Last;
+}
+
+double CaptureStats::Now()
+{
+	using namespace std::chrono;
+	return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// PhaseTimer
+//
+
+void PhaseTimer::Start()
+{
+	Start(CaptureStats::Now());
+}
+
+void PhaseTimer::Start(double time)
+{
+	m_Start = time;
+	m_Last = time;
+	m_Phases.clear();
+}
+
+double PhaseTimer::Phase(const std::string& name)
+{
+	double now = CaptureStats::Now();
+	double elapsed = now - m_Last;
+	m_Phases.push_back(std::make_pair(name, elapsed));
+	m_Last = now;
+	return elapsed;
+}
+
+double PhaseTimer::GetTotal() const
+{
+	return m_Last - m_Start;
+}
+
+unsigned int PhaseTimer::GetCount() const
+{
+	return (unsigned int)m_Phases.size();
+}
+
+std::string PhaseTimer::GetName(unsigned int index) const
+{
+	return index < m_Phases.size() ? m_Phases[index].first : std::string();
+}
+
+double PhaseTimer::GetTime(unsigned int index) const
+{
+	return index < m_Phases.size() ? m_Phases[index].second : 0.0;
+}
+
+std::string PhaseTimer::Report() const
+{
+	char tmp[128];
+	snprintf(tmp, 128, "%.1f msec", GetTotal());
+	std::string report = tmp;
+	for (size_t i = 0; i < m_Phases.size(); i++) {
+		snprintf(tmp, 128, "%s %s %.1f", i == 0 ? " :" : ",", m_Phases[i].first.c_str(), m_Phases[i].second);
+		report += tmp;
+	}
+	return report;
+}
@@ -0,0 +1,80 @@
+//
+//	CaptureStats
+//
+//	Rolling timing statistics for the capture, send and preview stages.
+//	Samples are in milliseconds and kept in a fixed size ring so that
+//	the averages follow the most recent frames.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+
+class CaptureStats {
+
+public:
+
+	CaptureStats(unsigned int samples = 120);
+
+	// Time a stage
+	void Start();
+	double Stop(); // Returns the elapsed msec and adds it as a sample
+
+	// Add a sample directly, e.g. an interval between frames
+	void AddSample(double msec);
+	void Reset();
+
+	// Samples added since the last reset
+	unsigned int GetCount() const;
+
+	// Statistics over the samples currently in the ring
+	double GetAverage() const;
+	double GetMinimum() const;
+	double GetMaximum() const;
+	double GetDeviation() const; // Standard deviation (jitter)
+	double GetPercentile(double percent) const; // e.g. 99.0
+	double GetLast() const;
+
+	// Monotonic clock in msec
+	static double Now();
+
+private:
+
+	std::vector<double> m_Samples;
+	unsigned int m_Next = 0;
+	unsigned int m_Count = 0;
+	double m_StartTime = 0.0;
+	double m_Last = 0.0;
+
+};
+
+// Elapsed time of each phase of a sequence, e.g. startup
+class PhaseTimer {
+
+public:
+
+	// Start from now or an earlier time
+	void Start();
+	void Start(double time);
+
+	// End the current phase and start the next
+	double Phase(const std::string& name);
+
+	double GetTotal() const; // Start to the end of the last phase
+	unsigned int GetCount() const;
+	std::string GetName(unsigned int index) const;
+	double GetTime(unsigned int index) const;
+
+	// e.g. "120.5 msec : window 80.2, directx 30.1, ..."
+	std::string Report() const;
+
+private:
+
+	double m_Start = 0.0;
+	double m_Last = 0.0;
+	std::vector<std::pair<std::string, double>> m_Phases;
+
+};
@@ -0,0 +1,194 @@
+//
+//	DuplicationRecovery
+//
+//	Re-create desktop duplication away from the capture loop.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "DuplicationRecovery.h"
+
+#include <algorithm>
+#include <chrono>
+
+DuplicationRecovery::DuplicationRecovery()
+{
+	m_Clock = CaptureStats::Now;
+}
+
+DuplicationRecovery::~DuplicationRecovery()
+{
+	StopThread();
+}
+
+void DuplicationRecovery::SetReconnect(Action reconnect)
+{
+	m_Reconnect = reconnect;
+}
+
+void DuplicationRecovery::SetEnumerate(Action enumerate)
+{
+	m_Enumerate = enumerate;
+}
+
+void DuplicationRecovery::SetClock(Clock clock)
+{
+	m_Clock = clock;
+}
+
+void DuplicationRecovery::SetBackoff(double first, double maximum)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_First = first;
+	m_Maximum = std::max(first, maximum);
+	m_Backoff = m_First;
+}
+
+void DuplicationRecovery::SetEnumerateAfter(unsigned int failures)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_EnumerateAfter = failures;
+}
+
+void DuplicationRecovery::SetSchedule(const ThreadSchedule& schedule)
+{
+	m_Schedule = schedule;
+}
+
+void DuplicationRecovery::StartThread()
+{
+	if (m_Thread.joinable())
+		return;
+	m_bStop = false;
+	m_Thread = std::thread(&DuplicationRecovery::Run, this);
+}
+
+void DuplicationRecovery::StopThread()
+{
+	if (!m_Thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_bStop = true;
+	}
+	m_Condition.notify_all();
+	m_Thread.join();
+}
+
+void DuplicationRecovery::Lost()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_State != CONNECTED)
+			return;
+		m_LostTime = m_Clock();
+		m_NextAttempt = m_LostTime; // Try once straight away
+		m_Backoff = m_First;
+		m_Failures = 0;
+		m_State = LOST;
+	}
+	m_Condition.notify_all();
+}
+
+bool DuplicationRecovery::Recovered()
+{
+	int state = RECOVERED;
+	return m_State.compare_exchange_strong(state, CONNECTED);
+}
+
+DuplicationRecovery::State DuplicationRecovery::GetState() const
+{
+	return (State)m_State.load();
+}
+
+bool DuplicationRecovery::Step()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+
+	if (m_State != LOST || m_Clock() < m_NextAttempt)
+		return false;
+
+	m_Attempts++;
+	bool bEnumerate = (m_Failures >= m_EnumerateAfter);
+	lock.unlock();
+
+	// The cached output is tried first. If that keeps failing,
+	// the adapters and outputs may have changed, so refresh them.
+	bool bSuccess = true;
+	if (bEnumerate && m_Enumerate) {
+		m_Enumerations++;
+		bSuccess = m_Enumerate();
+	}
+	if (bSuccess)
+		bSuccess = m_Reconnect && m_Reconnect();
+
+	lock.lock();
+	double now = m_Clock();
+	if (bSuccess) {
+		m_RecoveryTimes.AddSample(now - m_LostTime);
+		m_Recoveries++;
+		m_Failures = 0;
+		m_Backoff = m_First;
+		m_State = RECOVERED;
+		return true;
+	}
+
+	// Try again later
+	m_Failures++;
+	m_NextAttempt = now + m_Backoff;
+	m_Backoff = std::min(m_Backoff*2.0, m_Maximum);
+	return false;
+}
+
+double DuplicationRecovery::GetWait() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_State != LOST)
+		return 0.0;
+	double wait = m_NextAttempt - m_Clock();
+	return wait > 0.0 ? wait : 0.0;
+}
+
+CaptureStats DuplicationRecovery::GetRecoveryTimes()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_RecoveryTimes;
+}
+
+unsigned int DuplicationRecovery::GetRecoveries() const
+{
+	return m_Recoveries;
+}
+
+unsigned int DuplicationRecovery::GetAttempts() const
+{
+	return m_Attempts;
+}
+
+unsigned int DuplicationRecovery::GetEnumerations() const
+{
+	return m_Enumerations;
+}
+
+void DuplicationRecovery::Run()
+{
+	ThreadScheduler scheduler;
+	scheduler.Apply(m_Schedule);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (!m_bStop) {
+		if (m_State != LOST) {
+			// Wait for a loss
+			m_Condition.wait(lock, [this] { return m_bStop || m_State == LOST; });
+			continue;
+		}
+		double wait = m_NextAttempt - m_Clock();
+		if (wait > 0.0) {
+			m_Condition.wait_for(lock, std::chrono::duration<double, std::milli>(wait));
+			continue;
+		}
+		lock.unlock();
+		Step();
+		lock.lock();
+	}
+}
@@ -0,0 +1,105 @@
+//
+//	DuplicationRecovery
+//
+//	Re-create desktop duplication away from the capture loop.
+//
+//	The duplication interface is lost on a desktop switch (UAC prompt),
+//	a mode change or a full screen application. The capture thread reports
+//	the loss and continues. A background thread retries with increasing
+//	intervals and the capture thread picks up the new interface when ready.
+//
+//	The duplication itself is done by two functions supplied by the
+//	application so that the recovery does not depend on DirectX :
+//		Reconnect : duplicate the cached output
+//		Enumerate : refresh the cached adapter and output topology
+//	Enumeration is only used if reconnecting to the cached output fails.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "CaptureStats.h"
+#include "ThreadSchedule.h"
+
+class DuplicationRecovery {
+
+public:
+
+	enum State {
+		CONNECTED,
+		LOST,      // Reconnecting
+		RECOVERED  // Waiting for the capture thread to take the new interface
+	};
+
+	typedef std::function<bool()> Action;
+	typedef std::function<double()> Clock; // msec
+
+	DuplicationRecovery();
+	~DuplicationRecovery();
+
+	void SetReconnect(Action reconnect);
+	void SetEnumerate(Action enumerate);
+	void SetClock(Clock clock);
+	// Interval after the first failure, doubled up to the maximum
+	void SetBackoff(double first, double maximum);
+	// Failures of the cached output before the topology is refreshed
+	void SetEnumerateAfter(unsigned int failures);
+
+	// Retry on a background thread.
+	// Without the thread, Step() can be called directly.
+	void SetSchedule(const ThreadSchedule& schedule); // Before StartThread
+	void StartThread();
+	void StopThread();
+
+	// Capture thread
+	void Lost();      // The duplication interface has been released
+	bool Recovered(); // True once when a new interface is ready
+	State GetState() const;
+
+	// Make one attempt if one is due.
+	// Returns true if the duplication was re-created.
+	bool Step();
+	// Msec until the next attempt
+	double GetWait() const;
+
+	// Metrics
+	CaptureStats GetRecoveryTimes(); // msec from loss to recovery
+	unsigned int GetRecoveries() const;
+	unsigned int GetAttempts() const;
+	unsigned int GetEnumerations() const;
+
+private:
+
+	Action m_Reconnect;
+	Action m_Enumerate;
+	Clock m_Clock;
+
+	std::atomic<int> m_State{ CONNECTED };
+	double m_First = 50.0;
+	double m_Maximum = 2000.0;
+	double m_Backoff = 50.0;
+	double m_LostTime = 0.0;
+	double m_NextAttempt = 0.0;
+	unsigned int m_EnumerateAfter = 2;
+	unsigned int m_Failures = 0;
+
+	std::atomic<unsigned int> m_Recoveries{ 0 };
+	std::atomic<unsigned int> m_Attempts{ 0 };
+	std::atomic<unsigned int> m_Enumerations{ 0 };
+	CaptureStats m_RecoveryTimes;
+
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Condition;
+	std::thread m_Thread;
+	ThreadSchedule m_Schedule;
+	bool m_bStop = false;
+
+	void Run();
+
+};
@@ -0,0 +1,248 @@
+//
+//	FrameArena
+//
+//	Reference counted frames shared by the senders, preview and stream.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "FrameArena.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+// A size not allocated in this many allocations is no longer pooled
+#define FRAMEARENA_RECENT 120
+
+FrameArena::FrameArena(size_t budget)
+{
+	m_Pool = std::make_shared<Pool>();
+	m_Pool->budget = budget;
+}
+
+FrameArena::~FrameArena()
+{
+	// Frames still referenced are freed when released
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	m_Pool->bClosed = true;
+	m_Pool->TrimTo(0);
+}
+
+void FrameArena::SetBudget(size_t budget)
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	m_Pool->budget = budget;
+	if (m_Pool->live + m_Pool->pooled > budget)
+		m_Pool->TrimTo(budget > m_Pool->live ? budget - m_Pool->live : 0);
+}
+
+size_t FrameArena::GetBudget() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->budget;
+}
+
+FramePtr FrameArena::Allocate(unsigned int width, unsigned int height)
+{
+	size_t size = (size_t)width*height*4;
+	if (size == 0)
+		return nullptr;
+
+	unsigned char* pixels = nullptr;
+	std::shared_ptr<Pool> pool = m_Pool;
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->Request(size);
+
+		// Re-use a free buffer of the same size
+		for (size_t i = 0; i < pool->free.size(); i++) {
+			if (pool->free[i].first == size) {
+				pixels = pool->free[i].second;
+				pool->free[i] = pool->free.back();
+				pool->free.pop_back();
+				pool->pooled -= size;
+				pool->reused++;
+				break;
+			}
+		}
+
+		if (!pixels) {
+			// Make room from free buffers of other sizes
+			if (pool->live + pool->pooled + size > pool->budget)
+				pool->TrimTo(pool->budget > pool->live + size ? pool->budget - pool->live - size : 0);
+			if (pool->live + size > pool->budget) {
+				pool->failures++;
+				return nullptr;
+			}
+			pixels = (unsigned char*)malloc(size);
+			if (!pixels) {
+				pool->failures++;
+				return nullptr;
+			}
+			pool->allocations++;
+		}
+
+		pool->live += size;
+		pool->peak = std::max(pool->peak, pool->live + pool->pooled);
+	}
+
+	CaptureFrame* frame = new CaptureFrame;
+	frame->width = width;
+	frame->height = height;
+	frame->pitch = width*4;
+	frame->pixels = pixels;
+	frame->size = size;
+
+	// The buffer returns to the pool when the last reference is released
+	return FramePtr(frame, [pool](CaptureFrame* f) {
+		pool->Release(f->pixels, f->size);
+		delete f;
+	});
+}
+
+FramePtr FrameArena::Clone(const FrameRef& frame)
+{
+	if (!frame)
+		return nullptr;
+	FramePtr copy = Allocate(frame->width, frame->height);
+	if (!copy)
+		return nullptr;
+	memcpy(copy->pixels, frame->pixels, frame->size);
+	copy->number = frame->number;
+	copy->timestamp = frame->timestamp;
+	AddCopy(frame->size);
+	return copy;
+}
+
+void FrameArena::AddCopy(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	m_Pool->copies++;
+	m_Pool->copyBytes += bytes;
+}
+
+void FrameArena::Trim()
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	m_Pool->TrimTo(0);
+}
+
+size_t FrameArena::GetLiveBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->live;
+}
+
+size_t FrameArena::GetPoolBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->pooled;
+}
+
+size_t FrameArena::GetPeakBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->peak;
+}
+
+unsigned int FrameArena::GetAllocations() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->allocations;
+}
+
+unsigned int FrameArena::GetReused() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->reused;
+}
+
+unsigned int FrameArena::GetFailures() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->failures;
+}
+
+unsigned int FrameArena::GetCopies() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->copies;
+}
+
+size_t FrameArena::GetCopyBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_Pool->mutex);
+	return m_Pool->copyBytes;
+}
+
+void FrameArena::Pool::Release(unsigned char* pixels, size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	live -= size;
+	// Keep the buffer for re-use within the budget
+	if (!bClosed && live + pooled + size <= budget && IsRecent(size)) {
+		free.push_back(std::make_pair(size, pixels));
+		pooled += size;
+	}
+	else {
+		::free(pixels);
+	}
+}
+
+// Record an allocation of a size. Free the buffers of
+// sizes that have not been allocated for a while.
+void FrameArena::Pool::Request(size_t size)
+{
+	requests++;
+	bool bFound = false;
+	bool bExpired = false;
+	for (size_t i = 0; i < sizes.size();) {
+		if (sizes[i].first == size) {
+			sizes[i].second = requests;
+			bFound = true;
+		}
+		else if (requests - sizes[i].second > FRAMEARENA_RECENT) {
+			// e.g. the size of a window before it was resized
+			sizes[i] = sizes.back();
+			sizes.pop_back();
+			bExpired = true;
+			continue;
+		}
+		i++;
+	}
+	if (!bFound)
+		sizes.push_back(std::make_pair(size, requests));
+	if (!bExpired)
+		return;
+
+	for (size_t i = 0; i < free.size();) {
+		if (!IsRecent(free[i].first)) {
+			::free(free[i].second);
+			pooled -= free[i].first;
+			free[i] = free.back();
+			free.pop_back();
+			continue;
+		}
+		i++;
+	}
+}
+
+bool FrameArena::Pool::IsRecent(size_t size) const
+{
+	for (const std::pair<size_t, unsigned int>& s : sizes) {
+		if (s.first == size)
+			return requests - s.second <= FRAMEARENA_RECENT;
+	}
+	return false;
+}
+
+// Free unused buffers until the pool is no larger than bytes
+void FrameArena::Pool::TrimTo(size_t bytes)
+{
+	while (pooled > bytes && !free.empty()) {
+		::free(free.back().second);
+		pooled -= free.back().first;
+		free.pop_back();
+	}
+}
@@ -0,0 +1,101 @@
+//
+//	FrameArena
+//
+//	Reference counted frames shared by the senders, preview and stream.
+//
+//	A frame is written once by the capture and then shared as a const
+//	reference (FrameRef). Each stage keeps a reference for as long as it
+//	needs the pixels instead of making its own copy. When the last
+//	reference is released the buffer returns to the arena to be re-used.
+//
+//	Memory for live and re-usable buffers is bounded by a budget.
+//	Allocation fails rather than exceeding it. Only buffers of the sizes
+//	allocated recently are kept for re-use, so that the buffers of a
+//	window before it was resized or changed do not hold the budget.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct CaptureFrame {
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int pitch = 0; // Bytes per row, width*4
+	uint32_t number = 0;    // Sender frame number
+	double timestamp = 0.0; // Capture time, msec
+	unsigned char* pixels = nullptr; // 4 bytes per pixel
+	size_t size = 0;
+};
+
+// Writable frame before it is shared
+typedef std::shared_ptr<CaptureFrame> FramePtr;
+// Shared frame, read only
+typedef std::shared_ptr<const CaptureFrame> FrameRef;
+
+class FrameArena {
+
+public:
+
+	FrameArena(size_t budget = (size_t)512*1024*1024);
+	~FrameArena();
+
+	void SetBudget(size_t budget);
+	size_t GetBudget() const;
+
+	// A frame of 4 bytes per pixel. The pixels are not cleared.
+	// Returns nullptr if the budget would be exceeded.
+	FramePtr Allocate(unsigned int width, unsigned int height);
+
+	// Copy a frame, counted as a copy
+	FramePtr Clone(const FrameRef& frame);
+	// Count a copy made by a stage outside the arena
+	void AddCopy(size_t bytes);
+
+	// Release buffers that are not in use
+	void Trim();
+
+	// Metrics
+	size_t GetLiveBytes() const;  // In frames still referenced
+	size_t GetPoolBytes() const;  // Free for re-use
+	size_t GetPeakBytes() const;  // Live and free
+	unsigned int GetAllocations() const; // New buffers
+	unsigned int GetReused() const;      // Buffers re-used
+	unsigned int GetFailures() const;    // Over budget
+	unsigned int GetCopies() const;
+	size_t GetCopyBytes() const;
+
+private:
+
+	// Shared with the frames so that a frame released
+	// after the arena is destroyed is still freed
+	struct Pool {
+		std::mutex mutex;
+		size_t budget = 0;
+		size_t live = 0;
+		size_t pooled = 0;
+		size_t peak = 0;
+		unsigned int allocations = 0;
+		unsigned int reused = 0;
+		unsigned int failures = 0;
+		unsigned int copies = 0;
+		size_t copyBytes = 0;
+		bool bClosed = false;
+		std::vector<std::pair<size_t, unsigned char*>> free;
+		// Sizes allocated and the allocation count when each was last
+		unsigned int requests = 0;
+		std::vector<std::pair<size_t, unsigned int>> sizes;
+		void Release(unsigned char* pixels, size_t size);
+		void TrimTo(size_t bytes);
+		void Request(size_t size);
+		bool IsRecent(size_t size) const;
+	};
+	std::shared_ptr<Pool> m_Pool;
+
+};
@@ -0,0 +1,160 @@
+//
+//	FramePacer
+//
+//	Frame pacing for a sender with its own target frame rate.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cmath>
+
+FramePacer::FramePacer(double fps, PaceMode mode)
+{
+	m_Clock = CaptureStats::Now;
+	m_Mode = mode;
+	SetFps(fps);
+}
+
+void FramePacer::SetFps(double fps)
+{
+	SetPeriod(fps);
+	Reset();
+}
+
+void FramePacer::ChangeFps(double fps)
+{
+	if (fps == m_Fps)
+		return;
+	SetPeriod(fps);
+	// Not before now, so that the frames of the new rate
+	// since the last frame are not counted as skipped
+	if (m_bStarted)
+		m_Next = std::max(m_LastFrame + m_Period, Now());
+}
+
+void FramePacer::SetPeriod(double fps)
+{
+	if (fps <= 0.0) {
+		m_Fps = 0.0;
+		m_Period = 0.0;
+		m_Tolerance = 0.0;
+	}
+	else {
+		m_Fps = fps;
+		m_Period = 1000.0/fps;
+		// A frame that is only slightly early is sent, so that a loop
+		// running close to the target rate does not skip alternate frames.
+		m_Tolerance = std::min(m_Period*0.25, 4.0);
+	}
+}
+
+double FramePacer::GetFps() const
+{
+	return m_Fps;
+}
+
+void FramePacer::SetMode(PaceMode mode)
+{
+	m_Mode = mode;
+	Reset();
+}
+
+FramePacer::PaceMode FramePacer::GetMode() const
+{
+	return m_Mode;
+}
+
+void FramePacer::SetClock(Clock clock)
+{
+	m_Clock = clock;
+	Reset();
+}
+
+double FramePacer::Now() const
+{
+	return m_Clock();
+}
+
+bool FramePacer::IsDue() const
+{
+	return GetWait() <= 0.0;
+}
+
+double FramePacer::GetWait() const
+{
+	if (m_Mode == PACE_FREE || m_Period <= 0.0 || !m_bStarted)
+		return 0.0;
+	double wait = (m_Next - m_Tolerance) - Now();
+	return wait > 0.0 ? wait : 0.0;
+}
+
+void FramePacer::Frame()
+{
+	Frame(Now());
+}
+
+void FramePacer::Frame(double presentTime)
+{
+	// The fixed schedule uses the clock, the present
+	// schedule uses the time the frame was presented
+	double time = (m_Mode == PACE_PRESENT) ? presentTime : Now();
+
+	if (m_bStarted) {
+		m_Intervals.AddSample(time - m_LastFrame);
+		if (m_Period > 0.0)
+			m_Lateness.AddSample(std::max(time - m_Next, 0.0));
+	}
+	m_LastFrame = time;
+
+	if (m_Period <= 0.0 || m_Mode == PACE_FREE) {
+		m_Next = time;
+	}
+	else if (!m_bStarted || m_Mode == PACE_PRESENT) {
+		// Align the schedule to this frame
+		m_Next = time + m_Period;
+	}
+	else {
+		m_Next += m_Period;
+		// If the loop has fallen behind by more than a frame,
+		// start again from now rather than send a burst to catch up
+		if (time > m_Next) {
+			m_Skipped += (unsigned int)floor((time - m_Next)/m_Period) + 1;
+			m_Next = time + m_Period;
+		}
+	}
+	m_bStarted = true;
+}
+
+void FramePacer::Reset()
+{
+	m_bStarted = false;
+	m_Next = 0.0;
+	m_LastFrame = 0.0;
+	m_Skipped = 0;
+	m_Intervals.Reset();
+	m_Lateness.Reset();
+}
+
+const CaptureStats& FramePacer::GetIntervals() const
+{
+	return m_Intervals;
+}
+
+const CaptureStats& FramePacer::GetLateness() const
+{
+	return m_Lateness;
+}
+
+unsigned int FramePacer::GetSkipped() const
+{
+	return m_Skipped;
+}
+
+double FramePacer::GetMeasuredFps() const
+{
+	double interval = m_Intervals.GetAverage();
+	return interval > 0.0 ? 1000.0/interval : 0.0;
+}
@@ -0,0 +1,90 @@
+//
+//	FramePacer
+//
+//	Frame pacing for a sender with its own target frame rate.
+//
+//	Each sender has a pacer so that the desktop and window senders
+//	can run at different rates, for example a 60 fps window feed
+//	and a 15 fps desktop overview. The capture loop asks whether a
+//	frame is due and how long it can wait before the next one.
+//
+//	Modes
+//		PACE_FREE    : every frame is due (loop rate)
+//		PACE_FIXED   : frames are scheduled at the target rate from the clock
+//		PACE_PRESENT : as fixed, but the schedule is aligned to the
+//		               present time of the frames, e.g. LastPresentTime
+//		               from desktop duplication, so that it follows vsync
+//
+//	The clock is a function returning msec so that a virtual
+//	clock can be used in place of the system clock.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <functional>
+#include "CaptureStats.h"
+
+class FramePacer {
+
+public:
+
+	enum PaceMode {
+		PACE_FREE,
+		PACE_FIXED,
+		PACE_PRESENT
+	};
+
+	typedef std::function<double()> Clock; // msec
+
+	FramePacer(double fps = 60.0, PaceMode mode = PACE_FIXED);
+
+	void SetFps(double fps); // 0 for free running
+	// Change the rate of a running schedule, e.g. AdaptiveRate. The next frame
+	// is due a period of the new rate after the last, so a higher rate is at once.
+	void ChangeFps(double fps);
+	double GetFps() const;
+	void SetMode(PaceMode mode);
+	PaceMode GetMode() const;
+	void SetClock(Clock clock);
+	double Now() const;
+
+	// True if a frame is due now
+	bool IsDue() const;
+	// Msec until the next frame is due, 0 if due now
+	double GetWait() const;
+	// Record a frame sent now
+	void Frame();
+	// Record a frame with its present time in the same
+	// domain as the clock. Used for PACE_PRESENT.
+	void Frame(double presentTime);
+	// Start the schedule again from now
+	void Reset();
+
+	// Interval between frames sent
+	const CaptureStats& GetIntervals() const;
+	// Time a frame was sent after it was due (jitter)
+	const CaptureStats& GetLateness() const;
+	// Frames that were skipped because the loop fell behind
+	unsigned int GetSkipped() const;
+	// Measured frame rate
+	double GetMeasuredFps() const;
+
+private:
+
+	Clock m_Clock;
+	PaceMode m_Mode = PACE_FIXED;
+	double m_Fps = 60.0;
+	double m_Period = 1000.0/60.0;
+	double m_Tolerance = 4.0; // Early by less than this is still due
+	double m_Next = 0.0;
+	double m_LastFrame = 0.0;
+	bool m_bStarted = false;
+	unsigned int m_Skipped = 0;
+	CaptureStats m_Intervals;
+	CaptureStats m_Lateness;
+
+	void SetPeriod(double fps);
+
+};
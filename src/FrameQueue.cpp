@@ -0,0 +1,315 @@
+//
+//	FrameQueue
+//
+//	Bounded queue of shared frames between a capture stage and an output stage.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "FrameQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "CaptureStats.h"
+
+// Wait for another thread without a lock.
+// Yield at first and then sleep briefly so that a long wait does not use a core.
+static void QueueWait(unsigned int& count)
+{
+	if (count < 64)
+		std::this_thread::yield();
+	else
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	count++;
+}
+
+FrameQueue::FrameQueue(unsigned int capacity, QueuePolicy policy)
+{
+	m_Policy = policy;
+	SetCapacity(capacity);
+}
+
+void FrameQueue::SetCapacity(unsigned int capacity)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	m_Slots.reset(new Slot[size]);
+	for (size_t i = 0; i < size; i++)
+		m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+	m_Mask = size - 1;
+	m_PushPos.store(0, std::memory_order_relaxed);
+	m_PopPos.store(0, std::memory_order_relaxed);
+	m_bCarry = false;
+	m_bCarryKey = false;
+	m_bPushKey = true;
+}
+
+unsigned int FrameQueue::GetCapacity() const
+{
+	return (unsigned int)(m_Mask + 1);
+}
+
+void FrameQueue::SetPolicy(QueuePolicy policy)
+{
+	m_Policy = policy;
+}
+
+QueuePolicy FrameQueue::GetPolicy() const
+{
+	return (QueuePolicy)m_Policy.load();
+}
+
+void FrameQueue::SetTimeout(double msec)
+{
+	m_Timeout = msec;
+}
+
+double FrameQueue::GetTimeout() const
+{
+	return m_Timeout;
+}
+
+bool FrameQueue::Push(QueuedFrame& item)
+{
+	// After a frame pushed before was dropped
+	if (m_bPushKey.exchange(false))
+		item.bKey = true;
+
+	if (TryPush(item)) {
+		m_Pushed++;
+		UpdateHighWater();
+		return true;
+	}
+
+	QueuePolicy policy = GetPolicy();
+
+	if (policy == QUEUE_DROP_NEWEST) {
+		m_DroppedNewest++;
+		m_bPushKey = true;
+		return false;
+	}
+
+	if (policy == QUEUE_BLOCK) {
+		double timeout = m_Timeout;
+		double start = CaptureStats::Now();
+		unsigned int count = 0;
+		while (!TryPush(item)) {
+			if (CaptureStats::Now() - start >= timeout) {
+				m_Timeouts++;
+				m_bPushKey = true;
+				return false;
+			}
+			QueueWait(count);
+		}
+		m_Pushed++;
+		UpdateHighWater();
+		return true;
+	}
+
+	// Make room by removing the oldest frame. Other producers
+	// may take the room first, so repeat until there is a slot.
+	// The next frame popped follows the oldest, so it takes its tiles,
+	// or is sent complete.
+	QueuedFrame oldest;
+	do {
+		std::lock_guard<std::mutex> lock(m_CarryMutex);
+		if (TryPop(oldest)) {
+			if (policy == QUEUE_COALESCE) {
+				if (m_bCarry) {
+					m_Carry.Merge(oldest.tiles);
+				}
+				else {
+					std::swap(m_Carry, oldest.tiles);
+					m_bCarry = true;
+				}
+				m_bCarryKey = m_bCarryKey || oldest.bKey;
+				m_Coalesced++;
+			}
+			else {
+				m_bCarryKey = true;
+				m_DroppedOldest++;
+			}
+			oldest.frame.reset();
+		}
+	} while (!TryPush(item));
+
+	m_Pushed++;
+	UpdateHighWater();
+	return true;
+}
+
+bool FrameQueue::Pop(QueuedFrame& item, double timeout)
+{
+	if (TryPopNext(item)) {
+		m_Popped++;
+		return true;
+	}
+	if (timeout <= 0.0)
+		return false;
+
+	double start = CaptureStats::Now();
+	unsigned int count = 0;
+	while (!TryPopNext(item)) {
+		if (CaptureStats::Now() - start >= timeout)
+			return false;
+		QueueWait(count);
+	}
+	m_Popped++;
+	return true;
+}
+
+void FrameQueue::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_CarryMutex);
+	QueuedFrame item;
+	while (TryPop(item)) {
+		m_DroppedOldest++;
+		item.frame.reset();
+	}
+	// Lost with the frames, the next is sent complete
+	m_bCarry = false;
+	m_bPushKey = true;
+}
+
+unsigned int FrameQueue::GetSize() const
+{
+	// Approximate while other threads push and pop
+	size_t pop = m_PopPos.load(std::memory_order_acquire);
+	size_t push = m_PushPos.load(std::memory_order_acquire);
+	if (push <= pop)
+		return 0;
+	return (unsigned int)std::min(push - pop, m_Mask + 1);
+}
+
+unsigned int FrameQueue::GetPushed() const
+{
+	return m_Pushed;
+}
+
+unsigned int FrameQueue::GetPopped() const
+{
+	return m_Popped;
+}
+
+unsigned int FrameQueue::GetDroppedOldest() const
+{
+	return m_DroppedOldest;
+}
+
+unsigned int FrameQueue::GetDroppedNewest() const
+{
+	return m_DroppedNewest;
+}
+
+unsigned int FrameQueue::GetTimeouts() const
+{
+	return m_Timeouts;
+}
+
+unsigned int FrameQueue::GetCoalesced() const
+{
+	return m_Coalesced;
+}
+
+unsigned int FrameQueue::GetLost() const
+{
+	return m_DroppedOldest + m_DroppedNewest + m_Timeouts;
+}
+
+unsigned int FrameQueue::GetHighWater() const
+{
+	return m_HighWater;
+}
+
+void FrameQueue::ResetCounters()
+{
+	m_Pushed = 0;
+	m_Popped = 0;
+	m_DroppedOldest = 0;
+	m_DroppedNewest = 0;
+	m_Timeouts = 0;
+	m_Coalesced = 0;
+	m_HighWater = 0;
+}
+
+// A slot is free for the push at position pos when its sequence is pos,
+// and holds a frame for the pop at position pos when its sequence is pos + 1.
+// The position is claimed first, so only the claiming thread uses the item.
+bool FrameQueue::TryPush(QueuedFrame& item)
+{
+	size_t pos = m_PushPos.load(std::memory_order_relaxed);
+	Slot* slot = nullptr;
+	while (true) {
+		slot = &m_Slots[pos & m_Mask];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+		if (diff == 0) {
+			if (m_PushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			return false; // Full
+		}
+		else {
+			pos = m_PushPos.load(std::memory_order_relaxed);
+		}
+	}
+	slot->item.frame = std::move(item.frame);
+	std::swap(slot->item.tiles, item.tiles);
+	slot->item.bKey = item.bKey;
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool FrameQueue::TryPop(QueuedFrame& item)
+{
+	size_t pos = m_PopPos.load(std::memory_order_relaxed);
+	Slot* slot = nullptr;
+	while (true) {
+		slot = &m_Slots[pos & m_Mask];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+		if (diff == 0) {
+			if (m_PopPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0) {
+			return false; // Empty
+		}
+		else {
+			pos = m_PopPos.load(std::memory_order_relaxed);
+		}
+	}
+	item.frame = std::move(slot->item.frame);
+	// The tiles are swapped so that the slot keeps a map to re-use
+	std::swap(item.tiles, slot->item.tiles);
+	item.bKey = slot->item.bKey;
+	slot->sequence.store(pos + m_Mask + 1, std::memory_order_release);
+	return true;
+}
+
+bool FrameQueue::TryPopNext(QueuedFrame& item)
+{
+	std::lock_guard<std::mutex> lock(m_CarryMutex);
+	if (!TryPop(item))
+		return false;
+	if (m_bCarry) {
+		item.tiles.Merge(m_Carry);
+		m_bCarry = false;
+	}
+	if (m_bCarryKey) {
+		item.bKey = true;
+		m_bCarryKey = false;
+	}
+	return true;
+}
+
+void FrameQueue::UpdateHighWater()
+{
+	unsigned int size = GetSize();
+	unsigned int high = m_HighWater;
+	while (size > high && !m_HighWater.compare_exchange_weak(high, size)) {}
+}
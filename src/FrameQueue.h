@@ -0,0 +1,127 @@
+//
+//	FrameQueue
+//
+//	Bounded queue of shared frames between a capture stage and an output stage.
+//
+//	The queue is a fixed ring of slots, each with a sequence number, that
+//	any number of producers and consumers claim with a compare and swap.
+//	The capacity is rounded up to a power of 2.
+//
+//	Policies when the queue is full :
+//		QUEUE_DROP_OLDEST  Remove the oldest frame to make room
+//		QUEUE_DROP_NEWEST  Drop the frame being pushed
+//		QUEUE_BLOCK        Wait for room up to a timeout, then drop the frame
+//		QUEUE_COALESCE     Remove the oldest frame and merge its changed tiles
+//		                   into the next frame popped, so no change is lost
+//
+//	The tiles of each frame are changes from the frame pushed before it.
+//	A coalesced frame's tiles are kept by the queue until the next pop,
+//	which is the frame that followed it. So the queue is not lock-free :
+//	every pop, the removal of the oldest frame by drop oldest or coalesce
+//	and Clear take a lock, so that the next frame cannot be popped before
+//	the tiles are kept. The lock is held for the slot claim and the merge
+//	of the tiles carried, and is not held by push to a queue with room,
+//	by drop newest, or while a blocked push waits.
+//
+//	Frames dropped by the first three policies lose their changed tiles.
+//	The frame that follows is popped with bKey set so that a consumer of
+//	tile deltas sends it complete. GetLost counts them.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include "FrameArena.h"
+#include "TileMap.h"
+
+enum QueuePolicy {
+	QUEUE_DROP_OLDEST,
+	QUEUE_DROP_NEWEST,
+	QUEUE_BLOCK,
+	QUEUE_COALESCE
+};
+
+struct QueuedFrame {
+	FrameRef frame;
+	TileMap tiles; // Changed since the previous frame pushed
+	bool bKey = false; // A frame before it was lost, send it complete
+};
+
+class FrameQueue {
+
+public:
+
+	FrameQueue(unsigned int capacity = 4, QueuePolicy policy = QUEUE_COALESCE);
+
+	// Not while frames are pushed or popped. Frames queued are released.
+	void SetCapacity(unsigned int capacity);
+	unsigned int GetCapacity() const;
+
+	void SetPolicy(QueuePolicy policy);
+	QueuePolicy GetPolicy() const;
+	void SetTimeout(double msec); // QUEUE_BLOCK
+	double GetTimeout() const;
+
+	// The item is moved into the queue.
+	// Returns false if it was dropped.
+	bool Push(QueuedFrame& item);
+	// Wait up to timeout msec for a frame, 0 to return immediately
+	bool Pop(QueuedFrame& item, double timeout = 0.0);
+	// Remove all frames, counted as dropped oldest
+	void Clear();
+	unsigned int GetSize() const;
+
+	// Metrics
+	unsigned int GetPushed() const;
+	unsigned int GetPopped() const;
+	unsigned int GetDroppedOldest() const;
+	unsigned int GetDroppedNewest() const;
+	unsigned int GetTimeouts() const;  // Dropped after waiting for room
+	unsigned int GetCoalesced() const; // Merged into the next frame popped
+	unsigned int GetLost() const;      // Dropped with their changed tiles
+	unsigned int GetHighWater() const; // Largest number of frames queued
+	void ResetCounters();
+
+private:
+
+	struct Slot {
+		std::atomic<size_t> sequence{ 0 };
+		QueuedFrame item;
+	};
+	std::unique_ptr<Slot[]> m_Slots;
+	size_t m_Mask = 0;
+
+	// Producer and consumer positions on separate cache lines
+	alignas(64) std::atomic<size_t> m_PushPos{ 0 };
+	alignas(64) std::atomic<size_t> m_PopPos{ 0 };
+
+	alignas(64) std::atomic<int> m_Policy;
+	std::atomic<double> m_Timeout{ 10.0 };
+
+	std::atomic<unsigned int> m_Pushed{ 0 };
+	std::atomic<unsigned int> m_Popped{ 0 };
+	std::atomic<unsigned int> m_DroppedOldest{ 0 };
+	std::atomic<unsigned int> m_DroppedNewest{ 0 };
+	std::atomic<unsigned int> m_Timeouts{ 0 };
+	std::atomic<unsigned int> m_Coalesced{ 0 };
+	std::atomic<unsigned int> m_HighWater{ 0 };
+
+	// Tiles of coalesced frames, or a loss, for the next pop
+	std::mutex m_CarryMutex;
+	TileMap m_Carry;
+	bool m_bCarry = false;
+	bool m_bCarryKey = false;
+	// The newest frame was dropped, for the next push
+	std::atomic<bool> m_bPushKey{ false };
+
+	bool TryPush(QueuedFrame& item);
+	bool TryPop(QueuedFrame& item);
+	bool TryPopNext(QueuedFrame& item); // With the tiles carried
+	void UpdateHighWater();
+
+};
@@ -0,0 +1,537 @@
+//
+//	FrameStream
+//
+//	Stream captured frames to another process on the same host.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "FrameStream.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment (lib, "ws2_32.lib")
+typedef int socklen_t;
+#define STREAM_NOSIGNAL 0
+#define STREAM_SOCKET(s) ((SOCKET)(s))
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define STREAM_NOSIGNAL MSG_NOSIGNAL
+#define STREAM_SOCKET(s) ((int)(s))
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Socket helpers
+//
+
+bool StreamStartup()
+{
+#ifdef _WIN32
+	static bool bStarted = false;
+	if (!bStarted) {
+		WSADATA data;
+		bStarted = (WSAStartup(MAKEWORD(2, 2), &data) == 0);
+	}
+	return bStarted;
+#else
+	return true;
+#endif
+}
+
+// Fill a socket address from "unix:path", "tcp:port" or "tcp:host:port"
+static int StreamAddress(const std::string& address, sockaddr_storage* storage, socklen_t* length)
+{
+	memset(storage, 0, sizeof(sockaddr_storage));
+
+	if (address.compare(0, 5, "unix:") == 0) {
+		sockaddr_un* un = (sockaddr_un*)storage;
+		std::string path = address.substr(5);
+		if (path.empty() || path.size() >= sizeof(un->sun_path))
+			return -1;
+		un->sun_family = AF_UNIX;
+		memcpy(un->sun_path, path.c_str(), path.size());
+		*length = (socklen_t)sizeof(sockaddr_un);
+		return AF_UNIX;
+	}
+
+	if (address.compare(0, 4, "tcp:") == 0) {
+		std::string host = "127.0.0.1";
+		std::string port = address.substr(4);
+		size_t colon = port.rfind(':');
+		if (colon != std::string::npos) {
+			host = port.substr(0, colon);
+			port = port.substr(colon + 1);
+		}
+		sockaddr_in* in = (sockaddr_in*)storage;
+		in->sin_family = AF_INET;
+		in->sin_port = htons((unsigned short)atoi(port.c_str()));
+		if (inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1)
+			return -1;
+		*length = (socklen_t)sizeof(sockaddr_in);
+		return AF_INET;
+	}
+
+	return -1;
+}
+
+intptr_t StreamListen(const std::string& address, bool bRemote)
+{
+	sockaddr_storage storage;
+	socklen_t length = 0;
+	if (!StreamStartup())
+		return -1;
+	int family = StreamAddress(address, &storage, &length);
+	if (family < 0)
+		return -1;
+	// 127.0.0.0/8 only unless allowed
+	if (family == AF_INET && !bRemote
+		&& (ntohl(((sockaddr_in*)&storage)->sin_addr.s_addr) >> 24) != 127)
+		return -1;
+
+	intptr_t s = (intptr_t)socket(family, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+
+	if (family == AF_UNIX) {
+		// Remove a socket file left by a previous run
+#ifdef _WIN32
+		DeleteFileA(((sockaddr_un*)&storage)->sun_path);
+#else
+		unlink(((sockaddr_un*)&storage)->sun_path);
+#endif
+	}
+	else {
+		int reuse = 1;
+		setsockopt(STREAM_SOCKET(s), SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+	}
+
+	if (bind(STREAM_SOCKET(s), (sockaddr*)&storage, length) != 0 || listen(STREAM_SOCKET(s), 1) != 0) {
+		StreamClose(s);
+		return -1;
+	}
+	return s;
+}
+
+intptr_t StreamConnect(const std::string& address)
+{
+	sockaddr_storage storage;
+	socklen_t length = 0;
+	if (!StreamStartup())
+		return -1;
+	int family = StreamAddress(address, &storage, &length);
+	if (family < 0)
+		return -1;
+
+	intptr_t s = (intptr_t)socket(family, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+	if (connect(STREAM_SOCKET(s), (sockaddr*)&storage, length) != 0) {
+		StreamClose(s);
+		return -1;
+	}
+	if (family == AF_INET) {
+		int nodelay = 1;
+		setsockopt(STREAM_SOCKET(s), IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+	}
+	return s;
+}
+
+void StreamShutdown(intptr_t s)
+{
+	if (s < 0)
+		return;
+#ifdef _WIN32
+	shutdown(STREAM_SOCKET(s), SD_BOTH);
+#else
+	shutdown(STREAM_SOCKET(s), SHUT_RDWR);
+#endif
+}
+
+void StreamClose(intptr_t s)
+{
+	if (s < 0)
+		return;
+	StreamShutdown(s);
+#ifdef _WIN32
+	closesocket(STREAM_SOCKET(s));
+#else
+	close(STREAM_SOCKET(s));
+#endif
+}
+
+bool StreamSendAll(intptr_t s, const unsigned char* data, size_t size)
+{
+	while (size > 0) {
+		int chunk = (int)(size < 0x40000000 ? size : 0x40000000);
+		int n = send(STREAM_SOCKET(s), (const char*)data, chunk, STREAM_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+bool StreamReceiveAll(intptr_t s, unsigned char* data, size_t size)
+{
+	while (size > 0) {
+		int chunk = (int)(size < 0x40000000 ? size : 0x40000000);
+		int n = recv(STREAM_SOCKET(s), (char*)data, chunk, 0);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+//
+// FrameStream
+//
+
+FrameStream::FrameStream()
+{
+}
+
+FrameStream::~FrameStream()
+{
+	Close();
+}
+
+bool FrameStream::Open(const std::string& address)
+{
+	Close();
+
+	m_Listen = StreamListen(address, m_bRemote);
+	if (m_Listen < 0)
+		return false;
+
+	m_Address = address;
+	m_bStop = false;
+	m_Thread = std::thread(&FrameStream::Run, this);
+	return true;
+}
+
+void FrameStream::Close()
+{
+	if (m_Thread.joinable()) {
+		m_bStop = true;
+		// Unblock a send to a receiver that is not reading.
+		// The stream thread closes the socket.
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			StreamShutdown(m_Client);
+		}
+		m_Thread.join();
+	}
+	Disconnect();
+	StreamClose(m_Listen);
+	m_Listen = -1;
+	if (m_Address.compare(0, 5, "unix:") == 0) {
+#ifdef _WIN32
+		DeleteFileA(m_Address.substr(5).c_str());
+#else
+		unlink(m_Address.substr(5).c_str());
+#endif
+	}
+	m_Address.clear();
+	m_Queue.Clear();
+	m_bSkipped = false;
+}
+
+void FrameStream::SetQueue(unsigned int capacity, QueuePolicy policy)
+{
+	if (m_Thread.joinable())
+		return;
+	m_Queue.SetCapacity(capacity);
+	m_Queue.SetPolicy(policy);
+}
+
+FrameQueue& FrameStream::GetQueue()
+{
+	return m_Queue;
+}
+
+void FrameStream::SetRemote(bool bRemote)
+{
+	m_bRemote = bRemote;
+}
+
+void FrameStream::SetSchedule(const ThreadSchedule& schedule)
+{
+	m_Schedule = schedule;
+}
+
+bool FrameStream::IsOpen() const
+{
+	return m_Listen >= 0;
+}
+
+bool FrameStream::IsConnected() const
+{
+	return m_Client >= 0;
+}
+
+std::string FrameStream::GetAddress() const
+{
+	return m_Address;
+}
+
+void FrameStream::Push(const FrameRef& frame, const TileMap& map)
+{
+	if (!frame || !m_Thread.joinable())
+		return;
+
+	// The queue keeps a reference to the frame and a copy of the map
+	QueuedFrame item;
+	item.frame = frame;
+	item.tiles = map;
+	if (m_bSkipped) {
+		item.tiles.Merge(m_Skipped);
+		m_bSkipped = false;
+	}
+	m_Queue.Push(item);
+}
+
+void FrameStream::Skip(const TileMap& map)
+{
+	if (!m_Thread.joinable())
+		return;
+	if (m_bSkipped) {
+		m_Skipped.Merge(map);
+	}
+	else {
+		m_Skipped = map;
+		m_bSkipped = true;
+	}
+}
+
+unsigned int FrameStream::GetSent() const
+{
+	return m_Sent;
+}
+
+unsigned int FrameStream::GetDropped() const
+{
+	return m_Queue.GetLost() + m_Queue.GetCoalesced();
+}
+
+double FrameStream::GetBytesSent() const
+{
+	return m_BytesSent;
+}
+
+CaptureStats FrameStream::GetEncodeTimes()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_EncodeTimes;
+}
+
+CaptureStats FrameStream::GetSendTimes()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_SendTimes;
+}
+
+void FrameStream::Run()
+{
+	ThreadScheduler scheduler;
+	scheduler.Apply(m_Schedule);
+
+	QueuedFrame item;
+	FrameRef latest; // Last frame taken, to start a new receiver
+	unsigned int width = 0;
+	unsigned int height = 0;
+	bool bKey = true;
+
+	while (!m_bStop) {
+
+		// Wait for a receiver, keeping only the latest frame
+		if (m_Client < 0) {
+			while (m_Queue.Pop(item))
+				latest = item.frame;
+			if (Accept())
+				bKey = true; // New receiver, send everything
+			continue;
+		}
+
+		// Wait for a frame, with a timeout to check for Close
+		FrameRef frame;
+		if (m_Queue.Pop(item, 100.0)) {
+			frame = item.frame;
+		}
+		else if (bKey && latest) {
+			frame = latest;
+		}
+		else {
+			continue;
+		}
+		item.frame.reset();
+		latest = frame;
+
+		// The encoder needs a map of the frame size
+		if (item.tiles.GetWidth() != frame->width || item.tiles.GetHeight() != frame->height) {
+			item.tiles = TileMap(item.tiles.GetTileSize());
+			item.tiles.Resize(frame->width, frame->height);
+			bKey = true;
+		}
+
+		// Frames dropped with their changed tiles, or a new size
+		if (item.bKey || frame->width != width || frame->height != height) {
+			width = frame->width;
+			height = frame->height;
+			bKey = true;
+		}
+
+		// The frame is not modified after it is shared,
+		// so it is encoded and sent without holding up capture
+		double start = CaptureStats::Now();
+		m_Encoder.Gather(frame->pixels, frame->pitch, item.tiles, frame->number, frame->timestamp, bKey);
+		bKey = false;
+		frame.reset();
+		const std::vector<unsigned char>& message = m_Encoder.Pack();
+		double encoded = CaptureStats::Now();
+		uint32_t size = (uint32_t)message.size();
+		unsigned char prefix[4] = { (unsigned char)(size & 0xFF), (unsigned char)((size >> 8) & 0xFF),
+			(unsigned char)((size >> 16) & 0xFF), (unsigned char)(size >> 24) };
+		intptr_t client = m_Client;
+		bool bSent = StreamSendAll(client, prefix, 4) && StreamSendAll(client, message.data(), message.size());
+		double sent = CaptureStats::Now();
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_EncodeTimes.AddSample(encoded - start);
+			if (bSent) {
+				m_SendTimes.AddSample(sent - encoded);
+				m_Sent++;
+				m_BytesSent = m_BytesSent + (double)size + 4.0;
+			}
+		}
+
+		if (!bSent)
+			Disconnect();
+	}
+}
+
+bool FrameStream::Accept()
+{
+	// Wait with a timeout so that Close is not held up
+	fd_set set;
+	FD_ZERO(&set);
+	FD_SET(m_Listen, &set);
+	timeval timeout = { 0, 100000 };
+	if (select((int)m_Listen + 1, &set, nullptr, nullptr, &timeout) <= 0)
+		return false;
+
+	intptr_t client = (intptr_t)accept(STREAM_SOCKET(m_Listen), nullptr, nullptr);
+	if (client < 0)
+		return false;
+
+	int nodelay = 1;
+	setsockopt(STREAM_SOCKET(client), IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+	m_Client = client;
+	return true;
+}
+
+void FrameStream::Disconnect()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	intptr_t client = m_Client.exchange(-1);
+	StreamClose(client);
+}
+
+//
+// FrameStreamReceiver
+//
+
+FrameStreamReceiver::FrameStreamReceiver()
+{
+}
+
+FrameStreamReceiver::~FrameStreamReceiver()
+{
+	Close();
+}
+
+bool FrameStreamReceiver::Connect(const std::string& address)
+{
+	Close();
+	m_Socket = StreamConnect(address);
+	return m_Socket >= 0;
+}
+
+void FrameStreamReceiver::Close()
+{
+	StreamClose(m_Socket);
+	m_Socket = -1;
+}
+
+bool FrameStreamReceiver::IsConnected() const
+{
+	return m_Socket >= 0;
+}
+
+bool FrameStreamReceiver::Receive()
+{
+	while (m_Socket >= 0) {
+		unsigned char prefix[4];
+		if (!StreamReceiveAll(m_Socket, prefix, 4))
+			break;
+		// A size larger than any valid message cannot be skipped safely
+		uint32_t size = (uint32_t)prefix[0] | ((uint32_t)prefix[1] << 8)
+			| ((uint32_t)prefix[2] << 16) | ((uint32_t)prefix[3] << 24);
+		if (size > m_Decoder.GetMaximumMessage()) {
+			m_Errors++;
+			break;
+		}
+		m_Message.resize(size);
+		if (!StreamReceiveAll(m_Socket, m_Message.data(), size))
+			break;
+		m_BytesReceived += (double)size + 4.0;
+
+		if (m_Decoder.Decode(m_Message.data(), size)) {
+			// The clock is monotonic across processes on the same host
+			m_Latency.AddSample(CaptureStats::Now() - m_Decoder.GetTimestamp());
+			return true;
+		}
+		m_Errors++;
+	}
+	Close();
+	return false;
+}
+
+void FrameStreamReceiver::SetMaximumSize(unsigned int width, unsigned int height)
+{
+	m_Decoder.SetMaximumSize(width, height);
+}
+
+unsigned int FrameStreamReceiver::GetErrors() const
+{
+	return m_Errors;
+}
+
+const TileDecoder& FrameStreamReceiver::GetDecoder() const
+{
+	return m_Decoder;
+}
+
+CaptureStats& FrameStreamReceiver::GetLatency()
+{
+	return m_Latency;
+}
+
+double FrameStreamReceiver::GetBytesReceived() const
+{
+	return m_BytesReceived;
+}
@@ -0,0 +1,153 @@
+//
+//	FrameStream
+//
+//	Stream captured frames to another process on the same host.
+//
+//	SpoutCapture listens on a Unix domain socket or a loopback TCP port
+//	and sends tile delta encoded frames (TileCodec) to one receiver at a time.
+//	Each message is preceded by its size as a 4 byte little-endian value.
+//
+//	Addresses :
+//		"unix:path"       Unix domain socket (Windows 10 1803 and later)
+//		"tcp:port"        127.0.0.1
+//		"tcp:host:port"   A loopback address, or any with SetRemote
+//
+//	There is no authentication, so the stream only listens on another
+//	interface if SetRemote allows it, e.g. for a container network.
+//
+//	Backpressure
+//	The capture thread pushes a reference to the frame and its changed
+//	tiles to a FrameQueue. The stream thread takes frames from the queue,
+//	encodes and sends them. The queue policy decides what happens when
+//	the receiver is slower than capture. The default QUEUE_COALESCE
+//	replaces the oldest frame and merges its changed tiles into the next
+//	frame, so a slow receiver reduces the stream rate and never blocks
+//	capture. After a frame is dropped with its tiles, the next frame is
+//	sent complete.
+//
+//	FrameStreamReceiver is the reference receiver.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CaptureStats.h"
+#include "FrameArena.h"
+#include "FrameQueue.h"
+#include "ThreadSchedule.h"
+#include "TileCodec.h"
+#include "TileMap.h"
+
+class FrameStream {
+
+public:
+
+	FrameStream();
+	~FrameStream();
+
+	// Queue between capture and the stream thread, before Open
+	void SetQueue(unsigned int capacity, QueuePolicy policy);
+	FrameQueue& GetQueue();
+	// Priority and cores of the stream thread, before Open
+	void SetSchedule(const ThreadSchedule& schedule);
+	// Listen on an interface other than loopback, before Open
+	void SetRemote(bool bRemote);
+
+	// Listen for a receiver
+	bool Open(const std::string& address);
+	void Close();
+	bool IsOpen() const;
+	bool IsConnected() const;
+	std::string GetAddress() const;
+
+	// Latest frame and the tiles changed since the last push or skip.
+	// The stream keeps a reference to the frame until it is sent.
+	void Push(const FrameRef& frame, const TileMap& map);
+	// Tiles changed in a frame that is not pushed, added to the next
+	void Skip(const TileMap& map);
+
+	// Metrics
+	unsigned int GetSent() const;
+	unsigned int GetDropped() const; // Pushed but not sent
+	double GetBytesSent() const;
+	CaptureStats GetEncodeTimes(); // Gather and compress, msec
+	CaptureStats GetSendTimes();   // Time to send, msec
+
+private:
+
+	// Socket handles are stored as intptr_t for Windows and Linux
+	intptr_t m_Listen = -1;
+	std::atomic<intptr_t> m_Client{ -1 };
+	std::string m_Address;
+
+	// Frames shared with the stream thread
+	FrameQueue m_Queue;
+	TileMap m_Skipped; // Capture thread only
+	bool m_bSkipped = false;
+	std::atomic<bool> m_bStop{ false };
+	std::thread m_Thread;
+	ThreadSchedule m_Schedule;
+	bool m_bRemote = false;
+	std::mutex m_Mutex; // Metrics and closing the client
+
+	TileEncoder m_Encoder;
+	std::atomic<unsigned int> m_Sent{ 0 };
+	std::atomic<double> m_BytesSent{ 0.0 };
+	CaptureStats m_EncodeTimes;
+	CaptureStats m_SendTimes;
+
+	void Run();
+	bool Accept();
+	void Disconnect();
+
+};
+
+class FrameStreamReceiver {
+
+public:
+
+	FrameStreamReceiver();
+	~FrameStreamReceiver();
+
+	bool Connect(const std::string& address);
+	void Close();
+	bool IsConnected() const;
+
+	// Wait for the next message that decodes and apply it to the frame.
+	// A message that does not, such as a delta before the key frame, is
+	// counted by GetErrors and skipped. Returns false if the connection
+	// is closed, or closes it for a message larger than the maximum.
+	bool Receive();
+	// Largest frame accepted, default TILEFRAME_MAX_SIZE square
+	void SetMaximumSize(unsigned int width, unsigned int height);
+
+	const TileDecoder& GetDecoder() const;
+	CaptureStats& GetLatency(); // Capture to reconstructed frame, msec
+	double GetBytesReceived() const;
+	unsigned int GetErrors() const; // Messages skipped
+
+private:
+
+	intptr_t m_Socket = -1;
+	std::vector<unsigned char> m_Message;
+	TileDecoder m_Decoder;
+	CaptureStats m_Latency;
+	double m_BytesReceived = 0.0;
+	unsigned int m_Errors = 0;
+
+};
+
+// Socket helpers shared with other local IPC
+bool StreamStartup();
+intptr_t StreamListen(const std::string& address, bool bRemote = false); // bRemote for any interface
+intptr_t StreamConnect(const std::string& address);
+void StreamShutdown(intptr_t s);
+void StreamClose(intptr_t s);
+bool StreamSendAll(intptr_t s, const unsigned char* data, size_t size);
+bool StreamReceiveAll(intptr_t s, unsigned char* data, size_t size);
@@ -0,0 +1,274 @@
+//
+//	ScrollDetect
+//
+//	Find a scroll between two GDI window frames.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "ScrollDetect.h"
+
+#include <algorithm>
+#include <string.h>
+
+// Fewest changed lines, and lines that agree on a scroll
+#define SCROLL_MIN_LINES 16
+#define SCROLL_MIN_VOTES 8
+// Lines that repeat more often, such as blank lines, do not vote
+#define SCROLL_MAX_REPEAT 4
+
+static const uint64_t hashPrime = 0x9E3779B97F4A7C15ull;
+
+// Hash of a span of pixels, 4 independent lanes of 8 bytes
+static uint64_t HashSpan(const unsigned char* data, unsigned int bytes)
+{
+	uint64_t h[4] = { 1, 2, 3, 4 };
+	unsigned int i = 0;
+	for (; i + 32 <= bytes; i += 32) {
+		uint64_t w[4];
+		memcpy(w, data + i, 32);
+		for (int j = 0; j < 4; j++)
+			h[j] = (h[j] ^ w[j])*hashPrime;
+	}
+	for (; i + 4 <= bytes; i += 4) {
+		uint32_t w;
+		memcpy(&w, data + i, 4);
+		h[0] = (h[0] ^ w)*hashPrime;
+	}
+	uint64_t hash = h[0] ^ (h[1] >> 17) ^ (h[2] << 13) ^ (h[3] >> 29);
+	return (hash ^ (hash >> 32))*hashPrime;
+}
+
+ScrollDetector::ScrollDetector()
+{
+}
+
+void ScrollDetector::Reset()
+{
+	m_Last = nullptr;
+	m_bColumns = false;
+}
+
+void ScrollDetector::SetMinimumSize(unsigned int pixels)
+{
+	m_MinimumSize = std::max(pixels, (unsigned int)SCROLL_MIN_LINES);
+}
+
+unsigned int ScrollDetector::GetDetected() const
+{
+	return m_Detected;
+}
+
+CaptureStats ScrollDetector::GetTimes() const
+{
+	return m_Times;
+}
+
+bool ScrollDetector::Detect(const unsigned char* previous, const unsigned char* current,
+	unsigned int width, unsigned int height, unsigned int pitch, TileMove& move)
+{
+	if (!previous || !current || width < m_MinimumSize || height < m_MinimumSize) {
+		m_Last = nullptr;
+		return false;
+	}
+
+	double start = CaptureStats::Now();
+
+	// Hashes of the previous frame if it was not the last
+	bool bCached = previous == m_Last && width == m_Width && height == m_Height;
+	m_Width = width;
+	m_Height = height;
+	if (!bCached) {
+		HashRows(previous, pitch, m_Rows[0]);
+		m_bColumns = false;
+	}
+	HashRows(current, pitch, m_Rows[1]);
+
+	bool bFound = Vertical(previous, current, pitch, move);
+	bool bColumns = false;
+	if (!bFound) {
+		// A horizontal scroll changes many lines
+		unsigned int changed = 0;
+		for (unsigned int y = 0; y < height; y++) {
+			if (m_Rows[0][y] != m_Rows[1][y])
+				changed++;
+		}
+		if (changed >= m_MinimumSize) {
+			if (!m_bColumns)
+				HashColumns(previous, pitch, m_Columns[0]);
+			HashColumns(current, pitch, m_Columns[1]);
+			bColumns = true;
+			bFound = Horizontal(previous, current, pitch, move);
+		}
+	}
+
+	// The current frame is the next previous
+	std::swap(m_Rows[0], m_Rows[1]);
+	std::swap(m_Columns[0], m_Columns[1]);
+	m_bColumns = bColumns;
+	m_Last = current;
+
+	if (bFound)
+		m_Detected++;
+	m_Times.AddSample(CaptureStats::Now() - start);
+	return bFound;
+}
+
+// Lines between the outer eighths, clear of scroll bars and side panels
+void ScrollDetector::HashRows(const unsigned char* pixels, unsigned int pitch, std::vector<uint64_t>& hashes) const
+{
+	unsigned int x0 = m_Width/8;
+	unsigned int x1 = m_Width - m_Width/8;
+	hashes.resize(m_Height);
+	for (unsigned int y = 0; y < m_Height; y++)
+		hashes[y] = HashSpan(pixels + (size_t)y*pitch + (size_t)x0*4, (x1 - x0)*4);
+}
+
+// Columns between the outer eighths, clear of toolbars and status bars.
+// Each line updates every column hash so that memory is read in order.
+// Every fourth line is enough to tell columns apart, and TileMap::Compare
+// finds any tile that the move does not match.
+void ScrollDetector::HashColumns(const unsigned char* pixels, unsigned int pitch, std::vector<uint64_t>& hashes) const
+{
+	unsigned int y0 = m_Height/8;
+	unsigned int y1 = m_Height - m_Height/8;
+	hashes.assign(m_Width, 1);
+	for (unsigned int y = y0; y < y1; y += 4) {
+		const unsigned char* line = pixels + (size_t)y*pitch;
+		for (unsigned int x = 0; x < m_Width; x++) {
+			uint32_t w;
+			memcpy(&w, line + (size_t)x*4, 4);
+			hashes[x] = (hashes[x] ^ w)*hashPrime;
+		}
+	}
+	for (uint64_t& hash : hashes)
+		hash = (hash ^ (hash >> 32))*hashPrime;
+}
+
+// The offset of current lines from previous lines agreed by most changed
+// lines, and the longest run of lines [first, last) that match with it
+bool ScrollDetector::Correlate(const std::vector<uint64_t>& previous, const std::vector<uint64_t>& current,
+	int& shift, unsigned int& first, unsigned int& last)
+{
+	unsigned int n = (unsigned int)current.size();
+	unsigned int changed = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		if (previous[i] != current[i])
+			changed++;
+	}
+	if (changed < SCROLL_MIN_LINES)
+		return false;
+
+	// Previous lines sorted by hash
+	m_Index.resize(n);
+	for (unsigned int i = 0; i < n; i++)
+		m_Index[i] = { previous[i], i };
+	std::sort(m_Index.begin(), m_Index.end());
+
+	// Each changed line votes for the offsets of the previous lines it matches,
+	// up to half the frame
+	int range = (int)n/2;
+	m_Votes.assign((size_t)range*2 + 1, 0);
+	for (unsigned int i = 0; i < n; i++) {
+		if (previous[i] == current[i])
+			continue;
+		auto match = std::lower_bound(m_Index.begin(), m_Index.end(), std::make_pair(current[i], (uint32_t)0));
+		auto end = match;
+		while (end != m_Index.end() && end->first == current[i] && end - match <= SCROLL_MAX_REPEAT)
+			end++;
+		if (end - match > SCROLL_MAX_REPEAT)
+			continue;
+		for (; match != end; match++) {
+			int offset = (int)i - (int)match->second;
+			if (offset >= -range && offset <= range)
+				m_Votes[offset + range]++;
+		}
+	}
+
+	unsigned int best = 0;
+	for (unsigned int i = 0; i < m_Votes.size(); i++) {
+		if (m_Votes[i] > m_Votes[best])
+			best = i;
+	}
+	unsigned int votes = m_Votes[best];
+	shift = (int)best - range;
+	if (shift == 0 || votes < SCROLL_MIN_VOTES || votes < changed/4)
+		return false;
+
+	// Longest run of matching lines
+	unsigned int start = std::max(0, shift);
+	unsigned int end = std::min((int)n, (int)n + shift);
+	first = last = 0;
+	unsigned int runStart = start;
+	for (unsigned int i = start; i <= end; i++) {
+		if (i == end || current[i] != previous[i - shift]) {
+			if (i - runStart > last - first) {
+				first = runStart;
+				last = i;
+			}
+			runStart = i + 1;
+		}
+	}
+	return last - first >= m_MinimumSize;
+}
+
+bool ScrollDetector::Vertical(const unsigned char* previous, const unsigned char* current, unsigned int pitch, TileMove& move)
+{
+	int dy = 0;
+	unsigned int top = 0;
+	unsigned int bottom = 0;
+	if (!Correlate(m_Rows[0], m_Rows[1], dy, top, bottom))
+		return false;
+
+	// Widen the hashed band while every line matches
+	unsigned int x0 = m_Width/8;
+	unsigned int x1 = m_Width - m_Width/8;
+	unsigned int left = 0;
+	unsigned int right = m_Width;
+	for (unsigned int y = top; y < bottom; y++) {
+		const uint32_t* a = (const uint32_t*)(previous + (size_t)(y - dy)*pitch);
+		const uint32_t* b = (const uint32_t*)(current + (size_t)y*pitch);
+		if (left < x0 && TileSpanDiffers((const unsigned char*)(a + left), (const unsigned char*)(b + left), (x0 - left)*4)) {
+			unsigned int x = x0;
+			while (x > left && a[x - 1] == b[x - 1])
+				x--;
+			left = x;
+		}
+		if (right > x1 && TileSpanDiffers((const unsigned char*)(a + x1), (const unsigned char*)(b + x1), (right - x1)*4)) {
+			unsigned int x = x1;
+			while (x < right && a[x] == b[x])
+				x++;
+			right = x;
+		}
+	}
+	if (right - left < m_MinimumSize)
+		return false;
+
+	move = { (int32_t)left, (int32_t)top, (int32_t)right, (int32_t)bottom, 0, dy };
+	return true;
+}
+
+bool ScrollDetector::Horizontal(const unsigned char* previous, const unsigned char* current, unsigned int pitch, TileMove& move)
+{
+	int dx = 0;
+	unsigned int left = 0;
+	unsigned int right = 0;
+	if (!Correlate(m_Columns[0], m_Columns[1], dx, left, right))
+		return false;
+
+	// Widen the hashed band while lines match
+	unsigned int bytes = (right - left)*4;
+	size_t offset = (size_t)left*4;
+	size_t source = (size_t)((int)left - dx)*4;
+	unsigned int top = m_Height/8;
+	while (top > 0 && !TileSpanDiffers(previous + (size_t)(top - 1)*pitch + source, current + (size_t)(top - 1)*pitch + offset, bytes))
+		top--;
+	unsigned int bottom = m_Height - m_Height/8;
+	while (bottom < m_Height && !TileSpanDiffers(previous + (size_t)bottom*pitch + source, current + (size_t)bottom*pitch + offset, bytes))
+		bottom++;
+	if (bottom - top < m_MinimumSize)
+		return false;
+
+	move = { (int32_t)left, (int32_t)top, (int32_t)right, (int32_t)bottom, dx, 0 };
+	return true;
+}
@@ -0,0 +1,73 @@
+//
+//	ScrollDetect
+//
+//	Find a scroll between two GDI window frames, so that the tile map
+//	can send it as a move instead of every tile it touches.
+//
+//	Each line of the middle of the frame is hashed and the lines that
+//	have changed are matched with lines of the previous frame. The
+//	offset most of them agree on, if any, is the scroll. The longest
+//	run of lines that match at that offset is then widened pixel by
+//	pixel, which stops at a scroll bar or a fixed side panel. If no
+//	vertical scroll is found, the columns are tried in the same way.
+//
+//	The hashes of the current frame are kept for the next, so each
+//	frame is hashed once while the previous frame is the last current.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "CaptureStats.h"
+#include "TileMap.h"
+
+class ScrollDetector {
+
+public:
+
+	ScrollDetector();
+
+	// Compare 4 byte per pixel frames of the same size. Returns true
+	// with the moved rectangle of the current frame if there is a scroll.
+	// The previous frame must be the last current frame or a frame
+	// after Reset, and neither may change between calls.
+	bool Detect(const unsigned char* previous, const unsigned char* current,
+		unsigned int width, unsigned int height, unsigned int pitch, TileMove& move);
+
+	// Forget the hashes, e.g. for a new source or a frame not compared
+	void Reset();
+
+	// Smallest width and height of a move, default 64
+	void SetMinimumSize(unsigned int pixels);
+
+	unsigned int GetDetected() const; // Scrolls found
+	CaptureStats GetTimes() const;    // Detect, msec
+
+private:
+
+	// Line hashes of the last current frame and this one
+	std::vector<uint64_t> m_Rows[2];
+	std::vector<uint64_t> m_Columns[2];
+	const unsigned char* m_Last = nullptr;
+	unsigned int m_Width = 0;
+	unsigned int m_Height = 0;
+	bool m_bColumns = false; // Column hashes of the last frame
+
+	std::vector<std::pair<uint64_t, uint32_t>> m_Index;
+	std::vector<unsigned int> m_Votes;
+
+	unsigned int m_MinimumSize = 64;
+	unsigned int m_Detected = 0;
+	CaptureStats m_Times;
+
+	bool Correlate(const std::vector<uint64_t>& previous, const std::vector<uint64_t>& current,
+		int& shift, unsigned int& first, unsigned int& last);
+	void HashRows(const unsigned char* pixels, unsigned int pitch, std::vector<uint64_t>& hashes) const;
+	void HashColumns(const unsigned char* pixels, unsigned int pitch, std::vector<uint64_t>& hashes) const;
+	bool Vertical(const unsigned char* previous, const unsigned char* current, unsigned int pitch, TileMove& move);
+	bool Horizontal(const unsigned char* previous, const unsigned char* current, unsigned int pitch, TileMove& move);
+
+};
@@ -0,0 +1,583 @@
+//
+//	SnapshotRing
+//
+//	The last seconds of captured frames, kept in a memory-mapped file
+//	and written to a clip on demand.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "SnapshotRing.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct SnapshotEntry {
+	uint64_t pos;
+	uint32_t size;
+	uint32_t flags;
+	double timestamp;
+};
+
+static uint64_t Align(uint64_t size)
+{
+	return (size + 7) & ~(uint64_t)7;
+}
+
+static uint64_t RecordLength(uint32_t size)
+{
+	return Align(sizeof(SnapshotRecord) + (uint64_t)size);
+}
+
+// Read the record at pos, or after padding to the end of the ring.
+// Returns 1 with pos at the record, 0 at the head or -1 if invalid.
+static int ReadRecord(const unsigned char* records, uint64_t capacity, uint64_t head,
+	uint64_t& pos, SnapshotRecord& record)
+{
+	while (pos < head) {
+		uint64_t offset = pos % capacity;
+		uint64_t room = capacity - offset;
+		if (room < sizeof(SnapshotRecord)) {
+			pos += room;
+			continue;
+		}
+		memcpy(&record, records + offset, sizeof(SnapshotRecord));
+		if (record.magic != SNAPSHOT_RECORD)
+			return -1;
+		if (record.size == 0) {
+			pos += room;
+			continue;
+		}
+		if (sizeof(SnapshotRecord) + (uint64_t)record.size > room)
+			return -1;
+		return 1;
+	}
+	return 0;
+}
+
+// Every record from the tail to the head
+static bool ListRecords(const SnapshotHeader& header, const unsigned char* records,
+	std::vector<SnapshotEntry>& entries)
+{
+	entries.clear();
+	SnapshotRecord record;
+	uint64_t pos = header.tail;
+	int result = 0;
+	while ((result = ReadRecord(records, header.capacity, header.head, pos, record)) > 0) {
+		entries.push_back({ pos, record.size, record.flags, record.timestamp });
+		pos += RecordLength(record.size);
+	}
+	return result == 0;
+}
+
+// First record of a clip of the last msec. The newest key frame at or
+// before the start of the period, or the oldest key frame if there is
+// none that early. All from the oldest key frame if msec is 0.
+static int ClipStart(const std::vector<SnapshotEntry>& entries, double msec)
+{
+	if (entries.empty())
+		return -1;
+	double start = entries.back().timestamp - msec;
+	int first = -1;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (!(entries[i].flags & TILEFRAME_KEY))
+			continue;
+		if (first >= 0 && (msec <= 0.0 || entries[i].timestamp > start))
+			break;
+		first = (int)i;
+	}
+	return first;
+}
+
+// A clip message with its size, as sent by the stream
+static bool WriteMessage(FILE* file, const unsigned char* data, uint32_t size)
+{
+	unsigned char prefix[4] = { (unsigned char)(size & 0xFF), (unsigned char)((size >> 8) & 0xFF),
+		(unsigned char)((size >> 16) & 0xFF), (unsigned char)(size >> 24) };
+	return fwrite(prefix, 1, 4, file) == 4 && fwrite(data, 1, size, file) == size;
+}
+
+// "folder/snapshot-20241018-153012-250.stc" from the local time
+static std::string ClipName(const std::string& folder, const char* suffix)
+{
+	using namespace std::chrono;
+	system_clock::time_point now = system_clock::now();
+	time_t t = system_clock::to_time_t(now);
+	unsigned int msec = (unsigned int)(duration_cast<milliseconds>(now.time_since_epoch()).count() % 1000);
+	tm local{};
+#ifdef _WIN32
+	localtime_s(&local, &t);
+#else
+	localtime_r(&t, &local);
+#endif
+	char name[64];
+	snprintf(name, 64, "snapshot-%04d%02d%02d-%02d%02d%02d-%03u%s.stc",
+		local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+		local.tm_hour, local.tm_min, local.tm_sec, msec, suffix);
+	if (folder.empty() || folder.back() == '/' || folder.back() == '\\')
+		return folder + name;
+	return folder + "/" + name;
+}
+
+SnapshotRing::SnapshotRing()
+{
+}
+
+SnapshotRing::~SnapshotRing()
+{
+	Close();
+}
+
+void SnapshotRing::SetKeyInterval(double msec)
+{
+	m_KeyInterval = msec;
+}
+
+void SnapshotRing::SetSchedule(const ThreadSchedule& schedule)
+{
+	m_Schedule = schedule;
+}
+
+void SnapshotRing::SetClips(const std::string& folder, double msec)
+{
+	if (m_Thread.joinable())
+		return;
+	m_ClipFolder = folder;
+	m_ClipTime = msec;
+}
+
+bool SnapshotRing::Open(const std::string& path, size_t size)
+{
+	Close();
+
+	if (size < sizeof(SnapshotHeader) + 65536)
+		return false;
+
+	// Frames left by a process that did not close the ring
+	std::string clip = ClipName(m_ClipFolder, "-recovered");
+	m_LastClip = Recover(path, clip) > 0 ? clip : std::string();
+
+#ifdef _WIN32
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	m_hFile = hFile;
+	LARGE_INTEGER length{};
+	length.QuadPart = (LONGLONG)size;
+	HANDLE hMapping = NULL;
+	if (SetFilePointerEx(hFile, length, NULL, FILE_BEGIN) && SetEndOfFile(hFile))
+		hMapping = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+	if (hMapping) {
+		m_hMapping = hMapping;
+		m_Header = (SnapshotHeader*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	}
+#else
+	m_File = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (m_File < 0)
+		return false;
+	if (ftruncate(m_File, (off_t)size) == 0) {
+		void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+		if (view != MAP_FAILED)
+			m_Header = (SnapshotHeader*)view;
+	}
+#endif
+	if (!m_Header) {
+		Unmap();
+		return false;
+	}
+
+	m_Size = size;
+	m_Path = path;
+	m_Records = (unsigned char*)m_Header + sizeof(SnapshotHeader);
+	memset(m_Header, 0, sizeof(SnapshotHeader));
+	m_Header->magic = SNAPSHOT_MAGIC;
+	m_Header->version = SNAPSHOT_VERSION;
+	m_Header->capacity = (uint64_t)(size - sizeof(SnapshotHeader)) & ~(uint64_t)7;
+	m_Header->bOpen = 1;
+
+	m_bSkipped = false;
+	m_Newest = 0.0;
+	m_bFlushRequest = false;
+	m_bStop = false;
+	m_Thread = std::thread(&SnapshotRing::Run, this);
+	return true;
+}
+
+void SnapshotRing::Close()
+{
+	if (m_Thread.joinable()) {
+		m_bStop = true;
+		m_Thread.join();
+	}
+	// The writer thread starts the flush thread
+	if (m_FlushThread.joinable())
+		m_FlushThread.join();
+	m_Queue.Clear();
+
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	if (m_Header)
+		m_Header->bOpen = 0;
+	Unmap();
+	m_Path.clear();
+}
+
+void SnapshotRing::Unmap()
+{
+#ifdef _WIN32
+	if (m_Header)
+		UnmapViewOfFile(m_Header);
+	if (m_hMapping)
+		CloseHandle((HANDLE)m_hMapping);
+	if (m_hFile)
+		CloseHandle((HANDLE)m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = nullptr;
+#else
+	if (m_Header)
+		munmap(m_Header, m_Size);
+	if (m_File >= 0)
+		close(m_File);
+	m_File = -1;
+#endif
+	m_Header = nullptr;
+	m_Records = nullptr;
+	m_Size = 0;
+}
+
+bool SnapshotRing::IsOpen() const
+{
+	return m_Thread.joinable();
+}
+
+std::string SnapshotRing::GetPath() const
+{
+	return m_Path;
+}
+
+void SnapshotRing::Push(const FrameRef& frame, const TileMap& map)
+{
+	if (!frame || !m_Thread.joinable())
+		return;
+
+	// The queue keeps a reference to the frame and a copy of the map
+	QueuedFrame item;
+	item.frame = frame;
+	item.tiles = map;
+	if (m_bSkipped) {
+		item.tiles.Merge(m_Skipped);
+		m_bSkipped = false;
+	}
+	m_Queue.Push(item);
+}
+
+void SnapshotRing::Skip(const TileMap& map)
+{
+	if (!m_Thread.joinable())
+		return;
+	if (m_bSkipped) {
+		m_Skipped.Merge(map);
+	}
+	else {
+		m_Skipped = map;
+		m_bSkipped = true;
+	}
+}
+
+void SnapshotRing::RequestFlush()
+{
+	m_bFlushRequest = true;
+}
+
+bool SnapshotRing::IsFlushing() const
+{
+	return m_bFlushing;
+}
+
+unsigned int SnapshotRing::Flush(const std::string& path, double msec)
+{
+	double start = CaptureStats::Now();
+
+	// The records are listed together and then copied one at a time
+	// so that the writer is not held up for the whole clip
+	std::vector<SnapshotEntry> entries;
+	uint64_t capacity = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_RingMutex);
+		if (!m_Header)
+			return 0;
+		capacity = m_Header->capacity;
+		ListRecords(*m_Header, m_Records, entries);
+	}
+	int first = ClipStart(entries, msec);
+	if (first < 0)
+		return 0;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return 0;
+
+	std::vector<unsigned char> message;
+	unsigned int frames = 0;
+	bool bWritten = true;
+	for (size_t i = (size_t)first; i < entries.size() && bWritten; i++) {
+		{
+			std::lock_guard<std::mutex> lock(m_RingMutex);
+			// Replaced while the clip was written, the clip ends here
+			if (!m_Header || entries[i].pos < m_Header->tail)
+				break;
+			const unsigned char* data = m_Records + entries[i].pos % capacity + sizeof(SnapshotRecord);
+			message.assign(data, data + entries[i].size);
+		}
+		bWritten = WriteMessage(file, message.data(), entries[i].size);
+		if (bWritten)
+			frames++;
+	}
+	if (fclose(file) != 0)
+		bWritten = false;
+	if (!bWritten) {
+		remove(path.c_str());
+		frames = 0;
+	}
+
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	m_FlushTimes.AddSample(CaptureStats::Now() - start);
+	return frames;
+}
+
+unsigned int SnapshotRing::Recover(const std::string& ringPath, const std::string& clipPath, double msec)
+{
+	FILE* file = fopen(ringPath.c_str(), "rb");
+	if (!file)
+		return 0;
+
+	SnapshotHeader header{};
+	std::vector<unsigned char> records;
+	bool bValid = fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION
+		&& header.bOpen && header.capacity > 0 && header.capacity <= ((uint64_t)1 << 40)
+		&& header.head >= header.tail && header.head - header.tail <= header.capacity;
+	if (bValid) {
+		records.resize((size_t)header.capacity);
+		bValid = fread(records.data(), 1, records.size(), file) == records.size();
+	}
+	fclose(file);
+	if (!bValid)
+		return 0;
+
+	// Records that can be read up to a damaged one
+	std::vector<SnapshotEntry> entries;
+	ListRecords(header, records.data(), entries);
+	int first = ClipStart(entries, msec);
+	if (first < 0)
+		return 0;
+
+	file = fopen(clipPath.c_str(), "wb");
+	if (!file)
+		return 0;
+	unsigned int frames = 0;
+	bool bWritten = true;
+	for (size_t i = (size_t)first; i < entries.size() && bWritten; i++) {
+		const unsigned char* data = records.data() + entries[i].pos % header.capacity + sizeof(SnapshotRecord);
+		bWritten = WriteMessage(file, data, entries[i].size);
+		if (bWritten)
+			frames++;
+	}
+	if (fclose(file) != 0)
+		bWritten = false;
+	if (!bWritten) {
+		remove(clipPath.c_str());
+		frames = 0;
+	}
+	return frames;
+}
+
+const FrameQueue& SnapshotRing::GetQueue() const
+{
+	return m_Queue;
+}
+
+unsigned int SnapshotRing::GetRecorded() const
+{
+	return m_Recorded;
+}
+
+unsigned int SnapshotRing::GetDropped() const
+{
+	return m_Queue.GetLost() + m_Queue.GetCoalesced() + m_TooLarge;
+}
+
+double SnapshotRing::GetBytesWritten()
+{
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	return m_BytesWritten;
+}
+
+double SnapshotRing::GetRetained()
+{
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	if (!m_Header)
+		return 0.0;
+	SnapshotRecord record;
+	uint64_t pos = m_Header->tail;
+	if (ReadRecord(m_Records, m_Header->capacity, m_Header->head, pos, record) <= 0)
+		return 0.0;
+	return m_Newest - record.timestamp;
+}
+
+CaptureStats SnapshotRing::GetWriteTimes()
+{
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	return m_WriteTimes;
+}
+
+CaptureStats SnapshotRing::GetFlushTimes()
+{
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	return m_FlushTimes;
+}
+
+std::string SnapshotRing::GetLastClip()
+{
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+	return m_LastClip;
+}
+
+void SnapshotRing::Run()
+{
+	ThreadScheduler scheduler;
+	scheduler.Apply(m_Schedule);
+
+	QueuedFrame item;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	double keyTime = 0.0;
+	bool bKey = true;
+
+	while (!m_bStop) {
+
+		if (m_bFlushRequest.exchange(false))
+			StartFlush();
+
+		// Wait for a frame, with a timeout to check for Close and flush requests
+		if (!m_Queue.Pop(item, 100.0))
+			continue;
+		FrameRef frame = item.frame;
+		item.frame.reset();
+
+		// The encoder needs a map of the frame size
+		if (item.tiles.GetWidth() != frame->width || item.tiles.GetHeight() != frame->height) {
+			item.tiles = TileMap(item.tiles.GetTileSize());
+			item.tiles.Resize(frame->width, frame->height);
+			bKey = true;
+		}
+
+		// Frames dropped with their changed tiles, or a new size
+		if (item.bKey || frame->width != width || frame->height != height) {
+			width = frame->width;
+			height = frame->height;
+			bKey = true;
+		}
+
+		// Key frames at intervals so that a clip can start near the time asked for
+		if (frame->timestamp - keyTime >= m_KeyInterval)
+			bKey = true;
+
+		double start = CaptureStats::Now();
+		uint32_t number = frame->number;
+		double timestamp = frame->timestamp;
+		m_Encoder.Gather(frame->pixels, frame->pitch, item.tiles, number, timestamp, bKey);
+		frame.reset();
+		const std::vector<unsigned char>& message = m_Encoder.Pack();
+		if (Write(message, number, bKey ? TILEFRAME_KEY : 0, timestamp)) {
+			m_Recorded++;
+			if (bKey)
+				keyTime = timestamp;
+			bKey = false;
+		}
+		else {
+			// The next delta could not be applied without this frame
+			bKey = true;
+		}
+
+		std::lock_guard<std::mutex> lock(m_RingMutex);
+		m_WriteTimes.AddSample(CaptureStats::Now() - start);
+	}
+}
+
+void SnapshotRing::StartFlush()
+{
+	// One clip at a time
+	if (m_bFlushing)
+		return;
+	if (m_FlushThread.joinable())
+		m_FlushThread.join();
+
+	m_bFlushing = true;
+	std::string path = ClipName(m_ClipFolder, "");
+	m_FlushThread = std::thread([this, path]() {
+		unsigned int frames = Flush(path, m_ClipTime);
+		{
+			std::lock_guard<std::mutex> lock(m_RingMutex);
+			if (frames > 0)
+				m_LastClip = path;
+		}
+		m_bFlushing = false;
+	});
+}
+
+bool SnapshotRing::Write(const std::vector<unsigned char>& message, uint32_t frame, uint32_t flags, double timestamp)
+{
+	uint64_t capacity = m_Header->capacity;
+	uint64_t length = RecordLength((uint32_t)message.size());
+	if (length > capacity / 2) {
+		m_TooLarge++;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_RingMutex);
+
+	// A record does not wrap. If there is not room
+	// before the end of the ring, it starts again at 0.
+	uint64_t head = m_Header->head;
+	uint64_t room = capacity - head % capacity;
+	uint64_t pos = (room < length) ? head + room : head;
+	uint64_t end = pos + length;
+
+	// Remove the oldest records that will be replaced
+	SnapshotRecord record;
+	while (end - m_Header->tail > capacity) {
+		uint64_t tail = m_Header->tail;
+		if (ReadRecord(m_Records, capacity, head, tail, record) <= 0) {
+			m_Header->tail = pos;
+			break;
+		}
+		m_Header->tail = tail + RecordLength(record.size);
+	}
+
+	if (pos != head && room >= sizeof(SnapshotRecord)) {
+		SnapshotRecord pad{ SNAPSHOT_RECORD, 0, 0, 0, 0.0 };
+		memcpy(m_Records + head % capacity, &pad, sizeof(pad));
+	}
+
+	record = { SNAPSHOT_RECORD, (uint32_t)message.size(), frame, flags, timestamp };
+	unsigned char* data = m_Records + pos % capacity;
+	memcpy(data, &record, sizeof(record));
+	memcpy(data + sizeof(record), message.data(), message.size());
+	m_Header->head = end;
+
+	m_BytesWritten += (double)length;
+	m_Newest = timestamp;
+	return true;
+}
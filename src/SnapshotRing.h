@@ -0,0 +1,165 @@
+//
+//	SnapshotRing
+//
+//	The last seconds of captured frames, kept in a memory-mapped file
+//	and written to a clip on demand.
+//
+//	Frames are tile delta encoded (TileCodec) by a writer thread and
+//	appended to a fixed size ring in the file, replacing the oldest.
+//	The capture thread only pushes a reference to the frame and its
+//	changed tiles to a coalescing FrameQueue, so recording never holds
+//	up capture. A key frame is recorded at least every key interval so
+//	that a clip can start within that time of the period asked for.
+//
+//	Flush writes the frames from the key frame before the period to a
+//	clip on a separate thread. The ring is only locked to copy each
+//	record, so recording continues while the clip is written.
+//	RequestFlush only sets a flag for the writer thread, so the capture
+//	thread asking for a clip does not wait for it.
+//
+//	The clip has the same format as the stream (FrameStream), each
+//	message preceded by its size as a 4 byte little-endian value,
+//	starting with a key frame. The reference receiver plays it
+//	with "StreamReceiver file:clip.stc".
+//
+//	The file remains after the process stops. If it was not closed,
+//	Open first recovers the frames it holds to a clip.
+//
+//	File (little-endian) :
+//		SnapshotHeader
+//		capacity bytes of records, each 8 byte aligned :
+//			SnapshotRecord
+//			size bytes, TileCodec message
+//		A record with size 0, or less room than a record header,
+//		pads to the end of the ring.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CaptureStats.h"
+#include "FrameArena.h"
+#include "FrameQueue.h"
+#include "ThreadSchedule.h"
+#include "TileCodec.h"
+#include "TileMap.h"
+
+#define SNAPSHOT_MAGIC   0x47525453 // "STRG"
+#define SNAPSHOT_RECORD  0x43455253 // "SREC"
+#define SNAPSHOT_VERSION 1
+
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity; // Bytes of records after the header
+	uint64_t head;     // Position of the next record
+	uint64_t tail;     // Position of the oldest record
+	uint32_t bOpen;    // Not closed by the writer
+	uint32_t reserved[7];
+};
+
+// Positions increase without wrapping and are
+// at position % capacity in the records
+struct SnapshotRecord {
+	uint32_t magic;
+	uint32_t size;  // Message bytes, 0 for padding
+	uint32_t frame;
+	uint32_t flags; // TILEFRAME_KEY
+	double timestamp;
+};
+
+class SnapshotRing {
+
+public:
+
+	SnapshotRing();
+	~SnapshotRing();
+
+	// Before Open
+	void SetKeyInterval(double msec); // Default 2000
+	void SetSchedule(const ThreadSchedule& schedule);
+	// Folder and length of the clips written by RequestFlush
+	void SetClips(const std::string& folder, double msec);
+
+	// Create the file of size bytes and start recording
+	bool Open(const std::string& path, size_t size);
+	void Close();
+	bool IsOpen() const;
+	std::string GetPath() const;
+
+	// Frame and the tiles changed since the last frame pushed or skipped
+	void Push(const FrameRef& frame, const TileMap& map);
+	// Tiles changed in a frame that is not recorded, added to the next
+	void Skip(const TileMap& map);
+
+	// Write the last msec to a clip on the flush thread
+	void RequestFlush();
+	bool IsFlushing() const;
+	// Write the last msec to a clip now, from any thread.
+	// Returns the frames written, 0 if none.
+	unsigned int Flush(const std::string& path, double msec);
+	// Frames held by a ring file left by another process
+	static unsigned int Recover(const std::string& ringPath, const std::string& clipPath, double msec = 0.0);
+
+	// Metrics
+	const FrameQueue& GetQueue() const; // Between capture and the writer thread
+	unsigned int GetRecorded() const;
+	unsigned int GetDropped() const; // Coalesced or too large for the ring
+	double GetBytesWritten();
+	double GetRetained();            // Msec from the oldest frame to the newest
+	CaptureStats GetWriteTimes();    // Encode and write each frame, msec
+	CaptureStats GetFlushTimes();    // Write a clip, msec
+	std::string GetLastClip();       // Last clip written by the flush thread
+
+private:
+
+	std::string m_Path;
+	SnapshotHeader* m_Header = nullptr;
+	unsigned char* m_Records = nullptr;
+	size_t m_Size = 0;
+#ifdef _WIN32
+	void* m_hFile = nullptr;
+	void* m_hMapping = nullptr;
+#else
+	int m_File = -1;
+#endif
+	std::mutex m_RingMutex; // Records, the header and metrics
+
+	// Frames shared with the writer thread
+	FrameQueue m_Queue;
+	TileMap m_Skipped; // Capture thread only
+	bool m_bSkipped = false;
+	std::atomic<bool> m_bStop{ false };
+	std::thread m_Thread;
+	ThreadSchedule m_Schedule;
+	double m_KeyInterval = 2000.0;
+
+	// Clips
+	std::string m_ClipFolder;
+	double m_ClipTime = 10000.0;
+	std::atomic<bool> m_bFlushRequest{ false };
+	std::atomic<bool> m_bFlushing{ false };
+	std::thread m_FlushThread;
+	std::string m_LastClip;
+
+	TileEncoder m_Encoder;
+	std::atomic<unsigned int> m_Recorded{ 0 };
+	std::atomic<unsigned int> m_TooLarge{ 0 };
+	double m_BytesWritten = 0.0;
+	double m_Newest = 0.0; // Timestamp of the last record
+	CaptureStats m_WriteTimes;
+	CaptureStats m_FlushTimes;
+
+	void Run();
+	void StartFlush();
+	bool Write(const std::vector<unsigned char>& message, uint32_t frame, uint32_t flags, double timestamp);
+	void Unmap();
+
+};
@@ -0,0 +1,315 @@
+//
+//	ThreadSchedule
+//
+//	Priority and processor affinity for the capture and worker threads.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "ThreadSchedule.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <avrt.h>
+#pragma comment (lib, "avrt.lib")
+#pragma comment (lib, "winmm.lib")
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+bool ThreadSchedule::IsDefault() const
+{
+	return priority == PRIORITY_NORMAL && affinity == 0 && !bMmcss;
+}
+
+ThreadScheduler::ThreadScheduler()
+{
+}
+
+ThreadScheduler::~ThreadScheduler()
+{
+	Revert();
+}
+
+#ifdef _WIN32
+
+bool ThreadScheduler::Apply(const ThreadSchedule& schedule)
+{
+	Revert();
+
+	bool bResult = true;
+	char tmp[64];
+	m_hThread = GetCurrentThread();
+	m_Priority = GetThreadPriority(m_hThread);
+	m_bApplied = true;
+	m_Result = GetPriorityName(schedule.priority);
+
+	if (schedule.affinity) {
+		m_Affinity = SetThreadAffinityMask(m_hThread, (DWORD_PTR)schedule.affinity);
+		if (m_Affinity) {
+			snprintf(tmp, 64, ", cores 0x%llx", (unsigned long long)schedule.affinity);
+			m_Result += tmp;
+		}
+		else {
+			m_Result += ", affinity failed";
+			bResult = false;
+		}
+	}
+
+	if (schedule.priority != PRIORITY_NORMAL) {
+		int priority = THREAD_PRIORITY_ABOVE_NORMAL;
+		if (schedule.priority == PRIORITY_HIGHEST) priority = THREAD_PRIORITY_HIGHEST;
+		if (schedule.priority == PRIORITY_REALTIME) priority = THREAD_PRIORITY_TIME_CRITICAL;
+		if (!SetThreadPriority(m_hThread, priority)) {
+			m_Result += " failed";
+			bResult = false;
+		}
+	}
+
+	if (schedule.bMmcss) {
+		DWORD index = 0;
+		m_hTask = AvSetMmThreadCharacteristicsA("Capture", &index);
+		if (m_hTask) {
+			AVRT_PRIORITY priority = AVRT_PRIORITY_NORMAL;
+			if (schedule.priority == PRIORITY_HIGH) priority = AVRT_PRIORITY_HIGH;
+			if (schedule.priority == PRIORITY_HIGHEST) priority = AVRT_PRIORITY_HIGH;
+			if (schedule.priority == PRIORITY_REALTIME) priority = AVRT_PRIORITY_CRITICAL;
+			AvSetMmThreadPriority(m_hTask, priority);
+			m_Result += ", MMCSS Capture";
+		}
+		else {
+			m_Result += ", MMCSS failed";
+			bResult = false;
+		}
+	}
+
+	return bResult;
+}
+
+void ThreadScheduler::Revert()
+{
+	if (!m_bApplied)
+		return;
+	if (m_hTask)
+		AvRevertMmThreadCharacteristics(m_hTask);
+	m_hTask = nullptr;
+	SetThreadPriority(m_hThread, m_Priority);
+	if (m_Affinity)
+		SetThreadAffinityMask(m_hThread, m_Affinity);
+	m_Affinity = 0;
+	m_bApplied = false;
+}
+
+#else
+
+// Nice applies to a thread by its kernel thread id
+static int GetThreadId()
+{
+	return (int)syscall(SYS_gettid);
+}
+
+bool ThreadScheduler::Apply(const ThreadSchedule& schedule)
+{
+	Revert();
+
+	bool bResult = true;
+	char tmp[64];
+	sched_param param{};
+	pthread_getschedparam(pthread_self(), &m_Policy, &param);
+	m_SchedPriority = param.sched_priority;
+	errno = 0;
+	m_Nice = getpriority(PRIO_PROCESS, GetThreadId());
+	m_bNice = false;
+	m_bAffinity = false;
+	m_bApplied = true;
+	m_Result.clear();
+
+	if (schedule.priority == PRIORITY_REALTIME) {
+		// Above normal threads of other processes, below kernel threads
+		param.sched_priority = std::min(10, sched_get_priority_max(SCHED_FIFO));
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0) {
+			m_Result = "realtime SCHED_FIFO";
+		}
+		else {
+			m_Result = "realtime not permitted";
+			bResult = false;
+		}
+	}
+	else if (schedule.priority != PRIORITY_NORMAL) {
+		int nice = schedule.priority == PRIORITY_HIGH ? -5 : -10;
+		if (setpriority(PRIO_PROCESS, GetThreadId(), nice) == 0) {
+			snprintf(tmp, 64, "%s nice %d", GetPriorityName(schedule.priority), nice);
+			m_Result = tmp;
+			m_bNice = true;
+		}
+		else {
+			m_Result = std::string(GetPriorityName(schedule.priority)) + " not permitted";
+			bResult = false;
+		}
+	}
+	else {
+		m_Result = "normal";
+	}
+
+	if (schedule.affinity) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+			if (schedule.affinity & ((uint64_t)1 << i))
+				CPU_SET(i, &set);
+		}
+		pthread_getaffinity_np(pthread_self(), sizeof(m_CpuSet), &m_CpuSet);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+			snprintf(tmp, 64, ", cores 0x%llx", (unsigned long long)schedule.affinity);
+			m_Result += tmp;
+			m_bAffinity = true;
+		}
+		else {
+			m_Result += ", affinity failed";
+			bResult = false;
+		}
+	}
+
+	if (schedule.bMmcss)
+		m_Result += ", MMCSS not available";
+
+	return bResult;
+}
+
+void ThreadScheduler::Revert()
+{
+	if (!m_bApplied)
+		return;
+	sched_param param{};
+	param.sched_priority = m_SchedPriority;
+	pthread_setschedparam(pthread_self(), m_Policy, &param);
+	if (m_bNice)
+		setpriority(PRIO_PROCESS, GetThreadId(), m_Nice);
+	if (m_bAffinity)
+		pthread_setaffinity_np(pthread_self(), sizeof(m_CpuSet), &m_CpuSet);
+	m_bNice = false;
+	m_bAffinity = false;
+	m_bApplied = false;
+}
+
+#endif
+
+std::string ThreadScheduler::GetResult() const
+{
+	return m_Result;
+}
+
+bool ParseCores(const std::string& cores, uint64_t& mask)
+{
+	uint64_t result = 0;
+	size_t pos = 0;
+	while (pos <= cores.size()) {
+		size_t end = cores.find(',', pos);
+		if (end == std::string::npos)
+			end = cores.size();
+		std::string item = cores.substr(pos, end - pos);
+		pos = end + 1;
+
+		// "n" or "first-last"
+		char* next = nullptr;
+		long first = strtol(item.c_str(), &next, 10);
+		long last = first;
+		if (next == item.c_str())
+			return false;
+		while (*next == ' ') next++;
+		if (*next == '-') {
+			const char* start = next + 1;
+			last = strtol(start, &next, 10);
+			if (next == start)
+				return false;
+			while (*next == ' ') next++;
+		}
+		if (*next != 0 || first < 0 || last < first || last > 63)
+			return false;
+		for (long i = first; i <= last; i++)
+			result |= (uint64_t)1 << i;
+	}
+	mask = result;
+	return true;
+}
+
+bool ParsePriority(const std::string& name, ThreadPriority& priority)
+{
+	for (int i = PRIORITY_NORMAL; i <= PRIORITY_REALTIME; i++) {
+		if (name == GetPriorityName((ThreadPriority)i)) {
+			priority = (ThreadPriority)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* GetPriorityName(ThreadPriority priority)
+{
+	const char* names[] = { "normal", "high", "highest", "realtime" };
+	return (priority >= PRIORITY_NORMAL && priority <= PRIORITY_REALTIME) ? names[priority] : "normal";
+}
+
+CaptureStats MeasureJitter(const ThreadSchedule& schedule, double period, double duration,
+	unsigned int load, std::string* result)
+{
+	if (load == 0)
+		load = std::max(1u, std::thread::hardware_concurrency());
+	CaptureStats lateness((unsigned int)std::max(1.0, duration / period));
+
+	// Keep every core busy
+	std::atomic<bool> bStop{ false };
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < load; i++) {
+		threads.emplace_back([&bStop]() {
+			volatile double x = 1.0;
+			while (!bStop.load(std::memory_order_relaxed)) {
+				for (int j = 0; j < 1000; j++)
+					x = x*1.0000001 + 1e-9;
+			}
+		});
+	}
+
+#ifdef _WIN32
+	// 1 msec sleep resolution
+	timeBeginPeriod(1);
+#endif
+
+	std::thread probe([&]() {
+		ThreadScheduler scheduler;
+		scheduler.Apply(schedule);
+		if (result)
+			*result = scheduler.GetResult();
+		double next = CaptureStats::Now();
+		double end = next + duration;
+		while ((next += period) <= end) {
+			double wait = next - CaptureStats::Now();
+			if (wait > 0.0)
+				std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
+			lateness.AddSample(CaptureStats::Now() - next);
+		}
+	});
+	probe.join();
+
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+
+	bStop = true;
+	for (auto& thread : threads)
+		thread.join();
+
+	return lateness;
+}
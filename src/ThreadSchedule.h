@@ -0,0 +1,96 @@
+//
+//	ThreadSchedule
+//
+//	Priority and processor affinity for the capture and worker threads.
+//
+//	Windows :
+//		Thread priority from above normal to time critical, affinity mask,
+//		and optional registration with the Multimedia Class Scheduler
+//		Service as a "Capture" task, which raises the priority of the
+//		thread while it is active without starving the rest of the system.
+//
+//	Linux :
+//		Realtime uses SCHED_FIFO. Other levels lower the nice value of the
+//		thread. Both need CAP_SYS_NICE, or an rlimit allowing it, so on a
+//		stock system they fall back to normal and the result says so.
+//		Affinity is always available.
+//
+//	A schedule is applied to the thread that calls Apply and is
+//	reverted by the same thread with Revert or when destroyed.
+//
+//	MeasureJitter shows the effect. A thread with the schedule waits
+//	for a fixed period while other threads load every core, and the
+//	lateness of each wake is recorded.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include "CaptureStats.h"
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
+enum ThreadPriority {
+	PRIORITY_NORMAL,
+	PRIORITY_HIGH,
+	PRIORITY_HIGHEST,
+	PRIORITY_REALTIME
+};
+
+struct ThreadSchedule {
+	ThreadPriority priority = PRIORITY_NORMAL;
+	uint64_t affinity = 0; // One bit for each core, 0 for any
+	bool bMmcss = false;   // Windows "Capture" task
+	bool IsDefault() const;
+};
+
+class ThreadScheduler {
+
+public:
+
+	ThreadScheduler();
+	~ThreadScheduler();
+
+	// Returns false if any part of the schedule could not be applied.
+	// The parts that could are kept.
+	bool Apply(const ThreadSchedule& schedule);
+	void Revert();
+
+	// What was applied, e.g. "high, cores 0x3, MMCSS Capture"
+	std::string GetResult() const;
+
+private:
+
+	bool m_bApplied = false;
+	std::string m_Result;
+#ifdef _WIN32
+	void* m_hThread = nullptr;
+	void* m_hTask = nullptr; // MMCSS
+	int m_Priority = 0;
+	uintptr_t m_Affinity = 0;
+#else
+	int m_Policy = 0;
+	int m_SchedPriority = 0;
+	int m_Nice = 0;
+	bool m_bNice = false;
+	bool m_bAffinity = false;
+	cpu_set_t m_CpuSet;
+#endif
+
+};
+
+// Cores as "0,2-3" to an affinity mask. Returns false if invalid.
+bool ParseCores(const std::string& cores, uint64_t& mask);
+// Priority names "normal", "high", "highest", "realtime"
+bool ParsePriority(const std::string& name, ThreadPriority& priority);
+const char* GetPriorityName(ThreadPriority priority);
+
+// Wake lateness in msec of a thread with the schedule waiting for
+// period msec, for duration msec, with load threads busy (0 for one
+// for each core). The result of applying the schedule is optional.
+CaptureStats MeasureJitter(const ThreadSchedule& schedule, double period, double duration,
+	unsigned int load = 0, std::string* result = nullptr);
@@ -0,0 +1,428 @@
+//
+//	TileCodec
+//
+//	Tile delta encoding of frames for streaming.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "TileCodec.h"
+
+#include <algorithm>
+#include <string.h>
+
+//
+// LZ block format
+//
+// A sequence of :
+//		token : high 4 bits literal length, low 4 bits match length - 4
+//		        a value of 15 is followed by bytes of 255 and a final byte < 255
+//		literals
+//		offset : 2 bytes, back from the current position
+//		match length continuation bytes
+// The last sequence has literals only and ends the block.
+//
+#define LZ_MINMATCH   4
+#define LZ_HASHBITS   14
+#define LZ_MAXOFFSET  65535
+#define LZ_LASTLITERALS 8 // Bytes at the end always sent as literals
+
+static inline uint32_t LZRead32(const unsigned char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint32_t LZHash(uint32_t v)
+{
+	return (v*2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+static inline unsigned char* LZWriteLength(unsigned char* op, unsigned int length)
+{
+	for (; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+unsigned int LZCompressBound(unsigned int size)
+{
+	return size + size/255 + 16;
+}
+
+unsigned int LZCompress(const unsigned char* src, unsigned int size, unsigned char* dst)
+{
+	std::vector<uint32_t> table((size_t)1 << LZ_HASHBITS, 0);
+	const unsigned char* ip = src;
+	const unsigned char* anchor = src;
+	const unsigned char* end = src + size;
+	const unsigned char* limit = (size > LZ_LASTLITERALS + LZ_MINMATCH) ? end - LZ_LASTLITERALS : src;
+	unsigned char* op = dst;
+
+	while (ip < limit) {
+
+		uint32_t sequence = LZRead32(ip);
+		uint32_t h = LZHash(sequence);
+		const unsigned char* ref = src + table[h];
+		table[h] = (uint32_t)(ip - src);
+
+		if (ref >= ip || ip - ref > LZ_MAXOFFSET || LZRead32(ref) != sequence) {
+			ip++;
+			continue;
+		}
+
+		// Extend the match
+		const unsigned char* mp = ip + LZ_MINMATCH;
+		const unsigned char* rp = ref + LZ_MINMATCH;
+		while (mp < limit && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		unsigned int literals = (unsigned int)(ip - anchor);
+		unsigned int match = (unsigned int)(mp - ip) - LZ_MINMATCH;
+		unsigned int offset = (unsigned int)(ip - ref);
+
+		unsigned char* token = op++;
+		*token = (unsigned char)((std::min(literals, 15U) << 4) | std::min(match, 15U));
+		if (literals >= 15)
+			op = LZWriteLength(op, literals - 15);
+		memcpy(op, anchor, literals);
+		op += literals;
+		*op++ = (unsigned char)(offset & 0xFF);
+		*op++ = (unsigned char)(offset >> 8);
+		if (match >= 15)
+			op = LZWriteLength(op, match - 15);
+
+		ip = mp;
+		anchor = ip;
+	}
+
+	// Last literals
+	unsigned int literals = (unsigned int)(end - anchor);
+	*op++ = (unsigned char)(std::min(literals, 15U) << 4);
+	if (literals >= 15)
+		op = LZWriteLength(op, literals - 15);
+	memcpy(op, anchor, literals);
+	op += literals;
+
+	return (unsigned int)(op - dst);
+}
+
+int LZDecompress(const unsigned char* src, unsigned int size, unsigned char* dst, unsigned int capacity)
+{
+	const unsigned char* ip = src;
+	const unsigned char* end = src + size;
+	unsigned char* op = dst;
+	unsigned char* oend = dst + capacity;
+
+	while (ip < end) {
+
+		unsigned int token = *ip++;
+
+		// Literals
+		size_t literals = token >> 4;
+		if (literals == 15) {
+			unsigned int b;
+			do {
+				if (ip >= end) return -1;
+				b = *ip++;
+				literals += b;
+			} while (b == 255);
+		}
+		if (literals > (size_t)(end - ip) || literals > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+
+		// The last sequence has no match
+		if (ip >= end)
+			break;
+
+		// Match
+		if (end - ip < 2) return -1;
+		size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		size_t match = token & 15;
+		if (match == 15) {
+			unsigned int b;
+			do {
+				if (ip >= end) return -1;
+				b = *ip++;
+				match += b;
+			} while (b == 255);
+		}
+		match += LZ_MINMATCH;
+		if (offset == 0 || offset > (size_t)(op - dst) || match > (size_t)(oend - op))
+			return -1;
+
+		// Byte copy because the match can overlap
+		const unsigned char* ref = op - offset;
+		if (offset >= match) {
+			memcpy(op, ref, match);
+			op += match;
+		}
+		else {
+			for (size_t i = 0; i < match; i++)
+				*op++ = *ref++;
+		}
+	}
+
+	return (int)(op - dst);
+}
+
+//
+// TileEncoder
+//
+
+void TileEncoder::Gather(const unsigned char* pixels, unsigned int pitch, const TileMap& map,
+	uint32_t frame, double timestamp, bool bKey)
+{
+	unsigned int tileSize = map.GetTileSize();
+	unsigned int cols = map.GetCols();
+	unsigned int rows = map.GetRows();
+
+	m_Header = TileFrameHeader{};
+	m_Header.magic = TILEFRAME_MAGIC;
+	m_Header.version = TILEFRAME_VERSION;
+	m_Header.frame = frame;
+	m_Header.flags = bKey ? TILEFRAME_KEY : 0;
+	m_Header.timestamp = timestamp;
+	m_Header.width = map.GetWidth();
+	m_Header.height = map.GetHeight();
+	m_Header.tileSize = tileSize;
+
+	// Moves, not needed for a key frame
+	unsigned int moves = bKey ? 0 : (unsigned int)map.GetMoves().size();
+	size_t moveSize = (size_t)moves*sizeof(TileMove);
+
+	// Tile indices
+	unsigned int tiles = bKey ? cols*rows : map.GetChangedCount();
+	m_Raw.resize(moveSize + (size_t)tiles*4);
+	if (moves > 0)
+		memcpy(m_Raw.data(), map.GetMoves().data(), moveSize);
+	unsigned char* indices = m_Raw.data() + moveSize;
+	size_t pixelsize = 0;
+	for (unsigned int row = 0; row < rows; row++) {
+		for (unsigned int col = 0; col < cols; col++) {
+			if (bKey || map.IsChanged(col, row)) {
+				uint32_t index = row*cols + col;
+				memcpy(indices, &index, 4);
+				indices += 4;
+				unsigned int w = std::min(tileSize, m_Header.width - col*tileSize);
+				unsigned int h = std::min(tileSize, m_Header.height - row*tileSize);
+				pixelsize += (size_t)w*h*4;
+			}
+		}
+	}
+
+	// Tile pixels
+	m_Raw.resize(moveSize + (size_t)tiles*4 + pixelsize);
+	unsigned char* dst = m_Raw.data() + moveSize + (size_t)tiles*4;
+	for (unsigned int i = 0; i < tiles; i++) {
+		uint32_t index;
+		memcpy(&index, m_Raw.data() + moveSize + (size_t)i*4, 4);
+		unsigned int x = (index % cols)*tileSize;
+		unsigned int y = (index / cols)*tileSize;
+		unsigned int w = std::min(tileSize, m_Header.width - x);
+		unsigned int h = std::min(tileSize, m_Header.height - y);
+		const unsigned char* src = pixels + (size_t)y*pitch + (size_t)x*4;
+		for (unsigned int j = 0; j < h; j++) {
+			memcpy(dst, src, (size_t)w*4);
+			dst += (size_t)w*4;
+			src += pitch;
+		}
+	}
+
+	m_Header.tiles = tiles;
+	m_Header.moves = moves;
+	m_Header.rawSize = (uint32_t)m_Raw.size();
+}
+
+const std::vector<unsigned char>& TileEncoder::Pack()
+{
+	m_Message.resize(sizeof(TileFrameHeader) + LZCompressBound((unsigned int)m_Raw.size()));
+	m_Header.packedSize = LZCompress(m_Raw.data(), (unsigned int)m_Raw.size(),
+		m_Message.data() + sizeof(TileFrameHeader));
+	memcpy(m_Message.data(), &m_Header, sizeof(TileFrameHeader));
+	m_Message.resize(sizeof(TileFrameHeader) + m_Header.packedSize);
+	return m_Message;
+}
+
+const std::vector<unsigned char>& TileEncoder::Encode(const unsigned char* pixels, unsigned int pitch,
+	const TileMap& map, uint32_t frame, double timestamp, bool bKey)
+{
+	Gather(pixels, pitch, map, frame, timestamp, bKey);
+	return Pack();
+}
+
+unsigned int TileEncoder::GetTiles() const
+{
+	return m_Header.tiles;
+}
+
+unsigned int TileEncoder::GetRawSize() const
+{
+	return m_Header.rawSize;
+}
+
+//
+// TileDecoder
+//
+
+bool TileDecoder::Decode(const unsigned char* message, unsigned int size)
+{
+	TileFrameHeader header{};
+	if (!message || size < sizeof(TileFrameHeader))
+		return false;
+	memcpy(&header, message, sizeof(TileFrameHeader));
+	if (header.magic != TILEFRAME_MAGIC || header.version != TILEFRAME_VERSION
+		|| header.packedSize > size - sizeof(TileFrameHeader))
+		return false;
+	// Sizes from the message are limited before anything is allocated
+	if (header.width == 0 || header.height == 0 || header.width > m_MaxWidth || header.height > m_MaxHeight
+		|| header.tileSize < TILEFRAME_MIN_TILE || header.tileSize > TILEFRAME_MAX_TILE)
+		return false;
+
+	bool bKey = (header.flags & TILEFRAME_KEY) != 0;
+	if (!bKey && (!m_bKey || header.width != m_Header.width || header.height != m_Header.height
+		|| header.tileSize != m_Header.tileSize)) {
+		// Wait for a key frame
+		return false;
+	}
+
+	unsigned int tileSize = header.tileSize;
+	unsigned int cols = (header.width + tileSize - 1)/tileSize;
+	unsigned int rows = (header.height + tileSize - 1)/tileSize;
+	size_t moveSize = (size_t)header.moves*sizeof(TileMove);
+	if ((uint64_t)header.tiles > (uint64_t)cols*rows || header.moves > TILEMAP_MOVES
+		|| (bKey && header.moves > 0) || header.rawSize < (uint64_t)header.tiles*4 + moveSize)
+		return false;
+	// Tiles are clipped to the frame, so their pixels are no more than the frame
+	if ((uint64_t)header.rawSize > moveSize + (uint64_t)header.tiles*4 + (uint64_t)header.width*header.height*4
+		|| header.packedSize > LZCompressBound(header.rawSize))
+		return false;
+
+	m_Raw.resize(header.rawSize);
+	int raw = LZDecompress(message + sizeof(TileFrameHeader), header.packedSize, m_Raw.data(), header.rawSize);
+	if (raw != (int)header.rawSize)
+		return false;
+
+	if (bKey && (header.width != m_Header.width || header.height != m_Header.height || m_Pixels.empty()))
+		m_Pixels.assign((size_t)header.width*header.height*4, 0);
+
+	// From here the frame is modified. If the tiles are
+	// not all valid, wait for the next key frame.
+	m_Header = header;
+	m_bKey = false;
+
+	size_t pitch = (size_t)header.width*4;
+	if (header.moves > 0 && !ApplyMoves(m_Raw.data(), header.moves))
+		return false;
+
+	const unsigned char* indices = m_Raw.data() + moveSize;
+	const unsigned char* src = indices + (size_t)header.tiles*4;
+	const unsigned char* end = m_Raw.data() + m_Raw.size();
+	for (unsigned int i = 0; i < header.tiles; i++) {
+		uint32_t index;
+		memcpy(&index, indices + (size_t)i*4, 4);
+		if (index >= cols*rows)
+			return false; // Wait for a key frame
+		unsigned int x = (index % cols)*tileSize;
+		unsigned int y = (index / cols)*tileSize;
+		unsigned int w = std::min(tileSize, header.width - x);
+		unsigned int h = std::min(tileSize, header.height - y);
+		if ((size_t)(end - src) < (size_t)w*h*4)
+			return false;
+		unsigned char* dst = m_Pixels.data() + (size_t)y*pitch + (size_t)x*4;
+		for (unsigned int j = 0; j < h; j++) {
+			memcpy(dst, src, (size_t)w*4);
+			src += (size_t)w*4;
+			dst += pitch;
+		}
+	}
+
+	m_bKey = true;
+	return true;
+}
+
+void TileDecoder::SetMaximumSize(unsigned int width, unsigned int height)
+{
+	m_MaxWidth = std::min(std::max(width, 1u), (unsigned int)TILEFRAME_MAX_SIZE);
+	m_MaxHeight = std::min(std::max(height, 1u), (unsigned int)TILEFRAME_MAX_SIZE);
+}
+
+unsigned int TileDecoder::GetMaximumMessage() const
+{
+	unsigned int cols = (m_MaxWidth + TILEFRAME_MIN_TILE - 1)/TILEFRAME_MIN_TILE;
+	unsigned int rows = (m_MaxHeight + TILEFRAME_MIN_TILE - 1)/TILEFRAME_MIN_TILE;
+	unsigned int raw = TILEMAP_MOVES*(unsigned int)sizeof(TileMove) + cols*rows*4 + m_MaxWidth*m_MaxHeight*4;
+	return (unsigned int)sizeof(TileFrameHeader) + LZCompressBound(raw);
+}
+
+// Copy the moved rectangles of the previous frame
+bool TileDecoder::ApplyMoves(const unsigned char* data, unsigned int count)
+{
+	int width = (int)m_Header.width;
+	int height = (int)m_Header.height;
+	size_t pitch = (size_t)width*4;
+	std::vector<TileMove> moves(count);
+	memcpy(moves.data(), data, (size_t)count*sizeof(TileMove));
+	for (const TileMove& m : moves) {
+		if (m.left < std::max(0, m.dx) || m.top < std::max(0, m.dy)
+			|| m.right > std::min(width, width + m.dx) || m.bottom > std::min(height, height + m.dy)
+			|| m.left >= m.right || m.top >= m.bottom)
+			return false;
+	}
+
+	// In place, in an order that reads each line before it is replaced.
+	// Moves do not overlap each other (TileMap::AddMove).
+	unsigned char* pixels = m_Pixels.data();
+	for (const TileMove& m : moves) {
+		size_t bytes = (size_t)(m.right - m.left)*4;
+		for (int i = 0; i < m.bottom - m.top; i++) {
+			int y = m.dy > 0 ? m.bottom - 1 - i : m.top + i;
+			memmove(pixels + (size_t)y*pitch + (size_t)m.left*4,
+				pixels + (size_t)(y - m.dy)*pitch + (size_t)(m.left - m.dx)*4, bytes);
+		}
+	}
+	return true;
+}
+
+const unsigned char* TileDecoder::GetPixels() const
+{
+	return m_Pixels.data();
+}
+
+unsigned int TileDecoder::GetWidth() const
+{
+	return m_Header.width;
+}
+
+unsigned int TileDecoder::GetHeight() const
+{
+	return m_Header.height;
+}
+
+uint32_t TileDecoder::GetFrame() const
+{
+	return m_Header.frame;
+}
+
+double TileDecoder::GetTimestamp() const
+{
+	return m_Header.timestamp;
+}
+
+unsigned int TileDecoder::GetTiles() const
+{
+	return m_Header.tiles;
+}
+
+unsigned int TileDecoder::GetMoves() const
+{
+	return m_Header.moves;
+}
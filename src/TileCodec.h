@@ -0,0 +1,126 @@
+//
+//	TileCodec
+//
+//	Tile delta encoding of frames for streaming.
+//
+//	Only the tiles marked in a TileMap are sent. The tile pixels
+//	are compressed together with a fast LZ77 block compressor.
+//	A key frame contains every tile and is sent when a receiver
+//	connects or the frame size changes.
+//
+//	The moves of the map (a scroll) are sent with a delta frame and
+//	applied to the previous frame in place before the tiles.
+//
+//	Message (little-endian) :
+//		TileFrameHeader
+//		packedSize bytes, LZ compressed :
+//			moves x TileMove
+//			tiles x uint32_t tile index (row*cols + col)
+//			tile pixels in index order, each tile row by row,
+//			4 bytes per pixel, clipped at the right and bottom edges
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "TileMap.h"
+
+#define TILEFRAME_MAGIC   0x52465453 // "STFR"
+#define TILEFRAME_VERSION 2
+#define TILEFRAME_KEY     0x01 // Every tile is included
+
+// Largest width and height a decoder accepts by default, and tile sizes.
+// A message is checked against them before anything is allocated.
+#define TILEFRAME_MAX_SIZE 8192
+#define TILEFRAME_MIN_TILE 8
+#define TILEFRAME_MAX_TILE 1024
+
+struct TileFrameHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frame;
+	uint32_t flags;
+	double timestamp;    // Capture time, msec monotonic clock
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t tiles;      // Number of tiles in the message
+	uint32_t rawSize;    // Payload size before compression
+	uint32_t packedSize; // Payload size after compression
+	uint32_t moves;      // Number of moves, before the tiles
+	uint32_t reserved;
+};
+
+//
+// LZ block compression
+//
+// Worst case compressed size
+unsigned int LZCompressBound(unsigned int size);
+// Returns the compressed size
+unsigned int LZCompress(const unsigned char* src, unsigned int size, unsigned char* dst);
+// Returns the decompressed size or -1 if the data is invalid
+int LZDecompress(const unsigned char* src, unsigned int size, unsigned char* dst, unsigned int capacity);
+
+class TileEncoder {
+
+public:
+
+	// Copy the changed tiles of a 4 byte per pixel frame.
+	// The copy can be made while the frame is locked
+	// and compressed afterwards with Pack.
+	void Gather(const unsigned char* pixels, unsigned int pitch, const TileMap& map,
+		uint32_t frame, double timestamp, bool bKey);
+	// Compress the gathered tiles into a message
+	const std::vector<unsigned char>& Pack();
+	// Both of the above
+	const std::vector<unsigned char>& Encode(const unsigned char* pixels, unsigned int pitch,
+		const TileMap& map, uint32_t frame, double timestamp, bool bKey);
+
+	unsigned int GetTiles() const;
+	unsigned int GetRawSize() const;
+
+private:
+
+	TileFrameHeader m_Header{};
+	std::vector<unsigned char> m_Raw;
+	std::vector<unsigned char> m_Message;
+
+};
+
+class TileDecoder {
+
+public:
+
+	// Apply a message to the frame.
+	// Returns false if the message is invalid or a delta
+	// arrives before a key frame.
+	bool Decode(const unsigned char* message, unsigned int size);
+
+	// Largest frame accepted, default TILEFRAME_MAX_SIZE square
+	void SetMaximumSize(unsigned int width, unsigned int height);
+	// Largest valid message for a frame of the maximum size
+	unsigned int GetMaximumMessage() const;
+
+	const unsigned char* GetPixels() const; // 4 bytes per pixel, pitch width*4
+	unsigned int GetWidth() const;
+	unsigned int GetHeight() const;
+	uint32_t GetFrame() const;
+	double GetTimestamp() const;
+	unsigned int GetTiles() const; // Tiles in the last message
+	unsigned int GetMoves() const; // Moves in the last message
+
+private:
+
+	TileFrameHeader m_Header{};
+	std::vector<unsigned char> m_Pixels;
+	std::vector<unsigned char> m_Raw;
+	bool m_bKey = false; // A key frame has been received
+	unsigned int m_MaxWidth = TILEFRAME_MAX_SIZE;
+	unsigned int m_MaxHeight = TILEFRAME_MAX_SIZE;
+
+	bool ApplyMoves(const unsigned char* data, unsigned int count);
+
+};
@@ -0,0 +1,353 @@
+//
+//	TileMap
+//
+//	Per-frame map of changed tiles.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "TileMap.h"
+#include "TileCodec.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TILEMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+bool TileSpanDiffers(const unsigned char* a, const unsigned char* b, unsigned int bytes)
+{
+#ifdef TILEMAP_SSE2
+	// 64 bytes per step, 16 pixels
+	unsigned int i = 0;
+	for (; i + 64 <= bytes; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)), _mm_loadu_si128((const __m128i*)(b + i + 16)));
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 32)), _mm_loadu_si128((const __m128i*)(b + i + 32)));
+		__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 48)), _mm_loadu_si128((const __m128i*)(b + i + 48)));
+		__m128i e = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+		if (_mm_movemask_epi8(e) != 0xFFFF)
+			return true;
+	}
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i e = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+		if (_mm_movemask_epi8(e) != 0xFFFF)
+			return true;
+	}
+	return (i < bytes) && memcmp(a + i, b + i, bytes - i) != 0;
+#else
+	return memcmp(a, b, bytes) != 0;
+#endif
+}
+
+TileMap::TileMap(unsigned int tileSize)
+{
+	m_TileSize = tileSize > 0 ? tileSize : 64;
+}
+
+void TileMap::Resize(unsigned int width, unsigned int height)
+{
+	m_Width = width;
+	m_Height = height;
+	m_Cols = (width + m_TileSize - 1)/m_TileSize;
+	m_Rows = (height + m_TileSize - 1)/m_TileSize;
+	m_Stride = (m_Cols + 7)/8;
+	m_Bits.assign(m_Stride*m_Rows, 0);
+	SetAll();
+}
+
+unsigned int TileMap::GetWidth() const
+{
+	return m_Width;
+}
+
+unsigned int TileMap::GetHeight() const
+{
+	return m_Height;
+}
+
+unsigned int TileMap::GetTileSize() const
+{
+	return m_TileSize;
+}
+
+unsigned int TileMap::GetCols() const
+{
+	return m_Cols;
+}
+
+unsigned int TileMap::GetRows() const
+{
+	return m_Rows;
+}
+
+void TileMap::Clear()
+{
+	std::fill(m_Bits.begin(), m_Bits.end(), (uint8_t)0);
+	m_Moves.clear();
+}
+
+void TileMap::SetAll()
+{
+	Clear();
+	for (unsigned int row = 0; row < m_Rows; row++) {
+		for (unsigned int col = 0; col < m_Cols; col++)
+			MarkTile(col, row);
+	}
+}
+
+// Whether the destination of a, offset by (-dx, -dy), overlaps the destination of b
+static bool MovesOverlap(const TileMove& a, const TileMove& b, int dx, int dy)
+{
+	return a.left - dx < b.right && b.left < a.right - dx && a.top - dy < b.bottom && b.top < a.bottom - dy;
+}
+
+void TileMap::AddMove(const TileMove& move)
+{
+	if (move.dx == 0 && move.dy == 0)
+		return;
+
+	// Clip the destination so that the source is also in the frame
+	TileMove clipped = move;
+	clipped.left = std::max({ move.left, 0, move.dx });
+	clipped.top = std::max({ move.top, 0, move.dy });
+	clipped.right = std::min({ move.right, (int)m_Width, (int)m_Width + move.dx });
+	clipped.bottom = std::min({ move.bottom, (int)m_Height, (int)m_Height + move.dy });
+	if (clipped.left >= clipped.right || clipped.top >= clipped.bottom) {
+		MarkRect(move.left, move.top, move.right, move.bottom);
+		return;
+	}
+
+	bool bAdd = m_Moves.size() < TILEMAP_MOVES;
+	// Moves may be applied in any order if none overlaps
+	// the source or destination of another
+	for (const TileMove& m : m_Moves) {
+		if (MovesOverlap(clipped, m, 0, 0) || MovesOverlap(clipped, m, clipped.dx, clipped.dy)
+			|| MovesOverlap(clipped, m, -m.dx, -m.dy))
+			bAdd = false;
+	}
+	if (!bAdd) {
+		MarkRect(move.left, move.top, move.right, move.bottom);
+		return;
+	}
+
+	m_Moves.push_back(clipped);
+	// The part with a source outside the frame
+	if (clipped.left != move.left || clipped.top != move.top
+		|| clipped.right != move.right || clipped.bottom != move.bottom) {
+		MarkRect(move.left, move.top, move.right, clipped.top);
+		MarkRect(move.left, clipped.bottom, move.right, move.bottom);
+		MarkRect(move.left, clipped.top, clipped.left, clipped.bottom);
+		MarkRect(clipped.right, clipped.top, move.right, clipped.bottom);
+	}
+}
+
+const std::vector<TileMove>& TileMap::GetMoves() const
+{
+	return m_Moves;
+}
+
+void TileMap::MarkRect(int left, int top, int right, int bottom)
+{
+	left = std::max(left, 0);
+	top = std::max(top, 0);
+	right = std::min(right, (int)m_Width);
+	bottom = std::min(bottom, (int)m_Height);
+	if (left >= right || top >= bottom)
+		return;
+
+	unsigned int col0 = (unsigned int)left/m_TileSize;
+	unsigned int col1 = (unsigned int)(right - 1)/m_TileSize;
+	unsigned int row0 = (unsigned int)top/m_TileSize;
+	unsigned int row1 = (unsigned int)(bottom - 1)/m_TileSize;
+	for (unsigned int row = row0; row <= row1; row++) {
+		for (unsigned int col = col0; col <= col1; col++)
+			MarkTile(col, row);
+	}
+}
+
+void TileMap::MarkTile(unsigned int col, unsigned int row)
+{
+	if (col < m_Cols && row < m_Rows)
+		m_Bits[row*m_Stride + col/8] |= (uint8_t)(1 << (col & 7));
+}
+
+bool TileMap::IsChanged(unsigned int col, unsigned int row) const
+{
+	if (col >= m_Cols || row >= m_Rows)
+		return false;
+	return (m_Bits[row*m_Stride + col/8] & (1 << (col & 7))) != 0;
+}
+
+unsigned int TileMap::GetChangedCount() const
+{
+	unsigned int count = 0;
+	for (uint8_t bits : m_Bits) {
+		for (; bits; bits &= (uint8_t)(bits - 1))
+			count++;
+	}
+	return count;
+}
+
+unsigned int TileMap::Compare(const unsigned char* previous, const unsigned char* current, unsigned int pitch)
+{
+	std::fill(m_Bits.begin(), m_Bits.end(), (uint8_t)0);
+	if (!previous || !current)
+		return 0;
+
+	unsigned int count = 0;
+	for (unsigned int row = 0; row < m_Rows; row++) {
+		unsigned int y0 = row*m_TileSize;
+		unsigned int y1 = std::min(y0 + m_TileSize, m_Height);
+		// Compare line by line through the band of tiles so that memory is
+		// read in order, and stop comparing a tile once it has changed.
+		unsigned int unchanged = m_Cols;
+		for (unsigned int y = y0; y < y1 && unchanged > 0; y++) {
+			const unsigned char* a = previous + (size_t)y*pitch;
+			const unsigned char* b = current + (size_t)y*pitch;
+			for (unsigned int col = 0; col < m_Cols; col++) {
+				if (IsChanged(col, row))
+					continue;
+				unsigned int x0 = col*m_TileSize;
+				unsigned int x1 = std::min(x0 + m_TileSize, m_Width);
+				bool bDiffers = m_Moves.empty() ? TileSpanDiffers(a + x0*4, b + x0*4, (x1 - x0)*4)
+					: SpanDiffers(previous, current, pitch, y, x0, x1);
+				if (bDiffers) {
+					MarkTile(col, row);
+					unchanged--;
+					count++;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+// Compare a span of a line with the previous frame after the moves.
+// Parts of the span outside the moves are compared in place.
+bool TileMap::SpanDiffers(const unsigned char* previous, const unsigned char* current, unsigned int pitch,
+	unsigned int y, unsigned int x0, unsigned int x1) const
+{
+	const unsigned char* b = current + (size_t)y*pitch;
+	unsigned int x = x0;
+	while (x < x1) {
+		// The move at x, or up to the next move on this line
+		const TileMove* move = nullptr;
+		unsigned int end = x1;
+		for (const TileMove& m : m_Moves) {
+			if ((int)y < m.top || (int)y >= m.bottom || (int)x >= m.right || (int)end <= m.left)
+				continue;
+			if ((int)x >= m.left) {
+				move = &m;
+				end = std::min(end, (unsigned int)m.right);
+				break;
+			}
+			end = (unsigned int)m.left;
+		}
+		const unsigned char* a = move
+			? previous + (size_t)((int)y - move->dy)*pitch + (size_t)((int)x - move->dx)*4
+			: previous + (size_t)y*pitch + (size_t)x*4;
+		if (TileSpanDiffers(a, b + (size_t)x*4, (end - x)*4))
+			return true;
+		x = end;
+	}
+	return false;
+}
+
+void TileMap::Merge(const TileMap& map)
+{
+	if (map.m_Bits.size() != m_Bits.size()) {
+		SetAll();
+		return;
+	}
+	// Moves are relative to different frames
+	std::vector<TileMove> moves;
+	moves.swap(m_Moves);
+	moves.insert(moves.end(), map.m_Moves.begin(), map.m_Moves.end());
+	for (const TileMove& m : moves)
+		MarkRect(m.left, m.top, m.right, m.bottom);
+	for (size_t i = 0; i < m_Bits.size(); i++)
+		m_Bits[i] |= map.m_Bits[i];
+}
+
+unsigned int TileMap::GetDataSize() const
+{
+	return (unsigned int)(sizeof(TileMapHeader) + m_Bits.size() + TILEMAP_MOVES*sizeof(TileMove));
+}
+
+void TileMap::Write(unsigned char* data, uint32_t frame) const
+{
+	TileMapHeader header{};
+	header.magic = TILEMAP_MAGIC;
+	header.version = TILEMAP_VERSION;
+	header.frame = frame;
+	header.width = m_Width;
+	header.height = m_Height;
+	header.tileSize = m_TileSize;
+	header.cols = m_Cols;
+	header.rows = m_Rows;
+	header.stride = m_Stride;
+	header.changed = GetChangedCount();
+	header.moves = (uint32_t)m_Moves.size();
+	memcpy(data, &header, sizeof(TileMapHeader));
+	if (!m_Bits.empty())
+		memcpy(data + sizeof(TileMapHeader), m_Bits.data(), m_Bits.size());
+	unsigned char* moves = data + sizeof(TileMapHeader) + m_Bits.size();
+	memset(moves, 0, TILEMAP_MOVES*sizeof(TileMove));
+	if (!m_Moves.empty())
+		memcpy(moves, m_Moves.data(), m_Moves.size()*sizeof(TileMove));
+}
+
+bool TileMap::Read(const unsigned char* data, unsigned int size, uint32_t* frame)
+{
+	TileMapHeader header{};
+	if (!data || size < sizeof(TileMapHeader))
+		return false;
+	memcpy(&header, data, sizeof(TileMapHeader));
+	if (header.magic != TILEMAP_MAGIC || header.version != TILEMAP_VERSION)
+		return false;
+
+	// Sizes from the buffer are limited as the stream decoder limits them,
+	// and checked before this map is changed
+	if (header.width == 0 || header.height == 0
+		|| header.width > TILEFRAME_MAX_SIZE || header.height > TILEFRAME_MAX_SIZE
+		|| header.tileSize < TILEFRAME_MIN_TILE || header.tileSize > TILEFRAME_MAX_TILE)
+		return false;
+	uint32_t cols = (header.width + header.tileSize - 1)/header.tileSize;
+	uint32_t rows = (header.height + header.tileSize - 1)/header.tileSize;
+	uint32_t stride = (cols + 7)/8;
+	size_t bits = (size_t)stride*rows;
+	if (header.cols != cols || header.rows != rows || header.stride != stride
+		|| header.moves > TILEMAP_MOVES
+		|| size < sizeof(TileMapHeader) + bits + TILEMAP_MOVES*sizeof(TileMove))
+		return false;
+
+	// Moves in the frame, as AddMove would clip them
+	std::vector<TileMove> moves;
+	const unsigned char* src = data + sizeof(TileMapHeader) + bits;
+	for (uint32_t i = 0; i < header.moves; i++) {
+		TileMove m;
+		memcpy(&m, src + i*sizeof(TileMove), sizeof(TileMove));
+		if (m.left < std::max(0, m.dx) || m.top < std::max(0, m.dy)
+			|| m.right > std::min((int)header.width, (int)header.width + m.dx)
+			|| m.bottom > std::min((int)header.height, (int)header.height + m.dy)
+			|| m.left >= m.right || m.top >= m.bottom)
+			return false;
+		moves.push_back(m);
+	}
+
+	m_TileSize = header.tileSize;
+	Resize(header.width, header.height);
+	if (!m_Bits.empty())
+		memcpy(m_Bits.data(), data + sizeof(TileMapHeader), m_Bits.size());
+	m_Moves = moves;
+	if (frame) *frame = header.frame;
+	return true;
+}
+
+const std::vector<uint8_t>& TileMap::GetBits() const
+{
+	return m_Bits;
+}
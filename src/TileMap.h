@@ -0,0 +1,134 @@
+//
+//	TileMap
+//
+//	Per-frame map of changed tiles.
+//
+//	The frame is divided into square tiles, 64x64 pixels by default,
+//	with one bit for each tile set if any pixel in it has changed.
+//	The map is built from desktop duplication dirty and move rectangles
+//	where they are available, or by comparing with the previous frame
+//	for GDI window capture.
+//
+//	Moves
+//	A scroll moves most of the frame a few pixels. Rather than mark every
+//	tile it touches, the map can hold up to TILEMAP_MOVES rectangles
+//	copied from the previous frame with an offset. Moves are applied to
+//	the previous frame first and then the changed tiles replace their
+//	part of it, so a scroll is a move and the strip it uncovers.
+//	Moves come from duplication move rectangles, or from ScrollDetector
+//	for GDI frames. Moves of two frames cannot be combined, so Merge
+//	marks the moved rectangles as changed instead.
+//
+//	The map is published alongside each frame so that receivers
+//	can process only the tiles that have changed.
+//
+//	Published format (little-endian) :
+//		TileMapHeader
+//		rows x stride bytes, bit (col & 7) of byte [row*stride + col/8]
+//		TILEMAP_MOVES x TileMove, the first "moves" are used
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#define TILEMAP_MAGIC   0x4C495453 // "STIL"
+#define TILEMAP_VERSION 2
+#define TILEMAP_MOVES   8 // Most moves in a map
+
+struct TileMapHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t frame;    // Sender frame number
+	uint32_t width;    // Frame size in pixels
+	uint32_t height;
+	uint32_t tileSize; // Tile width and height in pixels
+	uint32_t cols;     // Tiles across and down
+	uint32_t rows;
+	uint32_t stride;   // Bytes per row of the bitmap
+	uint32_t changed;  // Number of changed tiles
+	uint32_t moves;    // Number of moves
+};
+
+// Pixels of the rectangle (right and bottom exclusive) are copied from
+// the previous frame at (left - dx, top - dy). Content scrolled up by
+// 20 pixels is dy = -20. Both rectangles are within the frame.
+struct TileMove {
+	int32_t left;
+	int32_t top;
+	int32_t right;
+	int32_t bottom;
+	int32_t dx;
+	int32_t dy;
+};
+
+class TileMap {
+
+public:
+
+	TileMap(unsigned int tileSize = 64);
+
+	// Size of the frame in pixels
+	void Resize(unsigned int width, unsigned int height);
+	unsigned int GetWidth() const;
+	unsigned int GetHeight() const;
+	unsigned int GetTileSize() const;
+	unsigned int GetCols() const;
+	unsigned int GetRows() const;
+
+	void Clear(); // No change and no moves
+	void SetAll(); // Everything changed, e.g. a new source or size
+
+	// Add a move from the previous frame. The rectangle is clipped so that
+	// the source and destination are within the frame. If the map has
+	// TILEMAP_MOVES already, or a move that overlaps the source or
+	// destination, the destination is marked as changed instead.
+	void AddMove(const TileMove& move);
+	const std::vector<TileMove>& GetMoves() const;
+
+	// Mark tiles covered by a rectangle in pixels (right and bottom exclusive).
+	// The rectangle is clipped to the frame.
+	void MarkRect(int left, int top, int right, int bottom);
+	void MarkTile(unsigned int col, unsigned int row);
+	bool IsChanged(unsigned int col, unsigned int row) const;
+	unsigned int GetChangedCount() const;
+
+	// Compare two 4 byte per pixel frames of the map size and mark the
+	// tiles that differ from the previous frame after the moves of the map.
+	// Returns the number marked.
+	unsigned int Compare(const unsigned char* previous, const unsigned char* current, unsigned int pitch);
+
+	// Add the changes of another map of the same size.
+	// Moves of either map are marked as changed.
+	void Merge(const TileMap& map);
+
+	// Published data including the header
+	unsigned int GetDataSize() const;
+	void Write(unsigned char* data, uint32_t frame) const;
+	// Read published data, returns false if it is not a tile map
+	bool Read(const unsigned char* data, unsigned int size, uint32_t* frame = nullptr);
+
+	const std::vector<uint8_t>& GetBits() const;
+
+private:
+
+	unsigned int m_TileSize = 64;
+	unsigned int m_Width = 0;
+	unsigned int m_Height = 0;
+	unsigned int m_Cols = 0;
+	unsigned int m_Rows = 0;
+	unsigned int m_Stride = 0;
+	std::vector<uint8_t> m_Bits;
+	std::vector<TileMove> m_Moves;
+
+	bool SpanDiffers(const unsigned char* previous, const unsigned char* current, unsigned int pitch,
+		unsigned int y, unsigned int x0, unsigned int x1) const;
+
+};
+
+// True if a span of bytes differs.
+// SSE2 if available, otherwise memcmp.
+bool TileSpanDiffers(const unsigned char* a, const unsigned char* b, unsigned int bytes);
@@ -19,6 +19,8 @@
 // for window without console
 //========================================================================
 int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPSTR lpCmdLine, _In_ int nShowCmd) {
+	// Startup time includes creating the window and GL context
+	double start = CaptureStats::Now();
 	ofSetupOpenGL(640, 360, OF_WINDOW);			// <-------- setup the GL context
 	// this kicks off the running of my app
 	// can be OF_WINDOW or OF_FULLSCREEN
@@ -29,6 +31,7 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
 	// Allow for app lpCmdLine
 	ofApp* app = new ofApp();
 	app->lpCmdLine = lpCmdLine;
+	app->startupTimer.Start(start);
 	ofRunApp(app); // start the app
 
 }
@@ -46,6 +46,45 @@
 //				  Replace documentation pdf with messagebox.
 //				  VS2022 /MT x64
 //				  Version 2.004
+//	18.10.26	- Add preview options Off, Thumbnail and Full.
+//				  Capture and send timing independent of preview.
+//				  Window texture is only loaded if the preview needs it.
+//				  Desktop texture is only read back for the preview or region.
+//				- Frame pacing with independent desktop and window sender rates.
+//				  Desktop duplication wait limited by the next frame of each sender.
+//				  Region mode reads back only the region between desktop frames.
+//				- Cache the primary output and re-create desktop duplication
+//				  on a background thread with backoff after access is lost.
+//				  Desktop resources re-allocated if the mode has changed size.
+//				  Immediate context is only retrieved once.
+//				- Option to publish a map of changed 64x64 tiles with each frame
+//				  in the sender's shared memory buffer.
+//				- Stream tile delta frames to another process by local socket.
+//				  Reference receiver in the "receiver" folder.
+//				- Window frames from a reference counted frame arena shared
+//				  by the sender, preview and stream instead of malloc'd buffers.
+//				  Desktop and region frames are still copied from the staging
+//				  texture to an arena frame for each frame streamed or recorded.
+//				- Bounded frame queue between capture and the stream
+//				  with coalesce, drop oldest, drop newest and block policies.
+//				  "Queue" menu and drop counters in the fps display.
+//				- Headless mode from a configuration file or command line arguments.
+//				  No window, menu or font. Startup time logged by phase.
+//				- Priority, cores and MMCSS "Capture" task for the capture
+//				  and worker threads. Jitter measurement at startup.
+//				- Snapshot ring of the last seconds sent in a memory-mapped file,
+//				  saved as a clip by Ctrl+Alt+S, the File menu or another process.
+//				  On by default, 10 seconds in 64 MB. Staged desktop frames are
+//				  read by the next update so the capture thread does not wait for the GPU copy.
+//				- Scrolls sent as moves in the tile map and stream, from duplication
+//				  move rectangles or row hash correlation of window frames.
+//				- Performance regression suite in the "perf" folder replaying
+//				  synthetic workload traces through the frame pipeline.
+//				- Adaptive window rate from a sampled tile hash of each frame,
+//				  lowered for a static window and back to full rate on a change.
+//				  Only the tiles found changed are hashed when the tiles are compared.
+//				- Capture loop moved to CapturePipeline, which the tests and
+//				  the performance suite drive with simulated capture.
 //
 
 #include "ofApp.h"
@@ -63,6 +102,9 @@ static HWND g_hWnd = NULL; // Application window
 //--------------------------------------------------------------
 void ofApp::setup() {
 
+	// From the start of WinMain to here is creating the window and GL context
+	startupTimer.Phase("window");
+
 	// For debugging
 	// OpenSpoutConsole(); // empty console
 	// EnableSpoutLog(); // Error messages
@@ -75,6 +117,139 @@ void ofApp::setup() {
 	// Window handle used for the menu
 	g_hWnd =  ofGetWin32Window();
 
+	// Settings from the command line and configuration file
+	config.folder = ofToDataPath("", true);
+	bool bConfig = !lpCmdLine || config.ParseCommandLine(lpCmdLine);
+	if (bConfig)
+		bConfig = config.Validate();
+	bHeadless = config.bHeadless;
+	if (!config.logFile.empty())
+		EnableSpoutLogFile(config.logFile.c_str());
+	if (!bConfig) {
+		SpoutLogError("ofApp : %s", config.error.c_str());
+		if (bHeadless) {
+			// Unattended, do not capture with settings that were not intended
+			ofExit(1);
+			return;
+		}
+		MessageBoxA(NULL, config.error.c_str(), "SpoutCapture", MB_OK | MB_ICONWARNING);
+		config = CaptureConfig();
+		config.folder = ofToDataPath("", true);
+	}
+	SpoutLogNotice("ofApp : %s", config.Describe().c_str());
+	startupTimer.Phase("config");
+
+	// Compare wake jitter with and without the capture schedule
+	if (config.jitterTime > 0.0)
+		measureJitter();
+
+	// Capture thread priority and cores. Update runs on this thread.
+	if (!config.captureSchedule.IsDefault()) {
+		if (!captureScheduler.Apply(config.captureSchedule))
+			SpoutLogWarning("ofApp : capture thread %s", captureScheduler.GetResult().c_str());
+		else
+			SpoutLogNotice("ofApp : capture thread %s", captureScheduler.GetResult().c_str());
+	}
+	// Recovery thread. The stream and ring threads are set by the pipeline.
+	duplicationRecovery.SetSchedule(config.workerSchedule);
+
+	// Window, menu and font are not needed without a user
+	if (bHeadless)
+		ShowWindow(g_hWnd, SW_HIDE);
+	else
+		setupInterface();
+	startupTimer.Phase("interface");
+
+	// Initialize for DirectX11 now which creates a Direct3D 11 device.
+	desktopSender.SetDX9(false); // Set this here because DX9 won't work
+	if (!desktopSender.spout.OpenDirectX11()) {
+		SpoutLogError("ofApp : OpenDX11 failed");
+		if (!bHeadless) MessageBoxA(NULL, "OpenDX11 failed", "Info", MB_OK);
+		return;
+	}
+
+	// Get the Spout DX11 device to create the resources
+	// The device may have been created as Direct3D 11.0
+	// and not 11.1, but it still seems to work OK
+	g_d3dDevice = desktopSender.spout.GetDX11Device();
+	startupTimer.Phase("directx");
+
+	// Setup Desktop duplication which establishes monitorWidth and monitorHeight
+	if (!setupDesktopDuplication()) {
+		SpoutLogError("ofApp : Desktop duplication interface creation failed");
+		if (!bHeadless) MessageBoxA(NULL, "Desktop duplication interface creation failed", "Error", MB_OK);
+		return;
+	}
+	startupTimer.Phase("duplication");
+
+	// Create a DX11 texture to receive the duplication texture
+	// Use DXGI_FORMAT_B8G8R8A8_UNORM because that is the same format as
+	// the Spout shared texture and is also the format of the desktop image
+	// no matter what the current display mode is. 
+	desktopSender.spout.spoutdx.CreateDX11Texture(g_d3dDevice,
+		monitorWidth, monitorHeight, DXGI_FORMAT_B8G8R8A8_UNORM, &g_pDeskTexture);
+
+	// Allocate a readback OpenGL texture for the desktop
+	desktopTexture.allocate(monitorWidth, monitorHeight, GL_RGBA);
+
+	// Set the size of the OF window for the part of the desktop under the window
+	windowWidth = (unsigned int)ofGetWidth();
+	windowHeight = (unsigned int)ofGetHeight();
+
+	// Get the starting top, left position
+	RECT rect{};
+	GetClientRect(g_hWnd, &rect);
+	positionLeft = rect.left + GetSystemMetrics(SM_CYFRAME)*2;
+	positionTop = rect.top + GetSystemMetrics(SM_CYMENU) + GetSystemMetrics(SM_CYCAPTION) + GetSystemMetrics(SM_CYFRAME)*2;
+
+	// Fbo for crop of the desktop texture to the window size
+	windowFbo.allocate(windowWidth, windowHeight, GL_RGBA);
+
+	// Window frames are allocated by capture_window
+	setWindowFrame(nullptr);
+
+	// Window drawing texture
+	windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
+
+	// Window GDI capture
+	windowHwnd = NULL; // selected window
+
+	// Thumbnail preview at half the window size
+	if (!bHeadless)
+		previewFbo.allocate(windowWidth / 2, windowHeight / 2, GL_RGBA);
+	startupTimer.Phase("resources");
+
+	// Source, rates and outputs
+	setupPipeline();
+	applyConfig();
+	startupTimer.Phase("pipeline");
+
+}
+
+//--------------------------------------------------------------
+//
+// Wake lateness of a thread waiting for the desktop frame period,
+// with every core busy, first at normal priority and then with the
+// capture schedule. Half the jitter time each.
+//
+void ofApp::measureJitter() {
+
+	double period = 1000.0 / config.desktopFps;
+	double duration = config.jitterTime * 500.0;
+	ThreadSchedule schedules[2] = { ThreadSchedule(), config.captureSchedule };
+	for (int i = 0; i < 2; i++) {
+		std::string result;
+		CaptureStats lateness = MeasureJitter(schedules[i], period, duration, 0, &result);
+		SpoutLogNotice("ofApp : jitter %s : %u frames, lateness %.2f msec (p50 %.2f, p99 %.2f, max %.2f)",
+			result.c_str(), lateness.GetCount(), lateness.GetAverage(),
+			lateness.GetPercentile(50.0), lateness.GetPercentile(99.0), lateness.GetMaximum());
+	}
+
+}
+
+//--------------------------------------------------------------
+void ofApp::setupInterface() {
+
 	// Set a custom window icon
 	SetClassLongPtr(g_hWnd, GCLP_HICON, (LONG_PTR)LoadIconA(GetModuleHandle(NULL), MAKEINTRESOURCEA(IDI_ICON1)));
 
@@ -112,6 +287,8 @@ void ofApp::setup() {
 	// File popup
 	//
 	HMENU hPopup = menu->AddPopupMenu(hMenu, "File");
+	menu->AddPopupItem(hPopup, "Save snapshot", false, false);
+	menu->AddPopupSeparator(hPopup);
 	menu->AddPopupItem(hPopup, "Exit", false, false);
 
 	//
@@ -125,11 +302,43 @@ void ofApp::setup() {
 	menu->AddPopupSeparator(hPopup);
 	menu->AddPopupItem(hPopup, "Show fps", false); // Not checked and auto-check
 	menu->AddPopupItem(hPopup, "Show on top", false); // Not checked and auto-check
-	bDesktop = true;
-	bRegion = false;
-	bWindow = false;
+	menu->AddPopupItem(hPopup, "Tile map", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Stream", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Snapshot", true); // Checked and auto-check
 	bTopmost = false;
 
+	//
+	// Preview popup
+	//
+	hPopup = menu->AddPopupMenu(hMenu, "Preview");
+	menu->AddPopupItem(hPopup, "Preview off", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Thumbnail", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Full preview", true); // Checked and auto-check
+
+	//
+	// Rate popup
+	//
+	hPopup = menu->AddPopupMenu(hMenu, "Rate");
+	menu->AddPopupItem(hPopup, "Desktop 60 fps", true); // Checked and auto-check
+	menu->AddPopupItem(hPopup, "Desktop 30 fps", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Desktop 15 fps", false); // Not checked and auto-check
+	menu->AddPopupSeparator(hPopup);
+	menu->AddPopupItem(hPopup, "Window 60 fps", true); // Checked and auto-check
+	menu->AddPopupItem(hPopup, "Window 30 fps", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Window 15 fps", false); // Not checked and auto-check
+	menu->AddPopupSeparator(hPopup);
+	menu->AddPopupItem(hPopup, "Present aligned", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Adaptive rate", false); // Not checked and auto-check
+
+	//
+	// Queue popup
+	//
+	hPopup = menu->AddPopupMenu(hMenu, "Queue");
+	menu->AddPopupItem(hPopup, "Coalesce", true); // Checked and auto-check
+	menu->AddPopupItem(hPopup, "Drop oldest", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Drop newest", false); // Not checked and auto-check
+	menu->AddPopupItem(hPopup, "Block", false); // Not checked and auto-check
+
 	//
 	// Help popup
 	//
@@ -140,80 +349,155 @@ void ofApp::setup() {
 	// Set the menu to the window
 	menu->SetWindowMenu();
 
-	// Initialize for DirectX11 now which creates a Direct3D 11 device.
-	desktopSender.SetDX9(false); // Set this here because DX9 won't work
-	if (!desktopSender.spout.OpenDirectX11()) {
-		MessageBoxA(NULL, "OpenDX11 failed", "Info", MB_OK);
-		return;
-	}
+	// Load a font rather than the default
+	if (!myFont.load("fonts/DejaVuSansCondensed-Bold.ttf", 14, true, true))
+		SpoutLogWarning("ofApp error - Font not loaded");
 
-	// Get the Spout DX11 device to create the resources
-	// The device may have been created as Direct3D 11.0
-	// and not 11.1, but it still seems to work OK
-	g_d3dDevice = desktopSender.spout.GetDX11Device();
+}
 
-	// Setup Desktop duplication which establishes monitorWidth and monitorHeight
-	if (!setupDesktopDuplication()) {
-		MessageBoxA(NULL, "Desktop duplication interface creation failed", "Error", MB_OK);
-		return;
+//--------------------------------------------------------------
+void ofApp::applyConfig() {
+
+	// Rates, source and outputs are wired by the pipeline.
+	// The stream and ring are opened if they are set.
+	if (!pipeline.Configure(config))
+		SpoutLogWarning("ofApp : %s", pipeline.error.c_str());
+	bAdaptive = config.bAdaptive;
+	bTileMap = config.bTileMap;
+	bScroll = config.bScroll;
+	if (!config.streamAddress.empty()) {
+		streamAddress = config.streamAddress;
+		bStream = pipeline.GetStream().IsOpen();
+	}
+	if (pipeline.GetRing().IsOpen())
+		watchSnapshot();
+
+	// Source
+	bDesktop = config.source == SOURCE_DESKTOP;
+	bRegion = config.source == SOURCE_REGION;
+	bWindow = config.source == SOURCE_WINDOW;
+	if (bRegion && bHeadless) {
+		// Without the window, the region is fixed by the settings
+		positionLeft = config.regionLeft;
+		positionTop = config.regionTop;
+		if (config.regionWidth > 0) {
+			windowWidth = config.regionWidth;
+			windowHeight = config.regionHeight;
+			windowFbo.allocate(windowWidth, windowHeight, GL_RGBA);
+			windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
+		}
+	}
+	if (bWindow)
+		selectWindow(findWindow(config.windowTitle));
+
+	if (menu) {
+		menu->SetPopupItem("Desktop", bDesktop);
+		menu->SetPopupItem("Region", bRegion);
+		menu->SetPopupItem("Window", bWindow);
+		menu->SetPopupItem("Tile map", bTileMap);
+		menu->SetPopupItem("Stream", bStream);
+		menu->SetPopupItem("Snapshot", pipeline.GetRing().IsOpen());
+		menu->SetPopupItem("Present aligned", config.bPresentAligned);
+		menu->SetPopupItem("Adaptive rate", bAdaptive);
+		setDesktopRate(config.desktopFps);
+		setWindowRate(config.windowFps);
+		setQueuePolicy(config.queuePolicy);
+		// The region is under the window
+		if (bRegion)
+			appMenuFunction("Region", true);
+	}
+	else {
+		previewMode = PREVIEW_OFF;
 	}
 
-	// Create a DX11 texture to receive the duplication texture
-	// Use DXGI_FORMAT_B8G8R8A8_UNORM because that is the same format as
-	// the Spout shared texture and is also the format of the desktop image
-	// no matter what the current display mode is. 
-	desktopSender.spout.spoutdx.CreateDX11Texture(g_d3dDevice,
-		monitorWidth, monitorHeight, DXGI_FORMAT_B8G8R8A8_UNORM, &g_pDeskTexture);
+}
 
-	// Allocate a readback OpenGL texture for the desktop
-	desktopTexture.allocate(monitorWidth, monitorHeight, GL_RGBA);
+//--------------------------------------------------------------
+//
+// Capture and send functions called by the pipeline on this thread.
+// The pipeline decides what is due, keeps the tile maps and
+// pushes the frames sent to the stream and snapshot ring.
+//
+void ofApp::setupPipeline() {
+
+	CapturePlatform platform;
+	platform.AcquireDesktop = [this](unsigned int timeout, DesktopFrame &frame) {
+		return capture_desktop(timeout, frame);
+	};
+	platform.SendDesktop = [this](bool bReadback) { return sendDesktop(bReadback); };
+	platform.StageDesktop = [this]() { return copyDesktopStaging(); };
+	platform.ReleaseDesktop = [this]() {
+		if (g_deskDupl) g_deskDupl->ReleaseFrame();
+	};
+	platform.ReadStaged = [this](int left, int top, unsigned int width, unsigned int height) {
+		return readStaging(left, top, width, height);
+	};
+	platform.ReadRegion = [this](int left, int top, unsigned int width, unsigned int height) {
+		readRegion(left, top, width, height);
+	};
+	platform.SendRegion = [this]() { return sendRegion(); };
+	platform.CaptureWindow = [this]() { return capture_window(windowHwnd); };
+	platform.SendWindow = [this](const FrameRef &frame) { return sendWindow(frame); };
+	platform.PublishTiles = [this](CaptureOutput output, const TileMap &map) {
+		if (output == OUTPUT_DESKTOP)
+			publishTileMap(desktopSender, config.desktopName.c_str(), map, desktopTileSize);
+		else
+			publishTileMap(windowSender, config.windowName.c_str(), map, windowTileSize);
+	};
+	pipeline.SetPlatform(platform);
 
-	// Set the size of the OF window for the part of the desktop under the window
-	windowWidth = (unsigned int)ofGetWidth();
-	windowHeight = (unsigned int)ofGetHeight();
+}
 
-	// Get the starting top, left position
-	RECT rect{};
-	GetClientRect(g_hWnd, &rect);
-	positionLeft = rect.left + GetSystemMetrics(SM_CYFRAME)*2;
-	positionTop = rect.top + GetSystemMetrics(SM_CYMENU) + GetSystemMetrics(SM_CYCAPTION) + GetSystemMetrics(SM_CYFRAME)*2;
+bool ofApp::setupDesktopDuplication() {
 
-	// Fbo for crop of the desktop texture to the window size
-	windowFbo.allocate(windowWidth, windowHeight, GL_RGBA);
+	if (!g_d3dDevice) {
+		SpoutLogError("setupDesktopDuplication : no device");
+		return false;
+	}
 
-	// Window sending buffer
-	windowBuffer = (unsigned char *)malloc(windowWidth*windowHeight * 4 * sizeof(unsigned char));
-	
-	// Window drawing texture
-	windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
+	// The immediate context is retrieved once and released on exit
+	if (!g_d3dDeviceContext)
+		g_d3dDevice->GetImmediateContext(&g_d3dDeviceContext);
 
-	// Window GDI capture
-	windowHwnd = NULL; // selected window
+	// Find the primary output and keep it for recovery
+	if (!enumerateOutputs())
+		return false;
 
-	// Load a font rather than the default
-	if (!myFont.load("fonts/DejaVuSansCondensed-Bold.ttf", 14, true, true))
-		SpoutLogWarning("ofApp error - Font not loaded");
+	if (!duplicateOutput())
+		return false;
+
+	g_deskDupl = g_pendingDupl;
+	g_pendingDupl = NULL;
+	monitorWidth = pendingWidth;
+	monitorHeight = pendingHeight;
+
+	// Re-create duplication on a background thread when access is lost
+	duplicationRecovery.SetReconnect([this]() { return duplicateOutput(); });
+	duplicationRecovery.SetEnumerate([this]() { return enumerateOutputs(); });
+	duplicationRecovery.StartThread();
 
+	return true;
 }
 
-bool ofApp::setupDesktopDuplication() {
+//
+// Find the primary output of all adapters.
+// The output is retained so that duplication
+// can be re-created without enumerating again.
+// Called at setup and by the recovery thread.
+//
+bool ofApp::enumerateOutputs() {
 
-	LONG width = 0;
-	LONG height = 0;
 	IDXGIFactory1* factory = NULL;
-	IDXGIOutput1* output1 = NULL;
 	IDXGIAdapter1* adapter = NULL;
-	HRESULT hr = NULL;
 
-	if (!g_d3dDevice) {
-		SpoutLogError("setupDesktopDuplication : no device");
+	if (g_pOutput) g_pOutput->Release();
+	g_pOutput = NULL;
+
+	if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&factory)))) {
+		SpoutLogError("enumerateOutputs : CreateDXGIFactory1 failed");
 		return false;
 	}
 
-	g_d3dDevice->GetImmediateContext(&g_d3dDeviceContext);
-
-	CreateDXGIFactory1(__uuidof(IDXGIFactory1), reinterpret_cast<void**>(&factory));
-
 	for (int i = 0; (factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND); ++i) {
 		IDXGIOutput* output;
 		for (int j = 0; (adapter->EnumOutputs(j, &output) != DXGI_ERROR_NOT_FOUND); j++) {
@@ -225,27 +509,11 @@ bool ofApp::setupDesktopDuplication() {
 			monitorInfo.cbSize = sizeof(MONITORINFOEX);
 			GetMonitorInfo(outputDesc.Monitor, &monitorInfo);
 
-			LONG w = 0;
-			LONG h = 0;
-			w = monitorInfo.rcMonitor.right - monitorInfo.rcMonitor.left;
-			h = monitorInfo.rcMonitor.bottom - monitorInfo.rcMonitor.top;
-
-			if (monitorInfo.dwFlags == MONITORINFOF_PRIMARY) {
-				width = monitorInfo.rcMonitor.right - monitorInfo.rcMonitor.left;
-				height = monitorInfo.rcMonitor.bottom - monitorInfo.rcMonitor.top;
+			if (monitorInfo.dwFlags == MONITORINFOF_PRIMARY && !g_pOutput) {
 				// A process can have only one desktop duplication interface on a single desktop output;
 				// however, that process can have a desktop duplication interface for each output 
 				// that is part of the desktop. Only use the primary monitor. Other monitors are possible.
-				output1 = reinterpret_cast<IDXGIOutput1*>(output);
-				hr = output1->DuplicateOutput(g_d3dDevice, &g_deskDupl);
-				/// https://msdn.microsoft.com/en-gb/library/windows/desktop/hh404600(v=vs.85).aspx
-				if (FAILED(hr)) {
-					SpoutLogError("setupDesktopDuplication : DuplicateOutput failed");
-					output->Release();
-					adapter->Release();
-					factory->Release();
-					return false;
-				}
+				output->QueryInterface(__uuidof(IDXGIOutput1), reinterpret_cast<void**>(&g_pOutput));
 			}
 			output->Release();
 		}
@@ -253,8 +521,39 @@ bool ofApp::setupDesktopDuplication() {
 	}
 	factory->Release();
 
-	monitorWidth = width;
-	monitorHeight = height;
+	if (!g_pOutput) {
+		SpoutLogError("enumerateOutputs : primary output not found");
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Create a duplication interface for the cached output.
+// Called at setup and by the recovery thread.
+// The desktop size of the new interface is kept with it,
+// because a mode change can re-create duplication at a new size.
+// The capture thread takes both and resizes its own resources.
+//
+bool ofApp::duplicateOutput() {
+
+	if (!g_pOutput)
+		return false;
+
+	IDXGIOutputDuplication* dupl = NULL;
+	HRESULT hr = g_pOutput->DuplicateOutput(g_d3dDevice, &dupl);
+	/// https://msdn.microsoft.com/en-gb/library/windows/desktop/hh404600(v=vs.85).aspx
+	if (FAILED(hr)) {
+		// E_ACCESSDENIED while the secure desktop is shown (UAC)
+		SpoutLogWarning("duplicateOutput : DuplicateOutput failed (0x%X)", (unsigned int)hr);
+		return false;
+	}
+	DXGI_OUTDUPL_DESC desc{};
+	dupl->GetDesc(&desc);
+	pendingWidth = desc.ModeDesc.Width;
+	pendingHeight = desc.ModeDesc.Height;
+	g_pendingDupl = dupl;
 
 	return true;
 }
@@ -265,23 +564,33 @@ bool ofApp::setupDesktopDuplication() {
 //
 // https://msdn.microsoft.com/en-us/library/windows/desktop/hh404487(v=vs.85).aspx
 //
+// The frame is held until the pipeline releases it,
+// after it has been sent and copied for the stream.
 //
-bool ofApp::capture_desktop() {
+bool ofApp::capture_desktop(unsigned int timeout, DesktopFrame &frame) {
 
 	HRESULT hr = S_OK;
 	IDXGIResource* DesktopResource = NULL;
 	DXGI_OUTDUPL_FRAME_INFO FrameInfo;
 
-	// Allow for UAC disabling desktop duplication
+	// Allow for UAC disabling desktop duplication.
+	// Duplication is re-created by the recovery thread.
+	// Until then the senders retain the last good frame.
 	if (g_deskDupl == NULL) {
-		if (!setupDesktopDuplication()) {
-			return false;
-		}
-		return true; // skip this frame
+		if (!duplicationRecovery.Recovered())
+			return false; // skip this frame
+		g_deskDupl = g_pendingDupl;
+		g_pendingDupl = NULL;
+		SpoutLogNotice("Desktop duplication recovered in %.0f msec",
+			duplicationRecovery.GetRecoveryTimes().GetLast());
+		// After a mode change the desktop is a new size
+		if (pendingWidth != monitorWidth || pendingHeight != monitorHeight)
+			resizeDesktop(pendingWidth, pendingHeight);
 	}
 
 	// Get new frame
-	hr = g_deskDupl->AcquireNextFrame(500, &FrameInfo, &DesktopResource);
+	// The timeout limits the wait for an idle desktop
+	hr = g_deskDupl->AcquireNextFrame(timeout, &FrameInfo, &DesktopResource);
 	if (FAILED(hr)) {
 		if ((hr != DXGI_ERROR_ACCESS_LOST) && (hr != DXGI_ERROR_WAIT_TIMEOUT)) {
 			SpoutLogError("Failed to acquire next frame in DUPLICATIONMANAGER");
@@ -298,6 +607,7 @@ bool ofApp::capture_desktop() {
 			// and create a new IDXGIOutputDuplication for the new content.
 			g_deskDupl->Release();
 			g_deskDupl = NULL;
+			duplicationRecovery.Lost();
 		}
 		return false;
 	}
@@ -305,6 +615,9 @@ bool ofApp::capture_desktop() {
 	// Query Interface for the texture from the desktop resource
 	// The format of the desktop image is always DXGI_FORMAT_B8G8R8A8_UNORM
 	// no matter what the current display mode is.
+	// Release the reference to the previous frame first.
+	if (g_pDeskTexture) g_pDeskTexture->Release();
+	g_pDeskTexture = NULL;
 	hr = DesktopResource->QueryInterface(__uuidof(ID3D11Texture2D),
 		reinterpret_cast<void **>(&g_pDeskTexture));
 
@@ -312,44 +625,576 @@ bool ofApp::capture_desktop() {
 	DesktopResource->Release();
 	DesktopResource = NULL;
 
-	if (hr == S_OK) {
-		// Send the DX11 texture from the desktop resource and at the same
-		// time read back the linked OpenGL texture for the window sender
+	if (hr != S_OK) {
+		// Release the frame for the next round
+		g_deskDupl->ReleaseFrame();
+		return false;
+	}
+
+	frame.width = monitorWidth;
+	frame.height = monitorHeight;
+
+	// Present time in msec for pacing aligned with the display.
+	// Zero if only the mouse has been updated.
+	frame.bImage = FrameInfo.LastPresentTime.QuadPart != 0;
+	if (frame.bImage) {
+		static LARGE_INTEGER frequency{};
+		if (frequency.QuadPart == 0)
+			QueryPerformanceFrequency(&frequency);
+		frame.presentTime = (double)FrameInfo.LastPresentTime.QuadPart*1000.0/(double)frequency.QuadPart;
+	}
+	else {
+		frame.presentTime = CaptureStats::Now();
+	}
+
+	// Changed areas from the frame metadata, if the tile maps are used
+	if (bTileMap || bStream || pipeline.GetRing().IsOpen())
+		getDirtyRects(FrameInfo, frame);
+	else
+		frame.bAll = true;
+
+	return true;
+
+}
+
+//
+// Send the DX11 texture from the desktop resource. The linked OpenGL
+// texture is read back at the same time only if it is used, for the
+// region or the desktop preview. Otherwise the texture is sent
+// without the readback and the OpenGL texture is updated by the
+// next desktop frame after the preview or region is selected.
+//
+uint32_t ofApp::sendDesktop(bool bReadback) {
+
+	if (bReadback) {
 		desktopSender.spout.WriteTextureReadback(&g_pDeskTexture,
 			desktopTexture.getTextureData().textureID,
 			desktopTexture.getTextureData().textureTarget,
 			monitorWidth, monitorHeight, false);
 	}
+	else {
+		desktopSender.spout.WriteTexture(&g_pDeskTexture);
+	}
 
-	// Release the frame for the next round
-	g_deskDupl->ReleaseFrame();
+	return (uint32_t)desktopSender.GetFrame();
 
-	return true;
+}
+
+//
+// Read back only the region of the desktop frame to the OpenGL texture,
+// for a region frame between desktop frames. The region is copied to a
+// staging texture of its own size and loaded at its position.
+//
+void ofApp::readRegion(int left, int top, unsigned int width, unsigned int height) {
+
+	if (!g_pDeskTexture || !g_d3dDeviceContext)
+		return;
+
+	// Clip to the monitor
+	if (left < 0 || top < 0 || left >= (int)monitorWidth || top >= (int)monitorHeight)
+		return;
+	width = min(width, monitorWidth - (unsigned int)left);
+	height = min(height, monitorHeight - (unsigned int)top);
+	if (width == 0 || height == 0)
+		return;
+
+	if (g_pRegionTexture && (width != regionTextureWidth || height != regionTextureHeight)) {
+		g_pRegionTexture->Release();
+		g_pRegionTexture = NULL;
+	}
+	if (!g_pRegionTexture) {
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		if (FAILED(g_d3dDevice->CreateTexture2D(&desc, NULL, &g_pRegionTexture))) {
+			SpoutLogError("readRegion : could not create staging texture");
+			return;
+		}
+		regionTextureWidth = width;
+		regionTextureHeight = height;
+	}
+
+	D3D11_BOX box{};
+	box.left = (UINT)left;
+	box.top = (UINT)top;
+	box.right = (UINT)left + width;
+	box.bottom = (UINT)top + height;
+	box.front = 0;
+	box.back = 1;
+	g_d3dDeviceContext->CopySubresourceRegion(g_pRegionTexture, 0, 0, 0, 0, g_pDeskTexture, 0, &box);
+
+	D3D11_MAPPED_SUBRESOURCE mapped{};
+	if (FAILED(g_d3dDeviceContext->Map(g_pRegionTexture, 0, D3D11_MAP_READ, 0, &mapped)))
+		return;
+	const ofTextureData &data = desktopTexture.getTextureData();
+	glBindTexture(data.textureTarget, data.textureID);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(mapped.RowPitch / 4));
+	glTexSubImage2D(data.textureTarget, 0, left, top, width, height,
+		GL_BGRA, GL_UNSIGNED_BYTE, mapped.pData);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindTexture(data.textureTarget, 0);
+	g_d3dDeviceContext->Unmap(g_pRegionTexture, 0);
+
+}
+
+//
+// Draw the region of the readback texture to the window sender fbo
+// and send it. Sender width and height mirror the ofApp window.
+//
+uint32_t ofApp::sendRegion() {
+
+	ofSetColor(255);
+	windowFbo.bind();
+
+	desktopTexture.drawSubsection(0, 0,
+		(float)windowWidth, // size to draw and crop
+		(float)windowHeight,
+		(float)positionLeft, // position to crop at
+		(float)positionTop);
+
+	// Send the window fbo
+	// Invert because DirectX textures have origin reverse in y compared to OpenGL
+	windowSender.SendFbo(windowFbo.getId(), windowWidth, windowHeight, true);
+
+	windowFbo.unbind();
+
+	return (uint32_t)windowSender.GetFrame();
 
 }
 
-bool ofApp::capture_window(HWND hwnd)
+//
+// GDI capture of the selected window in a frame from the arena.
+// Returns nullptr if the window is closed or could not be captured.
+//
+FramePtr ofApp::capture_window(HWND hwnd)
 {
 	// Closed window or self
 	if (hwnd == NULL || hwnd == ofGetWin32Window() || hwnd == GetConsoleWindow() || !IsWindow(hwnd)) {
-		return false;
+		return nullptr;
+	}
+
+	// Check the size which the user might have changed.
+	// The pipeline starts the window map again for a new size.
+	RECT rect{};
+	GetClientRect(hwnd, &rect);
+	unsigned int width = rect.right - rect.left;
+	unsigned int height = rect.bottom - rect.top;
+	if (width == 0 || height == 0)
+		return nullptr;
+	if (width != windowWidth || height != windowHeight) {
+		// Update globals and buffers
+		windowWidth = width;
+		windowHeight = height;
+		windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
+		// Re-size pre-allocated bitmap
+		if (m_hWindowBitmap) DeleteObject(m_hWindowBitmap);
+		m_hWindowBitmap = CreateCompatibleBitmap(m_hWindowDC, windowWidth, windowHeight);
 	}
 
 	// Use pre-allocated compatible DC and bitmap
 	// Time saving 5-6 msec (total 8-9 msec/frame at at 1920x1080) for 60fps capture.
-	if (m_hWindowBitmap) {
-		m_hWindowOld = (HBITMAP)SelectObject(m_hWindowMemDC, m_hWindowBitmap);
-		BitBlt(m_hWindowMemDC, 0, 0, windowWidth, windowHeight, m_hWindowDC, 0, 0, SRCCOPY | CAPTUREBLT);
-		SelectObject(m_hWindowMemDC, m_hWindowOld);
-		// Get the pixel data
-		GetBitmapBits(m_hWindowBitmap, windowWidth*windowHeight * 4, windowBuffer);
-		return true;
+	if (!m_hWindowBitmap)
+		return nullptr;
+	m_hWindowOld = (HBITMAP)SelectObject(m_hWindowMemDC, m_hWindowBitmap);
+	BitBlt(m_hWindowMemDC, 0, 0, windowWidth, windowHeight, m_hWindowDC, 0, 0, SRCCOPY | CAPTUREBLT);
+	SelectObject(m_hWindowMemDC, m_hWindowOld);
+
+	// A new frame from the arena. The previous frame is
+	// re-used once the sender, preview and stream are done with it.
+	FramePtr frame = pipeline.GetArena().Allocate(windowWidth, windowHeight);
+	if (!frame) {
+		SpoutLogWarning("capture_window : frame memory budget exceeded");
+		return nullptr;
+	}
+
+	// Get the pixel data
+	GetBitmapBits(m_hWindowBitmap, windowWidth*windowHeight * 4, frame->pixels);
+	frame->timestamp = CaptureStats::Now();
+	// Set before the frame is shared, the sender frame it is sent as
+	frame->number = (uint32_t)windowSender.GetFrame() + 1;
+
+	return frame;
+
+}
+
+//
+// Send the window frame captured, loaded from GDI pixels.
+// Returns false if it was not sent.
+//
+bool ofApp::sendWindow(const FrameRef &frame) {
+
+	setWindowFrame(frame);
+	if (!bInitialized || !windowTexture.isAllocated())
+		return false;
+
+	if (!IsIconic(g_hWnd) && previewMode == PREVIEW_FULL) {
+		// The texture is loaded for both the sender and the full preview.
+		// 3 msec higher speed than SendImage compensates for loadData to texture.
+		// If not iconic, capture time is approximately the same (8-9 msec full screen window)
+		windowTexture.loadData((const unsigned char *)windowBuffer, windowWidth, windowHeight, GL_BGRA_EXT);
+		windowSender.SendTexture(windowTexture.getTextureData().textureID,
+			windowTexture.getTextureData().textureTarget, windowWidth, windowHeight, GL_BGRA_EXT);
+	}
+	else {
+		// Only the sender needs the pixels
+		windowSender.SendImage(windowBuffer, windowWidth, windowHeight, GL_BGRA_EXT);
+	}
+
+	return true;
+
+}
+
+
+//
+// Re-allocate the desktop resources for a new desktop size.
+// Capture thread only, when recovered duplication is taken.
+//
+void ofApp::resizeDesktop(unsigned int width, unsigned int height) {
+
+	SpoutLogNotice("Desktop size changed from %ux%u to %ux%u",
+		monitorWidth, monitorHeight, width, height);
+	monitorWidth = width;
+	monitorHeight = height;
+
+	// The duplication texture of the next frame replaces the last
+	if (g_pDeskTexture) g_pDeskTexture->Release();
+	g_pDeskTexture = NULL;
+	// Created for the new size by the next copy
+	if (g_pStagingTexture) g_pStagingTexture->Release();
+	g_pStagingTexture = NULL;
+	if (g_pRegionTexture) g_pRegionTexture->Release();
+	g_pRegionTexture = NULL;
+	// The pipeline starts the desktop map again for the new size
+	desktopTexture.allocate(monitorWidth, monitorHeight, GL_RGBA);
+	if (bInitialized)
+		desktopSender.UpdateSender(config.desktopName.c_str(), monitorWidth, monitorHeight);
+
+}
+
+//
+// Changed areas from desktop duplication metadata
+//
+// Move rectangles, from the source point to the destination,
+// and dirty rectangles. Together they cover everything that
+// has changed since the last frame.
+//
+void ofApp::getDirtyRects(DXGI_OUTDUPL_FRAME_INFO &info, DesktopFrame &frame) {
+
+	// No image update, only the mouse
+	if (info.LastPresentTime.QuadPart == 0)
+		return;
+
+	// An image update without metadata is not expected
+	if (info.TotalMetadataBufferSize == 0) {
+		frame.bAll = true;
+		return;
 	}
 
-	return false;
+	if (metaData.size() < info.TotalMetadataBufferSize)
+		metaData.resize(info.TotalMetadataBufferSize);
+
+	UINT size = 0;
+
+	// Moved areas
+	HRESULT hr = g_deskDupl->GetFrameMoveRects((UINT)metaData.size(),
+		reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(metaData.data()), &size);
+	if (SUCCEEDED(hr)) {
+		DXGI_OUTDUPL_MOVE_RECT* moved = reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(metaData.data());
+		for (UINT i = 0; i < size / sizeof(DXGI_OUTDUPL_MOVE_RECT); i++) {
+			RECT &r = moved[i].DestinationRect;
+			frame.moves.push_back({ r.left, r.top, r.right, r.bottom,
+				r.left - moved[i].SourcePoint.x, r.top - moved[i].SourcePoint.y });
+		}
+	}
+
+	// Dirty areas
+	if (SUCCEEDED(hr)) {
+		hr = g_deskDupl->GetFrameDirtyRects((UINT)metaData.size(),
+			reinterpret_cast<RECT*>(metaData.data()), &size);
+		if (SUCCEEDED(hr)) {
+			RECT* dirty = reinterpret_cast<RECT*>(metaData.data());
+			for (UINT i = 0; i < size / sizeof(RECT); i++)
+				frame.rects.push_back({ dirty[i].left, dirty[i].top, dirty[i].right, dirty[i].bottom });
+		}
+	}
+
+	if (FAILED(hr))
+		frame.bAll = true;
 
 }
 
+//
+// Write a tile map to the sender's shared memory buffer.
+// The frame number of the map is the sender frame number.
+//
+void ofApp::publishTileMap(SpoutSender &sender, const char* name, const TileMap &map, unsigned int &size) {
+
+	unsigned int datasize = map.GetDataSize();
+
+	// Create or re-create the buffer for the map size
+	if (size != datasize) {
+		if (size > 0) sender.DeleteMemoryBuffer();
+		if (!sender.CreateMemoryBuffer(name, (int)datasize)) {
+			SpoutLogWarning("publishTileMap : could not create buffer for %s", name);
+			size = 0;
+			return;
+		}
+		size = datasize;
+	}
+
+	tileData.resize(datasize);
+	map.Write(tileData.data(), (uint32_t)sender.GetFrame());
+	sender.WriteMemoryBuffer(name, (const char*)tileData.data(), (int)datasize);
+
+}
+
+//
+// Copy the desktop frame to a staging texture for CPU access.
+// Only used for streaming and the snapshot ring.
+//
+bool ofApp::copyDesktopStaging() {
+
+	if (!g_pDeskTexture || !g_d3dDeviceContext)
+		return false;
+
+	if (!g_pStagingTexture) {
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = monitorWidth;
+		desc.Height = monitorHeight;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		if (FAILED(g_d3dDevice->CreateTexture2D(&desc, NULL, &g_pStagingTexture))) {
+			SpoutLogError("copyDesktopStaging : could not create staging texture");
+			return false;
+		}
+	}
+
+	g_d3dDeviceContext->CopyResource(g_pStagingTexture, g_pDeskTexture);
+
+	return true;
+}
+
+//
+// Copy part of the staging texture to a frame from the arena, so that
+// the texture can be unmapped while the frame is encoded.
+// This is one copy for each desktop or region frame streamed or recorded.
+// A frame wrapping the mapped memory would keep the texture mapped
+// during the CopyResource of the next desktop frame.
+// Returns nullptr if the part is outside the monitor or could not be read.
+//
+FramePtr ofApp::readStaging(int left, int top, unsigned int width, unsigned int height) {
+
+	if (!g_pStagingTexture)
+		return nullptr;
+
+	// Clip to the monitor
+	if (left < 0 || top < 0 || left >= (int)monitorWidth || top >= (int)monitorHeight)
+		return nullptr;
+	width = min(width, monitorWidth - (unsigned int)left);
+	height = min(height, monitorHeight - (unsigned int)top);
+
+	D3D11_MAPPED_SUBRESOURCE mapped{};
+	if (FAILED(g_d3dDeviceContext->Map(g_pStagingTexture, 0, D3D11_MAP_READ, 0, &mapped)))
+		return nullptr;
+
+	FramePtr frame = pipeline.GetArena().Allocate(width, height);
+	if (frame) {
+		const unsigned char* src = (const unsigned char*)mapped.pData
+			+ (size_t)top*mapped.RowPitch + (size_t)left * 4;
+		for (unsigned int y = 0; y < height; y++)
+			memcpy(frame->pixels + (size_t)y*frame->pitch, src + (size_t)y*mapped.RowPitch, frame->pitch);
+		pipeline.GetArena().AddCopy(frame->size);
+	}
+
+	g_d3dDeviceContext->Unmap(g_pStagingTexture, 0);
+
+	return frame;
+}
+
+//
+// Start recording what is sent to the snapshot ring.
+// The ring file and clips are in the data folder unless set.
+//
+bool ofApp::openSnapshot() {
+
+	if (!pipeline.OpenSnapshot()) {
+		SpoutLogWarning("Snapshot ring could not be created as %s", config.snapshotFile.c_str());
+		return false;
+	}
+	watchSnapshot();
+
+	return true;
+}
+
+//
+// Clip recovered when the ring is opened, and requests from another process
+//
+void ofApp::watchSnapshot() {
+
+	// Frames from a previous run that did not close the ring
+	snapshotClip = pipeline.GetRing().GetLastClip();
+	if (!snapshotClip.empty())
+		SpoutLogNotice("Snapshot recovered to %s", snapshotClip.c_str());
+
+	// Another process asks for a clip with SetEvent
+	if (!snapshotEvent)
+		snapshotEvent = CreateEventA(NULL, FALSE, FALSE, "SpoutCaptureSnapshot");
+
+}
+
+//
+// Save the last seconds as a clip. The ring writes it on
+// its own thread while capture and recording continue.
+//
+void ofApp::saveSnapshot() {
+
+	pipeline.GetRing().RequestFlush();
+	bSnapshotRequested = true;
+	snapshotRequestTime = CaptureStats::Now();
+
+}
+
+//
+// Hotkey and event requests for a clip, and the result of the last
+//
+void ofApp::checkSnapshot() {
+
+	SnapshotRing &ring = pipeline.GetRing();
+	if (!ring.IsOpen())
+		return;
+
+	// Ctrl+Alt+key from any application
+	bool bDown = config.snapshotKey != 0
+		&& (GetAsyncKeyState(VK_CONTROL) & 0x8000)
+		&& (GetAsyncKeyState(VK_MENU) & 0x8000)
+		&& (GetAsyncKeyState(config.snapshotKey) & 0x8000);
+	if (bDown && !bSnapshotKey)
+		saveSnapshot();
+	bSnapshotKey = bDown;
+
+	// Another process
+	if (snapshotEvent && WaitForSingleObject(snapshotEvent, 0) == WAIT_OBJECT_0)
+		saveSnapshot();
+
+	// The ring starts the flush within 100 msec of the request
+	if (bSnapshotRequested && !ring.IsFlushing()
+		&& CaptureStats::Now() - snapshotRequestTime > 250.0) {
+		std::string clip = ring.GetLastClip();
+		if (clip != snapshotClip)
+			SpoutLogNotice("Snapshot saved to %s in %.0f msec", clip.c_str(), ring.GetFlushTimes().GetLast());
+		else
+			SpoutLogWarning("Snapshot not saved");
+		snapshotClip = clip;
+		bSnapshotRequested = false;
+	}
+
+}
+
+//
+// Select a window to capture and create the GDI objects for its size.
+// Returns false for no window or a console window.
+//
+bool ofApp::selectWindow(HWND hwnd) {
+
+	// Set global selected window handle
+	// If the window closes it is tested by IsWindow in capture_window
+	windowHwnd = hwnd;
+	if (!hwnd)
+		return false;
+
+	char str[256]{};
+	GetWindowTextA(hwnd, str, 256);
+
+	RECT rect{};
+	GetClientRect(hwnd, &rect);
+
+	// printf("Window = %s (0X%7.7X) %dx%d\n", str, PtrToUint(hwnd), rect.right - rect.left, rect.bottom - rect.top);
+
+	// Look for Class to avoid console
+	GetClassNameA(hwnd, str, 256);
+	if (strcmp(str, "ConsoleWindowClass") == 0)
+		return false;
+
+	unsigned int width = rect.right - rect.left;
+	unsigned int height = rect.bottom - rect.top;
+	windowWidth = width;
+	windowHeight = height;
+	// Update draw texture
+	windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
+	// Release the current frame, the next is the new size.
+	// The pipeline frees the buffers of the last window and
+	// starts the new window map and rate again.
+	setWindowFrame(nullptr);
+	pipeline.ResetWindow();
+	// Update sender
+	if (bInitialized) windowSender.UpdateSender(config.windowName.c_str(), windowWidth, windowHeight);
+	// Pre-allocate compatibleDC and bitmap to avoid repeats (saves 5-6 msec/frame)
+	if (m_hWindowBitmap) DeleteObject(m_hWindowBitmap);
+	if (m_hWindowMemDC) DeleteDC(m_hWindowMemDC);
+	if (m_hWindowDC) ReleaseDC(NULL, m_hWindowDC);
+	m_hWindowDC = GetDC(hwnd);
+	m_hWindowMemDC = CreateCompatibleDC(m_hWindowDC);
+	m_hWindowBitmap = CreateCompatibleBitmap(m_hWindowDC, windowWidth, windowHeight);
+
+	// printf("m_hWindowDC = 0x%X, m_hWindowMemDC = 0x%X,  m_hWindowBitmap = 0x%X\n",
+		// PtrToUint(m_hWindowDC), PtrToUint(m_hWindowMemDC), PtrToUint(m_hWindowBitmap));
+
+	return true;
+
+}
+
+//
+// Find a visible top level window with a title containing the text
+//
+struct WindowSearch {
+	std::string title;
+	HWND hwnd;
+};
+
+static BOOL CALLBACK FindWindowProc(HWND hwnd, LPARAM lParam)
+{
+	WindowSearch* search = (WindowSearch*)lParam;
+	if (hwnd == g_hWnd || !IsWindowVisible(hwnd))
+		return TRUE;
+	char title[256]{};
+	GetWindowTextA(hwnd, title, 256);
+	if (strstr(title, search->title.c_str())) {
+		search->hwnd = hwnd;
+		return FALSE; // Stop
+	}
+	return TRUE;
+}
+
+HWND ofApp::findWindow(const std::string& title) {
+
+	if (title.empty())
+		return NULL;
+	WindowSearch search = { title, NULL };
+	EnumWindows(FindWindowProc, (LPARAM)&search);
+	return search.hwnd;
+
+}
+
+//
+// Set the current window frame.
+// The previous frame is released unless another stage still has it.
+//
+void ofApp::setWindowFrame(FrameRef frame) {
+
+	windowFrame = frame;
+	windowBuffer = frame ? frame->pixels : nullptr;
+
+}
 
 //--------------------------------------------------------------
 void ofApp::exit() {
@@ -358,6 +1203,28 @@ void ofApp::exit() {
 	windowSender.ReleaseSender();
 	if (g_hMouseHook) UnhookWindowsHookEx(g_hMouseHook);
 
+	// Stop streaming, recording and recovery before releasing the duplication objects
+	pipeline.CloseStream();
+	pipeline.CloseSnapshot();
+	if (snapshotEvent) CloseHandle(snapshotEvent);
+	snapshotEvent = NULL;
+	setWindowFrame(nullptr);
+	if (g_pStagingTexture) g_pStagingTexture->Release();
+	g_pStagingTexture = NULL;
+	if (g_pRegionTexture) g_pRegionTexture->Release();
+	g_pRegionTexture = NULL;
+	duplicationRecovery.StopThread();
+	if (g_pendingDupl) g_pendingDupl->Release();
+	if (g_deskDupl) g_deskDupl->Release();
+	if (g_pOutput) g_pOutput->Release();
+	if (g_pDeskTexture) g_pDeskTexture->Release();
+	if (g_d3dDeviceContext) g_d3dDeviceContext->Release();
+	g_pendingDupl = NULL;
+	g_deskDupl = NULL;
+	g_pOutput = NULL;
+	g_pDeskTexture = NULL;
+	g_d3dDeviceContext = NULL;
+
 	ofExit();
 
 }
@@ -367,17 +1234,18 @@ void ofApp::update() {
 
 	if (!bInitialized) {
 		// Create the window sender first so that the desktop sender is set as active
-	    windowSender.CreateSender("WindowSender", ofGetWidth(), ofGetHeight());
+	    windowSender.CreateSender(config.windowName.c_str(), windowWidth, windowHeight);
 		// This sets up the interop device and object for WriteTextureReadBack to use
-		desktopSender.CreateSender("DesktopSender", ofGetScreenWidth(), ofGetScreenHeight());
+		desktopSender.CreateSender(config.desktopName.c_str(), ofGetScreenWidth(), ofGetScreenHeight());
 		bInitialized = true;
+		startupTimer.Phase("senders");
 	}
 
-	// Always capture using the desktop duplication method.
-	// The DirectX desktop texture is sent by capture_desktop().
-	// A readback texture allows the desktop to be drawn
-	// and a portion of it drawn to fbo for region capture.
-	capture_desktop();
+	// Time capture and send separately from the preview in draw()
+	captureStats.Start();
+
+	// Snapshot requests
+	checkSnapshot();
 
 	if (bRegion) {
 
@@ -391,29 +1259,14 @@ void ofApp::update() {
 		}
 
 		// We have the client rectangle dimensions, get the top, left position
-		if (!IsIconic(g_hWnd)) {
+		// Headless, the region is fixed by the settings
+		if (!bHeadless && !IsIconic(g_hWnd)) {
 			RECT rect{};
 			GetWindowRect(g_hWnd, &rect);
 			positionLeft = rect.left + GetSystemMetrics(SM_CYFRAME) * 2;
 			positionTop = rect.top + GetSystemMetrics(SM_CYMENU) + GetSystemMetrics(SM_CYCAPTION) + GetSystemMetrics(SM_CYFRAME) * 2;
 		}
-
-		// Draw a portion of the readback texture to the window sender fbo.
-		// Sender width and height mirror the ofApp window.
-		ofSetColor(255);
-		windowFbo.bind();
-
-		desktopTexture.drawSubsection(0, 0,
-			(float)windowWidth, // size to draw and crop
-			(float)windowHeight,
-			(float)positionLeft, // position to crop at
-			(float)positionTop);
-
-		// Send the window fbo
-		// Invert because DirectX textures have origin reverse in y compared to OpenGL
-		windowSender.SendFbo(windowFbo.getId(), windowWidth, windowHeight, true);
-
-		windowFbo.unbind();
+		pipeline.SetRegion(positionLeft, positionTop, windowWidth, windowHeight);
 
 	}
 	else if (bWindow) {
@@ -431,48 +1284,13 @@ void ofApp::update() {
 			p.y = yCoord;
 			HWND hwnd = WindowFromPoint(p);
 
-			// Set global selected window handle
-			// If the window closes it is tested by IsWindow in capture_window
-			windowHwnd = hwnd;
-
-			char str[256]{};
-			GetWindowTextA(hwnd, str, 256);
-
-			RECT rect{};
-			GetClientRect(hwnd, &rect);
-			
-			// printf("Window = %s (0X%7.7X) %dx%d\n", str, PtrToUint(hwnd), rect.right - rect.left, rect.bottom - rect.top);
-
-			// Look for Class to avoid console
-			GetClassNameA(hwnd, str, 256);
-			if (strcmp(str, "ConsoleWindowClass") != 0) {
-				unsigned int width = rect.right - rect.left;
-				unsigned int height = rect.bottom - rect.top;
-				windowWidth = width;
-				windowHeight = height;
-				// Update draw texture
-				windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
-				// Update capture pixel buffer
-				if (windowBuffer) free((void*)windowBuffer);
-				windowBuffer = (unsigned char*)malloc(windowWidth*windowHeight * 4 * sizeof(unsigned char));
-				// Update sender
-				if (bInitialized) windowSender.UpdateSender("WindowSender", windowWidth, windowHeight);
-				// Pre-allocate compatibleDC and bitmap to avoid repeats (saves 5-6 msec/frame)
-				if (m_hWindowMemDC) DeleteDC(m_hWindowMemDC);
-				if (m_hWindowDC) ReleaseDC(NULL, m_hWindowDC);
-				m_hWindowDC = GetDC(hwnd);
-				m_hWindowMemDC = CreateCompatibleDC(m_hWindowDC);
-				m_hWindowBitmap = CreateCompatibleBitmap(m_hWindowDC, windowWidth, windowHeight);
-				
-				// printf("m_hWindowDC = 0x%X, m_hWindowMemDC = 0x%X,  m_hWindowBitmap = 0x%X\n",
-					// PtrToUint(m_hWindowDC), PtrToUint(m_hWindowMemDC), PtrToUint(m_hWindowBitmap));
-			}
+			selectWindow(hwnd);
 
 			// Re-set focus
 			SetFocus(ofGetWin32Window());
 
 			// Enable the menu item
-			menu->SetPopupItem("Window", true);
+			if (menu) menu->SetPopupItem("Window", true);
 
 			// Reset mouse hook flag
 			bRHdown = false;
@@ -484,62 +1302,70 @@ void ofApp::update() {
 
 		}
 
-		//
-		// GDI capture
-		//
-		if (capture_window(windowHwnd)) {
-
-			// find the current selected window position and size
-			RECT rect{};
-			GetClientRect(windowHwnd, &rect);
-			// Check the size and position which the user might have changed
-			unsigned int width = rect.right - rect.left;
-			unsigned int height = rect.bottom - rect.top;
-			if (width != windowWidth || height != windowHeight) {
-				// Update globals and buffers
-				windowWidth = width;
-				windowHeight = height;
-				windowTexture.allocate(windowWidth, windowHeight, GL_RGBA);
-				if (windowBuffer) free((void *)windowBuffer);
-				windowBuffer = (unsigned char *)malloc(windowWidth*windowHeight * 4 * sizeof(unsigned char));
-				// Re-size pre-allocated bitmap
-				if (m_hWindowBitmap) DeleteObject(m_hWindowBitmap);
-				m_hWindowBitmap = CreateCompatibleBitmap(m_hWindowDC, windowWidth, windowHeight);
-			}
-			else {
-				// Send window texture, loaded from GDI pixels
-				if (bInitialized && windowTexture.isAllocated()) {
-					if (!IsIconic(g_hWnd)) {
-						// 3 msec higher speed than SendImage compensates for loadData to texture in Draw()
-						// If not iconic, capture time is approximately the same (8-9 msec full screen window)
-						windowSender.SendTexture(windowTexture.getTextureData().textureID,
-							windowTexture.getTextureData().textureTarget, windowWidth, windowHeight, GL_BGRA_EXT);
-					}
-					else {
-						windowSender.SendImage(windowBuffer, windowWidth, windowHeight);
-					}
-				}
-			}
+		// Headless, a window selected by title is looked for
+		// again if it is not open yet or has been closed
+		if (bHeadless && (!windowHwnd || !IsWindow(windowHwnd))
+			&& CaptureStats::Now() - windowSearchTime > 1000.0) {
+			windowSearchTime = CaptureStats::Now();
+			selectWindow(findWindow(config.windowTitle));
 		}
 	}
 
+	// Always capture using the desktop duplication method.
+	// A readback texture allows the desktop to be drawn
+	// and a portion of it drawn to fbo for region capture.
+	// The pipeline sends the desktop, the region cropped
+	// from it or the window, each when it is due.
+	pipeline.SetPreview(previewMode != PREVIEW_OFF);
+	pipeline.Update();
+	if (!bStarted && pipeline.GetDesktopFrames() > 0) {
+		startupTimer.Phase("first frame");
+		SpoutLogNotice("ofApp : startup %s", startupTimer.Report().c_str());
+		bStarted = true;
+	}
+
+	captureStats.Stop();
+
 }
 
 //--------------------------------------------------------------
 void ofApp::draw() {
 
+	// Nothing to show without a user
+	if (bHeadless)
+		return;
+
 	// do not process if Iconic
 	if (IsIconic(g_hWnd))
 		return;
 
+	previewStats.Start();
+
+	// Thumbnail refresh or full preview this frame
+	bool bRefresh = updatePreview();
+
 	if (bDesktop) {
 		//
 		// Desktop mode
 		//
 		// Draw the entire desktop.
 		ofBackground(0, 0, 0, 255);
-		// Draw the desktop readback texture
-		desktopTexture.draw(0, 0, ofGetWidth(), ofGetHeight());
+		if (previewMode == PREVIEW_FULL) {
+			// Draw the desktop readback texture
+			desktopTexture.draw(0, 0, ofGetWidth(), ofGetHeight());
+		}
+		else if (previewMode == PREVIEW_THUMBNAIL) {
+			// Downscale the readback texture at the preview interval
+			if (bRefresh) {
+				previewFbo.begin();
+				desktopTexture.draw(0, 0, previewFbo.getWidth(), previewFbo.getHeight());
+				previewFbo.end();
+			}
+			previewFbo.draw(0, 0, ofGetWidth(), ofGetHeight());
+		}
+		else {
+			myFont.drawString("Preview off", 50, ofGetHeight() / 2);
+		}
 	}
 	else if (bWindow) {
 		//
@@ -548,8 +1374,23 @@ void ofApp::draw() {
 		ofBackground(128); // Grey for no capture
 
 		if (windowHwnd && windowBuffer) {
-			windowTexture.loadData((const unsigned char *)windowBuffer, windowWidth, windowHeight, GL_BGRA_EXT);
-			windowTexture.draw(0, 0, ofGetWidth(), ofGetHeight());
+			if (previewMode == PREVIEW_FULL) {
+				// The window texture is loaded in update()
+				windowTexture.draw(0, 0, ofGetWidth(), ofGetHeight());
+			}
+			else if (previewMode == PREVIEW_THUMBNAIL) {
+				// Load the window pixels only at the preview interval
+				if (bRefresh) {
+					windowTexture.loadData((const unsigned char *)windowBuffer, windowWidth, windowHeight, GL_BGRA_EXT);
+					previewFbo.begin();
+					windowTexture.draw(0, 0, previewFbo.getWidth(), previewFbo.getHeight());
+					previewFbo.end();
+				}
+				previewFbo.draw(0, 0, ofGetWidth(), ofGetHeight());
+			}
+			else {
+				myFont.drawString("Preview off", 50, ofGetHeight() / 2);
+			}
 		}
 		else {
 			// No window captured - instruct user
@@ -566,17 +1407,152 @@ void ofApp::draw() {
 		ofBackground(255, 0, 0, 255);
 	}
 
+	previewStats.Stop();
+
 	// Capture frame rate display
 	if (bShowfps) {
 		char tmp[64];
 		ofSetColor(255, 255, 0);
 		sprintf_s(tmp, 64, "Fps - %d", (int)roundf(ofGetFrameRate()));
 		myFont.drawString(tmp, ofGetWidth() - 110, 30);
+		// Capture and send time independent of the preview
+		sprintf_s(tmp, 64, "Capture %.1f msec", captureStats.GetAverage());
+		myFont.drawString(tmp, ofGetWidth() - 190, 54);
+		sprintf_s(tmp, 64, "Preview %.1f msec", previewStats.GetAverage());
+		myFont.drawString(tmp, ofGetWidth() - 190, 78);
+		// Sender rates and jitter
+		FramePacer &desktopPacer = pipeline.GetDesktopPacer();
+		sprintf_s(tmp, 64, "Desktop %.0f fps (%.1f)", desktopPacer.GetMeasuredFps(),
+			desktopPacer.GetLateness().GetDeviation());
+		myFont.drawString(tmp, ofGetWidth() - 190, 102);
+		if (!bDesktop) {
+			FramePacer &windowPacer = pipeline.GetWindowPacer();
+			sprintf_s(tmp, 64, "Window %.0f fps (%.1f)", windowPacer.GetMeasuredFps(),
+				windowPacer.GetLateness().GetDeviation());
+			myFont.drawString(tmp, ofGetWidth() - 190, 126);
+		}
+		// Duplication recovery
+		if (!g_deskDupl) {
+			ofSetColor(255, 0, 0);
+			myFont.drawString("Reconnecting", ofGetWidth() - 190, 150);
+		}
+		else if (duplicationRecovery.GetRecoveries() > 0) {
+			sprintf_s(tmp, 64, "Recovered %d (%.0f msec)", duplicationRecovery.GetRecoveries(),
+				duplicationRecovery.GetRecoveryTimes().GetAverage());
+			myFont.drawString(tmp, ofGetWidth() - 190, 150);
+		}
+		// Frame memory
+		sprintf_s(tmp, 64, "Frames %.1f MB peak", (double)pipeline.GetArena().GetPeakBytes() / 1048576.0);
+		myFont.drawString(tmp, ofGetWidth() - 190, 198);
+		// Streaming
+		FrameStream &frameStream = pipeline.GetStream();
+		if (bStream) {
+			if (frameStream.IsConnected())
+				sprintf_s(tmp, 64, "Stream %d sent %d dropped", frameStream.GetSent(), frameStream.GetDropped());
+			else
+				sprintf_s(tmp, 64, "Stream waiting");
+			myFont.drawString(tmp, ofGetWidth() - 190, 174);
+			// Drops by reason
+			FrameQueue &queue = frameStream.GetQueue();
+			sprintf_s(tmp, 64, "Queue %d/%d/%d/%d (%d)", queue.GetCoalesced(), queue.GetDroppedOldest(),
+				queue.GetDroppedNewest(), queue.GetTimeouts(), queue.GetHighWater());
+			myFont.drawString(tmp, ofGetWidth() - 190, 222);
+		}
+		// Snapshot ring
+		SnapshotRing &snapshotRing = pipeline.GetRing();
+		if (snapshotRing.IsOpen()) {
+			sprintf_s(tmp, 64, "Snapshot %.1f s (%.2f msec)", snapshotRing.GetRetained() / 1000.0,
+				snapshotRing.GetWriteTimes().GetAverage());
+			myFont.drawString(tmp, ofGetWidth() - 190, 246);
+		}
+		// Window scrolls
+		const ScrollDetector &scrollDetector = pipeline.GetScrollDetector();
+		if (bWindow && bScroll && scrollDetector.GetDetected() > 0) {
+			sprintf_s(tmp, 64, "Scrolls %d (%.2f msec)", scrollDetector.GetDetected(),
+				scrollDetector.GetTimes().GetAverage());
+			myFont.drawString(tmp, ofGetWidth() - 190, 270);
+		}
+		// Adaptive window rate
+		if (bWindow && bAdaptive) {
+			AdaptiveRate &adaptiveRate = pipeline.GetAdaptiveRate();
+			sprintf_s(tmp, 64, "Adaptive %.0f fps (%.1f%%)", adaptiveRate.GetFps(),
+				adaptiveRate.GetDensity() * 100.0);
+			myFont.drawString(tmp, ofGetWidth() - 190, 294);
+		}
 		ofSetColor(255);
 	}
 
 }
 
+//--------------------------------------------------------------
+bool ofApp::updatePreview() {
+
+	if (previewMode == PREVIEW_OFF)
+		return false;
+
+	if (previewMode == PREVIEW_FULL)
+		return true;
+
+	// Thumbnail
+	bool bRefresh = (previewCount % previewInterval) == 0;
+	previewCount++;
+	return bRefresh;
+
+}
+
+//--------------------------------------------------------------
+void ofApp::setPreviewMode(PreviewMode mode) {
+
+	// Log the capture time with the previous mode for comparison
+	const char* names[] = { "off", "thumbnail", "full" };
+	SpoutLogNotice("Capture %.2f msec (p99 %.2f), preview %.2f msec with preview %s",
+		captureStats.GetAverage(), captureStats.GetPercentile(99.0),
+		previewStats.GetAverage(), names[previewMode]);
+
+	previewMode = mode;
+	previewCount = 0; // Refresh the thumbnail immediately
+	captureStats.Reset();
+	previewStats.Reset();
+
+	menu->SetPopupItem("Preview off", mode == PREVIEW_OFF);
+	menu->SetPopupItem("Thumbnail", mode == PREVIEW_THUMBNAIL);
+	menu->SetPopupItem("Full preview", mode == PREVIEW_FULL);
+
+}
+
+//--------------------------------------------------------------
+void ofApp::setDesktopRate(double fps) {
+
+	pipeline.SetDesktopFps(fps);
+	menu->SetPopupItem("Desktop 60 fps", fps == 60.0);
+	menu->SetPopupItem("Desktop 30 fps", fps == 30.0);
+	menu->SetPopupItem("Desktop 15 fps", fps == 15.0);
+
+}
+
+//--------------------------------------------------------------
+void ofApp::setWindowRate(double fps) {
+
+	// Also the adaptive maximum
+	pipeline.SetWindowFps(fps);
+	menu->SetPopupItem("Window 60 fps", fps == 60.0);
+	menu->SetPopupItem("Window 30 fps", fps == 30.0);
+	menu->SetPopupItem("Window 15 fps", fps == 15.0);
+
+}
+
+//--------------------------------------------------------------
+void ofApp::setQueuePolicy(QueuePolicy policy) {
+
+	// Takes effect for the next frame pushed
+	pipeline.GetStream().GetQueue().SetPolicy(policy);
+	menu->SetPopupItem("Coalesce", policy == QUEUE_COALESCE);
+	menu->SetPopupItem("Drop oldest", policy == QUEUE_DROP_OLDEST);
+	menu->SetPopupItem("Drop newest", policy == QUEUE_DROP_NEWEST);
+	menu->SetPopupItem("Block", policy == QUEUE_BLOCK);
+
+}
+
 //--------------------------------------------------------------
 void ofApp::windowResized(int w, int h) {
 
@@ -613,6 +1589,13 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 	// File menu
 	//
 
+	if (title == "Save snapshot") {
+		if (pipeline.GetRing().IsOpen())
+			saveSnapshot();
+		else
+			SpoutMessageBox(NULL, "Select \"Snapshot\" in the Capture menu first", "SpoutCapture", MB_OK);
+	}
+
 	if (title == "Exit") {
 		// Quit the application
 		exit();
@@ -626,10 +1609,11 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		bDesktop = true;
 		bRegion = false;
 		bWindow = false;
+		pipeline.SetSource(SOURCE_DESKTOP);
 		menu->SetPopupItem("Region", false);
 		menu->SetPopupItem("Window", false);
 		// Set desktop sender active
-		desktopSender.SetActiveSender("DesktopSender");
+		desktopSender.SetActiveSender(config.desktopName.c_str());
 		// Disable layered style
 		HWND hwnd = ofGetWin32Window();
 		LONG_PTR dwStyle = GetWindowLongPtrA(hwnd, GWL_EXSTYLE);
@@ -646,6 +1630,7 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		bWindow = true;
 		bDesktop = false;
 		bRegion = false;
+		pipeline.SetSource(SOURCE_WINDOW);
 		menu->SetPopupItem("Desktop", false);
 		menu->SetPopupItem("Region", false);
 		menu->SetPopupItem("Window", false);
@@ -654,15 +1639,17 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		// Compatible bitmap is re-created
 		windowHwnd = nullptr;
 
-		// clear buffer to grey
-		if (windowBuffer) {
-			memset((void *)windowBuffer, 128, windowWidth*windowHeight * 4);
+		// Clear to grey
+		FramePtr frame = pipeline.GetArena().Allocate(windowWidth, windowHeight);
+		if (frame) {
+			memset((void *)frame->pixels, 128, frame->size);
+			setWindowFrame(frame);
 			// Send a grey image frame to signal to overwrite the previous one
 			if (bInitialized)
 				windowSender.SendImage(windowBuffer, windowWidth, windowHeight, GL_BGRA_EXT);
 		}
 		// Set window sender active
-		if (bInitialized) desktopSender.SetActiveSender("WindowSender");
+		if (bInitialized) desktopSender.SetActiveSender(config.windowName.c_str());
 	}
 
 	if (title == "Region") {
@@ -670,6 +1657,7 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		bRegion = true;
 		bDesktop = false;
 		bWindow = false;
+		pipeline.SetSource(SOURCE_REGION);
 		menu->SetPopupItem("Desktop", false);
 		menu->SetPopupItem("Window", false);
 
@@ -694,7 +1682,7 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		SetLayeredWindowAttributes(hwnd, RGB(255, 0, 0), 0, LWA_COLORKEY);
 
 		// Set window sender active
-		desktopSender.SetActiveSender("WindowSender");
+		desktopSender.SetActiveSender(config.windowName.c_str());
 	}
 
 	if (title == "Show fps") {
@@ -706,6 +1694,84 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		doTopmost(bTopmost);
 	}
 
+	if (title == "Tile map") {
+		bTileMap = bChecked;
+		// Start again with all tiles changed
+		pipeline.SetTileMap(bTileMap);
+		if (!bTileMap) {
+			// Remove the shared memory buffers
+			if (desktopTileSize > 0) desktopSender.DeleteMemoryBuffer();
+			if (windowTileSize > 0) windowSender.DeleteMemoryBuffer();
+			desktopTileSize = 0;
+			windowTileSize = 0;
+		}
+	}
+
+	if (title == "Stream") {
+		bStream = false;
+		pipeline.CloseStream();
+		if (bChecked) {
+			// Listen for a receiver
+			if (pipeline.OpenStream(streamAddress)) {
+				bStream = true;
+			}
+			else {
+				SpoutLogWarning("Stream could not listen on %s", streamAddress.c_str());
+				menu->SetPopupItem("Stream", false);
+			}
+		}
+	}
+
+	if (title == "Snapshot") {
+		pipeline.CloseSnapshot();
+		if (bChecked && !openSnapshot())
+			menu->SetPopupItem("Snapshot", false);
+	}
+
+	//
+	// Preview menu
+	//
+	if (title == "Preview off") {
+		setPreviewMode(PREVIEW_OFF);
+	}
+
+	if (title == "Thumbnail") {
+		setPreviewMode(PREVIEW_THUMBNAIL);
+	}
+
+	if (title == "Full preview") {
+		setPreviewMode(PREVIEW_FULL);
+	}
+
+	//
+	// Rate menu
+	//
+	if (title == "Desktop 60 fps") setDesktopRate(60.0);
+	if (title == "Desktop 30 fps") setDesktopRate(30.0);
+	if (title == "Desktop 15 fps") setDesktopRate(15.0);
+	if (title == "Window 60 fps") setWindowRate(60.0);
+	if (title == "Window 30 fps") setWindowRate(30.0);
+	if (title == "Window 15 fps") setWindowRate(15.0);
+
+	if (title == "Present aligned") {
+		// Align the desktop schedule to the time frames are presented
+		pipeline.SetPresentAligned(bChecked);
+	}
+
+	if (title == "Adaptive rate") {
+		// Lower the window rate while the window is not changing
+		bAdaptive = bChecked;
+		pipeline.SetAdaptive(bAdaptive);
+	}
+
+	//
+	// Queue menu
+	//
+	if (title == "Coalesce") setQueuePolicy(QUEUE_COALESCE);
+	if (title == "Drop oldest") setQueuePolicy(QUEUE_DROP_OLDEST);
+	if (title == "Drop newest") setQueuePolicy(QUEUE_DROP_NEWEST);
+	if (title == "Block") setQueuePolicy(QUEUE_BLOCK);
+
 	//
 	// Help menu
 	//
@@ -734,6 +1800,38 @@ void ofApp::appMenuFunction(string title, bool bChecked) {
 		doc += "whereas a captured window can be obscured without affecting the capture. ";
 		doc += "All captures continue if SpoutCapture is minimized.\n\n";
 
+		doc += "\"Preview\"\n\nThe capture can be shown at full rate, as a thumbnail updated ";
+		doc += "a few times a second, or not at all. Capture and sending continue at ";
+		doc += "full rate with less preview. \"Show fps\" displays the capture and preview times.\n\n";
+
+		doc += "\"Rate\"\n\nThe desktop and window senders each have their own frame rate. ";
+		doc += "\"Present aligned\" schedules desktop frames from the time they were presented ";
+		doc += "so that the desktop sender follows the display refresh. ";
+		doc += "\"Adaptive rate\" lowers the window rate step by step while the window ";
+		doc += "is not changing, down to a few frames a second, and returns to the selected rate on a change.\n\n";
+
+		doc += "\"Tile map\"\n\nA map of the 64x64 pixel tiles that have changed is written to ";
+		doc += "the shared memory buffer of each sender with every frame, so that receivers ";
+		doc += "can process only the parts of the image that have changed. ";
+		doc += "A scroll is written as a move of the previous frame and the tiles it uncovers.\n\n";
+
+		doc += "\"Stream\"\n\nThe capture is streamed to another process on the same computer ";
+		doc += "by local TCP port 7590. Only changed tiles are sent, compressed. ";
+		doc += "If the receiver is slow, frames are dropped rather than holding up capture.\n\n";
+
+		doc += "\"Queue\"\n\nWhat happens to streamed frames when the receiver is slower than capture. ";
+		doc += "\"Coalesce\" replaces the oldest queued frame and keeps its changed tiles. ";
+		doc += "\"Drop oldest\" and \"Drop newest\" discard a frame and send the next one complete. ";
+		doc += "\"Block\" waits up to 10 msec for the receiver before dropping the frame. ";
+		doc += "\"Show fps\" displays the frames coalesced, dropped oldest, dropped newest ";
+		doc += "and timed out, and the most frames queued.\n\n";
+
+		doc += "\"Snapshot\"\n\nThe last seconds sent are kept, compressed, in \"snapshot.ring\" ";
+		doc += "in the data folder. \"Save snapshot\" in the File menu, Ctrl+Alt+S from any application, ";
+		doc += "or another process setting the \"SpoutCaptureSnapshot\" event writes them to a clip ";
+		doc += "in the data folder while capture continues. ";
+		doc += "The clip plays with \"StreamReceiver file:clip.stc\".\n\n";
+
 		SpoutMessageBoxIcon(LoadIconA(GetModuleHandle(NULL), MAKEINTRESOURCEA(IDI_ICON1)));
 		SpoutMessageBox(NULL, doc.c_str(), " ", MB_OK | MB_USERICON, "SpoutCapture");
 	}
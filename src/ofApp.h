@@ -5,6 +5,11 @@
 #include "ofxWinMenu.h" // Addon for a windows menu
 #include "..\apps\SpoutGL\SpoutSender.h" // Spout 2.007 beta (subject to change)
 #include <dxgi1_2.h> // Desktop Duplication
+#include "CaptureStats.h" // Capture and preview timing
+#include "DuplicationRecovery.h" // Background duplication reconnect
+#include "CapturePipeline.h" // Rates, tile maps, stream and snapshot ring
+#include "CaptureConfig.h" // Settings file and command line
+#include "ThreadSchedule.h" // Thread priority and affinity
 
 #include <shlwapi.h> // For PathRemoveFileSpecA
 #pragma comment (lib, "shlwapi.lib")
@@ -14,11 +19,19 @@ class ofApp : public ofBaseApp {
 public:
 
 	void setup();
+	void setupInterface(); // Window, menu and font
+	void applyConfig();
+	void setupPipeline(); // Capture functions of the pipeline
 	void update();
 	void exit();
 	void draw();
 	void windowResized(int w, int h);
 
+	// Capture loop
+	// Desktop, region and window rates, tile maps, the stream and the
+	// snapshot ring. The functions below capture and send for it.
+	CapturePipeline pipeline;
+
 	// Desktop sender
 	SpoutSender desktopSender;
 
@@ -26,7 +39,17 @@ public:
 	SpoutSender windowSender;
 	unsigned int windowWidth = 0;
 	unsigned int windowHeight = 0;
-	unsigned char * windowBuffer = nullptr;
+
+	// Adaptive window rate, lowered while the window is not changing
+	// and back to the selected rate on a change
+	bool bAdaptive = false;
+
+	// Captured frames are shared by the senders, preview and stream
+	// from the arena of the pipeline instead of each making a copy.
+	// windowBuffer points to the pixels of the current window frame.
+	FrameRef windowFrame;
+	const unsigned char * windowBuffer = nullptr;
+	void setWindowFrame(FrameRef frame);
 
 	// Application window position
 	int positionTop = 0;
@@ -42,10 +65,37 @@ public:
 	// Screen draw font
 	ofTrueTypeFont myFont;
 
+	// Preview
+	// Off : nothing is drawn and the window texture is not loaded
+	// Thumbnail : a downscaled copy is updated every previewInterval frames
+	// Full : the capture is drawn at full resolution every frame
+	enum PreviewMode {
+		PREVIEW_OFF,
+		PREVIEW_THUMBNAIL,
+		PREVIEW_FULL
+	};
+	PreviewMode previewMode = PREVIEW_FULL;
+	unsigned int previewInterval = 15; // Frames between thumbnail updates
+	unsigned int previewCount = 0;
+	ofFbo previewFbo; // Thumbnail
+	bool updatePreview(); // Returns true if the preview is drawn this frame
+	void setPreviewMode(PreviewMode mode);
+
+	// Sender rates
+	void setDesktopRate(double fps);
+	void setWindowRate(double fps);
+
+	// Stream queue policy when the receiver is slow
+	void setQueuePolicy(QueuePolicy policy);
+
+	// Timing of capture and send independent of preview
+	CaptureStats captureStats;
+	CaptureStats previewStats;
+
 	// Menu
 	HWND g_hwndForeground = NULL;
 	HINSTANCE g_hInstance = NULL;
-	ofxWinMenu * menu;
+	ofxWinMenu * menu = nullptr; // Not created headless
 	void appMenuFunction(string title, bool bChecked);
 	bool bTopmost = false;
 	void doTopmost(bool bTop);
@@ -59,14 +109,68 @@ public:
 	unsigned int monitorWidth = 0;
 	unsigned int monitorHeight = 0;
 	bool setupDesktopDuplication();
-	bool capture_desktop();
+
+	// Cached output topology and background recovery
+	IDXGIOutput1* g_pOutput = NULL; // Primary output to duplicate
+	IDXGIOutputDuplication* g_pendingDupl = NULL; // Created by the recovery thread
+	unsigned int pendingWidth = 0; // Desktop size of the pending duplication
+	unsigned int pendingHeight = 0;
+	DuplicationRecovery duplicationRecovery;
+	bool enumerateOutputs();
+	bool duplicateOutput();
+	void resizeDesktop(unsigned int width, unsigned int height);
+	bool capture_desktop(unsigned int timeout, DesktopFrame &frame);
+	uint32_t sendDesktop(bool bReadback);
+	uint32_t sendRegion();
+	// Region read back between desktop frames
+	ID3D11Texture2D* g_pRegionTexture = NULL;
+	unsigned int regionTextureWidth = 0;
+	unsigned int regionTextureHeight = 0;
+	void readRegion(int left, int top, unsigned int width, unsigned int height);
 	
 	// GDI capture
 	HDC m_hWindowDC = NULL;
 	HDC m_hWindowMemDC = NULL;
 	HBITMAP m_hWindowBitmap = NULL;
 	HBITMAP m_hWindowOld = NULL;
-	bool capture_window(HWND hwnd);
+	FramePtr capture_window(HWND hwnd);
+	bool sendWindow(const FrameRef &frame);
+	bool selectWindow(HWND hwnd);
+	HWND findWindow(const std::string& title);
+	double windowSearchTime = 0.0;
+
+	// Tile change maps published with each frame, kept by the pipeline
+	// Desktop and region from duplication move and dirty rectangles
+	// Window by comparison with the previous GDI frame, after a scroll
+	bool bScroll = true; // Scrolls and duplication moves sent as moves
+	std::vector<unsigned char> tileData; // Published map
+	std::vector<unsigned char> metaData; // Duplication dirty and move rectangles
+	unsigned int desktopTileSize = 0; // Shared memory buffer sizes
+	unsigned int windowTileSize = 0;
+	void getDirtyRects(DXGI_OUTDUPL_FRAME_INFO &info, DesktopFrame &frame);
+	void publishTileMap(SpoutSender &sender, const char* name, const TileMap &map, unsigned int &size);
+
+	// Streaming to another process
+	// Desktop and region pixels are copied to a staging texture
+	// and read by the next update, once the copy has completed
+	std::string streamAddress = "tcp:7590";
+	ID3D11Texture2D* g_pStagingTexture = NULL;
+	bool copyDesktopStaging();
+	FramePtr readStaging(int left, int top, unsigned int width, unsigned int height);
+
+	// Snapshot ring
+	// The last seconds sent are kept in a memory-mapped file and saved
+	// as a clip by Ctrl+Alt+key, the menu or the "SpoutCaptureSnapshot"
+	// event set by another process
+	HANDLE snapshotEvent = NULL;
+	bool bSnapshotKey = false; // Hotkey down
+	bool bSnapshotRequested = false;
+	double snapshotRequestTime = 0.0;
+	std::string snapshotClip; // Last clip saved
+	bool openSnapshot();
+	void watchSnapshot();
+	void saveSnapshot();
+	void checkSnapshot();
 
 	// Flags
 	bool bInitialized = false;
@@ -75,8 +179,17 @@ public:
 	bool bWindow = false;
 	bool bResized = false;
 	bool bShowfps = false;
+	bool bTileMap = false;
+	bool bStream = false;
 
-	// For command line args to set the receiving sender name
-	// e.g. "SpoutCapture" "Window Title"
+	// Command line arguments and configuration file
+	// e.g. SpoutCapture --config headless.cfg
+	// or SpoutCapture "Window Title"
 	LPSTR lpCmdLine = nullptr;
+	CaptureConfig config;
+	bool bHeadless = false; // No window, menu or preview
+	PhaseTimer startupTimer; // Started in WinMain
+	ThreadScheduler captureScheduler; // This thread
+	void measureJitter();
+	bool bStarted = false; // First frame sent
 };
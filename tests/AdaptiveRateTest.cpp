@@ -0,0 +1,219 @@
+//
+//	AdaptiveRateTest
+//
+//	Synthetic window traces captured on a virtual clock at the rate
+//	chosen : a static dialog falls to the minimum, video holds the
+//	maximum, a blinking caret and changes under the threshold do not
+//	keep the rate up. Measure from the compared tile map gives the same
+//	result as hashing the whole frame. The benchmark compares the two.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "AdaptiveRate.h"
+
+#include <functional>
+#include <string.h>
+
+// Draws the window at a time, adding any scroll to the map
+typedef std::function<void(double now, std::vector<uint32_t>& pixels, TileMap& map)> Scene;
+
+struct Trace {
+	unsigned int width = 640;
+	unsigned int height = 480;
+	double now = 0.0;
+	AdaptiveRate rate;     // From the tile map, as the window capture
+	AdaptiveRate hashed;   // From the whole frame
+	FramePacer pacer;
+	TileMap map;
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> current;
+	unsigned int mismatches = 0;
+
+	Trace() {
+		rate.SetClock([this]() { return now; });
+		hashed.SetClock([this]() { return now; });
+		pacer.SetClock([this]() { return now; });
+		rate.SetRange(5.0, 60.0);
+		hashed.SetRange(5.0, 60.0);
+		map.Resize(width, height);
+		current.resize((size_t)width*height);
+		for (unsigned int y = 0; y < height; y++)
+			for (unsigned int x = 0; x < width; x++)
+				current[(size_t)y*width + x] = 0xFF000000 | (x & 0xFF) << 8 | (y & 0xFF);
+	}
+
+	// Poll every msec for a time, capturing when due at the adaptive rate
+	// as the application loop does. Returns the frames captured.
+	unsigned int Run(double duration, const Scene& scene) {
+		unsigned int frames = 0;
+		double end = now + duration;
+		while (now < end) {
+			pacer.ChangeFps(rate.GetFps());
+			if (pacer.IsDue()) {
+				previous = current;
+				map.Clear();
+				scene(now, current, map);
+				map.Compare((const unsigned char*)previous.data(), (const unsigned char*)current.data(), width*4);
+				double changed = rate.Measure(map, (const unsigned char*)current.data(), width*4);
+				if (changed != hashed.Measure((const unsigned char*)current.data(), width, height, width*4))
+					mismatches++;
+				pacer.Frame();
+				frames++;
+			}
+			now += 1.0;
+		}
+		return frames;
+	}
+};
+
+static void Static(double, std::vector<uint32_t>&, TileMap&)
+{
+}
+
+// A video playing in a rectangle
+static void Video(double now, std::vector<uint32_t>& pixels, TileMap&)
+{
+	uint32_t seed = 1 + (uint32_t)now;
+	for (unsigned int y = 100; y < 280; y++)
+		for (unsigned int x = 200; x < 520; x++)
+			pixels[(size_t)y*640 + x] = TestRandom(seed);
+}
+
+// A text caret shown and hidden every half second
+static void Caret(double now, std::vector<uint32_t>& pixels, TileMap&)
+{
+	bool bShown = ((int)(now/500.0) & 1) != 0;
+	for (unsigned int y = 200; y < 216; y++)
+		for (unsigned int x = 300; x < 302; x++)
+			pixels[(size_t)y*640 + x] = bShown ? 0xFF000000 : 0xFFFFFFFF;
+}
+
+// A counter in one tile, new at every frame
+static void Counter(double now, std::vector<uint32_t>& pixels, TileMap&)
+{
+	for (unsigned int y = 10; y < 20; y++)
+		for (unsigned int x = 10; x < 40; x++)
+			pixels[(size_t)y*640 + x] = (uint32_t)now*2654435761u + x;
+}
+
+// Scrolled up by 8 lines a frame, with a new line at the bottom
+static void Scroll(double now, std::vector<uint32_t>& pixels, TileMap& map)
+{
+	std::vector<uint32_t> before = pixels;
+	memcpy(pixels.data(), before.data() + 8*640, (480 - 8)*640*4);
+	uint32_t seed = 7 + (uint32_t)now;
+	for (unsigned int i = (480 - 8)*640; i < 480*640; i++)
+		pixels[i] = TestRandom(seed);
+	map.AddMove({ 0, 0, 640, 480 - 8, 0, -8 });
+}
+
+TEST(AdaptiveRateStatic)
+{
+	Trace trace;
+	trace.Run(1000.0, Video);
+	CHECK(trace.rate.GetFps() == 60.0);
+	// 1 second at 60, then 30, 15, 7.5 and 5 fps
+	unsigned int frames = trace.Run(5000.0, Static);
+	CHECK(frames >= 60 + 30 + 15 + 7 + 5 - 2 && frames <= 60 + 30 + 15 + 8 + 5 + 2);
+	CHECK(trace.rate.GetFps() == 5.0);
+	frames = trace.Run(5000.0, Static);
+	CHECK(frames >= 24 && frames <= 26);
+	CHECK(trace.mismatches == 0);
+}
+
+TEST(AdaptiveRateVideo)
+{
+	Trace trace;
+	trace.Run(5000.0, Static);
+	CHECK(trace.rate.GetFps() == 5.0);
+	// Back to the maximum at the first frame that changes
+	trace.Run(200.0, Video);
+	CHECK(trace.rate.GetFps() == 60.0);
+	unsigned int frames = trace.Run(5000.0, Video);
+	CHECK(frames >= 298 && frames <= 301);
+	CHECK(trace.rate.GetFps() == 60.0);
+	CHECK(trace.rate.GetDensity() > 0.1);
+	CHECK(trace.mismatches == 0);
+}
+
+TEST(AdaptiveRateBlink)
+{
+	Trace trace;
+	trace.Run(5000.0, Caret);
+	CHECK(trace.rate.GetFps() == 5.0);
+	unsigned int frames = trace.Run(5000.0, Caret);
+	CHECK(frames >= 24 && frames <= 26);
+	CHECK(trace.mismatches == 0);
+}
+
+TEST(AdaptiveRateThreshold)
+{
+	// Any change keeps the maximum
+	Trace trace;
+	unsigned int frames = trace.Run(5000.0, Counter);
+	CHECK(frames >= 298 && trace.rate.GetFps() == 60.0);
+	// One tile of 80 is under 5%
+	Trace threshold;
+	threshold.rate.SetThreshold(0.05);
+	frames = threshold.Run(5000.0, Counter);
+	CHECK(frames <= 60 + 30 + 15 + 8 + 5 + 2);
+	CHECK(threshold.rate.GetFps() == 5.0);
+	CHECK(threshold.rate.GetActive() <= 1);
+	CHECK(trace.mismatches == 0 && threshold.mismatches == 0);
+}
+
+// Tiles under a move are measured, with the same result as the whole frame
+TEST(AdaptiveRateMoves)
+{
+	Trace trace;
+	trace.Run(3000.0, Static);
+	CHECK(trace.rate.GetFps() < 60.0);
+	trace.Run(2000.0, Scroll);
+	CHECK(trace.rate.GetFps() == 60.0);
+	CHECK(trace.rate.GetDensity() > 0.9);
+	// A new size falls back to the whole frame
+	trace.map.Resize(320, 240);
+	trace.map.SetAll();
+	CHECK(trace.rate.Measure(trace.map, (const unsigned char*)trace.current.data(), 640*4) == 1.0);
+	CHECK(trace.mismatches == 0);
+}
+
+// Measure of 1920x1080 frames with a line of text typed in each,
+// from the whole frame and from the tile map
+BENCH(AdaptiveRateSpeed)
+{
+	const unsigned int width = 1920;
+	const unsigned int height = 1080;
+	std::vector<uint32_t> frames[2];
+	frames[0].resize((size_t)width*height);
+	uint32_t seed = 3;
+	for (uint32_t& p : frames[0])
+		p = TestRandom(seed);
+	frames[1] = frames[0];
+	TileMap map;
+	map.Resize(width, height);
+	AdaptiveRate hashed;
+	AdaptiveRate rate;
+	CaptureStats whole;
+	CaptureStats tiles;
+	for (unsigned int i = 1; i <= 200; i++) {
+		std::vector<uint32_t>& previous = frames[(i - 1) & 1];
+		std::vector<uint32_t>& current = frames[i & 1];
+		current = previous;
+		for (unsigned int y = 500; y < 516; y++)
+			for (unsigned int x = (i % 100)*8; x < (i % 100)*8 + 8; x++)
+				current[(size_t)y*width + x] = i;
+		map.Clear();
+		map.Compare((const unsigned char*)previous.data(), (const unsigned char*)current.data(), width*4);
+		whole.Start();
+		double a = hashed.Measure((const unsigned char*)current.data(), width, height, width*4);
+		whole.Stop();
+		tiles.Start();
+		double b = rate.Measure(map, (const unsigned char*)current.data(), width*4);
+		tiles.Stop();
+		CHECK(a == b);
+	}
+	printf("    whole frame %.3f msec, tile map %.4f msec\n", whole.GetAverage(), tiles.GetAverage());
+}
@@ -0,0 +1,202 @@
+//
+//	CaptureConfigTest
+//
+//	Settings from text, from arguments after a configuration file and
+//	from a quoted command line, the region setting, and the settings
+//	that parse but are rejected by Validate.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "CaptureConfig.h"
+
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+
+static std::string TestPath(const char* name)
+{
+	return std::string(name) + "-" + std::to_string((int)getpid());
+}
+
+TEST(CaptureConfigParse)
+{
+	CaptureConfig config;
+	CHECK(config.Parse(
+		"# Headless region\n"
+		"headless = true\n"
+		"source = Region   # case is ignored\n"
+		"\n"
+		"  desktop-fps = 30\r\n"
+		"window-sender = Region Sender\n"
+		"queue = drop-oldest\n"
+		"queue-depth = 8\n"
+		"stream = tcp:7600\n"
+		"snapshot = 0\n"
+		"snapshot-key = off\n"
+		"capture-cores = 0,2-3\n"));
+	CHECK(config.bHeadless);
+	CHECK(config.source == SOURCE_REGION);
+	CHECK(config.desktopFps == 30.0);
+	CHECK(config.windowFps == 60.0); // Not set
+	CHECK(config.windowName == "Region Sender");
+	CHECK(config.queuePolicy == QUEUE_DROP_OLDEST);
+	CHECK(config.queueDepth == 8);
+	CHECK(config.streamAddress == "tcp:7600");
+	CHECK(config.snapshotTime == 0.0);
+	CHECK(config.snapshotKey == 0);
+	CHECK(config.captureSchedule.affinity == 0xD);
+	CHECK(config.Validate());
+
+	// The line of the first error
+	CaptureConfig bad;
+	CHECK(!bad.Parse("desktop-fps = 30\nno equals\n", "test.cfg"));
+	CHECK(bad.error == "test.cfg line 2 : expected key = value");
+	CHECK(!bad.Parse("tile-map = maybe\n", "test.cfg"));
+	CHECK(bad.error == "test.cfg line 1 : invalid value \"maybe\" for tile-map");
+	CHECK(!bad.Parse("frame-rate = 30\n", "test.cfg"));
+	CHECK(bad.error == "test.cfg line 1 : unknown setting \"frame-rate\"");
+}
+
+TEST(CaptureConfigArgs)
+{
+	std::string path = TestPath("config-test") + ".cfg";
+	FILE* file = fopen(path.c_str(), "wb");
+	CHECK(file != nullptr);
+	if (!file)
+		return;
+	fputs("desktop-fps = 30\nwindow-fps = 30\ntile-map = true\nqueue = block\n", file);
+	fclose(file);
+
+	// Arguments after the file replace its settings, those before do not
+	CaptureConfig config;
+	CHECK(config.ParseArgs({ "--window-fps", "15", "--config", path,
+		"--desktop-fps=20", "--queue", "coalesce", "--headless", "--scroll", "off" }));
+	CHECK(config.desktopFps == 20.0);
+	CHECK(config.windowFps == 30.0);
+	CHECK(config.bTileMap);
+	CHECK(config.queuePolicy == QUEUE_COALESCE);
+	CHECK(config.bHeadless); // A flag without a value
+	CHECK(!config.bScroll);
+
+	// An argument without a key is the window title
+	CaptureConfig window;
+	CHECK(window.ParseArgs({ "--config", path, "Untitled - Notepad" }));
+	CHECK(window.source == SOURCE_WINDOW);
+	CHECK(window.windowTitle == "Untitled - Notepad");
+	CHECK(window.desktopFps == 30.0);
+
+	CaptureConfig missing;
+	CHECK(!missing.ParseArgs({ "--config", path + ".missing" }));
+	CHECK(missing.error == "Could not open " + path + ".missing");
+	CaptureConfig unknown;
+	CHECK(!unknown.ParseArgs({ "--config", path, "--fps", "30" }));
+	CHECK(unknown.error == "unknown setting \"fps\"");
+
+	remove(path.c_str());
+}
+
+TEST(CaptureConfigCommandLine)
+{
+	std::vector<std::string> args = SplitCommandLine(
+		"  --config \"C:\\My Settings\\capture.cfg\"\t--window=\"Untitled - Notepad\" \"\" --headless ");
+	CHECK(args.size() == 5);
+	if (args.size() == 5) {
+		CHECK(args[0] == "--config");
+		CHECK(args[1] == "C:\\My Settings\\capture.cfg");
+		CHECK(args[2] == "--window=Untitled - Notepad");
+		CHECK(args[3] == ""); // Quotes are an argument
+		CHECK(args[4] == "--headless");
+	}
+	CHECK(SplitCommandLine("").empty());
+	CHECK(SplitCommandLine(" \t ").empty());
+
+	// Quoted in the middle, and an unterminated quote to the end
+	args = SplitCommandLine("a\"b c\"d \"e f");
+	CHECK(args.size() == 2);
+	if (args.size() == 2) {
+		CHECK(args[0] == "ab cd");
+		CHECK(args[1] == "e f");
+	}
+
+	CaptureConfig config;
+	CHECK(config.ParseCommandLine("--source region --region \"10, -20, 640, 360\" --desktop-sender \"My Desktop\""));
+	CHECK(config.source == SOURCE_REGION);
+	CHECK(config.regionLeft == 10 && config.regionTop == -20);
+	CHECK(config.desktopName == "My Desktop");
+}
+
+TEST(CaptureConfigRegion)
+{
+	CaptureConfig config;
+	CHECK(config.Set("region", " 100 ,200, 1280,720 "));
+	CHECK(config.regionLeft == 100);
+	CHECK(config.regionTop == 200);
+	CHECK(config.regionWidth == 1280);
+	CHECK(config.regionHeight == 720);
+
+	// Left of and above the primary monitor
+	CHECK(config.Set("region", "-1920,-100,1920,1080"));
+	CHECK(config.regionLeft == -1920 && config.regionTop == -100);
+
+	// Zero size for the window size
+	CHECK(config.Set("region", "0,0,0,0"));
+	CHECK(config.regionWidth == 0 && config.regionHeight == 0);
+	CHECK(config.Validate());
+
+	// Each leaves the last region
+	CHECK(config.Set("region", "1,2,3,4"));
+	const char* invalid[] = { "1,2,3", "1,2,3,4,5", "1,2,-3,4", "1,2,3,-4", "a,2,3,4", "1,,3,4", "1 2,3,4,5", "" };
+	for (const char* value : invalid) {
+		CHECK(!config.Set("region", value));
+		CHECK(config.error == std::string("invalid value \"") + value + "\" for region");
+	}
+	CHECK(config.regionLeft == 1 && config.regionTop == 2);
+	CHECK(config.regionWidth == 3 && config.regionHeight == 4);
+}
+
+TEST(CaptureConfigValidate)
+{
+	CaptureConfig defaults;
+	CHECK(defaults.Validate());
+
+	// Each setting parses but is rejected
+	struct Case {
+		const char* text;
+		const char* error;
+	};
+	Case cases[] = {
+		{ "desktop-fps = 0", "frame rates must be more than 0 and no more than 1000 fps" },
+		{ "window-fps = 1001", "frame rates must be more than 0 and no more than 1000 fps" },
+		{ "adaptive-min-fps = 0.5", "the adaptive minimum must be at least 1 fps and no more than 1000 fps" },
+		{ "source = window", "window capture needs a window title" },
+		{ "region = 0, 0, 640, 0", "region width and height must both be set" },
+		{ "window-sender = DesktopSender", "the desktop and window senders need different names" },
+		{ "desktop-sender = " "0123456789012345678901234567890123456789012345678901234567890123"
+			"0123456789012345678901234567890123456789012345678901234567890123"
+			"0123456789012345678901234567890123456789012345678901234567890123"
+			"0123456789012345678901234567890123456789012345678901234567890123",
+			"sender names must be 1 to 255 characters" },
+		{ "queue-depth = 1025", "queue depth must be no more than 1024" },
+		{ "frame-memory = 8", "frame memory must be at least 16 MB" },
+		{ "snapshot-memory = 8", "snapshot memory must be 16 to 65536 MB" },
+		{ "snapshot-fps = 0", "the snapshot frame rate must be more than 0 and no more than 1000 fps" },
+	};
+	for (const Case& c : cases) {
+		CaptureConfig config;
+		CHECK(config.Parse(c.text));
+		CHECK(!config.Validate());
+		CHECK(config.error == c.error);
+	}
+
+	// Snapshot memory is not checked without the ring
+	CaptureConfig off;
+	CHECK(off.Parse("snapshot = 0\nsnapshot-memory = 8\n"));
+	CHECK(off.Validate());
+
+	// A window title makes window capture valid
+	CaptureConfig window;
+	CHECK(window.Parse("source = window\nwindow = Notepad\n"));
+	CHECK(window.Validate());
+}
@@ -0,0 +1,549 @@
+//
+//	CapturePipelineTest
+//
+//	The capture loop on a virtual clock with simulated capture : the
+//	desktop, region and window rates, the wait for an idle desktop,
+//	tile maps of the desktop, the region and the window, and frames
+//	copied for the snapshot ring and read by the next update.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "CapturePipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static std::string TestPath(const char* name)
+{
+	return std::string(name) + "-" + std::to_string((int)getpid());
+}
+
+struct StagedRead {
+	int left;
+	int top;
+	unsigned int width;
+	unsigned int height;
+};
+
+// Capture of a 640x480 desktop and a window, counting each call
+struct FakeCapture {
+	double now = 0.0;
+	CapturePipeline pipeline;
+
+	// Desktop
+	unsigned int width = 640;
+	unsigned int height = 480;
+	bool bIdle = false;  // No new desktop frame, acquire waits for the timeout
+	DesktopFrame next;   // Changes of the next desktop frame
+	std::vector<unsigned int> timeouts;
+	unsigned int acquired = 0;
+	unsigned int desktopSends = 0;
+	unsigned int readbacks = 0;
+	unsigned int regionReads = 0; // Region read back without the desktop
+	unsigned int stages = 0;
+	unsigned int releases = 0;
+
+	// Region and window sender
+	unsigned int windowSends = 0;
+	unsigned int regionSends = 0;
+	bool bWindowOpen = true;
+	bool bSendWindow = true;
+	unsigned int windowWidth = 320;
+	unsigned int windowHeight = 240;
+	std::vector<uint32_t> window;
+
+	TileMap published[2];
+	unsigned int publishes[2]{};
+
+	// Staged parts read, and the sender frame each was staged with
+	std::vector<StagedRead> reads;
+	uint32_t stagedNumber = 0;
+	uint32_t readNumber = 0;
+	FramePtr lastRead;
+
+	FakeCapture() {
+		DrawWindow(0);
+		pipeline.SetClock([this]() { return now; });
+
+		CapturePlatform platform;
+		platform.AcquireDesktop = [this](unsigned int timeout, DesktopFrame& frame) {
+			timeouts.push_back(timeout);
+			if (bIdle) {
+				now += timeout;
+				return false;
+			}
+			frame = next;
+			frame.width = width;
+			frame.height = height;
+			frame.presentTime = now;
+			next = DesktopFrame();
+			acquired++;
+			return true;
+		};
+		platform.SendDesktop = [this](bool bReadback) {
+			if (bReadback) readbacks++;
+			return ++desktopSends;
+		};
+		platform.StageDesktop = [this]() {
+			stages++;
+			stagedNumber = pipeline.GetSource() == SOURCE_DESKTOP ? desktopSends : windowSends + 1;
+			return true;
+		};
+		platform.ReleaseDesktop = [this]() { releases++; };
+		platform.ReadStaged = [this](int left, int top, unsigned int w, unsigned int h) {
+			reads.push_back({ left, top, w, h });
+			readNumber = stagedNumber;
+			lastRead = pipeline.GetArena().Allocate(w, h);
+			if (lastRead)
+				memset(lastRead->pixels, 0x40, lastRead->size);
+			return lastRead;
+		};
+		platform.ReadRegion = [this](int, int, unsigned int, unsigned int) { regionReads++; };
+		platform.SendRegion = [this]() {
+			regionSends++;
+			return ++windowSends;
+		};
+		platform.CaptureWindow = [this]() -> FramePtr {
+			if (!bWindowOpen)
+				return nullptr;
+			FramePtr frame = pipeline.GetArena().Allocate(windowWidth, windowHeight);
+			if (frame)
+				memcpy(frame->pixels, window.data(), frame->size);
+			return frame;
+		};
+		platform.SendWindow = [this](const FrameRef&) {
+			if (bSendWindow)
+				windowSends++;
+			return bSendWindow;
+		};
+		platform.PublishTiles = [this](CaptureOutput output, const TileMap& map) {
+			published[output] = map;
+			publishes[output]++;
+		};
+		pipeline.SetPlatform(platform);
+
+		// No stream or ring unless a test opens them
+		CaptureConfig config;
+		config.snapshotTime = 0.0;
+		CHECK(pipeline.Configure(config));
+	}
+
+	void DrawWindow(uint32_t seed) {
+		window.resize((size_t)windowWidth*windowHeight);
+		for (unsigned int y = 0; y < windowHeight; y++)
+			for (unsigned int x = 0; x < windowWidth; x++)
+				window[(size_t)y*windowWidth + x] = 0xFF000000 | ((x + seed) & 0xFF) << 8 | (y & 0xFF);
+	}
+
+	// Poll every msec, as the application loop with vsync off
+	void Run(double duration) {
+		double end = now + duration;
+		while (now < end) {
+			pipeline.Update();
+			now += 1.0;
+		}
+	}
+
+	// Poll until the next output frame is published
+	void Next(CaptureOutput output) {
+		unsigned int count = publishes[output];
+		for (int i = 0; i < 1000 && publishes[output] == count; i++) {
+			pipeline.Update();
+			now += 1.0;
+		}
+		CHECK(publishes[output] == count + 1);
+	}
+
+	// Counts from the next update, with the part staged by the last read
+	void Reset() {
+		pipeline.Flush();
+		timeouts.clear();
+		acquired = desktopSends = readbacks = regionReads = stages = releases = 0;
+		regionSends = windowSends = 0;
+		reads.clear();
+	}
+};
+
+TEST(CapturePipelineRates)
+{
+	// Desktop at its own rate, nothing else
+	FakeCapture capture;
+	capture.pipeline.SetDesktopFps(30.0);
+	capture.Run(1000.0);
+	CHECK(capture.desktopSends >= 29 && capture.desktopSends <= 31);
+	CHECK(capture.releases == capture.acquired);
+	CHECK(capture.windowSends == 0);
+	CHECK(capture.readbacks == 0); // No preview
+	capture.pipeline.SetPreview(true);
+	capture.Run(100.0);
+	CHECK(capture.readbacks > 0);
+
+	// Region at the window rate, read back from every desktop frame
+	FakeCapture region;
+	region.pipeline.SetSource(SOURCE_REGION);
+	region.pipeline.SetRegion(128, 128, 256, 256);
+	region.pipeline.SetDesktopFps(60.0);
+	region.pipeline.SetWindowFps(30.0);
+	region.Run(1000.0);
+	CHECK(region.regionSends >= 29 && region.regionSends <= 31);
+	CHECK(region.desktopSends >= 59 && region.desktopSends <= 61);
+	CHECK(region.readbacks == region.desktopSends);
+
+	// A region faster than the desktop is acquired at its own rate,
+	// but the desktop is only sent at the desktop rate
+	FakeCapture fast;
+	fast.pipeline.SetSource(SOURCE_REGION);
+	fast.pipeline.SetRegion(128, 128, 256, 256);
+	fast.pipeline.SetDesktopFps(15.0);
+	fast.pipeline.SetWindowFps(60.0);
+	fast.Run(1000.0);
+	CHECK(fast.regionSends >= 59 && fast.regionSends <= 61);
+	CHECK(fast.desktopSends >= 14 && fast.desktopSends <= 16);
+	CHECK(fast.acquired >= 59 && fast.acquired <= 61);
+	CHECK(fast.readbacks == fast.desktopSends);
+	CHECK(fast.regionReads + fast.desktopSends >= fast.regionSends);
+	CHECK(fast.releases == fast.acquired);
+
+	// Window captured at the window rate
+	FakeCapture window;
+	window.pipeline.SetSource(SOURCE_WINDOW);
+	window.pipeline.SetWindowFps(20.0);
+	window.Run(1000.0);
+	CHECK(window.windowSends >= 19 && window.windowSends <= 21);
+	CHECK(window.desktopSends >= 59 && window.desktopSends <= 61);
+	CHECK(window.pipeline.GetWindowFrame() != nullptr);
+
+	// Not sent, the window is captured again next update
+	window.bSendWindow = false;
+	window.Reset();
+	window.Run(100.0);
+	CHECK(window.windowSends == 0);
+	CHECK(window.pipeline.GetWindowPacer().IsDue());
+}
+
+TEST(CapturePipelineTimeout)
+{
+	// An idle desktop does not hold back the window
+	FakeCapture window;
+	window.pipeline.SetSource(SOURCE_WINDOW);
+	window.pipeline.SetWindowFps(30.0);
+	window.bIdle = true;
+	window.Run(1.0); // The first window frame
+	window.Reset();
+	window.Run(1000.0);
+	CHECK(window.windowSends >= 29 && window.windowSends <= 31);
+	CHECK(!window.timeouts.empty());
+	for (unsigned int timeout : window.timeouts)
+		CHECK(timeout <= 34);
+
+	// With the window closed, the wait is not limited by it
+	window.bWindowOpen = false;
+	window.Run(100.0);
+	CHECK(window.pipeline.GetDesktopTimeout() == 500);
+
+	// Nor the region, at a higher rate than the desktop
+	FakeCapture region;
+	region.pipeline.SetSource(SOURCE_REGION);
+	region.pipeline.SetRegion(0, 0, 320, 240);
+	region.pipeline.SetDesktopFps(10.0);
+	region.pipeline.SetWindowFps(30.0);
+	region.bIdle = true;
+	region.Run(1000.0);
+	CHECK(!region.timeouts.empty());
+	for (unsigned int timeout : region.timeouts)
+		CHECK(timeout <= 34);
+
+	// Acquired for the region, the wait is limited by the next desktop frame
+	FakeCapture slow;
+	slow.pipeline.SetSource(SOURCE_REGION);
+	slow.pipeline.SetRegion(0, 0, 320, 240);
+	slow.pipeline.SetDesktopFps(30.0);
+	slow.pipeline.SetWindowFps(5.0);
+	slow.Run(20.0);
+	CHECK(slow.desktopSends == 1);
+	CHECK(!slow.pipeline.GetDesktopPacer().IsDue());
+	CHECK(slow.pipeline.GetDesktopTimeout() <= 34);
+
+	// Nothing else is due for the desktop
+	FakeCapture desktop;
+	desktop.bIdle = true;
+	CHECK(desktop.pipeline.GetDesktopTimeout() == 500);
+	desktop.Run(1.0);
+	CHECK(desktop.timeouts.size() == 1 && desktop.timeouts[0] == 500);
+	CHECK(desktop.now == 501.0);
+	CHECK(desktop.acquired == 0 && desktop.releases == 0);
+}
+
+TEST(CapturePipelineDesktopTiles)
+{
+	FakeCapture capture;
+	capture.pipeline.SetTileMap(true);
+	TileMap& map = capture.published[OUTPUT_DESKTOP];
+
+	// Everything has changed in the first frame
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetWidth() == 640 && map.GetHeight() == 480);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+
+	// Dirty rectangles
+	capture.next.rects = { { 70, 10, 80, 20 }, { 600, 470, 640, 480 } };
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetChangedCount() == 2);
+	CHECK(map.IsChanged(1, 0));
+	CHECK(map.IsChanged(9, 7));
+
+	// A frame with no change
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetChangedCount() == 0 && map.GetMoves().empty());
+
+	// A scroll is a move, or changed tiles without scroll moves
+	capture.next.moves = { { 0, 0, 640, 448, 0, -32 } };
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetMoves().size() == 1);
+	capture.pipeline.SetScroll(false);
+	capture.next.moves = { { 0, 0, 640, 448, 0, -32 } };
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetMoves().empty());
+	CHECK(map.GetChangedCount() == 10*7);
+
+	// Only the mouse has moved
+	capture.next.bImage = false;
+	capture.next.rects = { { 0, 0, 640, 480 } };
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetChangedCount() == 0);
+
+	// Changes not known
+	capture.next.bAll = true;
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+
+	// A new desktop size
+	capture.width = 800;
+	capture.height = 600;
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(map.GetWidth() == 800 && map.GetHeight() == 600);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+}
+
+TEST(CapturePipelineRegionTiles)
+{
+	FakeCapture capture;
+	capture.pipeline.SetTileMap(true);
+	capture.pipeline.SetSource(SOURCE_REGION);
+	capture.pipeline.SetRegion(128, 128, 256, 256);
+	capture.pipeline.SetWindowFps(15.0);
+	TileMap& map = capture.published[OUTPUT_WINDOW];
+
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetWidth() == 256 && map.GetHeight() == 256);
+	CHECK(map.GetChangedCount() == 16);
+
+	// Changes in the region from each desktop frame until the region frame,
+	// and none from outside it
+	capture.next.rects = { { 130, 130, 140, 140 }, { 0, 0, 10, 10 } };
+	capture.Next(OUTPUT_DESKTOP);
+	capture.next.rects = { { 380, 380, 390, 390 } };
+	capture.Next(OUTPUT_DESKTOP);
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetChangedCount() == 2);
+	CHECK(map.IsChanged(0, 0));
+	CHECK(map.IsChanged(3, 3));
+	CHECK(map.GetMoves().empty());
+
+	// Changes acquired only for a region frame are kept for the next
+	// desktop frame
+	capture.pipeline.SetDesktopFps(5.0);
+	capture.pipeline.SetWindowFps(60.0);
+	TileMap& desktop = capture.published[OUTPUT_DESKTOP];
+	capture.Next(OUTPUT_DESKTOP);
+	unsigned int sends = capture.desktopSends;
+	capture.next.rects = { { 0, 0, 10, 10 } };
+	capture.Next(OUTPUT_WINDOW);
+	capture.next.rects = { { 600, 470, 640, 480 } };
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(capture.desktopSends == sends);
+	CHECK(capture.regionReads > 0);
+	capture.Next(OUTPUT_DESKTOP);
+	CHECK(desktop.GetChangedCount() == 2);
+	CHECK(desktop.IsChanged(0, 0));
+	CHECK(desktop.IsChanged(9, 7));
+	capture.pipeline.SetDesktopFps(60.0);
+	capture.pipeline.SetWindowFps(15.0);
+	capture.Next(OUTPUT_WINDOW);
+
+	// A scroll in the region is a move from the last region frame
+	capture.next.moves = { { 128, 128, 384, 352, 0, -32 } };
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetMoves().size() == 1);
+	if (map.GetMoves().size() == 1) {
+		CHECK(map.GetMoves()[0].left == 0 && map.GetMoves()[0].top == 0);
+		CHECK(map.GetMoves()[0].dy == -32);
+	}
+
+	// Everything has changed when the region moves
+	capture.pipeline.SetRegion(200, 128, 256, 256);
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetChangedCount() == 16);
+
+	// And for a new size
+	capture.pipeline.SetRegion(200, 128, 320, 256);
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetWidth() == 320);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+}
+
+TEST(CapturePipelineWindowTiles)
+{
+	FakeCapture capture;
+	capture.pipeline.SetTileMap(true);
+	capture.pipeline.SetSource(SOURCE_WINDOW);
+	TileMap& map = capture.published[OUTPUT_WINDOW];
+
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+
+	// One pixel changed
+	capture.window[(size_t)100*capture.windowWidth + 100] ^= 0xFF;
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetChangedCount() == 1);
+	CHECK(map.IsChanged(1, 1));
+
+	// Scrolled by 16 rows
+	std::vector<uint32_t> previous = capture.window;
+	for (unsigned int y = 0; y < capture.windowHeight; y++) {
+		uint32_t seed = 0x1234 + y;
+		for (unsigned int x = 0; x < capture.windowWidth; x++) {
+			unsigned int source = y + 16;
+			capture.window[(size_t)y*capture.windowWidth + x] = source < capture.windowHeight
+				? previous[(size_t)source*capture.windowWidth + x] : TestRandom(seed);
+		}
+	}
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetMoves().size() == 1);
+	CHECK(map.GetChangedCount() < map.GetCols()*map.GetRows());
+
+	// A new size
+	capture.windowWidth = 400;
+	capture.DrawWindow(0);
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetWidth() == 400);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+
+	// A new window starts again
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetChangedCount() == 0);
+	capture.pipeline.ResetWindow();
+	CHECK(capture.pipeline.GetWindowFrame() == nullptr);
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(map.GetChangedCount() == map.GetCols()*map.GetRows());
+}
+
+TEST(CapturePipelineStaging)
+{
+	std::string ringPath = TestPath("pipeline-test") + ".ring";
+	std::string address = "unix:" + TestPath("pipeline-test") + ".sock";
+
+	{
+		// A stream with no receiver copies nothing
+		FakeCapture capture;
+		CHECK(capture.pipeline.OpenStream(address));
+		capture.Run(500.0);
+		CHECK(capture.stages == 0);
+		CHECK(capture.reads.empty());
+
+		// The ring records the desktop at the snapshot rate
+		CaptureConfig config;
+		config.snapshotTime = 2.0;
+		config.snapshotMemory = 16;
+		config.snapshotFps = 20.0;
+		config.snapshotFile = ringPath;
+		config.snapshotFolder = ".";
+		CHECK(capture.pipeline.Configure(config));
+		CHECK(capture.pipeline.GetRing().IsOpen());
+		capture.Reset();
+		capture.Run(1000.0);
+		CHECK(capture.stages >= 19 && capture.stages <= 21);
+		CHECK(capture.reads.size() + 1 >= capture.stages && capture.reads.size() <= capture.stages);
+		for (const StagedRead& read : capture.reads)
+			CHECK(read.left == 0 && read.top == 0 && read.width == 640 && read.height == 480);
+		CHECK(capture.lastRead && capture.lastRead->number == capture.readNumber);
+
+		// Each staged part is read by the next update
+		unsigned int stages = capture.stages;
+		while (capture.stages == stages) {
+			capture.pipeline.Update();
+			capture.now += 1.0;
+		}
+		CHECK(capture.reads.size() == stages);
+		capture.pipeline.Update();
+		CHECK(capture.reads.size() == stages + 1);
+
+		// The region from the copy at its position
+		capture.pipeline.SetSource(SOURCE_REGION);
+		capture.pipeline.SetRegion(100, 50, 200, 100);
+		capture.pipeline.SetWindowFps(20.0);
+		capture.Reset();
+		capture.Run(1000.0);
+		CHECK(capture.reads.size() >= 19 && capture.reads.size() <= 21);
+		for (const StagedRead& read : capture.reads)
+			CHECK(read.left == 100 && read.top == 50 && read.width == 200 && read.height == 100);
+		CHECK(capture.lastRead && capture.lastRead->number == capture.readNumber);
+
+		// Window frames are recorded without a copy
+		capture.pipeline.SetSource(SOURCE_WINDOW);
+		capture.Reset();
+		capture.Run(1000.0);
+		CHECK(capture.stages == 0 && capture.reads.empty());
+
+		capture.pipeline.Flush();
+		capture.pipeline.CloseSnapshot();
+		CHECK(capture.pipeline.GetRing().GetRecorded() + capture.pipeline.GetRing().GetDropped() >= 50);
+		capture.pipeline.CloseStream();
+	}
+
+	remove(ringPath.c_str());
+	unlink(address.substr(5).c_str());
+}
+
+TEST(CapturePipelineConfigure)
+{
+	FakeCapture capture;
+	CaptureConfig config;
+	config.desktopFps = 30.0;
+	config.windowFps = 20.0;
+	config.bPresentAligned = true;
+	config.bAdaptive = true;
+	config.adaptiveMinFps = 4.0;
+	config.source = SOURCE_REGION;
+	config.regionLeft = 10;
+	config.regionTop = 20;
+	config.regionWidth = 64;
+	config.regionHeight = 32;
+	config.snapshotTime = 0.0;
+	CHECK(capture.pipeline.Configure(config));
+	CHECK(capture.pipeline.GetDesktopPacer().GetFps() == 30.0);
+	CHECK(capture.pipeline.GetDesktopPacer().GetMode() == FramePacer::PACE_PRESENT);
+	CHECK(capture.pipeline.GetWindowPacer().GetFps() == 20.0);
+	CHECK(capture.pipeline.GetAdaptiveRate().GetMinimum() == 4.0);
+	CHECK(capture.pipeline.GetAdaptiveRate().GetMaximum() == 20.0);
+	CHECK(capture.pipeline.GetSource() == SOURCE_REGION);
+	CHECK(!capture.pipeline.GetStream().IsOpen());
+	CHECK(!capture.pipeline.GetRing().IsOpen());
+	capture.pipeline.SetTileMap(true);
+	capture.Next(OUTPUT_WINDOW);
+	CHECK(capture.published[OUTPUT_WINDOW].GetWidth() == 64);
+	CHECK(capture.published[OUTPUT_WINDOW].GetHeight() == 32);
+
+	// Outputs that could not be opened
+	config.streamAddress = "unix:/nonexistent/pipeline-test.sock";
+	config.snapshotTime = 1.0;
+	config.snapshotFile = "/nonexistent/pipeline-test.ring";
+	CHECK(!capture.pipeline.Configure(config));
+	CHECK(capture.pipeline.error.find("stream") != std::string::npos);
+	CHECK(capture.pipeline.error.find("snapshot") != std::string::npos);
+	CHECK(!capture.pipeline.GetStream().IsOpen());
+	CHECK(!capture.pipeline.GetRing().IsOpen());
+}
@@ -0,0 +1,108 @@
+//
+//	CaptureTests
+//
+//	Runs the checks registered by the test files.
+//
+//	Usage :
+//		CaptureTests [--bench] [--list] [name ...]
+//		Names select tests or benchmarks by prefix, default all tests
+//
+//	Build (Linux) :
+//		g++ -O2 -g -std=c++17 -I../src *.cpp ../src/AdaptiveRate.cpp ../src/CaptureConfig.cpp
+//			../src/CapturePipeline.cpp ../src/CaptureStats.cpp ../src/DuplicationRecovery.cpp ../src/FrameArena.cpp
+//			../src/FramePacer.cpp ../src/FrameQueue.cpp ../src/FrameStream.cpp
+//			../src/ScrollDetect.cpp ../src/SnapshotRing.cpp ../src/ThreadSchedule.cpp
+//			../src/TileCodec.cpp ../src/TileMap.cpp -lpthread -o CaptureTests
+//
+//	Add -fsanitize=address,undefined or -fsanitize=thread to run the
+//	tests under the sanitizers. The exit code is 1 if a check fails.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "CaptureStats.h"
+
+#include <string.h>
+#include <string>
+
+static unsigned int g_Failures = 0;
+
+std::vector<TestCase>& TestRegistry()
+{
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+void TestFail(const char* file, int line, const char* expression)
+{
+	// File name without the path
+	const char* name = strrchr(file, '/');
+	if (!name)
+		name = strrchr(file, '\\');
+	printf("    %s(%d) : CHECK(%s) failed\n", name ? name + 1 : file, line, expression);
+	g_Failures++;
+}
+
+uint32_t TestRandom(uint32_t& state)
+{
+	// xorshift32
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+int main(int argc, char* argv[])
+{
+	bool bBench = false;
+	bool bList = false;
+	std::vector<std::string> names;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--bench")
+			bBench = true;
+		else if (arg == "--list")
+			bList = true;
+		else
+			names.push_back(arg);
+	}
+
+	unsigned int run = 0;
+	unsigned int failed = 0;
+	for (const TestCase& test : TestRegistry()) {
+		if (test.bBench != bBench)
+			continue;
+		if (!names.empty()) {
+			bool bSelected = false;
+			for (const std::string& name : names)
+				bSelected = bSelected || strncmp(test.name, name.c_str(), name.size()) == 0;
+			if (!bSelected)
+				continue;
+		}
+		if (bList) {
+			printf("%s\n", test.name);
+			continue;
+		}
+
+		printf("%s\n", test.name);
+		fflush(stdout);
+		unsigned int failures = g_Failures;
+		double start = CaptureStats::Now();
+		test.run();
+		double time = CaptureStats::Now() - start;
+		run++;
+		if (g_Failures != failures) {
+			failed++;
+			printf("  FAILED (%.0f msec)\n", time);
+		}
+		else {
+			printf("  ok (%.0f msec)\n", time);
+		}
+		fflush(stdout);
+	}
+
+	if (!bList)
+		printf("%u %s, %u failed\n", run, bBench ? "benchmarks" : "tests", failed);
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,49 @@
+//
+//	CaptureTests
+//
+//	Checks for the portable parts of SpoutCapture, built and run on Linux
+//	or Windows without openFrameworks or Spout. Each file holds the tests
+//	of one module, registered by TEST and run by CaptureTests.cpp.
+//	BENCH registers a benchmark that is only run with "--bench".
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct TestCase {
+	const char* name;
+	void (*run)();
+	bool bBench;
+};
+
+std::vector<TestCase>& TestRegistry();
+
+struct TestRegister {
+	TestRegister(const char* name, void (*run)(), bool bBench) {
+		TestRegistry().push_back({ name, run, bBench });
+	}
+};
+
+#define TEST(name) \
+	static void Test_##name(); \
+	static TestRegister Register_##name(#name, Test_##name, false); \
+	static void Test_##name()
+
+#define BENCH(name) \
+	static void Bench_##name(); \
+	static TestRegister Register_##name(#name, Bench_##name, true); \
+	static void Bench_##name()
+
+// A failed check is reported and the test carries on
+void TestFail(const char* file, int line, const char* expression);
+
+#define CHECK(expression) \
+	do { if (!(expression)) TestFail(__FILE__, __LINE__, #expression); } while (0)
+
+// Deterministic pseudo random numbers for test content
+uint32_t TestRandom(uint32_t& state);
@@ -0,0 +1,221 @@
+//
+//	DuplicationRecoveryTest
+//
+//	Recovery against a fake duplication backend that fails on demand :
+//	the retry intervals, a refresh of the topology only when the cached
+//	output keeps failing, and a capture loop that never waits for the
+//	retries on the background thread.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "DuplicationRecovery.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// Desktop duplication as seen by the recovery. The desktop is unavailable
+// until a time, e.g. a UAC prompt, and a changed output topology fails
+// to reconnect until enumerated again.
+struct FakeDuplication {
+	std::mutex mutex;
+	double availableTime = 0.0; // Reconnect fails before this
+	unsigned int topology = 0;  // Current
+	unsigned int cached = 0;    // Enumerated
+	unsigned int reconnects = 0;
+	unsigned int enumerates = 0;
+	double delay = 0.0; // Msec that each call blocks
+	std::function<double()> clock;
+
+	void Attach(DuplicationRecovery& recovery) {
+		recovery.SetReconnect([this]() {
+			Block();
+			std::lock_guard<std::mutex> lock(mutex);
+			reconnects++;
+			return clock() >= availableTime && cached == topology;
+		});
+		recovery.SetEnumerate([this]() {
+			Block();
+			std::lock_guard<std::mutex> lock(mutex);
+			enumerates++;
+			cached = topology;
+			return true;
+		});
+	}
+
+	void Block() {
+		if (delay > 0.0)
+			std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delay));
+	}
+};
+
+TEST(DuplicationRecoveryBackoff)
+{
+	double now = 1000.0;
+	FakeDuplication backend;
+	backend.clock = [&]() { return now; };
+	backend.availableTime = now + 1000.0;
+	DuplicationRecovery recovery;
+	recovery.SetClock([&]() { return now; });
+	recovery.SetBackoff(50.0, 400.0);
+	backend.Attach(recovery);
+
+	recovery.Lost();
+	CHECK(recovery.GetState() == DuplicationRecovery::LOST);
+	// Attempts at 0, 50, 150, 350, 750, 1150 msec after the loss
+	const double attempts[] = { 0.0, 50.0, 150.0, 350.0, 750.0, 1150.0 };
+	for (double t : attempts) {
+		now = 1000.0 + t - 1.0;
+		if (t > 0.0) {
+			CHECK(!recovery.Step());
+			CHECK(recovery.GetWait() > 0.0 && recovery.GetWait() <= 1.0);
+		}
+		now += 1.0;
+		bool bRecovered = recovery.Step();
+		CHECK(bRecovered == (t > 1000.0));
+	}
+	CHECK(recovery.GetAttempts() == 6);
+	CHECK(recovery.GetState() == DuplicationRecovery::RECOVERED);
+	CHECK(recovery.Recovered());
+	CHECK(!recovery.Recovered());
+	CHECK(recovery.GetState() == DuplicationRecovery::CONNECTED);
+	CHECK(recovery.GetRecoveries() == 1);
+	CHECK(recovery.GetRecoveryTimes().GetLast() == 1150.0);
+
+	// A second loss starts again at the first interval
+	recovery.Lost();
+	recovery.Lost();
+	CHECK(recovery.Step());
+	CHECK(recovery.GetAttempts() == 7);
+	CHECK(recovery.Recovered());
+}
+
+TEST(DuplicationRecoveryTopology)
+{
+	double now = 0.0;
+	FakeDuplication backend;
+	backend.clock = [&]() { return now; };
+	DuplicationRecovery recovery;
+	recovery.SetClock([&]() { return now; });
+	recovery.SetBackoff(10.0, 10.0);
+	recovery.SetEnumerateAfter(2);
+	backend.Attach(recovery);
+
+	// The cached output reconnects without enumerating
+	recovery.Lost();
+	CHECK(recovery.Step());
+	CHECK(recovery.Recovered());
+	CHECK(backend.enumerates == 0);
+
+	// A monitor is removed. The cached output fails twice before
+	// the topology is refreshed, then reconnects at once.
+	backend.topology++;
+	recovery.Lost();
+	for (int i = 0; i < 3; i++) {
+		recovery.Step();
+		now += 10.0;
+	}
+	CHECK(backend.reconnects == 4);
+	CHECK(backend.enumerates == 1);
+	CHECK(recovery.GetEnumerations() == 1);
+	CHECK(recovery.Recovered());
+
+	// Without an enumerate function it keeps trying the cached output
+	DuplicationRecovery cachedOnly;
+	cachedOnly.SetClock([&]() { return now; });
+	cachedOnly.SetBackoff(10.0, 10.0);
+	unsigned int reconnects = 0;
+	cachedOnly.SetReconnect([&]() { return ++reconnects >= 5; });
+	cachedOnly.Lost();
+	for (int i = 0; i < 5; i++) {
+		cachedOnly.Step();
+		now += 10.0;
+	}
+	CHECK(cachedOnly.Recovered());
+	CHECK(cachedOnly.GetEnumerations() == 0);
+}
+
+// A capture loop at 1 msec with faults injected at random. The backend
+// blocks for each call but the loop is never held up, and each loss
+// is recovered once the desktop is available.
+TEST(DuplicationRecoveryThread)
+{
+	FakeDuplication backend;
+	backend.clock = CaptureStats::Now;
+	backend.delay = 15.0;
+	DuplicationRecovery recovery;
+	recovery.SetBackoff(5.0, 40.0);
+	recovery.SetEnumerateAfter(3);
+	backend.Attach(recovery);
+	recovery.StartThread();
+
+	uint32_t seed = 17;
+	unsigned int losses = 0;
+	unsigned int recovered = 0;
+	bool bConnected = true;
+	CaptureStats loop(1000);
+	double end = CaptureStats::Now() + 1500.0;
+	while (CaptureStats::Now() < end) {
+		loop.Start();
+		if (bConnected) {
+			uint32_t fault = TestRandom(seed) % 100;
+			if (fault < 3) {
+				// The desktop is unavailable for up to 100 msec and may change
+				std::lock_guard<std::mutex> lock(backend.mutex);
+				backend.availableTime = CaptureStats::Now() + TestRandom(seed) % 100;
+				if (fault == 0)
+					backend.topology++;
+				bConnected = false;
+				losses++;
+				recovery.Lost();
+			}
+		}
+		else if (recovery.Recovered()) {
+			bConnected = true;
+			recovered++;
+		}
+		loop.Stop();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	// The last loss has time to recover
+	for (int i = 0; i < 500 && !bConnected; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (recovery.Recovered()) {
+			bConnected = true;
+			recovered++;
+		}
+	}
+	recovery.StopThread();
+
+	CHECK(losses > 5);
+	CHECK(recovered == losses);
+	CHECK(recovery.GetRecoveries() == losses);
+	CHECK(recovery.GetAttempts() >= losses);
+	// The loop itself only takes a lock
+	CHECK(loop.GetMaximum() < backend.delay);
+	printf("    %u losses, %u attempts, %u enumerations, recovery %.1f msec average\n",
+		losses, recovery.GetAttempts(), recovery.GetEnumerations(),
+		recovery.GetRecoveryTimes().GetAverage());
+}
+
+// Stopping while retrying does not wait for the backoff
+TEST(DuplicationRecoveryStop)
+{
+	FakeDuplication backend;
+	backend.clock = CaptureStats::Now;
+	backend.availableTime = 1e30;
+	DuplicationRecovery recovery;
+	recovery.SetBackoff(10000.0, 10000.0);
+	backend.Attach(recovery);
+	recovery.StartThread();
+	recovery.Lost();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	double start = CaptureStats::Now();
+	recovery.StopThread();
+	CHECK(CaptureStats::Now() - start < 1000.0);
+	CHECK(recovery.GetAttempts() == 1);
+	CHECK(recovery.GetState() == DuplicationRecovery::LOST);
+}
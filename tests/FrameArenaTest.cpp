@@ -0,0 +1,167 @@
+//
+//	FrameArenaTest
+//
+//	Buffers re-used within the budget, buffers of a size no longer
+//	allocated released, and frames shared and released by several
+//	threads at once.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "FrameArena.h"
+
+#include <atomic>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+TEST(FrameArenaReuse)
+{
+	FrameArena arena((size_t)16*1024*1024);
+	FrameRef a = arena.Allocate(640, 480);
+	CHECK(a && a->pitch == 640*4 && a->size == (size_t)640*480*4);
+	a.reset();
+	CHECK(arena.GetLiveBytes() == 0 && arena.GetPoolBytes() == (size_t)640*480*4);
+	FrameRef b = arena.Allocate(640, 480);
+	CHECK(arena.GetAllocations() == 1 && arena.GetReused() == 1);
+	CHECK(arena.GetPoolBytes() == 0);
+
+	// Over the budget fails
+	FramePtr big = arena.Allocate(4096, 4096);
+	CHECK(!big);
+	CHECK(arena.GetFailures() == 1);
+	CHECK(!arena.Allocate(0, 100));
+
+	// Clone counts a copy
+	FramePtr c = arena.Clone(b);
+	CHECK(c && c->size == b->size && arena.GetCopies() == 1 && arena.GetCopyBytes() == b->size);
+	b.reset();
+	c.reset();
+	arena.Trim();
+	CHECK(arena.GetPoolBytes() == 0);
+	CHECK(arena.GetPeakBytes() == (size_t)640*480*4*2);
+}
+
+// A window resized from one size to another. The buffers of the first size
+// are not kept once it is no longer allocated, while a second size
+// allocated alongside, e.g. the region, keeps its buffers.
+TEST(FrameArenaResize)
+{
+	FrameArena arena;
+	const size_t first = (size_t)800*600*4;
+	const size_t second = (size_t)1024*768*4;
+	const size_t region = (size_t)320*240*4;
+	{
+		std::vector<FrameRef> frames;
+		for (int i = 0; i < 8; i++)
+			frames.push_back(arena.Allocate(800, 600));
+	}
+	CHECK(arena.GetPoolBytes() == 8*first);
+
+	// Frames of the new size while the last of the old are still referenced
+	FrameRef held = arena.Allocate(800, 600);
+	FrameRef window;
+	FrameRef previous;
+	for (int i = 0; i < 300; i++) {
+		previous = window;
+		window = arena.Allocate(1024, 768);
+		if (i % 2 == 0)
+			arena.Allocate(320, 240);
+		if (i == 10)
+			held.reset();
+	}
+	CHECK(arena.GetPoolBytes() <= second + region);
+	CHECK(arena.GetLiveBytes() == 2*second);
+	unsigned int allocations = arena.GetAllocations();
+	for (int i = 0; i < 100; i++) {
+		previous = window;
+		window = arena.Allocate(1024, 768);
+		arena.Allocate(320, 240);
+	}
+	// Both current sizes are re-used
+	CHECK(arena.GetAllocations() == allocations);
+}
+
+// Capture allocates and shares frames with consumers that hold them for
+// different times, as the senders, preview and stream do.
+TEST(FrameArenaThreads)
+{
+	FrameArena arena((size_t)64*1024*1024);
+	const unsigned int consumers = 3;
+	const unsigned int frames = 3000;
+	std::atomic<bool> bDone{ false };
+	std::atomic<unsigned int> corrupt{ 0 };
+	std::mutex mutex;
+	FrameRef latest;
+
+	std::vector<std::thread> threads;
+	for (unsigned int c = 0; c < consumers; c++) {
+		threads.emplace_back([&, c]() {
+			uint32_t seed = 100 + c;
+			std::vector<FrameRef> held;
+			while (!bDone) {
+				FrameRef frame;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					frame = latest;
+				}
+				if (!frame)
+					continue;
+				// The pixels are those written for the frame number
+				const uint32_t* p = (const uint32_t*)frame->pixels;
+				if (p[0] != frame->number || p[frame->width*frame->height - 1] != frame->number)
+					corrupt++;
+				held.push_back(frame);
+				if (held.size() > 1 + c*2 || TestRandom(seed) % 8 == 0)
+					held.erase(held.begin());
+			}
+		});
+	}
+
+	// Sizes change now and then, as a window being resized
+	uint32_t seed = 1;
+	unsigned int failures = 0;
+	for (unsigned int n = 1; n <= frames; n++) {
+		unsigned int width = 256 + ((n/500) % 3)*64;
+		FramePtr frame = arena.Allocate(width, 200);
+		if (!frame) {
+			failures++;
+			continue;
+		}
+		frame->number = n;
+		uint32_t* p = (uint32_t*)frame->pixels;
+		for (unsigned int i = 0; i < width*200; i++)
+			p[i] = n;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			latest = frame;
+		}
+		if (TestRandom(seed) % 16 == 0)
+			std::this_thread::yield();
+	}
+	bDone = true;
+	for (std::thread& t : threads)
+		t.join();
+	latest.reset();
+
+	CHECK(corrupt == 0);
+	CHECK(failures == 0);
+	CHECK(arena.GetLiveBytes() == 0);
+	CHECK(arena.GetReused() > frames/2);
+	printf("    %u allocations, %u reused, %.1f MB peak\n", arena.GetAllocations(),
+		arena.GetReused(), (double)arena.GetPeakBytes()/1048576.0);
+}
+
+// Frames released after the arena is destroyed are still freed
+TEST(FrameArenaOutlived)
+{
+	FrameRef frame;
+	{
+		FrameArena arena;
+		frame = arena.Allocate(64, 64);
+		memset(frame.get()->pixels, 0, frame->size);
+	}
+	CHECK(frame->size == 64*64*4);
+	frame.reset();
+}
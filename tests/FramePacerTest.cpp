@@ -0,0 +1,159 @@
+//
+//	FramePacerTest
+//
+//	Pacing on a virtual clock : frames at the target rate whatever the loop
+//	rate, senders at their own rates, no burst after a stall, a schedule
+//	that follows the present times and a rate changed between frames.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "FramePacer.h"
+
+#include <cmath>
+
+// Run a loop polling the pacer every step msec for a time,
+// sending a frame when due. Returns the frames sent.
+static unsigned int RunLoop(FramePacer& pacer, double& now, double step, double duration)
+{
+	unsigned int frames = 0;
+	double end = now + duration;
+	while (now < end) {
+		if (pacer.IsDue()) {
+			pacer.Frame();
+			frames++;
+		}
+		now += step;
+	}
+	return frames;
+}
+
+TEST(FramePacerFixedRate)
+{
+	// Loop rates faster than, close to and not a multiple of the target
+	const double steps[] = { 1.0, 3.0, 7.0, 16.0 };
+	for (double step : steps) {
+		double now = 0.0;
+		FramePacer pacer(30.0);
+		pacer.SetClock([&]() { return now; });
+		unsigned int frames = RunLoop(pacer, now, step, 10000.0);
+		// 300 frames in 10 seconds, within a frame
+		CHECK(frames >= 299 && frames <= 301);
+		CHECK(std::fabs(pacer.GetMeasuredFps() - 30.0) < 1.5);
+		CHECK(pacer.GetSkipped() == 0);
+		// Never later than a loop step
+		CHECK(pacer.GetLateness().GetMaximum() <= step);
+	}
+}
+
+TEST(FramePacerIndependentSenders)
+{
+	double now = 0.0;
+	FramePacer window(60.0);
+	FramePacer desktop(15.0);
+	window.SetClock([&]() { return now; });
+	desktop.SetClock([&]() { return now; });
+	unsigned int windowFrames = 0;
+	unsigned int desktopFrames = 0;
+	for (; now < 5000.0; now += 1.0) {
+		if (window.IsDue()) {
+			window.Frame();
+			windowFrames++;
+		}
+		if (desktop.IsDue()) {
+			desktop.Frame();
+			desktopFrames++;
+		}
+	}
+	CHECK(windowFrames >= 299 && windowFrames <= 301);
+	CHECK(desktopFrames >= 74 && desktopFrames <= 76);
+}
+
+TEST(FramePacerWait)
+{
+	double now = 0.0;
+	FramePacer pacer(50.0);
+	pacer.SetClock([&]() { return now; });
+	CHECK(pacer.GetWait() == 0.0);
+	pacer.Frame();
+	// Due 20 msec later, less the tolerance of 4 msec
+	CHECK(std::fabs(pacer.GetWait() - 16.0) < 1e-9);
+	now = 10.0;
+	CHECK(!pacer.IsDue());
+	CHECK(std::fabs(pacer.GetWait() - 6.0) < 1e-9);
+	now = 16.0;
+	CHECK(pacer.IsDue());
+
+	pacer.SetMode(FramePacer::PACE_FREE);
+	pacer.Frame();
+	CHECK(pacer.IsDue());
+	pacer.SetFps(0.0);
+	pacer.SetMode(FramePacer::PACE_FIXED);
+	pacer.Frame();
+	CHECK(pacer.IsDue());
+}
+
+// A stall of the loop skips the frames missed and does not send them in a burst
+TEST(FramePacerStall)
+{
+	double now = 0.0;
+	FramePacer pacer(60.0);
+	pacer.SetClock([&]() { return now; });
+	RunLoop(pacer, now, 1.0, 1000.0);
+	now += 500.0;
+	CHECK(pacer.IsDue());
+	pacer.Frame();
+	CHECK(pacer.GetSkipped() >= 28 && pacer.GetSkipped() <= 31);
+	now += 1.0;
+	CHECK(!pacer.IsDue());
+	unsigned int frames = RunLoop(pacer, now, 1.0, 1000.0);
+	CHECK(frames >= 59 && frames <= 61);
+}
+
+// Present times from duplication that drift from the clock
+TEST(FramePacerPresent)
+{
+	double now = 0.0;
+	FramePacer pacer(30.0, FramePacer::PACE_PRESENT);
+	pacer.SetClock([&]() { return now; });
+	// Vsync at 60 Hz, 2 msec after the loop sees it
+	unsigned int frames = 0;
+	for (unsigned int vsync = 0; vsync < 600; vsync++) {
+		double present = vsync*1000.0/60.0;
+		now = present + 2.0;
+		if (pacer.IsDue()) {
+			pacer.Frame(present);
+			frames++;
+		}
+	}
+	// Every second vsync
+	CHECK(frames >= 299 && frames <= 301);
+	CHECK(std::fabs(pacer.GetIntervals().GetAverage() - 1000.0/30.0) < 0.5);
+}
+
+TEST(FramePacerChangeFps)
+{
+	double now = 0.0;
+	FramePacer pacer(5.0);
+	pacer.SetClock([&]() { return now; });
+	pacer.Frame();
+	now = 50.0;
+	CHECK(!pacer.IsDue());
+	// A higher rate is due a period of the new rate after the last frame
+	pacer.ChangeFps(60.0);
+	CHECK(pacer.IsDue());
+	pacer.Frame();
+	CHECK(pacer.GetSkipped() == 0);
+	// A lower rate waits the new period and keeps the statistics
+	unsigned int count = pacer.GetIntervals().GetCount();
+	pacer.ChangeFps(10.0);
+	CHECK(pacer.GetIntervals().GetCount() == count);
+	now = 140.0;
+	CHECK(!pacer.IsDue());
+	now = 147.0;
+	CHECK(pacer.IsDue());
+	// The same rate leaves the schedule as it is
+	pacer.ChangeFps(10.0);
+	CHECK(pacer.IsDue());
+}
@@ -0,0 +1,277 @@
+//
+//	FrameQueueTest
+//
+//	Frames taken from the queue under each policy decode to the frames
+//	pushed, and the counters add up with several producers and consumers.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "FrameArena.h"
+#include "FrameQueue.h"
+#include "TileCodec.h"
+
+#include <atomic>
+#include <chrono>
+#include <string.h>
+#include <thread>
+
+static const unsigned int frameWidth = 320;
+static const unsigned int frameHeight = 192;
+
+// A frame of random pixels
+static FramePtr NewFrame(FrameArena& arena, uint32_t& seed)
+{
+	FramePtr frame = arena.Allocate(frameWidth, frameHeight);
+	uint32_t* p = (uint32_t*)frame->pixels;
+	for (unsigned int i = 0; i < frameWidth*frameHeight; i++)
+		p[i] = TestRandom(seed);
+	return frame;
+}
+
+// The next frame with one tile repainted, or scrolled up
+// with a new strip at the bottom. Returns the map of changes.
+static FramePtr NextFrame(FrameArena& arena, const FrameRef& previous, uint32_t& seed,
+	bool bScroll, TileMap& map)
+{
+	FramePtr frame = arena.Allocate(frameWidth, frameHeight);
+	frame->number = previous->number + 1;
+	unsigned int pitch = frameWidth*4;
+	map.Resize(frameWidth, frameHeight);
+	map.Clear();
+	if (bScroll) {
+		unsigned int dy = 8 + TestRandom(seed) % 24;
+		memcpy(frame->pixels, previous->pixels + (size_t)dy*pitch, (size_t)(frameHeight - dy)*pitch);
+		uint32_t* p = (uint32_t*)(frame->pixels + (size_t)(frameHeight - dy)*pitch);
+		for (unsigned int i = 0; i < dy*frameWidth; i++)
+			p[i] = TestRandom(seed);
+		map.AddMove({ 0, 0, (int32_t)frameWidth, (int32_t)(frameHeight - dy), 0, -(int32_t)dy });
+	}
+	else {
+		memcpy(frame->pixels, previous->pixels, (size_t)frameHeight*pitch);
+		unsigned int col = TestRandom(seed) % map.GetCols();
+		unsigned int row = TestRandom(seed) % map.GetRows();
+		for (unsigned int y = row*64; y < std::min(frameHeight, row*64 + 64); y++) {
+			uint32_t* p = (uint32_t*)(frame->pixels + (size_t)y*pitch);
+			for (unsigned int x = col*64; x < std::min(frameWidth, col*64 + 64); x++)
+				p[x] = TestRandom(seed);
+		}
+	}
+	map.Compare(previous->pixels, frame->pixels, pitch);
+	return frame;
+}
+
+// Encode and decode a frame taken from the queue as the stream does,
+// complete after a loss. Returns true if the decoded frame is the frame pushed.
+struct QueueReceiver {
+	TileEncoder encoder;
+	TileDecoder decoder;
+	bool bKey = true;
+	unsigned int decoded = 0;
+
+	bool Receive(QueuedFrame& item) {
+		bKey = bKey || item.bKey;
+		const CaptureFrame* frame = item.frame.get();
+		const std::vector<unsigned char>& message = encoder.Encode(frame->pixels, frame->pitch,
+			item.tiles, frame->number, frame->timestamp, bKey);
+		bKey = false;
+		if (!decoder.Decode(message.data(), (unsigned int)message.size()))
+			return false;
+		decoded++;
+		return memcmp(decoder.GetPixels(), frame->pixels, (size_t)frame->pitch*frame->height) == 0;
+	}
+};
+
+// Push a frame and its map to the queue
+static bool PushFrame(FrameQueue& queue, const FrameRef& frame, const TileMap& map)
+{
+	QueuedFrame item;
+	item.frame = frame;
+	item.tiles = map;
+	return queue.Push(item);
+}
+
+// A slow consumer : the tiles of each coalesced frame must reach the frame
+// taken next, not the frame that replaced it, for every frame to decode.
+static void CoalesceSequence(bool bScroll)
+{
+	FrameArena arena;
+	FrameQueue queue(2, QUEUE_COALESCE);
+	QueueReceiver receiver;
+	uint32_t seed = bScroll ? 7 : 3;
+	TileMap map;
+	map.Resize(frameWidth, frameHeight);
+	map.SetAll();
+	FrameRef frame = NewFrame(arena, seed);
+	QueuedFrame item;
+
+	PushFrame(queue, frame, map);
+	CHECK(queue.Pop(item));
+	CHECK(receiver.Receive(item));
+
+	// Frames 2 to 4, frame 2 is coalesced
+	for (int i = 0; i < 3; i++) {
+		frame = NextFrame(arena, frame, seed, bScroll, map);
+		PushFrame(queue, frame, map);
+	}
+	CHECK(queue.GetCoalesced() == 1);
+	CHECK(queue.Pop(item));
+	CHECK(item.frame->number == 2);
+	CHECK(receiver.Receive(item));
+	CHECK(queue.Pop(item));
+	CHECK(receiver.Receive(item));
+	CHECK(!queue.Pop(item));
+	CHECK(queue.GetLost() == 0);
+
+	// Several coalesced in a row
+	for (int i = 0; i < 9; i++) {
+		frame = NextFrame(arena, frame, seed, bScroll && (i & 1), map);
+		PushFrame(queue, frame, map);
+	}
+	CHECK(queue.GetCoalesced() == 8);
+	while (queue.Pop(item))
+		CHECK(receiver.Receive(item));
+	CHECK(receiver.decoded == 5);
+}
+
+TEST(FrameQueueCoalesceDecodes)
+{
+	CoalesceSequence(false);
+}
+
+TEST(FrameQueueCoalesceScrollDecodes)
+{
+	CoalesceSequence(true);
+}
+
+// Capture and a slower stream thread with each policy. Every frame
+// decoded must be the frame pushed, with a key frame after a loss.
+static void ProducerConsumer(QueuePolicy policy)
+{
+	FrameArena arena;
+	FrameQueue queue(4, policy);
+	queue.SetTimeout(1.0);
+	const unsigned int frames = 1500;
+	std::atomic<bool> bDone{ false };
+	std::atomic<unsigned int> mismatches{ 0 };
+	QueueReceiver receiver;
+
+	std::thread consumer([&]() {
+		uint32_t seed = 11;
+		QueuedFrame item;
+		while (true) {
+			bool bDoneBefore = bDone;
+			if (!queue.Pop(item, 1.0)) {
+				if (bDoneBefore)
+					break;
+				continue;
+			}
+			if (!receiver.Receive(item))
+				mismatches++;
+			item.frame.reset();
+			// Slower than capture at times
+			if (TestRandom(seed) % 4 == 0)
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	});
+
+	uint32_t seed = 5;
+	TileMap map;
+	map.Resize(frameWidth, frameHeight);
+	map.SetAll();
+	FrameRef frame = NewFrame(arena, seed);
+	PushFrame(queue, frame, map);
+	for (unsigned int i = 1; i < frames; i++) {
+		frame = NextFrame(arena, frame, seed, TestRandom(seed) % 5 == 0, map);
+		PushFrame(queue, frame, map);
+		if (i % 8 == 0)
+			std::this_thread::yield();
+	}
+	frame.reset();
+	bDone = true;
+	consumer.join();
+
+	CHECK(mismatches == 0);
+	CHECK(receiver.decoded > 0);
+	CHECK(queue.GetPushed() + queue.GetDroppedNewest() + queue.GetTimeouts() == frames);
+	CHECK(queue.GetPopped() + queue.GetDroppedOldest() + queue.GetCoalesced() == queue.GetPushed());
+	if (policy == QUEUE_COALESCE)
+		CHECK(queue.GetLost() == 0);
+	CHECK(arena.GetLiveBytes() == 0);
+	printf("    %u decoded, %u coalesced, %u lost\n", receiver.decoded, queue.GetCoalesced(), queue.GetLost());
+}
+
+TEST(FrameQueueCoalesceStream)
+{
+	ProducerConsumer(QUEUE_COALESCE);
+}
+
+TEST(FrameQueueDropOldestStream)
+{
+	ProducerConsumer(QUEUE_DROP_OLDEST);
+}
+
+TEST(FrameQueueDropNewestStream)
+{
+	ProducerConsumer(QUEUE_DROP_NEWEST);
+}
+
+TEST(FrameQueueBlockStream)
+{
+	ProducerConsumer(QUEUE_BLOCK);
+}
+
+// Several producers and consumers. Each frame is taken at most once
+// and every frame pushed is popped, dropped or coalesced.
+TEST(FrameQueueStress)
+{
+	const QueuePolicy policies[] = { QUEUE_DROP_OLDEST, QUEUE_DROP_NEWEST, QUEUE_BLOCK, QUEUE_COALESCE };
+	for (QueuePolicy policy : policies) {
+		FrameArena arena;
+		FrameQueue queue(8, policy);
+		queue.SetTimeout(0.5);
+		const unsigned int producers = 4;
+		const unsigned int consumers = 2;
+		const unsigned int frames = 4000; // Each producer
+		std::vector<std::atomic<unsigned char>> taken(producers*frames);
+		std::atomic<unsigned int> duplicates{ 0 };
+		std::atomic<unsigned int> running{ producers };
+
+		std::vector<std::thread> threads;
+		for (unsigned int p = 0; p < producers; p++) {
+			threads.emplace_back([&, p]() {
+				TileMap map;
+				map.Resize(64, 64);
+				for (unsigned int i = 0; i < frames; i++) {
+					FramePtr frame = arena.Allocate(64, 64);
+					frame->number = p*frames + i;
+					PushFrame(queue, frame, map);
+				}
+				running--;
+			});
+		}
+		for (unsigned int c = 0; c < consumers; c++) {
+			threads.emplace_back([&]() {
+				QueuedFrame item;
+				while (running > 0 || queue.GetSize() > 0) {
+					if (queue.Pop(item, 0.5)) {
+						if (taken[item.frame->number].fetch_add(1) != 0)
+							duplicates++;
+						item.frame.reset();
+					}
+				}
+			});
+		}
+		for (std::thread& t : threads)
+			t.join();
+
+		QueuedFrame item;
+		CHECK(!queue.Pop(item));
+		CHECK(duplicates == 0);
+		CHECK(queue.GetPushed() + queue.GetDroppedNewest() + queue.GetTimeouts() == producers*frames);
+		CHECK(queue.GetPopped() + queue.GetDroppedOldest() + queue.GetCoalesced() == queue.GetPushed());
+		CHECK(queue.GetHighWater() <= queue.GetCapacity());
+		CHECK(arena.GetLiveBytes() == 0);
+	}
+}
@@ -0,0 +1,185 @@
+//
+//	FrameStreamTest
+//
+//	Frames streamed over a local socket are reconstructed by the receiver,
+//	including the tiles of frames skipped by capture. The stream only
+//	listens on loopback unless allowed, and the receiver skips a message
+//	it cannot decode and refuses one larger than any valid message.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "FrameArena.h"
+#include "FrameStream.h"
+
+#include <chrono>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static std::string SocketAddress(const char* name)
+{
+	return "unix:" + std::string(name) + "-" + std::to_string((int)getpid()) + ".sock";
+}
+
+TEST(FrameStreamListensOnLoopback)
+{
+	intptr_t s = StreamListen("tcp:0.0.0.0:0");
+	CHECK(s < 0);
+	StreamClose(s);
+	s = StreamListen("tcp:192.168.1.1:0");
+	CHECK(s < 0);
+	StreamClose(s);
+	s = StreamListen("tcp:127.0.0.1:0");
+	CHECK(s >= 0);
+	StreamClose(s);
+	s = StreamListen("tcp:0.0.0.0:0", true);
+	CHECK(s >= 0);
+	StreamClose(s);
+
+	FrameStream stream;
+	CHECK(!stream.Open("tcp:0.0.0.0:0"));
+	stream.SetRemote(true);
+	CHECK(stream.Open("tcp:0.0.0.0:0"));
+	stream.Close();
+}
+
+// Capture pushes some frames and skips others, e.g. a region frame
+// with no desktop frame staged. Each frame received is the frame pushed.
+TEST(FrameStreamSkippedTiles)
+{
+	const unsigned int width = 256;
+	const unsigned int height = 128;
+	const unsigned int frames = 200;
+	std::string address = SocketAddress("stream-test");
+	FrameArena arena;
+	FrameStream stream;
+	stream.SetQueue(4, QUEUE_COALESCE);
+	CHECK(stream.Open(address));
+
+	// Frames by number, for the receiver to compare with
+	std::vector<FrameRef> sources(frames + 1);
+	std::atomic<unsigned int> received{ 0 };
+	std::atomic<unsigned int> mismatches{ 0 };
+	std::thread receiverThread([&]() {
+		FrameStreamReceiver receiver;
+		for (int i = 0; i < 200 && !receiver.Connect(address); i++)
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		while (receiver.Receive()) {
+			const TileDecoder& decoder = receiver.GetDecoder();
+			const FrameRef& source = sources[decoder.GetFrame()];
+			if (!source || memcmp(decoder.GetPixels(), source->pixels, source->size) != 0)
+				mismatches++;
+			received++;
+			if (decoder.GetFrame() == frames)
+				break;
+		}
+	});
+	for (int i = 0; i < 200 && !stream.IsConnected(); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	CHECK(stream.IsConnected());
+
+	uint32_t seed = 21;
+	TileMap map;
+	map.Resize(width, height);
+	FramePtr previous;
+	for (unsigned int n = 1; n <= frames; n++) {
+		FramePtr frame = arena.Allocate(width, height);
+		frame->number = n;
+		frame->timestamp = CaptureStats::Now();
+		if (previous) {
+			memcpy(frame->pixels, previous->pixels, frame->size);
+			unsigned int x = TestRandom(seed) % width;
+			unsigned int y = TestRandom(seed) % height;
+			memset(frame->pixels + (size_t)y*frame->pitch + x*4, (int)n, std::min(32u, width - x)*4);
+			map.Clear();
+			map.Compare(previous->pixels, frame->pixels, frame->pitch);
+		}
+		else {
+			for (size_t i = 0; i < frame->size; i++)
+				frame->pixels[i] = (unsigned char)TestRandom(seed);
+			map.SetAll();
+		}
+		sources[n] = frame;
+		// The last is always pushed
+		if (n < frames && TestRandom(seed) % 3 == 0)
+			stream.Skip(map);
+		else
+			stream.Push(frame, map);
+		previous = frame;
+	}
+	receiverThread.join();
+	stream.Close();
+
+	CHECK(received > 0);
+	CHECK(mismatches == 0);
+	printf("    %u frames received\n", received.load());
+}
+
+// Send a length prefixed message
+static bool SendMessage(intptr_t s, const unsigned char* data, uint32_t size)
+{
+	unsigned char prefix[4] = { (unsigned char)(size & 0xFF), (unsigned char)((size >> 8) & 0xFF),
+		(unsigned char)((size >> 16) & 0xFF), (unsigned char)(size >> 24) };
+	return StreamSendAll(s, prefix, 4) && (size == 0 || StreamSendAll(s, data, size));
+}
+
+TEST(FrameStreamReceiverErrors)
+{
+	std::string address = SocketAddress("receiver-test");
+	intptr_t listener = StreamListen(address);
+	CHECK(listener >= 0);
+	if (listener < 0)
+		return;
+
+	FrameStreamReceiver receiver;
+	std::thread connect([&]() { receiver.Connect(address); });
+#ifdef _WIN32
+	intptr_t server = (intptr_t)accept((SOCKET)listener, nullptr, nullptr);
+#else
+	intptr_t server = (intptr_t)accept((int)listener, nullptr, nullptr);
+#endif
+	connect.join();
+	CHECK(server >= 0 && receiver.IsConnected());
+
+	const unsigned int width = 64;
+	const unsigned int height = 64;
+	std::vector<unsigned char> pixels(width*height*4, 0x33);
+	TileMap map;
+	map.Resize(width, height);
+	map.SetAll();
+	TileEncoder encoder;
+	std::vector<unsigned char> key = encoder.Encode(pixels.data(), width*4, map, 5, 0.0, true);
+	std::vector<unsigned char> garbage(100, 0xEE);
+
+	// A message that does not decode is skipped, and the next received
+	CHECK(SendMessage(server, garbage.data(), (uint32_t)garbage.size()));
+	CHECK(SendMessage(server, key.data(), (uint32_t)key.size()));
+	CHECK(receiver.Receive());
+	CHECK(receiver.GetDecoder().GetFrame() == 5);
+	CHECK(receiver.GetErrors() == 1);
+
+	// A size larger than the maximum closes the connection
+	receiver.SetMaximumSize(width, height);
+	unsigned char prefix[4] = { 0xFF, 0xFF, 0xFF, 0x7F };
+	CHECK(StreamSendAll(server, prefix, 4));
+	CHECK(!receiver.Receive());
+	CHECK(!receiver.IsConnected());
+	CHECK(receiver.GetErrors() == 2);
+
+	StreamClose(server);
+	StreamClose(listener);
+#ifndef _WIN32
+	unlink(address.substr(5).c_str());
+#endif
+}
@@ -0,0 +1,243 @@
+//
+//	ScrollDetectTest
+//
+//	Scrolls of a synthetic document window are found with the offset
+//	scrolled, and the move with the tiles compared after it always
+//	rebuilds the frame. Changes that are not scrolls are not taken
+//	for one. The benchmark measures detection at 1920x1080.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "ScrollDetect.h"
+
+#include <string.h>
+
+#define TOOLBAR_HEIGHT  40
+#define STATUS_HEIGHT   20
+#define SCROLLBAR_WIDTH 16
+#define LINE_HEIGHT     18
+
+static uint32_t Hash(uint32_t x)
+{
+	x ^= x >> 16; x *= 0x7FEB352D;
+	x ^= x >> 15; x *= 0x846CA68B;
+	return x ^ (x >> 16);
+}
+
+// A document window scrolled to (scrollX, scrollY) pixels : a toolbar,
+// text lines of the document, a scroll bar with the thumb at the position
+// and a status bar showing the line.
+static void DrawDocument(std::vector<uint32_t>& pixels, unsigned int width, unsigned int height,
+	int scrollX, int scrollY)
+{
+	pixels.resize((size_t)width*height);
+	unsigned int textRight = width - SCROLLBAR_WIDTH;
+	for (unsigned int y = 0; y < height; y++) {
+		uint32_t* line = &pixels[(size_t)y*width];
+		if (y < TOOLBAR_HEIGHT) {
+			for (unsigned int x = 0; x < width; x++)
+				line[x] = (x/32) & 1 ? 0xFFD0D0D0 : 0xFFC0C0C0;
+			continue;
+		}
+		if (y >= height - STATUS_HEIGHT) {
+			for (unsigned int x = 0; x < width; x++)
+				line[x] = (x < 100 && ((Hash((uint32_t)scrollY/LINE_HEIGHT) >> (x & 31)) & 1)) ? 0xFF000000 : 0xFFE0E0E0;
+			continue;
+		}
+		// Text : glyph cells of 8 pixels in lines with a gap
+		int docY = (int)y - TOOLBAR_HEIGHT + scrollY;
+		int row = docY/LINE_HEIGHT;
+		int cellY = docY % LINE_HEIGHT;
+		for (unsigned int x = 0; x < textRight; x++) {
+			int docX = (int)x + scrollX;
+			uint32_t glyph = Hash((uint32_t)row*4096 + (uint32_t)(docX/8));
+			bool bInk = cellY >= 3 && cellY < 15 && (glyph & 3) != 0
+				&& ((Hash(glyph + (uint32_t)cellY*8 + (uint32_t)(docX % 8)) & 7) < 3);
+			line[x] = bInk ? 0xFF101010 : 0xFFFFFFFF;
+		}
+		// Scroll bar
+		int thumb = TOOLBAR_HEIGHT + (scrollY/8) % (int)(height - TOOLBAR_HEIGHT - STATUS_HEIGHT - 40);
+		for (unsigned int x = textRight; x < width; x++)
+			line[x] = ((int)y >= thumb && (int)y < thumb + 40) ? 0xFF808080 : 0xFFF0F0F0;
+	}
+}
+
+// The previous frame after the move, with the tiles that differ copied
+// from the current frame. True if that is the current frame.
+static bool Rebuilds(const std::vector<uint32_t>& previous, const std::vector<uint32_t>& current,
+	unsigned int width, unsigned int height, TileMap& map)
+{
+	unsigned int pitch = width*4;
+	map.Compare((const unsigned char*)previous.data(), (const unsigned char*)current.data(), pitch);
+	std::vector<uint32_t> rebuilt = previous;
+	for (const TileMove& m : map.GetMoves())
+		for (int y = m.top; y < m.bottom; y++)
+			memcpy(&rebuilt[(size_t)y*width + m.left], &previous[(size_t)(y - m.dy)*width + m.left - m.dx], (m.right - m.left)*4);
+	unsigned int tile = map.GetTileSize();
+	for (unsigned int row = 0; row < map.GetRows(); row++) {
+		for (unsigned int col = 0; col < map.GetCols(); col++) {
+			if (!map.IsChanged(col, row))
+				continue;
+			unsigned int x1 = std::min(width, (col + 1)*tile);
+			for (unsigned int y = row*tile; y < std::min(height, (row + 1)*tile); y++)
+				memcpy(&rebuilt[(size_t)y*width + col*tile], &current[(size_t)y*width + col*tile], (x1 - col*tile)*4);
+		}
+	}
+	return rebuilt == current;
+}
+
+TEST(ScrollDetectVertical)
+{
+	const unsigned int width = 800;
+	const unsigned int height = 600;
+	ScrollDetector detector;
+	TileMap map;
+	map.Resize(width, height);
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> current;
+	int scrollY = 1000;
+	DrawDocument(current, width, height, 0, scrollY);
+
+	// Scrolls by a line, a wheel step and a page, both ways, and single pixels.
+	// A scroll of 400 of the 540 lines of text leaves too few lines in the
+	// middle of the frame that match, and is sent as tiles.
+	const int steps[] = { 18, 54, -54, 1, -1, 3, 200, -200, 400, 7, -18, 90 };
+	unsigned int detected = 0;
+	unsigned int rebuilt = 0;
+	unsigned int tilesMoved = 0;
+	unsigned int tilesPlain = 0;
+	for (int i = 0; i < 120; i++) {
+		int dy = steps[i % 12];
+		previous.swap(current);
+		scrollY += dy;
+		DrawDocument(current, width, height, 0, scrollY);
+		TileMove move;
+		map.Clear();
+		bool bFound = detector.Detect((const unsigned char*)previous.data(), (const unsigned char*)current.data(),
+			width, height, width*4, move);
+		CHECK(bFound || dy == 400);
+		if (bFound && move.dy == -dy && move.dx == 0) {
+			detected++;
+			// The text area, not the bars
+			CHECK(move.left == 0 && move.right <= (int)(width - SCROLLBAR_WIDTH));
+			CHECK(move.top >= TOOLBAR_HEIGHT && move.bottom <= (int)(height - STATUS_HEIGHT));
+			CHECK(move.bottom - move.top >= (int)(height - TOOLBAR_HEIGHT - STATUS_HEIGHT) - std::abs(dy) - LINE_HEIGHT);
+		}
+		if (bFound)
+			map.AddMove(move);
+		if (Rebuilds(previous, current, width, height, map))
+			rebuilt++;
+		tilesMoved += map.GetChangedCount();
+		TileMap plain;
+		plain.Resize(width, height);
+		tilesPlain += plain.Compare((const unsigned char*)previous.data(), (const unsigned char*)current.data(), width*4);
+	}
+	printf("    %u of 120 detected, %u tiles sent with moves, %u without\n", detected, tilesMoved, tilesPlain);
+	CHECK(detected == 110);
+	CHECK(rebuilt == 120);
+	CHECK(tilesMoved*3 < tilesPlain);
+}
+
+TEST(ScrollDetectHorizontal)
+{
+	const unsigned int width = 640;
+	const unsigned int height = 400;
+	ScrollDetector detector;
+	TileMap map;
+	map.Resize(width, height);
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> current;
+	int scrollX = 500;
+	DrawDocument(current, width, height, scrollX, 0);
+	unsigned int detected = 0;
+	for (int i = 0; i < 40; i++) {
+		int dx = (i & 1) ? -24 : 40;
+		previous.swap(current);
+		scrollX += dx;
+		DrawDocument(current, width, height, scrollX, 0);
+		TileMove move;
+		map.Clear();
+		if (detector.Detect((const unsigned char*)previous.data(), (const unsigned char*)current.data(),
+			width, height, width*4, move)) {
+			if (move.dx == -dx && move.dy == 0)
+				detected++;
+			map.AddMove(move);
+		}
+		CHECK(Rebuilds(previous, current, width, height, map));
+	}
+	CHECK(detected >= 36);
+}
+
+// Repaints, a video area and a new page are not scrolls
+TEST(ScrollDetectNotScrolls)
+{
+	const unsigned int width = 800;
+	const unsigned int height = 600;
+	ScrollDetector detector;
+	std::vector<uint32_t> previous;
+	std::vector<uint32_t> current;
+	DrawDocument(current, width, height, 0, 0);
+	uint32_t seed = 9;
+	unsigned int found = 0;
+	for (int i = 0; i < 60; i++) {
+		previous = current;
+		if (i % 3 == 0) {
+			// Typing on a line
+			unsigned int y = TOOLBAR_HEIGHT + (TestRandom(seed) % 20)*LINE_HEIGHT;
+			for (unsigned int x = 0; x < 200; x++)
+				current[(size_t)(y + 5)*width + x] ^= 0x00FFFFFF;
+		}
+		else if (i % 3 == 1) {
+			// Video in a rectangle
+			for (unsigned int y = 100; y < 400; y++)
+				for (unsigned int x = 100; x < 500; x++)
+					current[(size_t)y*width + x] = TestRandom(seed);
+		}
+		else {
+			// Another document
+			DrawDocument(current, width, height, 1000 + i*7919, 0);
+			for (size_t p = 0; p < current.size(); p += 97)
+				current[p] ^= TestRandom(seed);
+		}
+		TileMove move;
+		if (detector.Detect((const unsigned char*)previous.data(), (const unsigned char*)current.data(),
+			width, height, width*4, move))
+			found++;
+	}
+	CHECK(found == 0);
+	// Too small to detect
+	std::vector<uint32_t> small(32*32, 0);
+	TileMove move;
+	CHECK(!detector.Detect((const unsigned char*)small.data(), (const unsigned char*)small.data(), 32, 32, 128, move));
+}
+
+BENCH(ScrollDetectSpeed)
+{
+	const unsigned int width = 1920;
+	const unsigned int height = 1080;
+	ScrollDetector detector;
+	std::vector<uint32_t> frames[2];
+	int scrollY = 0;
+	DrawDocument(frames[0], width, height, 0, scrollY);
+	// Scrolling, then the same frame, as when a window is idle
+	CaptureStats scroll;
+	CaptureStats idle;
+	for (int i = 1; i <= 200; i++) {
+		std::vector<uint32_t>& previous = frames[(i - 1) & 1];
+		std::vector<uint32_t>& current = frames[i & 1];
+		bool bScroll = i <= 100;
+		if (bScroll)
+			scrollY += 36;
+		DrawDocument(current, width, height, 0, scrollY);
+		TileMove move;
+		double start = CaptureStats::Now();
+		detector.Detect((const unsigned char*)previous.data(), (const unsigned char*)current.data(),
+			width, height, width*4, move);
+		(bScroll ? scroll : idle).AddSample(CaptureStats::Now() - start);
+	}
+	printf("    scroll %.3f msec p99 %.3f, idle %.3f msec, %u detected\n", scroll.GetAverage(),
+		scroll.GetPercentile(99.0), idle.GetAverage(), detector.GetDetected());
+	CHECK(detector.GetDetected() >= 95);
+}
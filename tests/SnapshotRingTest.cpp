@@ -0,0 +1,252 @@
+//
+//	SnapshotRingTest
+//
+//	Clips written from the ring, while recording and from a ring left
+//	open, decode to the frames recorded and start with a key frame within
+//	the period asked for. The benchmark measures the cost of recording on
+//	the capture thread and the time to write a clip.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "SnapshotRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static std::string TestPath(const char* name)
+{
+	return std::string(name) + "-" + std::to_string((int)getpid());
+}
+
+// Frames of a document with a few lines changing in each
+struct RecordedFrames {
+	FrameArena arena;
+	std::vector<FrameRef> frames; // By number
+	TileMap map;
+	uint32_t seed = 1;
+
+	FramePtr Next(unsigned int width, unsigned int height, double interval) {
+		FramePtr frame = arena.Allocate(width, height);
+		frame->number = (uint32_t)frames.size();
+		frame->timestamp = frame->number*interval;
+		map.Resize(width, height);
+		if (frames.empty() || frames.back()->size != frame->size) {
+			for (unsigned int y = 0; y < height; y++)
+				for (unsigned int x = 0; x < width; x++)
+					((uint32_t*)frame->pixels)[y*width + x] = 0xFF000000 | (x*3) << 8 | (y & 0xFF);
+			map.SetAll();
+		}
+		else {
+			memcpy(frame->pixels, frames.back()->pixels, frame->size);
+			for (int i = 0; i < 3; i++) {
+				unsigned int y = TestRandom(seed) % height;
+				memset(frame->pixels + (size_t)y*frame->pitch, (int)TestRandom(seed), frame->pitch);
+			}
+			map.Clear();
+			map.Compare(frames.back()->pixels, frame->pixels, frame->pitch);
+		}
+		frames.push_back(frame);
+		return frame;
+	}
+};
+
+// Wait for the writer to take every frame pushed
+static void WaitRecorded(SnapshotRing& ring, unsigned int pushed)
+{
+	for (int i = 0; i < 1000 && ring.GetRecorded() + ring.GetDropped() < pushed; i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+}
+
+// Decode a clip. Returns the frames, 0 if any is not the frame recorded.
+static unsigned int CheckClip(const std::string& path, const RecordedFrames& recorded,
+	uint32_t& first, uint32_t& last)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return 0;
+	TileDecoder decoder;
+	std::vector<unsigned char> message;
+	unsigned int frames = 0;
+	bool bValid = true;
+	unsigned char prefix[4];
+	while (bValid && fread(prefix, 1, 4, file) == 4) {
+		uint32_t size = prefix[0] | prefix[1] << 8 | prefix[2] << 16 | (uint32_t)prefix[3] << 24;
+		message.resize(size);
+		if (fread(message.data(), 1, size, file) != size || !decoder.Decode(message.data(), size)) {
+			bValid = false;
+			break;
+		}
+		const TileFrameHeader* header = (const TileFrameHeader*)message.data();
+		uint32_t number = decoder.GetFrame();
+		if (frames == 0) {
+			bValid = (header->flags & TILEFRAME_KEY) != 0;
+			first = number;
+		}
+		else if (number <= last) {
+			bValid = false;
+		}
+		last = number;
+		const FrameRef& frame = recorded.frames[number];
+		if (decoder.GetWidth() != frame->width || memcmp(decoder.GetPixels(), frame->pixels, frame->size) != 0)
+			bValid = false;
+		frames++;
+	}
+	fclose(file);
+	return bValid ? frames : 0;
+}
+
+TEST(SnapshotRingClip)
+{
+	std::string ringPath = TestPath("ring-test") + ".ring";
+	std::string clipPath = TestPath("ring-test") + ".stc";
+	RecordedFrames recorded;
+	SnapshotRing ring;
+	ring.SetKeyInterval(2000.0);
+	CHECK(ring.Open(ringPath, 16*1024*1024));
+
+	// 10 seconds at 30 fps, every third frame skipped
+	unsigned int pushed = 0;
+	for (unsigned int i = 0; i < 300; i++) {
+		FramePtr frame = recorded.Next(320, 200, 1000.0/30.0);
+		if (i % 3 == 1 && i != 299) {
+			ring.Skip(recorded.map);
+			continue;
+		}
+		ring.Push(frame, recorded.map);
+		pushed++;
+		if (i % 10 == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	WaitRecorded(ring, pushed);
+	CHECK(ring.GetRecorded() > 0);
+	CHECK(ring.GetRetained() > 9000.0);
+
+	// The last 3 seconds, from a key frame up to 2 seconds before
+	uint32_t first = 0;
+	uint32_t last = 0;
+	unsigned int frames = ring.Flush(clipPath, 3000.0);
+	CHECK(frames > 0);
+	CHECK(CheckClip(clipPath, recorded, first, last) == frames);
+	CHECK(last == 299);
+	double start = recorded.frames[first]->timestamp;
+	double end = recorded.frames[last]->timestamp;
+	CHECK(end - start >= 3000.0 - 1.0 && end - start <= 5000.0 + 1.0);
+
+	// A ring file left open is recovered, a closed one is not
+	std::string copyPath = TestPath("ring-copy") + ".ring";
+	{
+		FILE* in = fopen(ringPath.c_str(), "rb");
+		FILE* out = fopen(copyPath.c_str(), "wb");
+		std::vector<unsigned char> buffer(65536);
+		size_t n;
+		while (in && out && (n = fread(buffer.data(), 1, buffer.size(), in)) > 0)
+			fwrite(buffer.data(), 1, n, out);
+		if (in) fclose(in);
+		if (out) fclose(out);
+	}
+	frames = SnapshotRing::Recover(copyPath, clipPath);
+	CHECK(frames > 0);
+	CHECK(CheckClip(clipPath, recorded, first, last) == frames);
+	CHECK(last == 299);
+	ring.Close();
+	CHECK(SnapshotRing::Recover(ringPath, clipPath) == 0);
+
+	remove(ringPath.c_str());
+	remove(copyPath.c_str());
+	remove(clipPath.c_str());
+}
+
+// A small ring that wraps many times, with a size change, and
+// clips written while frames are being recorded
+TEST(SnapshotRingWrap)
+{
+	std::string ringPath = TestPath("ring-wrap") + ".ring";
+	std::string clipPath = TestPath("ring-wrap") + ".stc";
+	RecordedFrames recorded;
+	SnapshotRing ring;
+	ring.SetKeyInterval(500.0);
+	CHECK(ring.Open(ringPath, 1024*1024));
+
+	std::atomic<bool> bDone{ false };
+	std::atomic<unsigned int> clips{ 0 };
+	std::thread flusher([&]() {
+		while (!bDone) {
+			if (ring.Flush(clipPath, 1000.0) > 0)
+				clips++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(3));
+		}
+	});
+	for (unsigned int i = 0; i < 600; i++) {
+		unsigned int width = i < 300 ? 320 : 400;
+		ring.Push(recorded.Next(width, 240, 20.0), recorded.map);
+		if (i % 4 == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	WaitRecorded(ring, 600);
+	bDone = true;
+	flusher.join();
+	// The clips are replaced as they are written, check the last
+	uint32_t first = 0;
+	uint32_t last = 0;
+	unsigned int frames = ring.Flush(clipPath, 1000.0);
+	CHECK(frames > 0 && CheckClip(clipPath, recorded, first, last) == frames);
+	CHECK(last == 599);
+	CHECK(clips > 0);
+	CHECK(ring.GetBytesWritten() > 1024.0*1024.0);
+	CHECK(ring.GetRetained() < 600*20.0);
+	ring.Close();
+	remove(ringPath.c_str());
+	remove(clipPath.c_str());
+}
+
+// Recording 1920x1080 at 60 fps with a tenth of the screen changing.
+// Push is all the capture thread does.
+BENCH(SnapshotRingSpeed)
+{
+	std::string ringPath = TestPath("ring-bench") + ".ring";
+	std::string clipPath = TestPath("ring-bench") + ".stc";
+	RecordedFrames recorded;
+	SnapshotRing ring;
+	CHECK(ring.Open(ringPath, 256*1024*1024));
+
+	CaptureStats push(600);
+	for (unsigned int i = 0; i < 600; i++) {
+		FramePtr frame = recorded.Next(1920, 1080, 1000.0/60.0);
+		for (unsigned int y = 0; y < 108; y++)
+			memset(frame->pixels + (size_t)(((i*7) % 10)*108 + y)*frame->pitch, (int)i, frame->pitch/10);
+		recorded.map.MarkRect(0, ((i*7) % 10)*108, 192, ((i*7) % 10)*108 + 108);
+		push.Start();
+		ring.Push(frame, recorded.map);
+		push.Stop();
+		// Only the frames being recorded are kept
+		if (i > 0)
+			recorded.frames[i - 1].reset();
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	WaitRecorded(ring, 600);
+	double flush = CaptureStats::Now();
+	unsigned int frames = ring.Flush(clipPath, 10000.0);
+	flush = CaptureStats::Now() - flush;
+	CaptureStats writes = ring.GetWriteTimes();
+	printf("    push %.3f msec p99 %.3f, write %.2f msec, %u dropped, %.1f MB for %.1f s\n",
+		push.GetAverage(), push.GetPercentile(99.0), writes.GetAverage(), ring.GetDropped(),
+		ring.GetBytesWritten()/1048576.0, ring.GetRetained()/1000.0);
+	printf("    clip of %u frames in %.1f msec\n", frames, flush);
+	CHECK(frames > 0);
+	ring.Close();
+	remove(ringPath.c_str());
+	remove(clipPath.c_str());
+}
@@ -0,0 +1,108 @@
+//
+//	ThreadScheduleTest
+//
+//	Parsing of the schedule settings, a schedule applied and reverted
+//	on the calling thread, and wake jitter under load on stock Linux
+//	or Windows with each priority that is permitted.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "ThreadSchedule.h"
+
+#include <thread>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+TEST(ThreadScheduleParse)
+{
+	uint64_t mask = 0;
+	CHECK(ParseCores("0", mask) && mask == 1);
+	CHECK(ParseCores("0,2-3", mask) && mask == 0xD);
+	CHECK(ParseCores("1 - 2, 63", mask) && mask == (0x6 | ((uint64_t)1 << 63)));
+	mask = 5;
+	CHECK(!ParseCores("", mask) && mask == 5);
+	CHECK(!ParseCores("64", mask));
+	CHECK(!ParseCores("3-1", mask));
+	CHECK(!ParseCores("1,", mask));
+	CHECK(!ParseCores("a", mask));
+
+	ThreadPriority priority = PRIORITY_NORMAL;
+	CHECK(ParsePriority("realtime", priority) && priority == PRIORITY_REALTIME);
+	CHECK(ParsePriority("high", priority) && priority == PRIORITY_HIGH);
+	CHECK(!ParsePriority("max", priority) && priority == PRIORITY_HIGH);
+	CHECK(std::string(GetPriorityName(PRIORITY_HIGHEST)) == "highest");
+	CHECK(ThreadSchedule().IsDefault());
+}
+
+TEST(ThreadScheduleApply)
+{
+	std::thread thread([]() {
+		ThreadSchedule schedule;
+		schedule.priority = PRIORITY_HIGH;
+		schedule.affinity = 1;
+#ifndef _WIN32
+		int tid = (int)syscall(SYS_gettid);
+		int nice = getpriority(PRIO_PROCESS, tid);
+		cpu_set_t before;
+		pthread_getaffinity_np(pthread_self(), sizeof(before), &before);
+#endif
+		{
+			ThreadScheduler scheduler;
+			bool bApplied = scheduler.Apply(schedule);
+			std::string result = scheduler.GetResult();
+			printf("    %s\n", result.c_str());
+			// Applied or not permitted, and the result says which
+			CHECK(bApplied == (result.find("not permitted") == std::string::npos));
+			CHECK(result.find("cores 0x1") != std::string::npos);
+#ifndef _WIN32
+			cpu_set_t set;
+			pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+			CHECK(CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set));
+			if (bApplied)
+				CHECK(getpriority(PRIO_PROCESS, tid) == -5);
+#endif
+			// Reverted when the scheduler is destroyed
+		}
+#ifndef _WIN32
+		cpu_set_t after;
+		pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+		CHECK(CPU_EQUAL(&before, &after));
+		CHECK(getpriority(PRIO_PROCESS, tid) == nice);
+#endif
+	});
+	thread.join();
+}
+
+// Wake lateness of a 2 msec period with every core loaded. A normal thread
+// is usually woken within the period. Realtime, where permitted, keeps
+// nearly every wake within it.
+TEST(ThreadScheduleJitter)
+{
+	const double period = 2.0;
+	const double duration = 500.0;
+	double normalP99 = 0.0;
+	for (int p = PRIORITY_NORMAL; p <= PRIORITY_REALTIME; p++) {
+		ThreadSchedule schedule;
+		schedule.priority = (ThreadPriority)p;
+		std::string result;
+		CaptureStats lateness = MeasureJitter(schedule, period, duration, 0, &result);
+		printf("    %-22s p50 %.3f, p99 %.3f, max %.3f msec\n", result.c_str(),
+			lateness.GetPercentile(50.0), lateness.GetPercentile(99.0), lateness.GetMaximum());
+		CHECK(lateness.GetCount() >= (unsigned int)(duration/period) - 2);
+		CHECK(lateness.GetMinimum() >= 0.0);
+		if (result.find("not permitted") != std::string::npos)
+			continue;
+		CHECK(lateness.GetPercentile(50.0) < period);
+		if (p == PRIORITY_NORMAL)
+			normalP99 = lateness.GetPercentile(99.0);
+		else if (p == PRIORITY_REALTIME)
+			CHECK(lateness.GetPercentile(99.0) < std::max(period, normalP99));
+	}
+}
@@ -0,0 +1,167 @@
+//
+//	TileCodecTest
+//
+//	Tile delta frames decode to the frame encoded, and a decoder given
+//	damaged or hostile messages fails without allocating what they ask for.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "TileCodec.h"
+
+#include <stddef.h>
+#include <string.h>
+
+static void Fill(std::vector<unsigned char>& pixels, uint32_t& seed)
+{
+	for (size_t i = 0; i + 4 <= pixels.size(); i += 4) {
+		uint32_t v = TestRandom(seed);
+		memcpy(&pixels[i], &v, 4);
+	}
+}
+
+// Key frame, tile changes and a scroll, on a size that is not a multiple of the tiles
+TEST(TileCodecRoundTrip)
+{
+	const unsigned int width = 333;
+	const unsigned int height = 201;
+	const unsigned int pitch = width*4;
+	uint32_t seed = 1;
+	std::vector<unsigned char> previous(pitch*height);
+	std::vector<unsigned char> current(pitch*height);
+	Fill(current, seed);
+
+	TileMap map;
+	map.Resize(width, height);
+	map.SetAll();
+	TileEncoder encoder;
+	TileDecoder decoder;
+	const std::vector<unsigned char>& key = encoder.Encode(current.data(), pitch, map, 1, 10.0, true);
+	CHECK(decoder.Decode(key.data(), (unsigned int)key.size()));
+	CHECK(decoder.GetWidth() == width && decoder.GetHeight() == height);
+	CHECK(memcmp(decoder.GetPixels(), current.data(), current.size()) == 0);
+
+	for (uint32_t frame = 2; frame < 40; frame++) {
+		previous = current;
+		map.Clear();
+		if (frame % 3 == 0) {
+			// Scroll the middle up and draw the strip it uncovers
+			int dy = 5 + (int)(TestRandom(seed) % 30);
+			for (unsigned int y = 20; y < height - 20 - dy; y++)
+				memcpy(&current[y*pitch], &previous[(y + dy)*pitch], pitch);
+			for (unsigned int y = height - 20 - dy; y < height - 20; y++)
+				for (unsigned int x = 0; x < pitch; x++)
+					current[y*pitch + x] = (unsigned char)TestRandom(seed);
+			map.AddMove({ 0, 20, (int32_t)width, (int32_t)(height - 20 - dy), 0, -dy });
+		}
+		else {
+			unsigned int x0 = TestRandom(seed) % width;
+			unsigned int y0 = TestRandom(seed) % height;
+			for (unsigned int y = y0; y < std::min(height, y0 + 40); y++)
+				for (unsigned int x = x0; x < std::min(width, x0 + 70); x++)
+					current[y*pitch + x*4] ^= 0x5A;
+		}
+		map.Compare(previous.data(), current.data(), pitch);
+		const std::vector<unsigned char>& delta = encoder.Encode(current.data(), pitch, map, frame, frame*10.0, false);
+		CHECK(decoder.Decode(delta.data(), (unsigned int)delta.size()));
+		CHECK(decoder.GetFrame() == frame);
+		CHECK(memcmp(decoder.GetPixels(), current.data(), current.size()) == 0);
+	}
+}
+
+TEST(TileCodecCompression)
+{
+	uint32_t seed = 9;
+	std::vector<unsigned char> data(100000);
+	// Runs and repeats, then noise
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = i < 40000 ? (unsigned char)(i/1000) : i < 70000 ? (unsigned char)(i % 97) : (unsigned char)TestRandom(seed);
+	std::vector<unsigned char> packed(LZCompressBound((unsigned int)data.size()));
+	unsigned int size = LZCompress(data.data(), (unsigned int)data.size(), packed.data());
+	CHECK(size < data.size());
+	std::vector<unsigned char> unpacked(data.size());
+	CHECK(LZDecompress(packed.data(), size, unpacked.data(), (unsigned int)unpacked.size()) == (int)data.size());
+	CHECK(unpacked == data);
+	// Too small for the data
+	CHECK(LZDecompress(packed.data(), size, unpacked.data(), 1000) < 0);
+}
+
+// A message with a changed header field
+static std::vector<unsigned char> Altered(const std::vector<unsigned char>& message, size_t offset, uint32_t value)
+{
+	std::vector<unsigned char> altered = message;
+	memcpy(altered.data() + offset, &value, 4);
+	return altered;
+}
+
+TEST(TileCodecRejectsLargeSizes)
+{
+	const unsigned int width = 128;
+	const unsigned int height = 64;
+	std::vector<unsigned char> pixels(width*height*4, 7);
+	TileMap map;
+	map.Resize(width, height);
+	map.SetAll();
+	TileEncoder encoder;
+	std::vector<unsigned char> key = encoder.Encode(pixels.data(), width*4, map, 1, 0.0, true);
+
+	TileDecoder decoder;
+	std::vector<unsigned char> bad;
+	bad = Altered(key, offsetof(TileFrameHeader, width), 100000);
+	CHECK(!decoder.Decode(bad.data(), (unsigned int)bad.size()));
+	bad = Altered(key, offsetof(TileFrameHeader, height), 0);
+	CHECK(!decoder.Decode(bad.data(), (unsigned int)bad.size()));
+	bad = Altered(key, offsetof(TileFrameHeader, tileSize), 1);
+	CHECK(!decoder.Decode(bad.data(), (unsigned int)bad.size()));
+	bad = Altered(key, offsetof(TileFrameHeader, tileSize), 0x10000);
+	CHECK(!decoder.Decode(bad.data(), (unsigned int)bad.size()));
+	// More raw data than the frame could have
+	bad = Altered(key, offsetof(TileFrameHeader, rawSize), 0x7FFFFFFF);
+	CHECK(!decoder.Decode(bad.data(), (unsigned int)bad.size()));
+	bad = Altered(key, offsetof(TileFrameHeader, packedSize), (uint32_t)key.size());
+	CHECK(!decoder.Decode(bad.data(), (unsigned int)bad.size()));
+
+	// Within a lower maximum, and not above it
+	decoder.SetMaximumSize(width, height);
+	CHECK(decoder.Decode(key.data(), (unsigned int)key.size()));
+	CHECK(memcmp(decoder.GetPixels(), pixels.data(), pixels.size()) == 0);
+	decoder.SetMaximumSize(width - 1, height);
+	CHECK(!decoder.Decode(key.data(), (unsigned int)key.size()));
+	CHECK(decoder.GetMaximumMessage() > key.size());
+}
+
+// Random damage to valid messages must not crash or read out of bounds
+TEST(TileCodecDamagedMessages)
+{
+	const unsigned int width = 200;
+	const unsigned int height = 120;
+	uint32_t seed = 3;
+	std::vector<unsigned char> pixels(width*height*4);
+	Fill(pixels, seed);
+	TileMap map;
+	map.Resize(width, height);
+	map.SetAll();
+	TileEncoder encoder;
+	std::vector<unsigned char> key = encoder.Encode(pixels.data(), width*4, map, 1, 0.0, true);
+	map.Clear();
+	map.AddMove({ 0, 0, (int32_t)width, (int32_t)height - 10, 0, -10 });
+	map.MarkRect(0, height - 10, width, height);
+	std::vector<unsigned char> delta = encoder.Encode(pixels.data(), width*4, map, 2, 0.0, false);
+
+	unsigned int decoded = 0;
+	for (int i = 0; i < 3000; i++) {
+		TileDecoder decoder;
+		decoder.Decode(key.data(), (unsigned int)key.size());
+		std::vector<unsigned char> damaged = (i & 1) ? delta : key;
+		int changes = 1 + TestRandom(seed) % 4;
+		for (int j = 0; j < changes; j++)
+			damaged[TestRandom(seed) % damaged.size()] = (unsigned char)TestRandom(seed);
+		if (i % 7 == 0)
+			damaged.resize(TestRandom(seed) % damaged.size());
+		if (decoder.Decode(damaged.data(), (unsigned int)damaged.size()))
+			decoded++;
+	}
+	// Damage to pixels only still decodes
+	CHECK(decoded > 0);
+}
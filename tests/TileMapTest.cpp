@@ -0,0 +1,288 @@
+//
+//	TileMapTest
+//
+//	The span compare and the tile compare against plain per-pixel
+//	references, the bitmap operations, published format and malformed
+//	headers, and a benchmark of the compare.
+//
+//	SpoutCapture is Licensed with the LGPL3 license.
+//	Copyright(C) 2019-2024. Lynn Jarvis.
+//
+#include "CaptureTests.h"
+#include "CaptureStats.h"
+#include "TileMap.h"
+
+#include <string.h>
+
+TEST(TileMapSpanDiffers)
+{
+	std::vector<unsigned char> a(300);
+	std::vector<unsigned char> b(300);
+	uint32_t seed = 5;
+	for (unsigned char& c : a)
+		c = (unsigned char)TestRandom(seed);
+	// Every length and unaligned start, with one byte differing at each position
+	for (unsigned int offset = 0; offset < 4; offset++) {
+		for (unsigned int bytes = 0; bytes + offset <= a.size(); bytes += 7) {
+			b = a;
+			CHECK(!TileSpanDiffers(&a[offset], &b[offset], bytes));
+			for (unsigned int i = 0; i < bytes; i++) {
+				b[offset + i] ^= 0x80;
+				if (!TileSpanDiffers(&a[offset], &b[offset], bytes))
+					CHECK(!"difference missed");
+				b[offset + i] ^= 0x80;
+			}
+			// Outside the span
+			if (offset + bytes < b.size()) {
+				b[offset + bytes] ^= 1;
+				CHECK(!TileSpanDiffers(&a[offset], &b[offset], bytes));
+			}
+		}
+	}
+}
+
+// Tiles that differ from the previous frame after the moves, pixel by pixel
+static std::vector<bool> ReferenceCompare(const TileMap& map, const unsigned char* previous,
+	const unsigned char* current, unsigned int pitch)
+{
+	std::vector<bool> changed(map.GetCols()*map.GetRows(), false);
+	unsigned int tile = map.GetTileSize();
+	for (unsigned int y = 0; y < map.GetHeight(); y++) {
+		for (unsigned int x = 0; x < map.GetWidth(); x++) {
+			int sx = (int)x;
+			int sy = (int)y;
+			for (const TileMove& m : map.GetMoves()) {
+				if ((int)x >= m.left && (int)x < m.right && (int)y >= m.top && (int)y < m.bottom) {
+					sx -= m.dx;
+					sy -= m.dy;
+					break;
+				}
+			}
+			if (memcmp(previous + (size_t)sy*pitch + sx*4, current + (size_t)y*pitch + x*4, 4) != 0)
+				changed[(y/tile)*map.GetCols() + x/tile] = true;
+		}
+	}
+	return changed;
+}
+
+TEST(TileMapCompare)
+{
+	uint32_t seed = 8;
+	for (int trial = 0; trial < 60; trial++) {
+		unsigned int tile = (trial % 3 == 0) ? 32 : 64;
+		unsigned int width = 1 + TestRandom(seed) % 400;
+		unsigned int height = 1 + TestRandom(seed) % 300;
+		unsigned int pitch = width*4 + (TestRandom(seed) % 3)*16;
+		std::vector<unsigned char> previous((size_t)pitch*height);
+		for (unsigned char& c : previous)
+			c = (unsigned char)TestRandom(seed);
+		std::vector<unsigned char> current = previous;
+
+		TileMap map(tile);
+		map.Resize(width, height);
+		map.Clear();
+		// A scroll in half of the trials
+		if (trial & 1) {
+			int dy = (int)(TestRandom(seed) % 20) - 10;
+			int dx = (int)(TestRandom(seed) % 6) - 3;
+			map.AddMove({ 0, 0, (int32_t)width, (int32_t)height, dx, dy });
+			for (const TileMove& m : map.GetMoves())
+				for (int y = m.top; y < m.bottom; y++)
+					memcpy(&current[y*pitch + m.left*4], &previous[(y - m.dy)*pitch + (m.left - m.dx)*4], (m.right - m.left)*4);
+		}
+		// Changed pixels, including the last of the frame
+		unsigned int changes = TestRandom(seed) % 12;
+		for (unsigned int i = 0; i < changes; i++) {
+			unsigned int x = (i == 0) ? width - 1 : TestRandom(seed) % width;
+			unsigned int y = (i == 0) ? height - 1 : TestRandom(seed) % height;
+			current[(size_t)y*pitch + x*4 + TestRandom(seed) % 4] ^= 0x01;
+		}
+		// Padding past the width is not compared
+		if (pitch > width*4)
+			current[pitch - 1] ^= 0xFF;
+
+		std::vector<bool> expected = ReferenceCompare(map, previous.data(), current.data(), pitch);
+		unsigned int count = map.Compare(previous.data(), current.data(), pitch);
+		unsigned int mismatches = 0;
+		unsigned int expectedCount = 0;
+		for (unsigned int row = 0; row < map.GetRows(); row++) {
+			for (unsigned int col = 0; col < map.GetCols(); col++) {
+				bool bExpected = expected[row*map.GetCols() + col];
+				expectedCount += bExpected ? 1 : 0;
+				if (map.IsChanged(col, row) != bExpected)
+					mismatches++;
+			}
+		}
+		CHECK(mismatches == 0);
+		CHECK(count == expectedCount && map.GetChangedCount() == count);
+	}
+}
+
+TEST(TileMapBitmap)
+{
+	TileMap map;
+	map.Resize(1000, 130);
+	CHECK(map.GetCols() == 16 && map.GetRows() == 3);
+	CHECK(map.GetChangedCount() == 48);
+	map.Clear();
+	CHECK(map.GetChangedCount() == 0);
+
+	// Clipped to the frame
+	map.MarkRect(-50, -50, 10, 10);
+	map.MarkRect(990, 128, 5000, 5000);
+	map.MarkRect(500, 500, 600, 600);
+	map.MarkRect(100, 100, 100, 200); // Empty
+	CHECK(map.IsChanged(0, 0) && map.IsChanged(15, 2));
+	CHECK(map.GetChangedCount() == 2);
+	// A rectangle ending on a tile edge
+	map.MarkRect(64, 64, 128, 128);
+	CHECK(map.IsChanged(1, 1) && !map.IsChanged(2, 1) && !map.IsChanged(1, 2));
+	CHECK(!map.IsChanged(16, 0) && !map.IsChanged(0, 3));
+	map.MarkTile(16, 0);
+	CHECK(map.GetChangedCount() == 3);
+
+	// A move with a source partly outside the frame marks the rest
+	map.Clear();
+	map.AddMove({ 0, 0, 1000, 130, 0, 40 });
+	CHECK(map.GetMoves().size() == 1);
+	CHECK(map.GetMoves()[0].top == 40);
+	CHECK(map.IsChanged(0, 0) && !map.IsChanged(0, 1));
+	// Overlapping the first, marked instead
+	map.AddMove({ 0, 0, 200, 100, 10, 0 });
+	CHECK(map.GetMoves().size() == 1);
+	CHECK(map.IsChanged(3, 1));
+	// No more than TILEMAP_MOVES
+	map.Clear();
+	for (int i = 0; i < TILEMAP_MOVES + 2; i++)
+		map.AddMove({ i*100 + 10, 0, i*100 + 60, 20, -5, 0 });
+	CHECK(map.GetMoves().size() == TILEMAP_MOVES);
+	CHECK(map.IsChanged(12, 0) && map.IsChanged(14, 0) && !map.IsChanged(15, 0) && !map.IsChanged(0, 0));
+
+	// Merge marks the moves of both maps
+	TileMap other;
+	other.Resize(1000, 130);
+	other.Clear();
+	other.MarkTile(5, 2);
+	other.AddMove({ 0, 70, 50, 128, 0, -5 });
+	map.Merge(other);
+	CHECK(map.GetMoves().empty());
+	CHECK(map.IsChanged(0, 0) && map.IsChanged(5, 2) && map.IsChanged(0, 1) && !map.IsChanged(0, 2));
+	// A different size is a full change
+	TileMap small;
+	small.Resize(100, 100);
+	map.Merge(small);
+	CHECK(map.GetChangedCount() == 48);
+}
+
+TEST(TileMapPublished)
+{
+	TileMap map;
+	map.Resize(1920, 1080);
+	map.Clear();
+	map.MarkRect(100, 100, 300, 200);
+	map.AddMove({ 0, 300, 1920, 900, 0, -12 });
+	std::vector<unsigned char> data(map.GetDataSize());
+	map.Write(data.data(), 77);
+
+	TileMap read;
+	uint32_t frame = 0;
+	CHECK(read.Read(data.data(), (unsigned int)data.size(), &frame));
+	CHECK(frame == 77);
+	CHECK(read.GetWidth() == 1920 && read.GetHeight() == 1080);
+	CHECK(read.GetBits() == map.GetBits());
+	CHECK(read.GetMoves().size() == 1 && read.GetMoves()[0].dy == -12);
+
+	// Not a tile map, too short, or a move outside the frame
+	CHECK(!read.Read(data.data(), 10));
+	CHECK(!read.Read(data.data(), (unsigned int)data.size() - 1));
+	std::vector<unsigned char> bad = data;
+	bad[0] ^= 1;
+	CHECK(!read.Read(bad.data(), (unsigned int)bad.size()));
+	bad = data;
+	TileMove move = { 0, 300, 1920, 1080, 0, -12 };
+	memcpy(&bad[sizeof(TileMapHeader) + map.GetBits().size()], &move, sizeof(TileMove));
+	CHECK(!read.Read(bad.data(), (unsigned int)bad.size()));
+}
+
+// Header fields from another process are checked before anything is
+// allocated, and a rejected map leaves the one read before unchanged
+TEST(TileMapMalformed)
+{
+	TileMap map;
+	map.Resize(640, 480);
+	map.MarkRect(0, 0, 100, 100);
+	map.AddMove({ 0, 100, 640, 400, 0, -8 });
+	std::vector<unsigned char> data(map.GetDataSize());
+	map.Write(data.data(), 5);
+
+	TileMap read;
+	CHECK(read.Read(data.data(), (unsigned int)data.size()));
+	std::vector<uint8_t> bits = read.GetBits();
+
+	TileMapHeader header;
+	memcpy(&header, data.data(), sizeof(TileMapHeader));
+	TileMapHeader bad[6] = { header, header, header, header, header, header };
+	bad[0].width = 0;
+	bad[1].width = 0xFFFFFFFF; // Would allocate gigabytes
+	bad[1].cols = (bad[1].width + 63)/64;
+	bad[1].stride = (bad[1].cols + 7)/8;
+	bad[2].tileSize = 0;
+	bad[3].tileSize = 1; // 640x480 tiles
+	bad[3].cols = 640;
+	bad[3].rows = 480;
+	bad[3].stride = 80;
+	bad[4].cols = header.cols + 1;
+	bad[5].moves = TILEMAP_MOVES + 1;
+	for (TileMapHeader& h : bad) {
+		std::vector<unsigned char> copy = data;
+		memcpy(copy.data(), &h, sizeof(TileMapHeader));
+		CHECK(!read.Read(copy.data(), (unsigned int)copy.size()));
+		CHECK(read.GetWidth() == 640 && read.GetHeight() == 480 && read.GetTileSize() == 64);
+		CHECK(read.GetBits() == bits && read.GetMoves().size() == 1);
+	}
+}
+
+// Compare of identical 1920x1080 frames, the most work as no tile stops early,
+// against one memcmp per tile line
+BENCH(TileMapCompareSpeed)
+{
+	const unsigned int width = 1920;
+	const unsigned int height = 1080;
+	const unsigned int pitch = width*4;
+	std::vector<unsigned char> previous((size_t)pitch*height);
+	uint32_t seed = 1;
+	for (unsigned char& c : previous)
+		c = (unsigned char)TestRandom(seed);
+	std::vector<unsigned char> current = previous;
+	TileMap map;
+	map.Resize(width, height);
+
+	const int frames = 100;
+	double start = CaptureStats::Now();
+	for (int i = 0; i < frames; i++)
+		map.Compare(previous.data(), current.data(), pitch);
+	double compare = (CaptureStats::Now() - start)/frames;
+
+	start = CaptureStats::Now();
+	unsigned int differ = 0;
+	for (int i = 0; i < frames; i++) {
+		for (unsigned int y = 0; y < height; y++)
+			for (unsigned int x = 0; x < width; x += 64)
+				differ += memcmp(&previous[y*pitch + x*4], &current[y*pitch + x*4], 256) != 0;
+	}
+	double reference = (CaptureStats::Now() - start)/frames;
+
+	// A scroll, compared through the move
+	map.Clear();
+	map.AddMove({ 0, 0, (int32_t)width, (int32_t)height - 20, 0, -20 });
+	for (unsigned int y = 0; y < height - 20; y++)
+		memcpy(&current[y*pitch], &previous[(y + 20)*pitch], pitch);
+	start = CaptureStats::Now();
+	for (int i = 0; i < frames; i++)
+		map.Compare(previous.data(), current.data(), pitch);
+	double scroll = (CaptureStats::Now() - start)/frames;
+
+	CHECK(differ == 0);
+	printf("    compare %.2f msec (%.1f GB/s), memcmp %.2f msec, scroll %.2f msec\n",
+		compare, 2.0*pitch*height/(compare*1e6), reference, scroll);
+}